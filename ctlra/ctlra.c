@@ -7,15 +7,31 @@
 
 #include "impl.h"
 #include "usb.h"
-
-#define CTLRA_MAX_DEVICES 64
-struct ctlra_dev_connect_func_t __ctlra_devices[CTLRA_MAX_DEVICES];
+#include "pixel.h"
+#include "shm.h"
+#include "shard.h"
+#include "rt.h"
+#include "describe.h"
+#include "devices/headless.h"
+
+struct ctlra_dev_connect_func_t *__ctlra_devices;
 uint32_t __ctlra_device_count;
+static uint32_t ctlra_device_capacity;
 
-__attribute__((constructor(101)))
-static void ctlra_static_setup()
+int32_t ctlra_impl_device_register(const struct ctlra_dev_connect_func_t *d)
 {
-	/* placeholder */
+	if(__ctlra_device_count == ctlra_device_capacity) {
+		uint32_t cap = ctlra_device_capacity ?
+			       ctlra_device_capacity * 2 : 64;
+		void *grown = realloc(__ctlra_devices,
+				      cap * sizeof(*__ctlra_devices));
+		if(!grown)
+			return -ENOMEM;
+		__ctlra_devices = grown;
+		ctlra_device_capacity = cap;
+	}
+	__ctlra_devices[__ctlra_device_count++] = *d;
+	return 0;
 }
 
 int ctlra_impl_get_id_by_vid_pid(uint32_t vid, uint32_t pid)
@@ -45,6 +61,24 @@ int ctlra_impl_dev_get_by_vid_pid(struct ctlra_t *ctlra, int32_t vid,
 	return -1;
 }
 
+static void
+ctlra_impl_dev_list_append(struct ctlra_t *ctlra, struct ctlra_dev_t *new_dev)
+{
+	new_dev->dev_list_next = 0;
+
+	// if list empty, add as main ptr
+	if(ctlra->dev_list == 0) {
+		ctlra->dev_list = new_dev;
+		return;
+	}
+
+	// skip to end of list, and append
+	struct ctlra_dev_t *dev_iter = ctlra->dev_list;
+	while(dev_iter->dev_list_next)
+		dev_iter = dev_iter->dev_list_next;
+	dev_iter->dev_list_next = new_dev;
+}
+
 struct ctlra_dev_t *ctlra_dev_connect(struct ctlra_t *ctlra,
 				      ctlra_dev_connect_func connect,
 				      ctlra_event_func event_func,
@@ -57,19 +91,7 @@ struct ctlra_dev_t *ctlra_dev_connect(struct ctlra_t *ctlra,
 	new_dev = connect(event_func, userdata, future);
 	if(new_dev) {
 		new_dev->ctlra_context = ctlra;
-		new_dev->dev_list_next = 0;
-
-		// if list empty, add as main ptr
-		if(ctlra->dev_list == 0) {
-			ctlra->dev_list = new_dev;
-			return new_dev;
-		}
-
-		// skip to end of list, and append
-		struct ctlra_dev_t *dev_iter = ctlra->dev_list;
-		while(dev_iter->dev_list_next)
-			dev_iter = dev_iter->dev_list_next;
-		dev_iter->dev_list_next = new_dev;
+		ctlra_impl_dev_list_append(ctlra, new_dev);
 		return new_dev;
 	}
 	return 0;
@@ -134,41 +156,39 @@ ctlra_get_vendors(const char *vendors[], int32_t size)
 	return vendor_idx;
 }
 
-int32_t
-ctlra_dev_virtualize(struct ctlra_t *c, const char *vendor,
-		     const char *device)
+/* Search the registered drivers for the info of vendor / device */
+static struct ctlra_dev_info_t *
+ctlra_impl_info_get_by_name(struct ctlra_t *c, const char *vendor,
+			    const char *device)
 {
 	int i;
-	struct ctlra_dev_info_t *info = 0;
-
 	for(i = 0; i < __ctlra_device_count; i++) {
 		if(__ctlra_devices[i].info &&
 		   strcmp(vendor, __ctlra_devices[i].info->vendor) == 0 &&
 		   strcmp(device, __ctlra_devices[i].info->device) == 0) {
-			info = __ctlra_devices[i].info;
-			break;
+			return __ctlra_devices[i].info;
 		}
 	}
 
-	if(!info) {
-		CTLRA_WARN(c, "Couldn't find device '%s' '%s' in %d registered drivers\n",
-			   vendor, device, i);
-		CTLRA_STRERROR(c, "Device not found\n");
-		return -ENODEV;
-	}
-
-#ifdef HAVE_AVTKA
-	/* TODO: find better solution to this hack */
-CTLRA_DEVICE_DECL(avtka);
+	CTLRA_WARN(c, "Couldn't find device '%s' '%s' in %d registered drivers\n",
+		   vendor, device, i);
+	CTLRA_STRERROR(c, "Device not found\n");
+	return 0;
+}
 
-	/* call into AVTKA and virtualize the device, passing info through
-	 * the future (void *) to the AVTKA backend. */
+/* Connect a virtual device using *connect*, passing the info through
+ * the future (void *) to the backend, then offer it to the application */
+static int32_t
+ctlra_impl_virtualize(struct ctlra_t *c, ctlra_dev_connect_func connect,
+		      struct ctlra_dev_info_t *info,
+		      struct ctlra_dev_t **out_dev)
+{
 	CTLRA_INFO(c, "virtualizing dev '%s' '%s'\n",
 		   info->vendor, info->device);
-	struct ctlra_dev_t *dev = ctlra_dev_connect(c, ctlra_avtka_connect,
+	struct ctlra_dev_t *dev = ctlra_dev_connect(c, connect,
 						    0x0, 0x0, info);
 	if(!dev) {
-		CTLRA_ERROR(c, "avtka dev returned %p\n", dev);
+		CTLRA_ERROR(c, "virtual dev returned %p\n", dev);
 		return -EINVAL;
 	}
 
@@ -184,17 +204,300 @@ CTLRA_DEVICE_DECL(avtka);
 		CTLRA_STRERROR(c, "Application refused device\n");
 		return -ECONNREFUSED;
 	}
+
+	if(out_dev)
+		*out_dev = dev;
 	return 0;
-#else
-	CTLRA_STRERROR(c, "No virtualized backends available\n");
-	return -ENOTSUP;
+}
+
+CTLRA_DEVICE_DECL(headless);
+
+struct ctlra_dev_t *
+ctlra_dev_virtualize_headless(struct ctlra_t *c, const char *vendor,
+			      const char *device)
+{
+	struct ctlra_dev_info_t *info = ctlra_impl_info_get_by_name(c, vendor,
+								   device);
+	if(!info)
+		return 0;
+
+	struct ctlra_dev_t *dev = 0;
+	int32_t ret = ctlra_impl_virtualize(c, ctlra_headless_connect,
+					    info, &dev);
+	if(ret)
+		return 0;
+
+	/* scripted input from ENV variable, eg: for CI load testing */
+	char *script = getenv("CTLRA_VIRTUAL_SCRIPT");
+	if(script)
+		ctlra_headless_script_load(dev, script);
+
+	return dev;
+}
+
+int32_t
+ctlra_dev_virtualize(struct ctlra_t *c, const char *vendor,
+		     const char *device)
+{
+	struct ctlra_dev_info_t *info = ctlra_impl_info_get_by_name(c, vendor,
+								   device);
+	if(!info)
+		return -ENODEV;
+
+#ifdef HAVE_AVTKA
+	/* ENV variable selects headless even if a UI is available */
+	if(!getenv("CTLRA_VIRTUAL_HEADLESS")) {
+		/* TODO: find better solution to this hack */
+CTLRA_DEVICE_DECL(avtka);
+		return ctlra_impl_virtualize(c, ctlra_avtka_connect, info, 0);
+	}
 #endif
+
+	struct ctlra_dev_t *dev = ctlra_dev_virtualize_headless(c, vendor,
+								device);
+	return dev ? 0 : -EINVAL;
+}
+
+static void
+ctlra_impl_event_compact_flush(struct ctlra_dev_t *dev)
+{
+	if(dev->compact_count && dev->event_compact_func)
+		dev->event_compact_func(dev, dev->compact_count,
+					dev->compact_events,
+					dev->event_func_userdata);
+	dev->compact_count = 0;
+}
+
+/* Installed as the event_func of devices using compact events: drivers
+ * still emit ctlra_event_t pointers, which are converted and batched */
+static void
+ctlra_impl_event_compact_shim(struct ctlra_dev_t* dev, uint32_t num_events,
+			      struct ctlra_event_t** events, void *userdata)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+	uint64_t delta = now - dev->compact_last_ns;
+	if(dev->compact_last_ns == 0 || delta > UINT32_MAX)
+		delta = UINT32_MAX;
+	dev->compact_last_ns = now;
+
+	for(uint32_t i = 0; i < num_events; i++) {
+		if(dev->compact_count == CTLRA_EVENT_COMPACT_BATCH)
+			ctlra_impl_event_compact_flush(dev);
+
+		struct ctlra_event_compact_t *c =
+			&dev->compact_events[dev->compact_count];
+		if(ctlra_event_to_compact(events[i], c)) {
+			CTLRA_WARN(dev->ctlra_context,
+				   "event type %d not representable as compact\n",
+				   events[i]->type);
+			continue;
+		}
+		c->time_delta = i == 0 ? delta : 0;
+		dev->compact_count++;
+	}
+}
+
+static void
+ctlra_impl_event_coalesce_flush(struct ctlra_dev_t *dev)
+{
+	uint32_t count = dev->coalesce_count;
+	if(!count)
+		return;
+
+	struct ctlra_event_t *ptrs[CTLRA_EVENT_COALESCE_MAX];
+	for(uint32_t i = 0; i < count; i++)
+		ptrs[i] = &dev->coalesce_events[i];
+	dev->coalesce_count = 0;
+	dev->stage_next(dev, count, ptrs, dev->event_func_userdata);
+}
+
+static void
+ctlra_impl_event_coalesce_merge(struct ctlra_dev_t *dev,
+				const struct ctlra_event_t *e)
+{
+	for(uint32_t i = 0; i < dev->coalesce_count; i++) {
+		struct ctlra_event_t *p = &dev->coalesce_events[i];
+		if(p->type != e->type)
+			continue;
+
+		if(e->type == CTLRA_EVENT_SLIDER &&
+		   p->slider.id == e->slider.id) {
+			p->slider.value = e->slider.value;
+			return;
+		}
+		if(e->type == CTLRA_EVENT_ENCODER &&
+		   p->encoder.id == e->encoder.id &&
+		   p->encoder.flags == e->encoder.flags) {
+			if(e->encoder.flags & CTLRA_EVENT_ENCODER_FLAG_FLOAT)
+				p->encoder.delta_float += e->encoder.delta_float;
+			else
+				p->encoder.delta += e->encoder.delta;
+			return;
+		}
+	}
+
+	if(dev->coalesce_count == CTLRA_EVENT_COALESCE_MAX)
+		ctlra_impl_event_coalesce_flush(dev);
+	dev->coalesce_events[dev->coalesce_count++] = *e;
+}
+
+static int
+ctlra_impl_event_wanted(const struct ctlra_dev_t *dev,
+			const struct ctlra_event_t *e)
+{
+	uint32_t type = e->type;
+	if(type >= CTLRA_EVENT_T_COUNT)
+		return 1;
+	if(dev->event_types_masked & (1u << type))
+		return 0;
+	if(!(dev->event_types_ranged & (1u << type)))
+		return 1;
+
+	uint32_t id;
+	switch(type) {
+	case CTLRA_EVENT_BUTTON:  id = e->button.id; break;
+	case CTLRA_EVENT_ENCODER: id = e->encoder.id; break;
+	case CTLRA_EVENT_SLIDER:  id = e->slider.id; break;
+	case CTLRA_EVENT_GRID:    id = e->grid.id; break;
+	default: return 1;
+	}
+	/* unsigned wrap makes ids below first fail too */
+	return id - dev->event_id_first[type] < dev->event_id_count[type];
+}
+
+static void
+ctlra_impl_state_update(struct ctlra_dev_t *dev,
+			const struct ctlra_event_t *e)
+{
+	const struct ctlra_dev_state_layout_t *l = &dev->state_layout;
+	float *v;
+
+	switch(e->type) {
+	case CTLRA_EVENT_BUTTON:
+		if(e->button.id >= l->size[CTLRA_EVENT_BUTTON])
+			return;
+		v = &dev->state[l->offset[CTLRA_EVENT_BUTTON] + e->button.id];
+		*v = e->button.pressed;
+		break;
+	case CTLRA_EVENT_ENCODER:
+		if(e->encoder.id >= l->size[CTLRA_EVENT_ENCODER])
+			return;
+		v = &dev->state[l->offset[CTLRA_EVENT_ENCODER] + e->encoder.id];
+		if(e->encoder.flags & CTLRA_EVENT_ENCODER_FLAG_FLOAT)
+			*v += e->encoder.delta_float;
+		else
+			*v += e->encoder.delta;
+		break;
+	case CTLRA_EVENT_SLIDER:
+		if(e->slider.id >= l->size[CTLRA_EVENT_SLIDER])
+			return;
+		dev->state[l->offset[CTLRA_EVENT_SLIDER] + e->slider.id] =
+			e->slider.value;
+		break;
+	case CTLRA_EVENT_GRID: {
+		uint32_t g = e->grid.id;
+		if(g >= dev->info.control_count[CTLRA_EVENT_GRID] ||
+		   g >= CTLRA_NUM_GRIDS_MAX)
+			return;
+		const struct ctlra_grid_info_t *gi = &dev->info.grid_info[g];
+		if(e->grid.pos >= gi->x * gi->y)
+			return;
+		v = &dev->state[l->grid_offset[g] + e->grid.pos];
+		float p = gi->pressure ? e->grid.pressure : 1.f;
+		if(e->grid.flags & CTLRA_EVENT_GRID_FLAG_BUTTON)
+			*v = e->grid.pressed ? p : 0.f;
+		else if(*v != 0.f)
+			*v = p;
+		break;
+		}
+	default:
+		break;
+	}
+}
+
+/* Installed as the event_func of devices with event masks, coalescing
+ * or state tracking enabled. The state table is updated first, then
+ * unwanted events are dropped, and runs of events that are not
+ * coalesced are passed on directly, after any pending coalesced events,
+ * so the order of the event stream is kept */
+static void
+ctlra_impl_event_stage_shim(struct ctlra_dev_t* dev, uint32_t num_events,
+			    struct ctlra_event_t** events, void *userdata)
+{
+	if(dev->state) {
+		uint32_t seq = dev->state_seq;
+		__atomic_store_n(&dev->state_seq, seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		for(uint32_t i = 0; i < num_events; i++)
+			ctlra_impl_state_update(dev, events[i]);
+		__atomic_store_n(&dev->state_seq, seq + 2, __ATOMIC_RELEASE);
+	}
+
+	uint32_t run = 0;
+	for(uint32_t i = 0; i < num_events; i++) {
+		struct ctlra_event_t *e = events[i];
+		int wanted = ctlra_impl_event_wanted(dev, e);
+		int merge = wanted && (dev->coalesce_types & (1u << e->type));
+		if(wanted && !merge) {
+			ctlra_impl_event_coalesce_flush(dev);
+			continue;
+		}
+		if(i > run)
+			dev->stage_next(dev, i - run, &events[run], userdata);
+		run = i + 1;
+		if(merge)
+			ctlra_impl_event_coalesce_merge(dev, e);
+	}
+	if(num_events > run)
+		dev->stage_next(dev, num_events - run, &events[run],
+				userdata);
+}
+
+/* Install or remove the event stage shim, as masks and coalescing
+ * settings require */
+static void
+ctlra_impl_event_stage_update(struct ctlra_dev_t *dev)
+{
+	uint8_t active = dev->coalesce_types || dev->event_types_masked ||
+			 dev->event_types_ranged || dev->state;
+	ctlra_impl_event_coalesce_flush(dev);
+	if(active && !dev->stage_active) {
+		dev->stage_next = dev->event_func;
+		dev->event_func = ctlra_impl_event_stage_shim;
+	} else if(!active && dev->stage_active) {
+		dev->event_func = dev->stage_next;
+	}
+	dev->stage_active = active;
+}
+
+/* Set the function that receives events from the driver, after the
+ * event stage if that is enabled */
+static void
+ctlra_impl_event_func_install(struct ctlra_dev_t *dev, ctlra_event_func f)
+{
+	ctlra_impl_event_coalesce_flush(dev);
+	if(dev->event_compact_func)
+		ctlra_impl_event_compact_flush(dev);
+
+	if(dev->stage_active)
+		dev->stage_next = f;
+	else
+		dev->event_func = f;
 }
 
 uint32_t ctlra_dev_poll(struct ctlra_dev_t *dev)
 {
 	if(dev && dev->poll && !dev->banished) {
-		return dev->poll(dev);
+		uint32_t ret = dev->poll(dev);
+		/* events may also arrive from USB callbacks before poll,
+		 * deliver all of them in one batch */
+		if(dev->stage_active)
+			ctlra_impl_event_coalesce_flush(dev);
+		if(dev->event_compact_func)
+			ctlra_impl_event_compact_flush(dev);
+		return ret;
 	}
 	return 0;
 }
@@ -213,8 +516,125 @@ ctlra_dev_set_callback_userdata(struct ctlra_dev_t *dev,
 void
 ctlra_dev_set_event_func(struct ctlra_dev_t* dev, ctlra_event_func f)
 {
-	if(dev)
-		dev->event_func = f;
+	if(dev) {
+		ctlra_impl_event_func_install(dev, f);
+		dev->event_compact_func = 0;
+	}
+}
+
+void
+ctlra_dev_set_event_compact_func(struct ctlra_dev_t* dev,
+				 ctlra_event_compact_func f)
+{
+	if(!dev)
+		return;
+	ctlra_impl_event_func_install(dev, ctlra_impl_event_compact_shim);
+	dev->compact_count = 0;
+	dev->compact_last_ns = 0;
+	dev->event_compact_func = f;
+}
+
+int32_t
+ctlra_dev_set_event_coalesce(struct ctlra_dev_t* dev, uint32_t type_mask)
+{
+	const uint32_t supported = (1u << CTLRA_EVENT_ENCODER) |
+				   (1u << CTLRA_EVENT_SLIDER);
+	if(!dev || (type_mask & ~supported))
+		return -EINVAL;
+
+	ctlra_impl_event_coalesce_flush(dev);
+	dev->coalesce_types = type_mask;
+	ctlra_impl_event_stage_update(dev);
+	return 0;
+}
+
+int32_t
+ctlra_dev_set_event_mask(struct ctlra_dev_t* dev,
+			 const struct ctlra_event_mask_t *mask)
+{
+	if(!dev)
+		return -EINVAL;
+
+	const uint32_t all = (1u << CTLRA_EVENT_T_COUNT) - 1;
+	dev->event_types_masked = 0;
+	dev->event_types_ranged = 0;
+	if(mask) {
+		dev->event_types_masked = ~mask->types & all;
+		for(int i = 0; i < CTLRA_EVENT_T_COUNT; i++) {
+			dev->event_id_first[i] = mask->ids[i].first;
+			dev->event_id_count[i] = mask->ids[i].count;
+			if(mask->ids[i].count)
+				dev->event_types_ranged |= 1u << i;
+		}
+	}
+	ctlra_impl_event_stage_update(dev);
+	return 0;
+}
+
+int32_t
+ctlra_dev_state_enable(struct ctlra_dev_t* dev,
+		       struct ctlra_dev_state_layout_t *layout)
+{
+	if(!dev)
+		return -EINVAL;
+
+	if(!dev->state) {
+		struct ctlra_dev_state_layout_t *l = &dev->state_layout;
+		const struct ctlra_dev_info_t *info = &dev->info;
+		memset(l, 0, sizeof(*l));
+		for(int i = 0; i < CTLRA_EVENT_T_COUNT; i++) {
+			l->offset[i] = l->count;
+			if(i == CTLRA_EVENT_GRID) {
+				uint32_t grids = info->control_count[i];
+				if(grids > CTLRA_NUM_GRIDS_MAX)
+					grids = CTLRA_NUM_GRIDS_MAX;
+				for(uint32_t g = 0; g < grids; g++) {
+					const struct ctlra_grid_info_t *gi =
+						&info->grid_info[g];
+					l->grid_offset[g] = l->count + l->size[i];
+					l->size[i] += gi->x * gi->y;
+				}
+			} else if(i != CTLRA_FEEDBACK_ITEM) {
+				l->size[i] = info->control_count[i];
+			}
+			l->count += l->size[i];
+		}
+
+		/* one extra so a device without controls gets a table */
+		dev->state = calloc(l->count + 1, sizeof(float));
+		if(!dev->state)
+			return -ENOMEM;
+		ctlra_impl_event_stage_update(dev);
+	}
+
+	if(layout)
+		*layout = dev->state_layout;
+	return 0;
+}
+
+int32_t
+ctlra_dev_state_read(struct ctlra_dev_t* dev, float *values,
+		     uint32_t count, uint32_t *version)
+{
+	if(!dev || !dev->state)
+		return -ENOTSUP;
+
+	if(count > dev->state_layout.count)
+		count = dev->state_layout.count;
+
+	for(;;) {
+		uint32_t s1 = __atomic_load_n(&dev->state_seq, __ATOMIC_ACQUIRE);
+		if(s1 & 1)
+			continue;
+		memcpy(values, dev->state, count * sizeof(float));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		uint32_t s2 = __atomic_load_n(&dev->state_seq, __ATOMIC_RELAXED);
+		if(s1 == s2) {
+			if(version)
+				*version = s1 / 2;
+			return count;
+		}
+	}
 }
 
 void
@@ -247,10 +667,16 @@ int32_t ctlra_dev_disconnect(struct ctlra_dev_t *dev)
 	struct ctlra_dev_t *dev_iter = ctlra->dev_list;
 
 	if(dev && dev->disconnect) {
+		/* stop redrawing the screens before the app frees state */
+		ctlra_impl_shard_detach(dev);
+
 		/* call the application remove_func() to inform app */
 		if(dev->remove_func)
 			dev->remove_func(dev, dev->banished,
 					 dev->event_func_userdata);
+		/* readers stopped in remove_func(), see state_read() docs */
+		free(dev->state);
+		dev->state = 0;
 
 		if(dev_iter == dev) {
 			ctlra->dev_list = dev_iter->dev_list_next;
@@ -308,6 +734,44 @@ void ctlra_dev_grid_light_set(struct ctlra_dev_t *dev, uint32_t grid_id,
 		dev->grid_light_set(dev, grid_id, light_id, light_status);
 }
 
+int32_t
+ctlra_dev_grid_pressure_stream(struct ctlra_dev_t *dev, uint32_t grid_id,
+			       const struct ctlra_grid_pressure_opts_t *opts)
+{
+	if(dev && dev->grid_pressure_stream)
+		return dev->grid_pressure_stream(dev, grid_id, opts);
+	return -ENOTSUP;
+}
+
+int32_t
+ctlra_dev_grid_pad_config(struct ctlra_dev_t *dev, uint32_t grid_id,
+			  uint32_t square,
+			  const struct ctlra_grid_pad_opts_t *opts)
+{
+	if(dev && dev->grid_pad_config)
+		return dev->grid_pad_config(dev, grid_id, square, opts);
+	return -ENOTSUP;
+}
+
+int32_t
+ctlra_dev_jog_wheel_config(struct ctlra_dev_t *dev,
+			   const struct ctlra_jog_wheel_opts_t *opts)
+{
+	if(dev && dev->jog_wheel_config)
+		return dev->jog_wheel_config(dev, opts);
+	return -ENOTSUP;
+}
+
+int32_t
+ctlra_dev_jog_wheel_read(struct ctlra_dev_t *dev, uint32_t wheel_id,
+			 uint64_t now_ns,
+			 struct ctlra_jog_wheel_state_t *state)
+{
+	if(dev && dev->jog_wheel_read)
+		return dev->jog_wheel_read(dev, wheel_id, now_ns, state);
+	return -ENOTSUP;
+}
+
 int32_t ctlra_screen_get_data(struct ctlra_dev_t *dev,
 				  uint32_t screen_idx,
 				  uint8_t **pixels,
@@ -349,6 +813,10 @@ ctlra_info_get_name(const struct ctlra_dev_info_t *info,
 	if(info->get_name)
 		return info->get_name(type, control_id);
 
+	const char *name = ctlra_impl_desc_name(info, type, control_id);
+	if(name && name[0])
+		return name;
+
 	return "N/A";
 }
 
@@ -385,47 +853,82 @@ struct ctlra_t *ctlra_create(const struct ctlra_create_opts_t *opts)
 	/* Setup/compute runtime values */
 	c->screen_redraw_ns = 1000000000.f / c->opts.screen_redraw_target_fps;
 
+	/* mlockall, rt permission check, and caller thread priority */
+	ctlra_impl_rt_init(c);
+
+	/* select screen pixel kernels for this CPU */
+	const char *kernels = ctlra_impl_pixel_init();
+	CTLRA_INFO(c, "pixel kernels: %s\n", kernels);
+
+	/* described devices join the registry before any probe or
+	 * hotplug can look them up */
+	ctlra_impl_desc_load_env(c);
+
 	/* register USB hotplug etc */
 	int err = ctlra_dev_impl_usb_init(c);
 	if(err)
 		CTLRA_ERROR(c, "impl_usb_init() returned %d\n", err);
 
+	if(c->opts.screen_shards) {
+		err = ctlra_impl_shards_start(c);
+		if(err)
+			CTLRA_WARN(c, "screen shards not started: %d\n", err);
+	}
+
 	return c;
 }
 
-int ctlra_impl_accept_dev(struct ctlra_t *ctlra,
-			  int id)
+/* Connect the driver of device *id*, without adding the device to the
+ * device list or offering it to the application. This may run on the
+ * hotplug helper thread, see usb.c */
+struct ctlra_dev_t *
+ctlra_impl_dev_bringup(struct ctlra_t *ctlra, int id)
 {
 	if(id < 0 || id >= __ctlra_device_count || !__ctlra_devices[id].connect) {
 		CTLRA_WARN(ctlra, "invalid device id recieved %d\n", id);
 		return 0;
 	}
 
-	struct ctlra_dev_t* dev = ctlra_dev_connect(ctlra,
-						    __ctlra_devices[id].connect,
-						    0x0,
-						    0 /* userdata */,
-						    0x0);
+	struct ctlra_dev_t* dev = __ctlra_devices[id].connect(0x0,
+							      0 /* userdata */,
+							      __ctlra_devices[id].future);
 	if(dev) {
 		/* Store the ctlra context into the dev pointer */
 		dev->ctlra_context = ctlra;
+		dev->dev_list_next = 0;
+	}
+	return dev;
+}
 
-		/* Application sets function pointers directly to device */
-		int accepted = ctlra->accept_dev_func(ctlra,
-						      &dev->info,
-						      dev,
-						      ctlra->accept_dev_func_userdata);
+/* Add a connected device to the device list, and offer it to the
+ * application. Must run on the thread that runs ctlra_idle_iter() */
+int ctlra_impl_dev_publish(struct ctlra_t *ctlra, struct ctlra_dev_t *dev)
+{
+	ctlra_impl_dev_list_append(ctlra, dev);
 
-		CTLRA_INFO(ctlra, "%s %s %s accepted\n", dev->info.vendor,
-			   dev->info.device, accepted ? "" : "not");
+	/* Application sets function pointers directly to device */
+	int accepted = ctlra->accept_dev_func(ctlra,
+					      &dev->info,
+					      dev,
+					      ctlra->accept_dev_func_userdata);
 
-		if(!accepted) {
-			ctlra_dev_disconnect(dev);
-			return 0;
-		}
-		return 1;
+	CTLRA_INFO(ctlra, "%s %s %s accepted\n", dev->info.vendor,
+		   dev->info.device, accepted ? "" : "not");
+
+	if(!accepted) {
+		ctlra_dev_disconnect(dev);
+		return 0;
 	}
-	return 0;
+	return 1;
+}
+
+int ctlra_impl_accept_dev(struct ctlra_t *ctlra,
+			  int id)
+{
+	struct ctlra_dev_t* dev = ctlra_impl_dev_bringup(ctlra, id);
+	if(!dev)
+		return 0;
+	return ctlra_impl_dev_publish(ctlra, dev);
 }
 
 int ctlra_probe(struct ctlra_t *ctlra,
@@ -456,10 +959,16 @@ int ctlra_probe(struct ctlra_t *ctlra,
 		num_accepted += (ret == 0);
 	}
 
+	/* HID controllers without a driver of their own */
+	num_accepted += ctlra_impl_usb_hid_probe(ctlra);
+
+	/* devices owned and shared by a daemon process */
+	num_accepted += ctlra_impl_shm_probe(ctlra);
+
 	return num_accepted;
 }
 
-static void
+void
 ctlra_impl_screen_redraw(struct ctlra_t *ctlra,
 			 struct ctlra_dev_t *dev_iter,
 			 uint32_t screen_idx)
@@ -529,7 +1038,11 @@ void ctlra_idle_iter(struct ctlra_t *ctlra)
 				dev_iter->event_func_userdata);
 		}
 
-		if(dev_iter->screen_redraw_cb) {
+		if(dev_iter->screen_redraw_cb && ctlra->shards &&
+		   !dev_iter->shard)
+			ctlra_impl_shard_attach(ctlra, dev_iter);
+
+		if(dev_iter->screen_redraw_cb && !dev_iter->shard) {
 			struct timespec now;
 			int err = clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 			if(err)
@@ -582,6 +1095,10 @@ void ctlra_exit(struct ctlra_t *ctlra)
 	 * pending reads/writes */
 	ctlra_idle_iter(ctlra);
 
+	/* device closes only submit their final writes: usb shutdown waits
+	 * for all of them at once, bounded by opts.teardown_timeout_ms */
+	ctlra->usb_teardown = 1;
+
 	struct ctlra_dev_t *dev_iter = ctlra->dev_list;
 	while(dev_iter) {
 		struct ctlra_dev_t *dev_free = dev_iter;
@@ -591,6 +1108,7 @@ void ctlra_exit(struct ctlra_t *ctlra)
 		ctlra_dev_disconnect(dev_free);
 	}
 
+	ctlra_impl_shards_stop(ctlra);
 	ctlra_impl_usb_shutdown(ctlra);
 
 	free(ctlra);
@@ -94,7 +94,16 @@ struct ctlra_t;
 struct ctlra_create_opts_t {
 	/* creation time flags */
 	uint8_t flags_usb_no_own_context : 1;
-	uint8_t flags_usb_unsued : 7;
+	/* connect hotplugged devices inside ctlra_idle_iter(), instead of
+	 * on a helper thread that does not stall input of other devices */
+	uint8_t flags_usb_sync_hotplug : 1;
+	/* drive USB HID controllers that have no dedicated driver from
+	 * their HID report descriptor, as buttons, sliders and encoders.
+	 * Off by default, as the kernel driver of the HID interface is
+	 * detached while Ctlra uses the device. Boot keyboards and mice
+	 * are never claimed. */
+	uint8_t flags_usb_hid_generic : 1;
+	uint8_t flags_usb_unsued : 5;
 
 	/* debug verbosity */
 	uint8_t debug_level;
@@ -105,10 +114,48 @@ struct ctlra_create_opts_t {
 	 */
 	uint8_t screen_redraw_target_fps;
 
+	/* upper bound in milliseconds that ctlra_exit() waits for the final
+	 * lights-off and screen-clear writes of all devices, 0 for default */
+	uint16_t teardown_timeout_ms;
+
+	/* number of screen shard threads, 0 to redraw screens inside
+	 * ctlra_idle_iter(). Each shard redraws and flushes the screens of
+	 * its devices, so screen work does not delay input of the others.
+	 * Screen redraw callbacks then run on the shard thread of their
+	 * device, concurrently with ctlra_idle_iter(). */
+	uint8_t screen_shards;
+	/* shard N is pinned to CPU (screen_shard_cpu + N) */
+	uint8_t screen_shard_cpu;
+
+	/* CPUs the Ctlra threads may run on, CPU N is bit (N % 8) of byte
+	 * (N / 8), all zero for any. Bytes keep the struct layout free of
+	 * alignment. When set, shard N is pinned to the Nth CPU of the mask
+	 * instead of screen_shard_cpu + N. */
+	uint8_t rt_cpu_mask[8];
+	/* scheduling class of the screen shards, and of the thread calling
+	 * ctlra_create() if CTLRA_RT_CALLER is set: CTLRA_SCHED_* */
+	uint8_t rt_policy;
+	/* priority for CTLRA_SCHED_FIFO and CTLRA_SCHED_RR, 1 to 99 */
+	uint8_t rt_priority;
+	/* bitmask of CTLRA_RT_* flags */
+	uint8_t rt_flags;
+
 	/* reserve lots of space */
-	uint8_t padding[61];
+	uint8_t padding[45];
 };
 
+/* Scheduling classes for ctlra_create_opts_t.rt_policy */
+#define CTLRA_SCHED_OTHER 0
+#define CTLRA_SCHED_FIFO  1
+#define CTLRA_SCHED_RR    2
+
+/* Lock all current and future memory with mlockall(), so driver and
+ * screen buffers never page fault, and prefault the thread stacks */
+#define CTLRA_RT_MLOCK  (1 << 0)
+/* Apply rt_policy and rt_cpu_mask to the thread calling ctlra_create(),
+ * which should be the thread that calls ctlra_idle_iter() */
+#define CTLRA_RT_CALLER (1 << 1)
+
 /** Get the human readable name for *control_id* from *dev*. The
  * control id is passed in eg: event.button.id, or can be any of the
  * DEVICE_NAME_CONTROLS enumeration. Ownership of the string *remains* in
@@ -278,6 +325,13 @@ struct ctlra_screen_zone_t {
 	uint32_t h;
 };
 
+/* Size in pixels of the tiles in a dirty tile mask. A mask holds one
+ * uint64_t per row of tiles, with bit N set if any pixel in columns
+ * N * CTLRA_SCREEN_TILE_W to (N+1) * CTLRA_SCREEN_TILE_W - 1 changed.
+ * Columns beyond the 64th tile are reported in bit 63. */
+#define CTLRA_SCREEN_TILE_W 32
+#define CTLRA_SCREEN_TILE_H 16
+
 /** A callback function that the application must implement in order to
  * redraw a screen for a device. This callback is registered using the
  * *ctlra_dev_screen_register_callback* function.
@@ -402,8 +456,92 @@ int32_t ctlra_get_devices_by_vendor(const char *vendor,
 int32_t ctlra_dev_virtualize(struct ctlra_t *ctlra, const char *vendor,
 			     const char *device);
 
+/** Add a headless virtualized device. This works like
+ * *ctlra_dev_virtualize*, but no user interface is shown: feedback from
+ * the application is stored in memory, and events are injected by the
+ * application or a script. This allows eg: load-testing an application
+ * with many virtual devices on a machine without a display. See
+ * devices/headless.h for the functions to drive the device. The
+ * *CTLRA_VIRTUAL_SCRIPT* environment variable loads an event script.
+ *
+ * *ctlra_dev_virtualize* also uses this backend when Ctlra is built
+ * without AVTKA, or if the *CTLRA_VIRTUAL_HEADLESS* environment variable
+ * is set.
+ *
+ * @retval dev The device, which the application has accepted
+ * @retval 0 Error in virtualizing, or the application refused the device
+ */
+struct ctlra_dev_t *ctlra_dev_virtualize_headless(struct ctlra_t *ctlra,
+						  const char *vendor,
+						  const char *device);
+
+/** Load device descriptions, which add support for controllers without
+ * a compiled driver. *path* is a description file, or a directory of
+ * which every *.ctlra* file is loaded. Descriptions are kept for the
+ * life of the process, and must be loaded before ctlra_create(). The
+ * *CTLRA_DEVICE_PATH* environment variable, a colon separated list of
+ * paths, is loaded by ctlra_create().
+ *
+ * A description is an ini style text file: a *[device]* section, then
+ * one section per control and light, with ids counting up from 0:
+ *
+ *     [device]
+ *     vendor = Example
+ *     device = Mixer One
+ *     vid = 0x1209
+ *     pid = 0xc71a
+ *     interface = 3
+ *     in = 0x82             # interrupt IN endpoint
+ *     size = 30             # bytes of the input report
+ *     report = 0x01         # optional: the report id in byte 0
+ *     out = 0x02            # interrupt OUT endpoint for lights
+ *     light_report = 0x80   # optional: id byte of the light report
+ *     light_bytes = 21      # bytes of lights after the id
+ *     width = 120           # optional: size of the device
+ *     height = 294
+ *
+ *     [button.0]
+ *     name = A
+ *     byte = 29             # byte offset in the input report
+ *     mask = 0x10           # one bit, may extend over later bytes
+ *     light = 0             # optional: light id under the button
+ *     x = 44                # optional: x, y, w, h of the item
+ *
+ *     [slider.0]
+ *     name = Gain (L)
+ *     byte = 1
+ *     bits = 12             # little endian, default 8
+ *     shift = 0             # optional: bit offset from *byte*
+ *     min = 0               # optional: raw range, default full
+ *     max = 4095
+ *     style = dial, notch   # button, fader, dial, encoder, notch
+ *
+ *     [encoder.0]           # a wrapping counter, default 4 bits
+ *     byte = 12
+ *     bits = 4
+ *
+ *     [light.0]
+ *     byte = 14             # byte after the id, default the light id
+ *     channels = rb         # i(ntensity), r, g, b to consecutive bytes
+ *
+ * A # or ; at the start of a line or after whitespace starts a
+ * comment, so a # inside a name must not follow a space. Files that fail validation
+ * are reported and skipped, as are devices that have a compiled driver.
+ * @retval The number of devices loaded, or -errno
+ */
+int32_t ctlra_device_description_load(const char *path);
+
 void ctlra_strerror(struct ctlra_t *ctlra, FILE* out);
 
+/** Check that this process may run threads with realtime scheduling
+ * *policy* (a CTLRA_SCHED_* value) at *priority*. ctlra_create() runs
+ * this check when opts.rt_policy is set, and warns if it fails.
+ * @retval 0 Permitted
+ * @retval -EPERM Not permitted, eg: RLIMIT_RTPRIO is below *priority*
+ * @retval -EINVAL Invalid policy or priority
+ */
+int32_t ctlra_rt_check(uint32_t policy, uint32_t priority);
+
 /** Change the Event func. This may be useful when integrating into
  * an application that doesn't know yet which event func to attach to
  * the device when connecting to it. A dummy event_func can be used, and
@@ -412,6 +550,99 @@ void ctlra_strerror(struct ctlra_t *ctlra, FILE* out);
 void ctlra_dev_set_event_func(struct ctlra_dev_t* dev,
 			      ctlra_event_func event_func);
 
+/** Receive events as a contiguous array of *struct ctlra_event_compact_t*
+ * instead of an array of pointers. All events a device produces in one
+ * iteration of *ctlra_idle_iter* are delivered in a single call, after
+ * polling the device. The userdata passed to the callback is the same as
+ * for the event func. Calling *ctlra_dev_set_event_func* afterwards
+ * switches the device back to the pointer array API.
+ */
+void ctlra_dev_set_event_compact_func(struct ctlra_dev_t* dev,
+				      ctlra_event_compact_func func);
+
+/** Coalesce events of high resolution controls, so a busy application
+ * receives one event per control instead of every intermediate value.
+ * Within the events a device produces in one iteration of
+ * *ctlra_idle_iter*, encoder deltas are summed per encoder id, and only
+ * the latest value of each slider id is kept. Other events are passed
+ * on unchanged, and the order between them and the coalesced events is
+ * kept. Works with both the event func and the compact event func.
+ * @param type_mask Bitmask of (1 << CTLRA_EVENT_ENCODER) and
+ *                  (1 << CTLRA_EVENT_SLIDER) selecting the event types
+ *                  to coalesce, 0 disables coalescing.
+ * @retval 0 Success
+ * @retval -EINVAL *type_mask* contains other event types
+ */
+int32_t ctlra_dev_set_event_coalesce(struct ctlra_dev_t* dev,
+				     uint32_t type_mask);
+
+/** Selects the events an application is subscribed to */
+struct ctlra_event_mask_t {
+	/** Bitmask of (1 << CTLRA_EVENT_*) event types to deliver */
+	uint32_t types;
+	/** For each event type, deliver only controls with ids from
+	 * *first* to *first + count - 1*. A *count* of 0 delivers all ids.
+	 * For grid events the id is the id of the grid. */
+	struct {
+		uint32_t first;
+		uint32_t count;
+	} ids[CTLRA_EVENT_T_COUNT];
+};
+
+/** Subscribe to a subset of the events of a device. Events outside the
+ * mask are never delivered, and drivers skip decoding the parts of a
+ * report whose event types are all masked out, so an application that
+ * only uses the pads of a device does not pay for the rest. Pass NULL
+ * *mask* to subscribe to all events again, which is the default.
+ * @retval 0 Success
+ * @retval -EINVAL Invalid *dev*
+ */
+int32_t ctlra_dev_set_event_mask(struct ctlra_dev_t* dev,
+				 const struct ctlra_event_mask_t *mask);
+
+/** Layout of the control state snapshot of a device. The snapshot is a
+ * flat array of floats: button states (0.f or 1.f), encoder
+ * accumulators (sum of all deltas), slider values, and grid squares
+ * (pressure while held, 1.f for pads without pressure, 0.f released) */
+struct ctlra_dev_state_layout_t {
+	/** Total number of values in a snapshot */
+	uint32_t count;
+	/** Index of the first value, and number of values, of each event
+	 * type. The squares of all grids follow each other */
+	uint32_t offset[CTLRA_EVENT_T_COUNT];
+	uint32_t size[CTLRA_EVENT_T_COUNT];
+	/** Index of square 0 of each grid, squares are indexed by pos */
+	uint32_t grid_offset[CTLRA_NUM_GRIDS_MAX];
+};
+
+/** Start tracking the current state of all controls of the device, so
+ * it can be queried with *ctlra_dev_state_read*. The state is updated
+ * from the events the driver produces, so controls that have not moved
+ * since enabling read as 0.f. Call from the thread that runs
+ * *ctlra_idle_iter*, eg: in the accept callback.
+ * @param layout Filled in with the layout of the snapshot, may be NULL
+ * @retval 0 Success
+ * @retval -ENOMEM Allocating the state table failed
+ */
+int32_t ctlra_dev_state_enable(struct ctlra_dev_t* dev,
+			       struct ctlra_dev_state_layout_t *layout);
+
+/** Copy a consistent snapshot of the control state. This function is
+ * lock-free and safe to call from any thread, eg: a UI thread polling
+ * at its frame rate. It retries while the state is being updated.
+ * The state, and the device itself, are freed once the remove callback
+ * of the device returns, so the remove callback must make sure other
+ * threads have stopped reading before it returns.
+ * @param values Array to copy into, see the layout for the contents
+ * @param count Number of floats *values* can hold
+ * @param version If non-NULL, set to a number that increases with each
+ *                update, to skip work when nothing changed
+ * @returns The number of values copied
+ * @retval -ENOTSUP State tracking was not enabled for the device
+ */
+int32_t ctlra_dev_state_read(struct ctlra_dev_t* dev, float *values,
+			     uint32_t count, uint32_t *version);
+
 /** Write Lights/LEDs feedback to device. See *ctlra_dev_lights_flush* to
  * flush the actual bytes over the cable to the device.
  * The *light_id* is a value specific to the device that enumerates each
@@ -453,6 +684,117 @@ void ctlra_dev_grid_light_set(struct ctlra_dev_t *dev,
 			     uint32_t light_id,
 			     uint32_t light_status);
 
+/** Options for the continuous pressure stream of a grid */
+struct ctlra_grid_pressure_opts_t {
+	/** Minimum change in pressure, in the range 0.f to 1.f, before a
+	 * new pressure event is sent for a square */
+	float deadband;
+	/** Maximum number of pressure events per second for each square,
+	 * or 0 for no limit */
+	uint32_t max_rate_hz;
+};
+
+/** Enable a continuous stream of pressure events (polyphonic
+ * aftertouch) while grid squares are held down. Pressure events are grid
+ * events with only CTLRA_EVENT_GRID_FLAG_PRESSURE set in *flags*, and are
+ * delivered in batches, one array of events per device report. The press
+ * and release events are unchanged, and have CTLRA_EVENT_GRID_FLAG_BUTTON
+ * set. Pass NULL *opts* to disable the stream again.
+ * @retval 0 Success
+ * @retval -ENOTSUP The device does not support pressure streams
+ * @retval -EINVAL Invalid *grid_id*
+ */
+int32_t ctlra_dev_grid_pressure_stream(struct ctlra_dev_t *dev,
+				       uint32_t grid_id,
+				       const struct ctlra_grid_pressure_opts_t *opts);
+
+/** Conditioning of the raw sensor readings of a pressure sensitive grid
+ * square. Pressures are normalized to the range 0.f to 1.f. */
+struct ctlra_grid_pad_opts_t {
+	/** Smoothing of the readings, from 0.f (none) to 0.99f (heavy).
+	 * Higher values reject more noise, but delay note onsets */
+	float smoothing;
+	/** Pressure above which the square is pressed */
+	float on_threshold;
+	/** Pressure below which a pressed square is released. Must not be
+	 * higher than *on_threshold*, the gap is the hysteresis */
+	float off_threshold;
+	/** Pressure that gives full velocity, must be above 0.f */
+	float velocity_full;
+	/** Velocity curve exponent: 1.f is linear, below 1.f makes soft
+	 * hits louder, above 1.f makes them quieter */
+	float velocity_curve;
+};
+
+/** Pass as *square* to apply the options to all squares of a grid */
+#define CTLRA_GRID_SQUARE_ALL UINT32_MAX
+
+/** Tune the conditioning of the pressure readings of grid squares, which
+ * decides when a square is pressed or released, and the velocity of the
+ * press event. Options can be changed at any time, and apply from the
+ * next device report. Pass NULL *opts* to restore the driver defaults.
+ * @param square The square to configure, or CTLRA_GRID_SQUARE_ALL
+ * @retval 0 Success
+ * @retval -ENOTSUP The device has no pressure sensitive grid
+ * @retval -EINVAL Invalid *grid_id*, *square* or options
+ */
+int32_t ctlra_dev_grid_pad_config(struct ctlra_dev_t *dev,
+				  uint32_t grid_id,
+				  uint32_t square,
+				  const struct ctlra_grid_pad_opts_t *opts);
+
+/** Options for the motion estimate of jog wheels */
+struct ctlra_jog_wheel_opts_t {
+	/** Position correction gain of the alpha-beta filter, above 0.f
+	 * and up to 1.f. Higher values follow the sensor more tightly, but
+	 * pass on more of its quantization jitter */
+	float alpha;
+	/** Velocity correction gain, above 0.f and below 2.f. Higher values
+	 * react faster to a change in speed */
+	float beta;
+	/** Time in milliseconds without movement after which the wheel is
+	 * considered stopped, 0 for the default of 20 ms */
+	uint32_t stop_ms;
+};
+
+/** Motion estimate of a jog wheel. A turn is one full rotation, and
+ * positive values are clockwise, as for the encoder events of the wheel */
+struct ctlra_jog_wheel_state_t {
+	/** Position in turns, counted from when the estimate was enabled */
+	double position;
+	/** Angular velocity in turns per second */
+	float velocity;
+	/** Non-zero while the wheel is touched */
+	uint8_t touched;
+	/** Time of the estimate in CLOCK_MONOTONIC nanoseconds */
+	uint64_t time_ns;
+};
+
+/** Enable a filtered position and velocity estimate for the jog wheels
+ * of a device, for scratching and nudging in time with the hand instead
+ * of the USB reports. The encoder events of the wheels are unchanged.
+ * Pass NULL *opts* to disable the estimate again.
+ * @retval 0 Success
+ * @retval -ENOTSUP The device has no jog wheels
+ * @retval -EINVAL Invalid options
+ */
+int32_t ctlra_dev_jog_wheel_config(struct ctlra_dev_t *dev,
+				   const struct ctlra_jog_wheel_opts_t *opts);
+
+/** Read the motion estimate of a jog wheel. This function does not block
+ * or allocate, and may be called from any thread, eg: once per audio
+ * block in the process callback. If *now_ns* is non-zero, the position
+ * is extrapolated towards that CLOCK_MONOTONIC time, until the next
+ * report of the device is due.
+ * @param wheel_id The jog wheel, numbered as its encoder id
+ * @retval 0 Success, *state* is written
+ * @retval -ENOTSUP The device has no jog wheels
+ * @retval -EINVAL Invalid *wheel_id*, or the estimate is not enabled
+ */
+int32_t ctlra_dev_jog_wheel_read(struct ctlra_dev_t *dev, uint32_t wheel_id,
+				 uint64_t now_ns,
+				 struct ctlra_jog_wheel_state_t *state);
+
 /** @warning
  * @b DEPRECATED: this API has been superseeded, use the screen update
  * callback APIs instead.
@@ -16,6 +16,29 @@ int ctlra_screen_cairo_to_device(struct ctlra_dev_t *dev,
 				 struct ctlra_screen_zone_t *redraw_zone,
 				 void *cairo_image_surface);
 
+/** Convert a Cairo image surface to the device format like
+ * *ctlra_screen_cairo_to_device*, comparing each pixel against the
+ * previous frame already in *pixel_data* in the same pass. The bounding
+ * box of what changed is written to *redraw_zone*, and if *dirty_tiles* is
+ * not NULL, a mask of changed tiles is written to it, one uint64_t per
+ * CTLRA_SCREEN_TILE_H rows, for up to *dirty_tiles_count* rows of tiles.
+ *
+ * The return value can be returned from the screen redraw callback.
+ * Drivers do not do partial writes yet, so a change requests a full
+ * flush; *redraw_zone* is only for the application's information.
+ * @retval 0 No pixel changed, the screen need not be flushed
+ * @retval 1 Pixels changed, flush the screen
+ * @retval <0 Error, the surface is not a supported image surface
+ */
+int ctlra_screen_cairo_to_device_diff(struct ctlra_dev_t *dev,
+				      uint32_t screen_idx,
+				      uint8_t *pixel_data,
+				      uint32_t bytes,
+				      struct ctlra_screen_zone_t *redraw_zone,
+				      void *cairo_image_surface,
+				      uint64_t *dirty_tiles,
+				      uint32_t dirty_tiles_count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,586 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cairo/cairo.h>
+
+#include "ctlra.h"
+#include "ctlra_scene.h"
+#include "pixel.h"
+
+/* Glyph atlas entries, must be a power of two. Each entry holds one
+ * rasterized cell, so for a 24px font this is ~220 kB. */
+#define ATLAS_BITS 8
+#define ATLAS_SIZE (1 << ATLAS_BITS)
+
+/* A text cell is stored as a key: the character in the low byte, then the
+ * foreground and background in device 565 format. Character 0 is an
+ * empty cell, drawn as background without touching the atlas. */
+#define CELL_KEY(c, fg, bg) ((uint64_t)(uint8_t)(c) | \
+			     ((uint64_t)(fg) << 8) | ((uint64_t)(bg) << 24))
+#define CELL_CHAR(k)        ((uint8_t)((k) & 0xff))
+#define CELL_FG(k)          ((uint16_t)(((k) >> 8) & 0xffff))
+#define CELL_BG(k)          ((uint16_t)(((k) >> 24) & 0xffff))
+
+/* Meter value indicating the meter has not been drawn yet */
+#define METER_UNDRAWN 0xffff
+
+struct scene_text_t {
+	uint16_t x;
+	uint16_t y;
+	uint16_t cols;
+	uint32_t first_cell;
+};
+
+struct scene_meter_t {
+	uint16_t x;
+	uint16_t y;
+	uint16_t seg_w;
+	uint16_t seg_h;
+	uint16_t seg_pitch;
+	uint16_t segments;
+	uint16_t lit;
+	uint16_t drawn;
+	uint16_t unlit_col;
+	uint16_t *lit_cols;
+};
+
+struct ctlra_scene_t {
+	uint32_t width;
+	uint32_t height;
+	/* framebuffer in device format, copied out on flush */
+	uint16_t *fb;
+	uint8_t *last_pixels;
+	uint8_t full_redraw;
+
+	/* font metrics and glyph raster target */
+	uint32_t cell_w;
+	uint32_t cell_h;
+	uint32_t ascent;
+	cairo_surface_t *glyph_surf;
+	cairo_t *glyph_cr;
+
+	/* glyph atlas: open addressed, linear probing, keys of 0 unused */
+	uint64_t atlas_keys[ATLAS_SIZE];
+	uint16_t *atlas_px;
+	uint32_t atlas_used;
+
+	struct scene_text_t *text;
+	uint32_t text_count;
+	/* wanted and on-screen contents of every cell of every text row */
+	uint64_t *cells;
+	uint64_t *cells_drawn;
+	uint32_t cell_count;
+
+	struct scene_meter_t *meters;
+	uint32_t meter_count;
+
+	/* dirty rectangle of the current frame, x1/y1 exclusive */
+	uint32_t dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+};
+
+/* Convert 0xRRGGBB to 565 as the screens expect it: byteswapped */
+static inline uint16_t
+scene_col_to_dev(uint32_t col)
+{
+	uint16_t r = (col >> 16) & 0xff;
+	uint16_t g = (col >>  8) & 0xff;
+	uint16_t b = (col      ) & 0xff;
+	uint16_t px = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	return (px << 8) | (px >> 8);
+}
+
+static inline void
+scene_dev_to_rgb(uint16_t dev, double *r, double *g, double *b)
+{
+	uint16_t px = (dev << 8) | (dev >> 8);
+	*r = ((px >> 11) & 0x1f) / 31.;
+	*g = ((px >>  5) & 0x3f) / 63.;
+	*b = ((px      ) & 0x1f) / 31.;
+}
+
+static void
+scene_dirty_add(struct ctlra_scene_t *s, uint32_t x, uint32_t y,
+		uint32_t w, uint32_t h)
+{
+	if(s->dirty_x1 == 0) {
+		s->dirty_x0 = x;
+		s->dirty_y0 = y;
+		s->dirty_x1 = x + w;
+		s->dirty_y1 = y + h;
+		return;
+	}
+	if(x < s->dirty_x0) s->dirty_x0 = x;
+	if(y < s->dirty_y0) s->dirty_y0 = y;
+	if(x + w > s->dirty_x1) s->dirty_x1 = x + w;
+	if(y + h > s->dirty_y1) s->dirty_y1 = y + h;
+}
+
+static inline int
+scene_dirty_hits(struct ctlra_scene_t *s, uint32_t x, uint32_t y,
+		 uint32_t w, uint32_t h)
+{
+	return x < s->dirty_x1 && x + w > s->dirty_x0 &&
+	       y < s->dirty_y1 && y + h > s->dirty_y0;
+}
+
+static void
+scene_fill(struct ctlra_scene_t *s, uint32_t x, uint32_t y, uint32_t w,
+	   uint32_t h, uint16_t col)
+{
+	for(uint32_t j = 0; j < h; j++) {
+		uint16_t *row = &s->fb[(y + j) * s->width + x];
+		for(uint32_t i = 0; i < w; i++)
+			row[i] = col;
+	}
+}
+
+/* Rasterize a cell with Cairo into its atlas slot */
+static void
+scene_glyph_raster(struct ctlra_scene_t *s, uint64_t key, uint16_t *dst)
+{
+	cairo_t *cr = s->glyph_cr;
+	double r, g, b;
+
+	scene_dev_to_rgb(CELL_BG(key), &r, &g, &b);
+	cairo_set_source_rgb(cr, r, g, b);
+	cairo_paint(cr);
+
+	char str[2] = { CELL_CHAR(key), 0 };
+	scene_dev_to_rgb(CELL_FG(key), &r, &g, &b);
+	cairo_set_source_rgb(cr, r, g, b);
+	cairo_move_to(cr, 0, s->ascent);
+	cairo_show_text(cr, str);
+	cairo_surface_flush(s->glyph_surf);
+
+	ctlra_impl_pixel_565_to_dev((uint8_t *)dst,
+				    s->cell_w * s->cell_h * sizeof(uint16_t),
+				    cairo_image_surface_get_data(s->glyph_surf),
+				    s->cell_w, s->cell_h,
+				    cairo_image_surface_get_stride(s->glyph_surf));
+}
+
+static const uint16_t *
+scene_glyph_get(struct ctlra_scene_t *s, uint64_t key)
+{
+	const uint32_t cell_px = s->cell_w * s->cell_h;
+	uint32_t slot = (key * 0x9E3779B97F4A7C15ull) >> (64 - ATLAS_BITS);
+
+	for(;;) {
+		if(s->atlas_keys[slot] == key)
+			return &s->atlas_px[slot * cell_px];
+		if(s->atlas_keys[slot] == 0)
+			break;
+		slot = (slot + 1) & (ATLAS_SIZE - 1);
+	}
+
+	/* Miss: when the atlas is getting full, start over. Screens show
+	 * a bounded set of colours and characters, so this is rare. */
+	if(s->atlas_used >= (ATLAS_SIZE * 3) / 4) {
+		memset(s->atlas_keys, 0, sizeof(s->atlas_keys));
+		s->atlas_used = 0;
+		return scene_glyph_get(s, key);
+	}
+
+	uint16_t *dst = &s->atlas_px[slot * cell_px];
+	scene_glyph_raster(s, key, dst);
+	s->atlas_keys[slot] = key;
+	s->atlas_used++;
+	return dst;
+}
+
+static void
+scene_cell_draw(struct ctlra_scene_t *s, uint32_t x, uint32_t y,
+		uint64_t key)
+{
+	if(CELL_CHAR(key) == 0) {
+		scene_fill(s, x, y, s->cell_w, s->cell_h, 0);
+		return;
+	}
+
+	const uint16_t *glyph = scene_glyph_get(s, key);
+	for(uint32_t j = 0; j < s->cell_h; j++)
+		memcpy(&s->fb[(y + j) * s->width + x],
+		       &glyph[j * s->cell_w],
+		       s->cell_w * sizeof(uint16_t));
+}
+
+static void
+scene_meter_draw(struct ctlra_scene_t *s, struct scene_meter_t *m)
+{
+	for(uint32_t i = 0; i < m->segments; i++) {
+		uint16_t col = i < m->lit ? m->lit_cols[i] : m->unlit_col;
+		scene_fill(s, m->x + i * m->seg_pitch, m->y,
+			   m->seg_w, m->seg_h, col);
+	}
+	m->drawn = m->lit;
+}
+
+static inline uint32_t
+scene_meter_width(struct scene_meter_t *m)
+{
+	return (m->segments - 1) * m->seg_pitch + m->seg_w;
+}
+
+struct ctlra_scene_t *
+ctlra_scene_create(uint32_t width, uint32_t height, const char *font_face,
+		   float font_size)
+{
+	struct ctlra_scene_t *s = calloc(1, sizeof(*s));
+	if(!s)
+		return 0;
+
+	s->width = width;
+	s->height = height;
+	s->full_redraw = 1;
+	s->fb = calloc(width * height, sizeof(uint16_t));
+	if(!s->fb)
+		goto fail;
+
+	/* Measure the font on a scratch surface to size the cells */
+	cairo_surface_t *tmp = cairo_image_surface_create(CAIRO_FORMAT_RGB16_565,
+							  1, 1);
+	cairo_t *cr = cairo_create(tmp);
+	if(font_face)
+		cairo_select_font_face(cr, font_face,
+				       CAIRO_FONT_SLANT_NORMAL,
+				       CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size(cr, font_size);
+	cairo_text_extents_t extents;
+	cairo_text_extents(cr, "0123456789", &extents);
+	cairo_font_extents_t fextents;
+	cairo_font_extents(cr, &fextents);
+	cairo_font_face_t *face = cairo_get_font_face(cr);
+	cairo_font_face_reference(face);
+	cairo_destroy(cr);
+	cairo_surface_destroy(tmp);
+
+	s->cell_w = extents.x_advance / 10.0 + 0.5;
+	s->cell_h = fextents.height + 0.5;
+	s->ascent = fextents.ascent + 0.5;
+	if(s->cell_w == 0 || s->cell_h == 0) {
+		cairo_font_face_destroy(face);
+		goto fail;
+	}
+
+	s->glyph_surf = cairo_image_surface_create(CAIRO_FORMAT_RGB16_565,
+						   s->cell_w, s->cell_h);
+	s->glyph_cr = cairo_create(s->glyph_surf);
+	cairo_set_font_face(s->glyph_cr, face);
+	cairo_set_font_size(s->glyph_cr, font_size);
+	cairo_font_face_destroy(face);
+
+	s->atlas_px = malloc(ATLAS_SIZE * s->cell_w * s->cell_h *
+			     sizeof(uint16_t));
+	if(!s->atlas_px)
+		goto fail;
+
+	return s;
+fail:
+	ctlra_scene_destroy(s);
+	return 0;
+}
+
+void
+ctlra_scene_destroy(struct ctlra_scene_t *s)
+{
+	if(!s)
+		return;
+	if(s->glyph_cr)
+		cairo_destroy(s->glyph_cr);
+	if(s->glyph_surf)
+		cairo_surface_destroy(s->glyph_surf);
+	for(uint32_t i = 0; i < s->meter_count; i++)
+		free(s->meters[i].lit_cols);
+	free(s->meters);
+	free(s->text);
+	free(s->cells);
+	free(s->cells_drawn);
+	free(s->atlas_px);
+	free(s->fb);
+	free(s);
+}
+
+void
+ctlra_scene_font_metrics(struct ctlra_scene_t *s, uint32_t *cell_width,
+			 uint32_t *cell_height, uint32_t *ascent)
+{
+	if(cell_width)
+		*cell_width = s->cell_w;
+	if(cell_height)
+		*cell_height = s->cell_h;
+	if(ascent)
+		*ascent = s->ascent;
+}
+
+int32_t
+ctlra_scene_text_add(struct ctlra_scene_t *s, uint32_t x, uint32_t y,
+		     uint32_t cols)
+{
+	if(cols == 0 || x + cols * s->cell_w > s->width ||
+	   y + s->cell_h > s->height)
+		return -EINVAL;
+
+	void *text = realloc(s->text, (s->text_count + 1) * sizeof(*s->text));
+	if(!text)
+		return -ENOMEM;
+	s->text = text;
+
+	uint32_t count = s->cell_count + cols;
+	void *cells = realloc(s->cells, count * sizeof(uint64_t));
+	if(!cells)
+		return -ENOMEM;
+	s->cells = cells;
+	cells = realloc(s->cells_drawn, count * sizeof(uint64_t));
+	if(!cells)
+		return -ENOMEM;
+	s->cells_drawn = cells;
+
+	/* The framebuffer starts out blank, which is what an empty cell
+	 * shows, so new rows do not need to be drawn */
+	memset(&s->cells[s->cell_count], 0, cols * sizeof(uint64_t));
+	memset(&s->cells_drawn[s->cell_count], 0, cols * sizeof(uint64_t));
+
+	struct scene_text_t *t = &s->text[s->text_count];
+	t->x = x;
+	t->y = y;
+	t->cols = cols;
+	t->first_cell = s->cell_count;
+	s->cell_count = count;
+
+	return s->text_count++;
+}
+
+int32_t
+ctlra_scene_text_set(struct ctlra_scene_t *s, int32_t id, uint32_t col,
+		     const char *str, uint32_t fg, uint32_t bg)
+{
+	if(id < 0 || (uint32_t)id >= s->text_count)
+		return -EINVAL;
+
+	struct scene_text_t *t = &s->text[id];
+	uint64_t *cells = &s->cells[t->first_cell];
+	uint16_t dev_fg = scene_col_to_dev(fg);
+	uint16_t dev_bg = scene_col_to_dev(bg);
+
+	for(; col < t->cols && *str; col++, str++) {
+		/* cells hold single bytes, don't pass partial UTF-8
+		 * sequences to Cairo */
+		char c = (*str & 0x80) ? '?' : *str;
+		cells[col] = CELL_KEY(c, dev_fg, dev_bg);
+	}
+
+	return 0;
+}
+
+int32_t
+ctlra_scene_text_clear(struct ctlra_scene_t *s, int32_t id)
+{
+	if(id < 0 || (uint32_t)id >= s->text_count)
+		return -EINVAL;
+
+	struct scene_text_t *t = &s->text[id];
+	memset(&s->cells[t->first_cell], 0, t->cols * sizeof(uint64_t));
+	return 0;
+}
+
+int32_t
+ctlra_scene_meter_add(struct ctlra_scene_t *s, uint32_t x, uint32_t y,
+		      uint32_t seg_w, uint32_t seg_h, uint32_t seg_pitch,
+		      uint32_t segments, const uint32_t *lit_cols,
+		      uint32_t unlit_col)
+{
+	if(segments == 0 || segments >= METER_UNDRAWN ||
+	   x + (segments - 1) * seg_pitch + seg_w > s->width ||
+	   y + seg_h > s->height)
+		return -EINVAL;
+
+	void *meters = realloc(s->meters,
+			       (s->meter_count + 1) * sizeof(*s->meters));
+	if(!meters)
+		return -ENOMEM;
+	s->meters = meters;
+
+	struct scene_meter_t *m = &s->meters[s->meter_count];
+	m->lit_cols = malloc(segments * sizeof(uint16_t));
+	if(!m->lit_cols)
+		return -ENOMEM;
+	for(uint32_t i = 0; i < segments; i++)
+		m->lit_cols[i] = scene_col_to_dev(lit_cols[i]);
+
+	m->x = x;
+	m->y = y;
+	m->seg_w = seg_w;
+	m->seg_h = seg_h;
+	m->seg_pitch = seg_pitch;
+	m->segments = segments;
+	m->lit = 0;
+	m->drawn = METER_UNDRAWN;
+	m->unlit_col = scene_col_to_dev(unlit_col);
+
+	return s->meter_count++;
+}
+
+int32_t
+ctlra_scene_meter_set(struct ctlra_scene_t *s, int32_t id, uint32_t lit)
+{
+	if(id < 0 || (uint32_t)id >= s->meter_count)
+		return -EINVAL;
+
+	struct scene_meter_t *m = &s->meters[id];
+	m->lit = lit > m->segments ? m->segments : lit;
+	return 0;
+}
+
+void
+ctlra_scene_clear(struct ctlra_scene_t *s)
+{
+	memset(s->cells, 0, s->cell_count * sizeof(uint64_t));
+	for(uint32_t i = 0; i < s->meter_count; i++)
+		s->meters[i].lit = 0;
+}
+
+int32_t
+ctlra_scene_to_device(struct ctlra_scene_t *s, uint8_t *pixel_data,
+		      uint32_t bytes, struct ctlra_screen_zone_t *redraw_zone)
+{
+	const uint32_t cw = s->cell_w;
+	const uint32_t ch = s->cell_h;
+
+	if(bytes < s->width * s->height * sizeof(uint16_t))
+		return -EINVAL;
+
+	/* Collect the area covered by changed primitives */
+	s->dirty_x0 = s->dirty_y0 = s->dirty_x1 = s->dirty_y1 = 0;
+	for(uint32_t i = 0; i < s->text_count; i++) {
+		struct scene_text_t *t = &s->text[i];
+		uint64_t *want = &s->cells[t->first_cell];
+		uint64_t *drawn = &s->cells_drawn[t->first_cell];
+		for(uint32_t c = 0; c < t->cols; c++) {
+			if(want[c] != drawn[c])
+				scene_dirty_add(s, t->x + c * cw, t->y, cw, ch);
+		}
+	}
+	for(uint32_t i = 0; i < s->meter_count; i++) {
+		struct scene_meter_t *m = &s->meters[i];
+		if(m->lit != m->drawn)
+			scene_dirty_add(s, m->x, m->y, scene_meter_width(m),
+					m->seg_h);
+	}
+
+	int full = s->full_redraw || pixel_data != s->last_pixels;
+	if(s->dirty_x1 == 0 && !full)
+		return 0;
+
+	/* Redraw everything touching the dirty area in order, so that
+	 * overlapping primitives stack the same as in a full redraw */
+	if(s->dirty_x1) {
+		for(uint32_t i = 0; i < s->text_count; i++) {
+			struct scene_text_t *t = &s->text[i];
+			if(!scene_dirty_hits(s, t->x, t->y, t->cols * cw, ch))
+				continue;
+			uint64_t *want = &s->cells[t->first_cell];
+			uint64_t *drawn = &s->cells_drawn[t->first_cell];
+			for(uint32_t c = 0; c < t->cols; c++) {
+				uint32_t x = t->x + c * cw;
+				if(!scene_dirty_hits(s, x, t->y, cw, ch))
+					continue;
+				scene_cell_draw(s, x, t->y, want[c]);
+				drawn[c] = want[c];
+			}
+		}
+		for(uint32_t i = 0; i < s->meter_count; i++) {
+			struct scene_meter_t *m = &s->meters[i];
+			if(scene_dirty_hits(s, m->x, m->y,
+					    scene_meter_width(m), m->seg_h))
+				scene_meter_draw(s, m);
+		}
+	}
+
+	if(full) {
+		memcpy(pixel_data, s->fb, s->width * s->height * sizeof(uint16_t));
+		s->full_redraw = 0;
+		s->last_pixels = pixel_data;
+		if(redraw_zone) {
+			redraw_zone->x = 0;
+			redraw_zone->y = 0;
+			redraw_zone->w = s->width;
+			redraw_zone->h = s->height;
+		}
+		return 1;
+	}
+
+	uint32_t w = s->dirty_x1 - s->dirty_x0;
+	uint16_t *dst = (uint16_t *)pixel_data;
+	for(uint32_t y = s->dirty_y0; y < s->dirty_y1; y++) {
+		uint32_t offset = y * s->width + s->dirty_x0;
+		memcpy(&dst[offset], &s->fb[offset], w * sizeof(uint16_t));
+	}
+
+	if(redraw_zone) {
+		redraw_zone->x = s->dirty_x0;
+		redraw_zone->y = s->dirty_y0;
+		redraw_zone->w = w;
+		redraw_zone->h = s->dirty_y1 - s->dirty_y0;
+	}
+	return 1;
+}
+
+int32_t
+ctlra_scene_write_png(struct ctlra_scene_t *s, const char *path)
+{
+	cairo_surface_t *img = cairo_image_surface_create(CAIRO_FORMAT_RGB16_565,
+							  s->width, s->height);
+	if(cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(img);
+		return -ENOMEM;
+	}
+
+	/* swapping the bytes back is the same operation, row by row as
+	 * the surface rows may be padded */
+	cairo_surface_flush(img);
+	uint8_t *data = cairo_image_surface_get_data(img);
+	int stride = cairo_image_surface_get_stride(img);
+	for(uint32_t j = 0; j < s->height; j++)
+		ctlra_impl_pixel_565_to_dev(&data[j * stride],
+					    s->width * sizeof(uint16_t),
+					    (uint8_t *)&s->fb[j * s->width],
+					    s->width, 1, 0);
+	cairo_surface_mark_dirty(img);
+
+	cairo_status_t ret = cairo_surface_write_to_png(img, path);
+	cairo_surface_destroy(img);
+	return ret == CAIRO_STATUS_SUCCESS ? 0 : -EIO;
+}
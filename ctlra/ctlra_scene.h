@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OPENAV_CTLRA_SCENE_H
+#define OPENAV_CTLRA_SCENE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct ctlra_screen_zone_t;
+
+/* A scene is a retained description of a screen: rows of text cells and
+ * segmented meter bars, drawn into a framebuffer in the device's native
+ * (byteswapped) 565 format. Glyphs are rasterized once with Cairo and kept
+ * in an atlas keyed on character and colours, so a frame where only the
+ * timecode or one meter changed touches only those pixels.
+ *
+ * Typical usage from a screen redraw callback is to set the text and
+ * meter values every frame, and return the result of
+ * *ctlra_scene_to_device*. Setting a value that did not change is cheap.
+ *
+ * Primitives are redrawn in the order they were added, text before
+ * meters, so overlapping primitives compose the same as a full redraw.
+ * Colours are passed as 0xRRGGBB, the top byte is ignored.
+ */
+struct ctlra_scene_t;
+
+/** Create a scene of *width* x *height* pixels. Text is rendered with
+ * *font_face* (NULL for the Cairo default) at *font_size*, every glyph
+ * occupying a fixed width cell: monospace fonts are recommended.
+ * @retval 0 on error
+ */
+struct ctlra_scene_t *ctlra_scene_create(uint32_t width, uint32_t height,
+					 const char *font_face,
+					 float font_size);
+
+/** Destroy the scene and its glyph atlas */
+void ctlra_scene_destroy(struct ctlra_scene_t *scene);
+
+/** Retrieve the glyph cell size and ascent, in pixels */
+void ctlra_scene_font_metrics(struct ctlra_scene_t *scene,
+			      uint32_t *cell_width, uint32_t *cell_height,
+			      uint32_t *ascent);
+
+/** Add a row of *cols* text cells, with its top-left corner at *x*, *y*.
+ * @retval >= 0 The id of the text row
+ * @retval -EINVAL The row does not fit the screen
+ * @retval -ENOMEM Allocation failure
+ */
+int32_t ctlra_scene_text_add(struct ctlra_scene_t *scene, uint32_t x,
+			     uint32_t y, uint32_t cols);
+
+/** Write *str* into text row *id* starting at column *col*, truncated at
+ * the end of the row. Cells after the string are left untouched.
+ */
+int32_t ctlra_scene_text_set(struct ctlra_scene_t *scene, int32_t id,
+			     uint32_t col, const char *str,
+			     uint32_t fg, uint32_t bg);
+
+/** Set cells of text row *id* to empty, showing the scene background */
+int32_t ctlra_scene_text_clear(struct ctlra_scene_t *scene, int32_t id);
+
+/** Add a horizontal meter of *segments* segments of *seg_w* x *seg_h*
+ * pixels, spaced *seg_pitch* pixels apart. Lit segment *i* is drawn in
+ * *lit_cols[i]*, unlit segments in *unlit_col*.
+ * @retval >= 0 The id of the meter
+ * @retval -EINVAL The meter does not fit the screen
+ * @retval -ENOMEM Allocation failure
+ */
+int32_t ctlra_scene_meter_add(struct ctlra_scene_t *scene, uint32_t x,
+			      uint32_t y, uint32_t seg_w, uint32_t seg_h,
+			      uint32_t seg_pitch, uint32_t segments,
+			      const uint32_t *lit_cols, uint32_t unlit_col);
+
+/** Light the first *lit* segments of meter *id* */
+int32_t ctlra_scene_meter_set(struct ctlra_scene_t *scene, int32_t id,
+			      uint32_t lit);
+
+/** Empty all text rows and turn off all meters */
+void ctlra_scene_clear(struct ctlra_scene_t *scene);
+
+/** Render changed primitives and copy them into the device pixels. This
+ * is intended to be called from the screen redraw callback, passing its
+ * arguments, and returning its return value. Only the changed area is
+ * copied, and its bounds are written to *redraw_zone*, but a full flush
+ * is requested as drivers do not do partial writes yet.
+ * @retval 0 Nothing changed, no flush required
+ * @retval 1 Pixels were written, flush the screen
+ * @retval <0 *bytes* is too small for the scene
+ */
+int32_t ctlra_scene_to_device(struct ctlra_scene_t *scene,
+			      uint8_t *pixel_data, uint32_t bytes,
+			      struct ctlra_screen_zone_t *redraw_zone);
+
+/** Write the current contents of the scene to a PNG file */
+int32_t ctlra_scene_write_png(struct ctlra_scene_t *scene,
+			      const char *path);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* OPENAV_CTLRA_SCENE_H */
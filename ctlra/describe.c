@@ -0,0 +1,745 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "impl.h"
+#include "hid.h"
+#include "describe.h"
+
+#define DESC_LINE_MAX     256
+#define DESC_CONTROLS_MAX 512
+#define DESC_LIGHTS_MAX   1024
+
+/* The described backend, see devices/described.c */
+CTLRA_DEVICE_DECL(described);
+
+/* From ctlra.c */
+extern int ctlra_impl_get_id_by_vid_pid(uint32_t vid, uint32_t pid);
+
+enum desc_type_t {
+	DESC_BUTTON,
+	DESC_SLIDER,
+	DESC_ENCODER,
+	DESC_TYPES,
+	/* not controls */
+	DESC_LIGHT = DESC_TYPES,
+	DESC_DEVICE,
+	DESC_OTHER,
+};
+
+static const char *desc_type_names[] = {
+	"button",
+	"slider",
+	"encoder",
+	"light",
+};
+
+static const uint8_t desc_event_types[] = {
+	CTLRA_EVENT_BUTTON,
+	CTLRA_EVENT_SLIDER,
+	CTLRA_EVENT_ENCODER,
+};
+
+struct desc_ctl_t {
+	uint8_t set;
+	char name[CTLRA_DESC_NAME_MAX];
+	int32_t byte;
+	uint32_t mask;
+	uint32_t shift;
+	uint32_t bits;
+	int32_t min;
+	int32_t max;
+	uint8_t has_max;
+	int32_t light;
+	struct ctlra_item_info_t item;
+};
+
+struct desc_parse_t {
+	struct ctlra_t *ctlra;
+	const char *path;
+	uint32_t lineno;
+
+	struct ctlra_desc_t *desc;
+	int32_t report;
+	int32_t light_report;
+
+	enum desc_type_t section;
+	uint32_t section_id;
+
+	uint32_t count[DESC_TYPES];
+	struct desc_ctl_t ctls[DESC_TYPES][DESC_CONTROLS_MAX];
+	uint32_t light_count;
+	uint8_t light_set[DESC_LIGHTS_MAX];
+	struct ctlra_desc_light_t lights[DESC_LIGHTS_MAX];
+};
+
+/* described devices stay registered for the life of the process */
+static struct ctlra_desc_t *ctlra_desc_list;
+
+#define DESC_ERROR(p, fmt, ...)						\
+	CTLRA_ERROR(p->ctlra, "%s:%u: " fmt "\n", p->path, p->lineno,	\
+		    __VA_ARGS__)
+
+static char *
+desc_strip(char *s)
+{
+	while(*s == ' ' || *s == '\t')
+		s++;
+	char *end = s + strlen(s);
+	while(end > s && (end[-1] == ' ' || end[-1] == '\t' ||
+			  end[-1] == '\r' || end[-1] == '\n'))
+		*--end = 0;
+	return s;
+}
+
+static int32_t
+desc_int(struct desc_parse_t *p, const char *key, const char *val,
+	 int32_t *out)
+{
+	char *end;
+	long v = strtol(val, &end, 0);
+	if(end == val || *end) {
+		DESC_ERROR(p, "%s: '%s' is not a number", key, val);
+		return -EINVAL;
+	}
+	*out = v;
+	return 0;
+}
+
+static int32_t
+desc_device_key(struct desc_parse_t *p, const char *key, const char *val)
+{
+	struct ctlra_desc_t *d = p->desc;
+	struct ctlra_dev_info_t *info = &d->info;
+	int32_t v = 0;
+
+	if(strcmp(key, "vendor") == 0) {
+		snprintf(info->vendor, sizeof(info->vendor), "%s", val);
+		return 0;
+	}
+	if(strcmp(key, "device") == 0) {
+		snprintf(info->device, sizeof(info->device), "%s", val);
+		return 0;
+	}
+	if(desc_int(p, key, val, &v))
+		return -EINVAL;
+
+	if(strcmp(key, "vid") == 0)
+		info->vendor_id = v;
+	else if(strcmp(key, "pid") == 0)
+		info->device_id = v;
+	else if(strcmp(key, "interface") == 0)
+		d->interface = v;
+	else if(strcmp(key, "in") == 0)
+		d->endpoint_in = v;
+	else if(strcmp(key, "out") == 0)
+		d->endpoint_out = v;
+	else if(strcmp(key, "report") == 0)
+		p->report = v;
+	else if(strcmp(key, "size") == 0)
+		d->input_size = v;
+	else if(strcmp(key, "light_report") == 0)
+		p->light_report = v;
+	else if(strcmp(key, "light_bytes") == 0)
+		d->light_bytes = v;
+	else if(strcmp(key, "width") == 0)
+		info->size_x = v;
+	else if(strcmp(key, "height") == 0)
+		info->size_y = v;
+	else {
+		DESC_ERROR(p, "unknown device key '%s'", key);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int32_t
+desc_style(struct desc_parse_t *p, struct desc_ctl_t *c, const char *val)
+{
+	static const struct {
+		const char *name;
+		uint64_t flags;
+	} styles[] = {
+		{"button",  CTLRA_ITEM_BUTTON},
+		{"fader",   CTLRA_ITEM_FADER},
+		{"dial",    CTLRA_ITEM_DIAL},
+		{"encoder", CTLRA_ITEM_ENCODER},
+		{"notch",   CTLRA_ITEM_CENTER_NOTCH},
+	};
+	char buf[DESC_LINE_MAX];
+	snprintf(buf, sizeof(buf), "%s", val);
+
+	char *save;
+	for(char *t = strtok_r(buf, ", ", &save); t;
+	    t = strtok_r(0, ", ", &save)) {
+		uint32_t i;
+		for(i = 0; i < sizeof(styles) / sizeof(styles[0]); i++)
+			if(strcmp(t, styles[i].name) == 0)
+				break;
+		if(i == sizeof(styles) / sizeof(styles[0])) {
+			DESC_ERROR(p, "unknown style '%s'", t);
+			return -EINVAL;
+		}
+		c->item.flags |= styles[i].flags;
+	}
+	return 0;
+}
+
+static int32_t
+desc_ctl_key(struct desc_parse_t *p, const char *key, const char *val)
+{
+	struct desc_ctl_t *c = &p->ctls[p->section][p->section_id];
+
+	if(strcmp(key, "name") == 0) {
+		snprintf(c->name, sizeof(c->name), "%s", val);
+		return 0;
+	}
+	if(strcmp(key, "style") == 0)
+		return desc_style(p, c, val);
+
+	int32_t v;
+	if(desc_int(p, key, val, &v))
+		return -EINVAL;
+
+	if(strcmp(key, "byte") == 0)
+		c->byte = v;
+	else if(strcmp(key, "mask") == 0 && p->section == DESC_BUTTON)
+		c->mask = v;
+	else if(strcmp(key, "bits") == 0 && p->section != DESC_BUTTON)
+		c->bits = v;
+	else if(strcmp(key, "shift") == 0 && p->section != DESC_BUTTON)
+		c->shift = v;
+	else if(strcmp(key, "min") == 0 && p->section == DESC_SLIDER)
+		c->min = v;
+	else if(strcmp(key, "max") == 0 && p->section == DESC_SLIDER) {
+		c->max = v;
+		c->has_max = 1;
+	} else if(strcmp(key, "light") == 0)
+		c->light = v;
+	else if(strcmp(key, "x") == 0)
+		c->item.x = v;
+	else if(strcmp(key, "y") == 0)
+		c->item.y = v;
+	else if(strcmp(key, "w") == 0)
+		c->item.w = v;
+	else if(strcmp(key, "h") == 0)
+		c->item.h = v;
+	else {
+		DESC_ERROR(p, "unknown %s key '%s'",
+			   desc_type_names[p->section], key);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int32_t
+desc_light_key(struct desc_parse_t *p, const char *key, const char *val)
+{
+	struct ctlra_desc_light_t *l = &p->lights[p->section_id];
+
+	if(strcmp(key, "channels") == 0) {
+		uint32_t n = strlen(val);
+		if(n == 0 || n > CTLRA_DESC_CHANNELS_MAX ||
+		   strspn(val, "irgb") != n) {
+			DESC_ERROR(p, "channels '%s' must be 1 to %d of i r g b",
+				   val, CTLRA_DESC_CHANNELS_MAX);
+			return -EINVAL;
+		}
+		memcpy(l->channels, val, n);
+		l->channel_count = n;
+		return 0;
+	}
+
+	int32_t v;
+	if(strcmp(key, "byte") == 0 && !desc_int(p, key, val, &v) && v >= 0) {
+		l->byte = v;
+		return 0;
+	}
+	DESC_ERROR(p, "bad light key '%s'", key);
+	return -EINVAL;
+}
+
+/* "[button.3]" selects the section of button 3 */
+static int32_t
+desc_section(struct desc_parse_t *p, char *s)
+{
+	char *end = strchr(s, ']');
+	if(!end) {
+		DESC_ERROR(p, "unterminated section '%s'", s);
+		return -EINVAL;
+	}
+	*end = 0;
+	s++;
+
+	if(strcmp(s, "device") == 0) {
+		p->section = DESC_DEVICE;
+		return 0;
+	}
+
+	char *dot = strchr(s, '.');
+	if(!dot) {
+		DESC_ERROR(p, "unknown section '%s'", s);
+		return -EINVAL;
+	}
+	*dot = 0;
+
+	uint32_t type;
+	for(type = 0; type <= DESC_LIGHT; type++)
+		if(strcmp(s, desc_type_names[type]) == 0)
+			break;
+
+	char *num_end;
+	long id = strtol(dot + 1, &num_end, 10);
+	uint32_t max = type == DESC_LIGHT ? DESC_LIGHTS_MAX :
+					    DESC_CONTROLS_MAX;
+	if(type > DESC_LIGHT || *num_end || num_end == dot + 1 ||
+	   id < 0 || id >= max) {
+		DESC_ERROR(p, "bad section '%s.%s'", s, dot + 1);
+		return -EINVAL;
+	}
+
+	p->section = type;
+	p->section_id = id;
+	if(type == DESC_LIGHT) {
+		if(p->light_set[id]) {
+			DESC_ERROR(p, "light %ld described twice", id);
+			return -EINVAL;
+		}
+		p->light_set[id] = 1;
+		/* a light is its own byte of intensity by default */
+		p->lights[id].byte = id;
+		p->lights[id].channels[0] = 'i';
+		p->lights[id].channel_count = 1;
+		if(id + 1 > p->light_count)
+			p->light_count = id + 1;
+		return 0;
+	}
+
+	struct desc_ctl_t *c = &p->ctls[type][id];
+	if(c->set) {
+		DESC_ERROR(p, "%s %ld described twice", s, id);
+		return -EINVAL;
+	}
+	c->set = 1;
+	c->byte = -1;
+	c->light = -1;
+	c->bits = type == DESC_ENCODER ? 4 : 8;
+	if(id + 1 > p->count[type])
+		p->count[type] = id + 1;
+	return 0;
+}
+
+static int32_t
+desc_line(struct desc_parse_t *p, char *line)
+{
+	char *s = desc_strip(line);
+	if(!*s || *s == '#' || *s == ';')
+		return 0;
+	if(*s == '[')
+		return desc_section(p, s);
+
+	/* a # or ; after whitespace starts a trailing comment */
+	for(char *c = s + 1; *c; c++) {
+		if((*c == '#' || *c == ';') &&
+		   (c[-1] == ' ' || c[-1] == '\t')) {
+			*c = 0;
+			break;
+		}
+	}
+
+	char *eq = strchr(s, '=');
+	if(!eq) {
+		DESC_ERROR(p, "expected key = value, got '%s'", s);
+		return -EINVAL;
+	}
+	*eq = 0;
+	char *key = desc_strip(s);
+	char *val = desc_strip(eq + 1);
+
+	switch(p->section) {
+	case DESC_DEVICE:
+		return desc_device_key(p, key, val);
+	case DESC_LIGHT:
+		return desc_light_key(p, key, val);
+	case DESC_OTHER:
+		DESC_ERROR(p, "key '%s' outside of a section", key);
+		return -EINVAL;
+	default:
+		return desc_ctl_key(p, key, val);
+	}
+}
+
+/* Check the parsed description, and compile its decode table, names,
+ * item info and lights */
+static int32_t
+desc_compile(struct desc_parse_t *p)
+{
+	struct ctlra_desc_t *d = p->desc;
+	struct ctlra_dev_info_t *info = &d->info;
+	p->lineno = 0;
+
+	if(!info->vendor_id || !info->device_id || !info->vendor[0] ||
+	   !info->device[0]) {
+		DESC_ERROR(p, "[device] needs vendor, device, vid and pid%s",
+			   "");
+		return -EINVAL;
+	}
+	if(!(d->endpoint_in & 0x80) || !d->input_size) {
+		DESC_ERROR(p, "[device] needs an IN endpoint and input size%s",
+			   "");
+		return -EINVAL;
+	}
+	if(p->report > 255 || p->light_report > 255) {
+		DESC_ERROR(p, "report ids are one byte%s", "");
+		return -EINVAL;
+	}
+	d->has_report_id = p->report >= 0;
+	d->has_light_report = p->light_report >= 0;
+	d->light_report = d->has_light_report ? p->light_report : 0;
+
+	uint32_t fields = 0;
+	for(uint32_t t = 0; t < DESC_TYPES; t++)
+		fields += p->count[t];
+	d->fields = calloc(fields ? fields : 1, sizeof(*d->fields));
+	if(!d->fields)
+		return -ENOMEM;
+
+	for(uint32_t t = 0; t < DESC_TYPES; t++) {
+		uint32_t n = p->count[t];
+		uint8_t ev = desc_event_types[t];
+		if(!n)
+			continue;
+
+		d->names[ev] = calloc(n, CTLRA_DESC_NAME_MAX);
+		struct ctlra_item_info_t *items = calloc(n, sizeof(*items));
+		info->control_info[ev] = items;
+		info->control_count[ev] = n;
+		if(!d->names[ev] || !items)
+			return -ENOMEM;
+
+		for(uint32_t i = 0; i < n; i++) {
+			struct desc_ctl_t *c = &p->ctls[t][i];
+			const char *tn = desc_type_names[t];
+			if(!c->set) {
+				DESC_ERROR(p, "%s %u is missing, ids must "
+					   "count up from 0", tn, i);
+				return -EINVAL;
+			}
+
+			struct ctlra_hid_field_t *f = &d->fields[d->field_count++];
+			f->id = i;
+			f->report_id = d->has_report_id ? p->report : 0;
+			f->byte = c->byte;
+			f->shift = c->shift;
+			f->bits = c->bits;
+
+			switch(t) {
+			case DESC_BUTTON:
+				if(!c->mask || (c->mask & (c->mask - 1))) {
+					DESC_ERROR(p, "button %u needs a one "
+						   "bit mask", i);
+					return -EINVAL;
+				}
+				f->kind = CTLRA_HID_BUTTONS;
+				f->shift = __builtin_ctz(c->mask);
+				f->bits = 1;
+				c->item.flags |= CTLRA_ITEM_BUTTON;
+				break;
+			case DESC_SLIDER:
+				if(!c->has_max)
+					c->max = c->bits >= 31 ? INT32_MAX :
+						 (1 << c->bits) - 1;
+				if(c->max <= c->min) {
+					DESC_ERROR(p, "slider %u max must be "
+						   "above min", i);
+					return -EINVAL;
+				}
+				f->kind = CTLRA_HID_SLIDER;
+				f->logical_min = c->min;
+				f->is_signed = c->min < 0;
+				f->scale = 1.f / ((int64_t)c->max - c->min);
+				break;
+			case DESC_ENCODER:
+				f->kind = CTLRA_HID_COUNTER;
+				c->item.flags |= CTLRA_ITEM_ENCODER;
+				break;
+			}
+
+			uint32_t end = c->byte + (f->shift + f->bits + 7) / 8;
+			if(c->byte < 0 || f->bits < 1 || f->bits > 32 ||
+			   c->shift > 31 || f->shift > 31 ||
+			   end > d->input_size) {
+				DESC_ERROR(p, "%s %u is outside the %u byte "
+					   "input report", tn, i,
+					   d->input_size);
+				return -EINVAL;
+			}
+
+			if(c->light >= 0) {
+				if((uint32_t)c->light >= p->light_count ||
+				   !p->light_set[c->light]) {
+					DESC_ERROR(p, "%s %u uses undescribed "
+						   "light %d", tn, i, c->light);
+					return -EINVAL;
+				}
+				const struct ctlra_desc_light_t *l =
+					&p->lights[c->light];
+				c->item.flags |= CTLRA_ITEM_LED_INTENSITY |
+						 CTLRA_ITEM_HAS_FB_ID;
+				if(l->channel_count > 1 || l->channels[0] != 'i')
+					c->item.flags |= CTLRA_ITEM_LED_COLOR;
+				c->item.fb_id = c->light;
+			}
+
+			memcpy(d->names[ev][i], c->name, CTLRA_DESC_NAME_MAX);
+			items[i] = c->item;
+		}
+	}
+
+	if(p->light_count) {
+		if(!d->endpoint_out) {
+			DESC_ERROR(p, "lights need an OUT endpoint%s", "");
+			return -EINVAL;
+		}
+		d->lights = calloc(p->light_count, sizeof(*d->lights));
+		if(!d->lights)
+			return -ENOMEM;
+		d->light_count = p->light_count;
+	}
+	for(uint32_t i = 0; i < p->light_count; i++) {
+		const struct ctlra_desc_light_t *l = &p->lights[i];
+		if(!p->light_set[i]) {
+			DESC_ERROR(p, "light %u is missing, ids must count up "
+				   "from 0", i);
+			return -EINVAL;
+		}
+		if(l->byte + l->channel_count > d->light_bytes) {
+			DESC_ERROR(p, "light %u is outside the %u light bytes",
+				   i, d->light_bytes);
+			return -EINVAL;
+		}
+		d->lights[i] = *l;
+	}
+	return 0;
+}
+
+static void
+desc_free(struct ctlra_desc_t *d)
+{
+	if(!d)
+		return;
+	for(uint32_t t = 0; t < CTLRA_EVENT_T_COUNT; t++) {
+		free(d->names[t]);
+		free(d->info.control_info[t]);
+	}
+	free(d->fields);
+	free(d->lights);
+	free(d);
+}
+
+static int32_t
+desc_load_file(struct ctlra_t *ctlra, const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -errno;
+
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	const char *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return -errno;
+
+	struct desc_parse_t *p = calloc(1, sizeof(*p));
+	struct ctlra_desc_t *d = calloc(1, sizeof(*d));
+	int32_t ret = -ENOMEM;
+	if(!p || !d)
+		goto out;
+
+	p->ctlra = ctlra;
+	p->path = path;
+	p->desc = d;
+	p->report = -1;
+	p->light_report = -1;
+	p->section = DESC_OTHER;
+
+	ret = 0;
+	const char *pos = map;
+	const char *map_end = map + st.st_size;
+	while(!ret && pos < map_end) {
+		const char *nl = memchr(pos, '\n', map_end - pos);
+		const char *line_end = nl ? nl : map_end;
+		char line[DESC_LINE_MAX];
+		uint32_t len = line_end - pos;
+
+		p->lineno++;
+		if(len >= sizeof(line)) {
+			DESC_ERROR(p, "line longer than %d bytes",
+				   DESC_LINE_MAX - 1);
+			ret = -EINVAL;
+			break;
+		}
+		memcpy(line, pos, len);
+		line[len] = 0;
+		ret = desc_line(p, line);
+		pos = line_end + 1;
+	}
+
+	if(!ret)
+		ret = desc_compile(p);
+	if(ret)
+		goto out;
+
+	uint32_t vid = d->info.vendor_id;
+	uint32_t pid = d->info.device_id;
+	if(ctlra_impl_get_id_by_vid_pid(vid, pid) >= 0) {
+		CTLRA_WARN(ctlra, "%s: %04x:%04x already has a driver\n",
+			   path, vid, pid);
+		ret = -EEXIST;
+		goto out;
+	}
+
+	struct ctlra_dev_connect_func_t reg = {
+		.vid = vid,
+		.pid = pid,
+		.connect = CTLRA_DEVICE_FUNC(described),
+		.info = &d->info,
+		.future = d,
+	};
+	ret = ctlra_impl_device_register(&reg);
+	if(ret)
+		goto out;
+
+	d->next = ctlra_desc_list;
+	ctlra_desc_list = d;
+	d = 0;
+	CTLRA_INFO(ctlra, "%s: described %04x:%04x\n", path, vid, pid);
+
+out:
+	desc_free(d);
+	free(p);
+	munmap((void *)map, st.st_size);
+	return ret;
+}
+
+static int
+desc_filter(const struct dirent *e)
+{
+	uint32_t n = strlen(e->d_name);
+	return n > 6 && strcmp(e->d_name + n - 6, ".ctlra") == 0;
+}
+
+int32_t ctlra_impl_desc_load(struct ctlra_t *ctlra, const char *path)
+{
+	struct stat st;
+	if(stat(path, &st))
+		return -errno;
+
+	if(!S_ISDIR(st.st_mode)) {
+		int32_t ret = desc_load_file(ctlra, path);
+		return ret ? ret : 1;
+	}
+
+	struct dirent **list;
+	int n = scandir(path, &list, desc_filter, alphasort);
+	if(n < 0)
+		return -errno;
+
+	int32_t loaded = 0;
+	for(int i = 0; i < n; i++) {
+		char file[1024];
+		snprintf(file, sizeof(file), "%s/%s", path, list[i]->d_name);
+		loaded += desc_load_file(ctlra, file) == 0;
+		free(list[i]);
+	}
+	free(list);
+	return loaded;
+}
+
+void ctlra_impl_desc_load_env(struct ctlra_t *ctlra)
+{
+	static int loaded;
+	const char *env = getenv("CTLRA_DEVICE_PATH");
+	if(loaded || !env)
+		return;
+	loaded = 1;
+
+	char *paths = strdup(env);
+	if(!paths)
+		return;
+	char *save;
+	for(char *t = strtok_r(paths, ":", &save); t;
+	    t = strtok_r(0, ":", &save)) {
+		int32_t ret = ctlra_impl_desc_load(ctlra, t);
+		if(ret < 0 && ret != -EEXIST)
+			CTLRA_WARN(ctlra, "CTLRA_DEVICE_PATH %s: %s\n", t,
+				   strerror(-ret));
+	}
+	free(paths);
+}
+
+const char *ctlra_impl_desc_name(const struct ctlra_dev_info_t *info,
+				 enum ctlra_event_type_t type,
+				 uint32_t control_id)
+{
+	if(type >= CTLRA_EVENT_T_COUNT)
+		return 0;
+	for(struct ctlra_desc_t *d = ctlra_desc_list; d; d = d->next) {
+		if(d->info.vendor_id != info->vendor_id ||
+		   d->info.device_id != info->device_id)
+			continue;
+		if(!d->names[type] || control_id >= d->info.control_count[type])
+			return 0;
+		return d->names[type][control_id];
+	}
+	return 0;
+}
+
+int32_t ctlra_device_description_load(const char *path)
+{
+	if(!path)
+		return -EINVAL;
+	return ctlra_impl_desc_load(0, path);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CTLRA_DESCRIBE_H
+#define CTLRA_DESCRIBE_H
+
+#include <stdint.h>
+
+#include "ctlra.h"
+
+struct ctlra_t;
+struct ctlra_hid_field_t;
+
+/* Described devices: controllers supported by a text description file
+ * instead of a compiled driver. Each file is memory-mapped, validated
+ * and compiled into a ctlra_desc_t, which is added to the driver
+ * registry with the described backend (devices/described.c) as its
+ * connect function. Input is decoded by the field table of hid.h, and
+ * lights are encoded by the light table below. See
+ * ctlra_device_description_load() in ctlra.h for the file format. */
+
+#define CTLRA_DESC_NAME_MAX 32
+/* a light writes up to this many channels to consecutive bytes */
+#define CTLRA_DESC_CHANNELS_MAX 4
+
+struct ctlra_desc_light_t {
+	/* byte in the light report, after its id byte if any */
+	uint16_t byte;
+	uint8_t channel_count;
+	/* 'i'ntensity, 'r'ed, 'g'reen or 'b'lue of the light status */
+	char channels[CTLRA_DESC_CHANNELS_MAX];
+};
+
+struct ctlra_desc_t {
+	struct ctlra_desc_t *next;
+	struct ctlra_dev_info_t info;
+
+	uint8_t interface;
+	uint8_t endpoint_in;
+	uint8_t endpoint_out;
+	uint8_t has_report_id;
+	/* bytes of the largest input report */
+	uint16_t input_size;
+
+	/* lights are sent as one report: an optional id, then bytes */
+	uint8_t has_light_report;
+	uint8_t light_report;
+	uint16_t light_bytes;
+	uint32_t light_count;
+	struct ctlra_desc_light_t *lights;
+
+	/* input decode table, see ctlra_impl_hid_plan_build() */
+	uint32_t field_count;
+	struct ctlra_hid_field_t *fields;
+
+	/* control names and item info, by event type */
+	char (*names[CTLRA_EVENT_T_COUNT])[CTLRA_DESC_NAME_MAX];
+};
+
+/* Load a description file, or every *.ctlra file of a directory.
+ * Returns the number of devices registered, or -errno. */
+int32_t ctlra_impl_desc_load(struct ctlra_t *ctlra, const char *path);
+/* Load the files and directories of the colon separated
+ * CTLRA_DEVICE_PATH environment variable, once per process */
+void ctlra_impl_desc_load_env(struct ctlra_t *ctlra);
+/* Name of a control of a described device, or NULL */
+const char *ctlra_impl_desc_name(const struct ctlra_dev_info_t *info,
+				 enum ctlra_event_type_t type,
+				 uint32_t control_id);
+
+#endif /* CTLRA_DESCRIBE_H */
@@ -79,6 +79,12 @@ struct cavtka_t {
 	/* ctlra id offsets for each event type */
 	uint32_t type_to_item_offset[CTLRA_EVENT_T_COUNT];
 
+	/* direct map from light id to item id, built at UI creation */
+	uint16_t *fb_id_to_item;
+	uint32_t fb_id_count;
+	/* lights changed since the last redraw */
+	uint8_t redraw_pending;
+
 	/* screen info */
 	struct avtka_screent_t screen[CTLRA_NUM_SCREENS_MAX];
 };
@@ -87,6 +93,11 @@ uint32_t
 avtka_poll(struct ctlra_dev_t *base)
 {
 	struct cavtka_t *dev = (struct cavtka_t *)base;
+	/* redraw here for apps that don't call light_flush() */
+	if(dev->redraw_pending) {
+		avtka_redraw(dev->a);
+		dev->redraw_pending = 0;
+	}
 	avtka_iterate(dev->a);
 	/* events can be "sent" to the app from the widget callbacks */
 	return 0;
@@ -102,20 +113,23 @@ avtka_light_set(struct ctlra_dev_t *base, uint32_t light_id,
 
 	uint32_t in = (light_status >> 24);
 
-	for(int i = 0; i < MAX_ITEMS; i++) {
-		if(dev->id_to_ctlra[i].fb_id == light_id) {
-			uint32_t mask = dev->id_to_ctlra[i].col;
-			uint32_t bw = in | (in << 8) | (in << 16);
-			uint32_t final_col = bw & mask;
-			/* support RGB leds individual channels */
-			if((mask & 0x00ffffff) == 0xffffff) {
-				final_col = 0x00ffffff & light_status;
-			}
-			avtka_item_colour32(a, i, final_col);
-			break;
-		}
+	if(light_id >= dev->fb_id_count)
+		return;
+	uint32_t i = dev->fb_id_to_item[light_id];
+	if(i == UINT16_MAX)
+		return;
+
+	uint32_t mask = dev->id_to_ctlra[i].col;
+	uint32_t bw = in | (in << 8) | (in << 16);
+	uint32_t final_col = bw & mask;
+	/* support RGB leds individual channels */
+	if((mask & 0x00ffffff) == 0xffffff) {
+		final_col = 0x00ffffff & light_status;
 	}
-	avtka_redraw(a);
+	avtka_item_colour32(a, i, final_col);
+
+	/* redraw once in light_flush(), not for every light */
+	dev->redraw_pending = 1;
 }
 
 void
@@ -128,6 +142,10 @@ void
 avtka_light_flush(struct ctlra_dev_t *base, uint32_t force)
 {
 	struct cavtka_t *dev = (struct cavtka_t *)base;
+	if(!dev->redraw_pending && !force)
+		return;
+	avtka_redraw(dev->a);
+	dev->redraw_pending = 0;
 }
 
 int32_t
@@ -135,6 +153,7 @@ avtka_disconnect(struct ctlra_dev_t *base)
 {
 	struct cavtka_t *dev = (struct cavtka_t *)base;
 	avtka_destroy(dev->a);
+	free(dev->fb_id_to_item);
 	free(dev);
 	return 0;
 }
@@ -272,6 +291,31 @@ struct avtka_t *
 ctlra_build_avtka_ui(struct cavtka_t *dev,
 		     const struct ctlra_dev_info_t *info);
 
+/* Build the light id to item map, so light_set() is a direct lookup.
+ * The first item with a light id wins, as the previous linear search */
+static int
+ctlra_avtka_fb_map_build(struct cavtka_t *dev)
+{
+	uint32_t max = 0;
+	for(int i = 0; i < MAX_ITEMS; i++) {
+		if(dev->id_to_ctlra[i].fb_id > max)
+			max = dev->id_to_ctlra[i].fb_id;
+	}
+
+	dev->fb_id_count = max + 1;
+	dev->fb_id_to_item = malloc(dev->fb_id_count * sizeof(uint16_t));
+	if(!dev->fb_id_to_item)
+		return -1;
+	memset(dev->fb_id_to_item, 0xff, dev->fb_id_count * sizeof(uint16_t));
+
+	for(int i = 0; i < MAX_ITEMS; i++) {
+		uint32_t fb_id = dev->id_to_ctlra[i].fb_id;
+		if(dev->fb_id_to_item[fb_id] == UINT16_MAX)
+			dev->fb_id_to_item[fb_id] = i;
+	}
+	return 0;
+}
+
 struct ctlra_dev_t *
 ctlra_avtka_connect(ctlra_event_func event_func, void *userdata,
 		    const void *future)
@@ -295,6 +339,7 @@ ctlra_avtka_connect(ctlra_event_func event_func, void *userdata,
 	dev->base.poll = avtka_poll;
 	dev->base.disconnect = avtka_disconnect;
 	dev->base.light_set = avtka_light_set;
+	dev->base.light_flush = avtka_light_flush;
 	dev->base.screen_get_data = avtka_screen_get_data;
 
 	dev->base.event_func = event_func;
@@ -305,6 +350,11 @@ ctlra_avtka_connect(ctlra_event_func event_func, void *userdata,
 	if(!dev->a)
 		goto fail;
 
+	if(ctlra_avtka_fb_map_build(dev)) {
+		avtka_destroy(dev->a);
+		goto fail;
+	}
+
 	CTLRA_INFO(dev->base.ctlra_context, "avtka based '%s' '%s' created\n",
 		   dev->base.info.vendor, dev->base.info.device);
 
@@ -370,7 +420,7 @@ ctlra_build_avtka_ui(struct cavtka_t *dev,
 		ctlra_avtka_string_strip(ai.name);
 
 		uint32_t idx = avtka_item_create(a, &ai);
-		if(idx > MAX_ITEMS) {
+		if(idx >= MAX_ITEMS) {
 			printf("CTLRA ERROR: > MAX ITEMS in AVTKA dev\n");
 			return 0;
 		}
@@ -408,7 +458,7 @@ ctlra_build_avtka_ui(struct cavtka_t *dev,
 		snprintf(ai.name, sizeof(ai.name), "%s", name);
 		ctlra_avtka_string_strip(ai.name);
 		uint32_t idx = avtka_item_create(a, &ai);
-		if(idx > MAX_ITEMS) {
+		if(idx >= MAX_ITEMS) {
 			printf("CTLRA ERROR: > MAX ITEMS in AVTKA dev\n");
 			return 0;
 		}
@@ -444,7 +494,7 @@ ctlra_build_avtka_ui(struct cavtka_t *dev,
 		snprintf(ai.name, sizeof(ai.name), "%s", name);
 		ctlra_avtka_string_strip(ai.name);
 		uint32_t idx = avtka_item_create(a, &ai);
-		if(idx > MAX_ITEMS) {
+		if(idx >= MAX_ITEMS) {
 			printf("CTLRA ERROR: > MAX ITEMS in AVTKA dev\n");
 			return 0;
 		}
@@ -476,7 +526,7 @@ ctlra_build_avtka_ui(struct cavtka_t *dev,
 			ctlra_item_scale(&ai);
 			//printf("grid %d: %d %d, %d %d\n", i, ai.x, ai.y, ai.w, ai.h);
 			uint32_t idx = avtka_item_create(a, &ai);
-			if(idx > MAX_ITEMS) {
+			if(idx >= MAX_ITEMS) {
 				printf("CTLRA ERROR: > MAX ITEMS in AVTKA dev\n");
 				return 0;
 			}
@@ -553,7 +603,7 @@ ctlra_build_avtka_ui(struct cavtka_t *dev,
 		//snprintf(ai.name, sizeof(ai.name), "%s", name);
 		ctlra_avtka_string_strip(ai.name);
 		uint32_t idx = avtka_item_create(a, &ai);
-		if(idx > MAX_ITEMS) {
+		if(idx >= MAX_ITEMS) {
 			printf("CTLRA ERROR: > MAX ITEMS in AVTKA dev\n");
 			return 0;
 		}
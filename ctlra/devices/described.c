@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "impl.h"
+#include "hid.h"
+#include "describe.h"
+
+#define USB_HANDLE_IDX (0x0)
+#define READ_SIZE      1024
+
+/* A controller driven by its description, see describe.h */
+struct described_t {
+	struct ctlra_dev_t base;
+	const struct ctlra_desc_t *desc;
+	struct ctlra_hid_plan_t *plan;
+	/* event storage for one report, plan->event_max entries */
+	struct ctlra_event_t *events;
+	struct ctlra_event_t **event_ptrs;
+	uint8_t read_buf[READ_SIZE];
+
+	/* light report: optional id byte, then desc->light_bytes */
+	uint8_t lights_dirty;
+	uint32_t lights_size;
+	uint8_t *lights_payload;
+	uint8_t lights[];
+};
+
+static uint32_t
+described_poll(struct ctlra_dev_t *base)
+{
+	struct described_t *dev = (struct described_t *)base;
+	/* a lights only device has nothing to read */
+	if(!dev->plan)
+		return 0;
+	ctlra_dev_impl_usb_interrupt_read(base, USB_HANDLE_IDX,
+					  dev->desc->endpoint_in,
+					  dev->read_buf, READ_SIZE);
+	return 0;
+}
+
+static void
+described_usb_read_cb(struct ctlra_dev_t *base, uint32_t endpoint,
+		      uint8_t *data, uint32_t size)
+{
+	struct described_t *dev = (struct described_t *)base;
+	(void)endpoint;
+
+	uint32_t count = ctlra_impl_hid_plan_decode(dev->plan, data, size,
+						    dev->events);
+	if(count && dev->base.event_func)
+		dev->base.event_func(&dev->base, count, dev->event_ptrs,
+				     dev->base.event_func_userdata);
+}
+
+static void
+described_light_set(struct ctlra_dev_t *base, uint32_t light_id,
+		    uint32_t light_status)
+{
+	struct described_t *dev = (struct described_t *)base;
+	if(light_id >= dev->desc->light_count)
+		return;
+
+	/* the device takes 7 bit values, like the NI controllers */
+	const struct ctlra_desc_light_t *l = &dev->desc->lights[light_id];
+	for(uint32_t i = 0; i < l->channel_count; i++) {
+		uint8_t v = 0;
+		switch(l->channels[i]) {
+		case 'i': v = (light_status >> 24) & 0x7F; break;
+		case 'r': v = ((light_status >> 16) & 0xFF) >> 1; break;
+		case 'g': v = ((light_status >>  8) & 0xFF) >> 1; break;
+		case 'b': v = ((light_status >>  0) & 0xFF) >> 1; break;
+		}
+		dev->lights_payload[l->byte + i] = v;
+	}
+	dev->lights_dirty = 1;
+}
+
+static void
+described_light_flush(struct ctlra_dev_t *base, uint32_t force)
+{
+	struct described_t *dev = (struct described_t *)base;
+	if(!dev->lights_size || (!dev->lights_dirty && !force))
+		return;
+
+	ctlra_dev_impl_usb_interrupt_write(base, USB_HANDLE_IDX,
+					   dev->desc->endpoint_out,
+					   dev->lights, dev->lights_size);
+	dev->lights_dirty = 0;
+}
+
+static int32_t
+described_disconnect(struct ctlra_dev_t *base)
+{
+	struct described_t *dev = (struct described_t *)base;
+
+	/* Turn off all lights */
+	if(dev->lights_size) {
+		memset(dev->lights_payload, 0,
+		       dev->lights_size - dev->desc->has_light_report);
+		if(!base->banished)
+			described_light_flush(base, 1);
+	}
+
+	ctlra_dev_impl_usb_close(base);
+	free(dev->plan);
+	free(dev->events);
+	free(dev->event_ptrs);
+	free(dev);
+	return 0;
+}
+
+struct ctlra_dev_t *
+ctlra_described_connect(ctlra_event_func event_func, void *userdata,
+			void *future)
+{
+	const struct ctlra_desc_t *desc = future;
+	if(!desc)
+		return 0;
+
+	uint32_t lights_size = desc->light_count ?
+			       desc->has_light_report + desc->light_bytes : 0;
+	struct described_t *dev = calloc(1, sizeof(struct described_t) +
+					 lights_size);
+	if(!dev)
+		return 0;
+
+	dev->desc = desc;
+	dev->base.info = desc->info;
+	dev->lights_size = lights_size;
+	if(lights_size) {
+		dev->lights[0] = desc->light_report;
+		dev->lights_payload = &dev->lights[desc->has_light_report];
+	}
+
+	dev->plan = ctlra_impl_hid_plan_build(desc->fields, desc->field_count,
+					      desc->has_report_id);
+	if(desc->field_count && !dev->plan)
+		goto fail;
+
+	uint32_t n = dev->plan ? dev->plan->event_max : 0;
+	dev->events = calloc(n + 1, sizeof(struct ctlra_event_t));
+	dev->event_ptrs = calloc(n + 1, sizeof(struct ctlra_event_t *));
+	if(!dev->events || !dev->event_ptrs)
+		goto fail;
+	for(uint32_t i = 0; i < n; i++)
+		dev->event_ptrs[i] = &dev->events[i];
+
+	int err = ctlra_dev_impl_usb_open(&dev->base, desc->info.vendor_id,
+					  desc->info.device_id);
+	if(err)
+		goto fail;
+
+	err = ctlra_dev_impl_usb_open_interface(&dev->base, desc->interface,
+						USB_HANDLE_IDX);
+	if(err)
+		goto fail;
+
+	dev->base.poll = described_poll;
+	dev->base.disconnect = described_disconnect;
+	dev->base.light_set = described_light_set;
+	dev->base.light_flush = described_light_flush;
+	dev->base.usb_read_cb = described_usb_read_cb;
+
+	dev->base.event_func = event_func;
+	dev->base.event_func_userdata = userdata;
+
+	return (struct ctlra_dev_t *)dev;
+fail:
+	free(dev->plan);
+	free(dev->events);
+	free(dev->event_ptrs);
+	free(dev);
+	return 0;
+}
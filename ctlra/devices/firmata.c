@@ -33,70 +33,250 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/stat.h>
 
 #include "impl.h"
 
-#include "firmata.h"
-
 #define CTLRA_DRIVER_VENDOR (0x0)
 #define CTLRA_DRIVER_DEVICE (0x0)
 
-#define CONTROLS_MAX 64
+/* Layout of an Arduino Uno running StandardFirmata: A0-A5 are reported
+ * as sliders, D2-D13 as buttons with the internal pullup enabled. D0 and
+ * D1 carry the serial link itself and are left alone. */
+#define FIRMATA_ANALOG_PINS  6
+#define FIRMATA_DIGITAL_FIRST 2
+#define FIRMATA_DIGITAL_PINS 12
+#define FIRMATA_PORTS        2
+
+/* Analog readings are 10 bit and jitter by a count or two; smaller
+ * changes than this are not reported. */
+#define FIRMATA_ANALOG_HYST  4
+
+/* Boards that reset on open (DTR) take ~1.6 seconds to boot before the
+ * version report arrives, boards that do not reply immediately. */
+#define FIRMATA_READY_MS     2500
+#define FIRMATA_BAUD         B57600
+
+#define FIRMATA_ANALOG_MSG   0xE0
+#define FIRMATA_DIGITAL_MSG  0x90
+#define FIRMATA_REPORT_ANALOG  0xC0
+#define FIRMATA_REPORT_DIGITAL 0xD0
+#define FIRMATA_SET_PIN_MODE 0xF4
+#define FIRMATA_VERSION      0xF9
+#define FIRMATA_SYSEX_START  0xF0
+#define FIRMATA_SYSEX_END    0xF7
+#define FIRMATA_PIN_PULLUP   0x0B
+
 #define LIGHTS_MAX 256
 
 struct firmata_t {
 	/* base handles usb i/o etc */
 	struct ctlra_dev_t base;
 
-	/* firmata instance */
-	t_firmata *firmata;
-	/* current value of each controller is stored here */
-	int hw_values[CONTROLS_MAX];
+	/* non-blocking tty the board is attached to */
+	int fd;
+
+	/* protocol parser state */
+	uint8_t cmd;
+	uint8_t data[2];
+	uint8_t data_count;
+	uint8_t in_sysex;
+	uint8_t ready;
+
+	/* latest state from the board, and the state last reported to the
+	 * application. Change detection compares the two in poll. */
+	uint16_t analog[FIRMATA_ANALOG_PINS];
+	uint16_t analog_sent[FIRMATA_ANALOG_PINS];
+	uint8_t analog_seen;
+	uint16_t ports[FIRMATA_PORTS];
+	uint16_t ports_sent[FIRMATA_PORTS];
+
 	/* current state of the lights, only flush on dirty */
 	uint8_t lights_dirty;
 	uint8_t lights[LIGHTS_MAX];
 };
 
+static const char *analog_names[] = {
+	"A0", "A1", "A2", "A3", "A4", "A5",
+};
+
+static const char *digital_names[] = {
+	"D2", "D3", "D4", "D5", "D6", "D7",
+	"D8", "D9", "D10", "D11", "D12", "D13",
+};
+
+static void
+firmata_parse_byte(struct firmata_t *dev, uint8_t b)
+{
+	if(b == FIRMATA_SYSEX_START) {
+		dev->in_sysex = 1;
+		return;
+	}
+	/* sysex carries the firmware name and capability replies, none
+	 * of which are needed to decode pin state */
+	if(dev->in_sysex) {
+		if(b == FIRMATA_SYSEX_END)
+			dev->in_sysex = 0;
+		return;
+	}
+
+	if(b & 0x80) {
+		dev->cmd = b;
+		dev->data_count = 0;
+		return;
+	}
+
+	/* every message we decode has two data bytes. The command byte is
+	 * kept, so running status is handled too */
+	if(!dev->cmd)
+		return;
+	dev->data[dev->data_count++] = b;
+	if(dev->data_count < 2)
+		return;
+	dev->data_count = 0;
+
+	uint16_t value = dev->data[0] | (dev->data[1] << 7);
+	uint8_t chan = dev->cmd & 0x0F;
+
+	if(dev->cmd == FIRMATA_VERSION) {
+		dev->ready = 1;
+		return;
+	}
+
+	switch(dev->cmd & 0xF0) {
+	case FIRMATA_ANALOG_MSG:
+		if(chan < FIRMATA_ANALOG_PINS) {
+			dev->analog[chan] = value;
+			dev->analog_seen |= 1 << chan;
+		}
+		break;
+	case FIRMATA_DIGITAL_MSG:
+		if(chan < FIRMATA_PORTS)
+			dev->ports[chan] = value;
+		break;
+	}
+}
+
+/* Reads everything the tty has buffered. With VMIN and VTIME at zero an
+ * empty tty reads 0 bytes, so a hangup is only visible through poll().
+ * Returns 0 when drained, or a negative errno on a read error. */
+static int32_t
+firmata_read(struct firmata_t *dev)
+{
+	uint8_t buf[256];
+	for(;;) {
+		ssize_t r = read(dev->fd, buf, sizeof(buf));
+		if(r > 0) {
+			for(ssize_t i = 0; i < r; i++)
+				firmata_parse_byte(dev, buf[i]);
+			continue;
+		}
+		if(r == 0)
+			return 0;
+		if(errno == EINTR)
+			continue;
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		return -errno;
+	}
+}
+
+static void
+firmata_write(struct firmata_t *dev, const uint8_t *msg, uint32_t size)
+{
+	/* config messages are a few bytes into an empty tx buffer, a short
+	 * write only happens if the board vanished which poll() catches */
+	ssize_t w = write(dev->fd, msg, size);
+	(void)w;
+}
+
+static void
+firmata_reporting_enable(struct firmata_t *dev)
+{
+	for(int i = 0; i < FIRMATA_DIGITAL_PINS; i++) {
+		uint8_t msg[] = {FIRMATA_SET_PIN_MODE,
+				 FIRMATA_DIGITAL_FIRST + i,
+				 FIRMATA_PIN_PULLUP};
+		firmata_write(dev, msg, sizeof(msg));
+	}
+	for(int i = 0; i < FIRMATA_ANALOG_PINS; i++) {
+		uint8_t msg[] = {FIRMATA_REPORT_ANALOG | i, 1};
+		firmata_write(dev, msg, sizeof(msg));
+	}
+	for(int i = 0; i < FIRMATA_PORTS; i++) {
+		uint8_t msg[] = {FIRMATA_REPORT_DIGITAL | i, 1};
+		firmata_write(dev, msg, sizeof(msg));
+	}
+}
+
 static uint32_t
 firmata_poll(struct ctlra_dev_t *base)
 {
 	struct firmata_t *dev = (struct firmata_t *)base;
 
-	int ret = firmata_pull(dev->firmata);
-	if(ret < 0) {
-		printf("banished = 1\n");
+	struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+	int p = poll(&pfd, 1, 0);
+	if(p <= 0)
+		return 0;
+	if((pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) ||
+	   firmata_read(dev) < 0) {
 		ctlra_dev_impl_banish(base);
+		return 0;
 	}
 
-#if 0
-	for(int i = 0; i < ret; i++)
-		printf("parse %d = %d\n", i, dev->firmata->parse_buff[i]);
-	for(int i = 14; i < 15; i++)
-		printf("%d: %d\n", i, dev->firmata->pins[i].value);
-#endif
-
-	for(int i = 0; i < 1; i++) {
-		int pin = 14 + i;
-		int v = dev->firmata->pins[pin].value;
-		/* TODO: concider rework debounce in micro-controller,
-		 * so no debounce required here? */
-		int pressed = v > 512;
-		int changed = dev->hw_values[i] != (pressed);
-		if(changed) {
-			struct ctlra_event_t events = {
-				.type = CTLRA_EVENT_BUTTON,
-				.button  = {
-					.id = i,
-					.pressed = v > 512
-				}
-			};
-			struct ctlra_event_t *e = {&events};
-			dev->base.event_func(&dev->base, 1, &e,
-					     dev->base.event_func_userdata);
-			dev->hw_values[i] = pressed;
-		}
+	struct ctlra_event_t events[FIRMATA_ANALOG_PINS +
+				    FIRMATA_DIGITAL_PINS];
+	struct ctlra_event_t *e[FIRMATA_ANALOG_PINS + FIRMATA_DIGITAL_PINS];
+	uint32_t count = 0;
+
+	for(int i = 0; i < FIRMATA_ANALOG_PINS; i++) {
+		if(!(dev->analog_seen & (1 << i)))
+			continue;
+		int32_t delta = dev->analog[i] - dev->analog_sent[i];
+		if(delta > -FIRMATA_ANALOG_HYST && delta < FIRMATA_ANALOG_HYST)
+			continue;
+		dev->analog_sent[i] = dev->analog[i];
+		events[count] = (struct ctlra_event_t) {
+			.type = CTLRA_EVENT_SLIDER,
+			.slider = {
+				.id = i,
+				.value = dev->analog[i] / 1023.f,
+			},
+		};
+		e[count] = &events[count];
+		count++;
+	}
+
+	for(int i = 0; i < FIRMATA_DIGITAL_PINS; i++) {
+		int pin = FIRMATA_DIGITAL_FIRST + i;
+		uint16_t bit = 1 << (pin & 7);
+		uint16_t now = dev->ports[pin >> 3] & bit;
+		if(now == (dev->ports_sent[pin >> 3] & bit))
+			continue;
+		dev->ports_sent[pin >> 3] ^= bit;
+		/* pullup inputs read low while the switch is closed */
+		events[count] = (struct ctlra_event_t) {
+			.type = CTLRA_EVENT_BUTTON,
+			.button = {
+				.id = i,
+				.pressed = !now,
+			},
+		};
+		e[count] = &events[count];
+		count++;
 	}
 
+	if(count && dev->base.event_func)
+		dev->base.event_func(&dev->base, count, e,
+				     dev->base.event_func_userdata);
+
 	return 0;
 }
 
@@ -118,8 +298,10 @@ firmata_light_set(struct ctlra_dev_t *base, uint32_t light_id,
 static const char *
 firmata_get_name(enum ctlra_event_type_t type, uint32_t control_id)
 {
-	if(type == CTLRA_EVENT_BUTTON && control_id == 0)
-		return "Footswitch";
+	if(type == CTLRA_EVENT_SLIDER && control_id < FIRMATA_ANALOG_PINS)
+		return analog_names[control_id];
+	if(type == CTLRA_EVENT_BUTTON && control_id < FIRMATA_DIGITAL_PINS)
+		return digital_names[control_id];
 	return "Invalid";
 }
 
@@ -142,12 +324,138 @@ firmata_disconnect(struct ctlra_dev_t *base)
 	if(!base->banished)
 		firmata_light_flush(base, 1);
 
-	printf("free firmata instance\n");
-
+	close(dev->fd);
 	free(dev);
 	return 0;
 }
 
+static int
+firmata_tty_open(const char *path)
+{
+	int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if(fd < 0)
+		return -1;
+
+	struct termios tio;
+	if(tcgetattr(fd, &tio)) {
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, FIRMATA_BAUD);
+	cfsetospeed(&tio, FIRMATA_BAUD);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	if(tcsetattr(fd, TCSANOW, &tio)) {
+		close(fd);
+		return -1;
+	}
+	tcflush(fd, TCIOFLUSH);
+	return fd;
+}
+
+static int64_t
+firmata_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Opens the tty and asks for the protocol version, sleeping in poll()
+ * until the board answers or the deadline passes. Returns 0 when a
+ * Firmata board is attached to *path*. */
+static int32_t
+firmata_port_try(struct firmata_t *dev, const char *path)
+{
+	dev->fd = firmata_tty_open(path);
+	if(dev->fd < 0)
+		return -errno;
+
+	const uint8_t query = FIRMATA_VERSION;
+	firmata_write(dev, &query, 1);
+
+	int64_t deadline = firmata_now_ms() + FIRMATA_READY_MS;
+	while(!dev->ready) {
+		int64_t left = deadline - firmata_now_ms();
+		if(left <= 0)
+			break;
+		struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+		int p = poll(&pfd, 1, left);
+		if(p < 0 && errno == EINTR)
+			continue;
+		if(p <= 0 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+			break;
+		if(firmata_read(dev))
+			break;
+	}
+
+	if(!dev->ready) {
+		close(dev->fd);
+		dev->fd = -1;
+		return -ETIMEDOUT;
+	}
+	return 0;
+}
+
+static int
+firmata_tty_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* USB serial adaptors show up in sysfs as ttyACM* (CDC, Leonardo and
+ * newer Unos) or ttyUSB* (FTDI and CH340 clones). Only entries backed
+ * by a device are candidates, which skips the virtual consoles. The
+ * CTLRA_FIRMATA_PORT environment variable overrides the scan. */
+static int32_t
+firmata_port_find(struct firmata_t *dev)
+{
+	const char *env = getenv("CTLRA_FIRMATA_PORT");
+	if(env)
+		return firmata_port_try(dev, env) ? -ENODEV : 0;
+
+	DIR *dir = opendir("/sys/class/tty");
+	if(!dir)
+		return -ENODEV;
+
+	char *names[32];
+	int count = 0;
+	struct dirent *d;
+	while((d = readdir(dir)) && count < 32) {
+		if(strncmp(d->d_name, "ttyACM", 6) &&
+		   strncmp(d->d_name, "ttyUSB", 6))
+			continue;
+		char link[300];
+		struct stat st;
+		snprintf(link, sizeof(link), "/sys/class/tty/%s/device",
+			 d->d_name);
+		if(stat(link, &st))
+			continue;
+		names[count] = strdup(d->d_name);
+		if(names[count])
+			count++;
+	}
+	closedir(dir);
+
+	qsort(names, count, sizeof(char *), firmata_tty_cmp);
+
+	int32_t ret = -ENODEV;
+	for(int i = 0; i < count; i++) {
+		char path[300];
+		snprintf(path, sizeof(path), "/dev/%s", names[i]);
+		if(ret && firmata_port_try(dev, path) == 0) {
+			snprintf(dev->base.info.serial,
+				 sizeof(dev->base.info.serial), "%s",
+				 names[i]);
+			ret = 0;
+		}
+		free(names[i]);
+	}
+	return ret;
+}
+
 struct ctlra_dev_info_t ctlra_firmata_info;
 
 struct ctlra_dev_t *
@@ -159,20 +467,20 @@ ctlra_firmata_connect(ctlra_event_func event_func,
 	if(!dev)
 		goto fail;
 
-	/* initialize the firmata instance */
-	/* TODO: make the device ttyXXXY dynamic */
-	dev->firmata = firmata_new("/dev/ttyUSB0");
-	if(!dev->firmata)
+	dev->fd = -1;
+	dev->base.info = ctlra_firmata_info;
+	if(firmata_port_find(dev))
 		goto fail;
 
-	/* TODO: how to make this be more elegant? */
-	int32_t timeout = 100000000;
-	while (!dev->firmata->isReady && timeout) {
-		int p = firmata_pull(dev->firmata);
-		timeout--;
+	/* buttons idle high with the pullups, sliders report their first
+	 * reading whatever it is */
+	for(int i = 0; i < FIRMATA_PORTS; i++) {
+		dev->ports[i] = 0xFF;
+		dev->ports_sent[i] = 0xFF;
 	}
-
-	dev->base.info = ctlra_firmata_info;
+	for(int i = 0; i < FIRMATA_ANALOG_PINS; i++)
+		dev->analog_sent[i] = 0xFFFF;
+	firmata_reporting_enable(dev);
 
 	dev->base.poll = firmata_poll;
 	dev->base.disconnect = firmata_disconnect;
@@ -195,7 +503,8 @@ struct ctlra_dev_info_t ctlra_firmata_info = {
 	.vendor_id = CTLRA_DRIVER_VENDOR,
 	.device_id = CTLRA_DRIVER_DEVICE,
 
-	.control_count[CTLRA_EVENT_SLIDER] = 1,
+	.control_count[CTLRA_EVENT_SLIDER] = FIRMATA_ANALOG_PINS,
+	.control_count[CTLRA_EVENT_BUTTON] = FIRMATA_DIGITAL_PINS,
 
 	.get_name = firmata_get_name,
 };
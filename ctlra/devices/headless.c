@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "impl.h"
+#include "headless.h"
+
+/* Events queued by ctlra_headless_event_push(), must be a power of 2 */
+#define HEADLESS_QUEUE_SIZE 256
+/* Max events passed to the application in one event_func call */
+#define HEADLESS_BATCH 32
+
+struct headless_script_event_t {
+	uint64_t poll;
+	struct ctlra_event_t event;
+};
+
+struct headless_screen_t {
+	uint8_t *pixels;
+	uint32_t bytes;
+};
+
+/* A device with the controls of any registered driver, but no hardware
+ * or UI attached. All feedback is written to plain memory. */
+struct ctlra_headless_t {
+	/* base handles usb i/o etc */
+	struct ctlra_dev_t base;
+
+	/* polls since the script was loaded */
+	uint64_t poll_count;
+
+	/* scripted events, sorted by poll */
+	struct headless_script_event_t *script;
+	uint32_t script_count;
+	uint32_t script_idx;
+	/* poll at which the script restarts, or 0 for no looping */
+	uint64_t script_loop;
+
+	/* single producer single consumer queue of pushed events */
+	struct ctlra_event_t queue[HEADLESS_QUEUE_SIZE];
+	uint32_t queue_head;
+	uint32_t queue_tail;
+
+	/* feedback state, indexed by light id / feedback id */
+	uint32_t light_count;
+	uint32_t *lights;
+	float *feedback;
+
+	uint64_t light_flushes;
+	uint64_t screen_flushes;
+	struct headless_screen_t screen[CTLRA_NUM_SCREENS_MAX];
+};
+
+static void
+headless_deliver(struct ctlra_headless_t *dev, struct ctlra_event_t *events,
+		 uint32_t num_events)
+{
+	struct ctlra_event_t *e[HEADLESS_BATCH];
+	for(uint32_t i = 0; i < num_events; i++)
+		e[i] = &events[i];
+	if(dev->base.event_func)
+		dev->base.event_func(&dev->base, num_events, e,
+				     dev->base.event_func_userdata);
+}
+
+static uint32_t
+headless_poll(struct ctlra_dev_t *base)
+{
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	struct ctlra_event_t events[HEADLESS_BATCH];
+	uint32_t n = 0;
+	uint32_t total = 0;
+
+	/* scripted events that are due on this poll */
+	while(dev->script_idx < dev->script_count &&
+	      dev->script[dev->script_idx].poll <= dev->poll_count) {
+		events[n++] = dev->script[dev->script_idx++].event;
+		if(n == HEADLESS_BATCH) {
+			headless_deliver(dev, events, n);
+			total += n;
+			n = 0;
+		}
+	}
+
+	dev->poll_count++;
+	if(dev->script_loop && dev->poll_count >= dev->script_loop) {
+		dev->poll_count = 0;
+		dev->script_idx = 0;
+	}
+
+	/* events pushed programmatically */
+	uint32_t tail = dev->queue_tail;
+	uint32_t head = __atomic_load_n(&dev->queue_head, __ATOMIC_ACQUIRE);
+	for(; tail != head; tail++) {
+		events[n++] = dev->queue[tail & (HEADLESS_QUEUE_SIZE - 1)];
+		if(n == HEADLESS_BATCH) {
+			headless_deliver(dev, events, n);
+			total += n;
+			n = 0;
+		}
+	}
+	__atomic_store_n(&dev->queue_tail, tail, __ATOMIC_RELEASE);
+
+	if(n)
+		headless_deliver(dev, events, n);
+
+	return total + n;
+}
+
+static void
+headless_light_set(struct ctlra_dev_t *base, uint32_t light_id,
+		   uint32_t light_status)
+{
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	if(light_id < dev->light_count)
+		dev->lights[light_id] = light_status;
+}
+
+static int32_t
+headless_grid_light_set(struct ctlra_dev_t *base, uint32_t grid_id,
+			uint32_t light_id, uint32_t light_status)
+{
+	if(grid_id >= CTLRA_NUM_GRIDS_MAX)
+		return -EINVAL;
+	/* grid lights start at params[0], as used by the AVTKA backend */
+	const struct ctlra_grid_info_t *gi = &base->info.grid_info[grid_id];
+	headless_light_set(base, gi->info.params[0] + light_id, light_status);
+	return 0;
+}
+
+static void
+headless_feedback_set(struct ctlra_dev_t *base, uint32_t fb_id, float value)
+{
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	if(fb_id < dev->light_count)
+		dev->feedback[fb_id] = value;
+}
+
+static void
+headless_light_flush(struct ctlra_dev_t *base, uint32_t force)
+{
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	dev->light_flushes++;
+}
+
+static int32_t
+headless_screen_get_data(struct ctlra_dev_t *base, uint32_t screen_idx,
+			 uint8_t **pixels, uint32_t *bytes,
+			 struct ctlra_screen_zone_t *zone, uint8_t flush)
+{
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+
+	if(screen_idx >= CTLRA_NUM_SCREENS_MAX)
+		return -2;
+
+	struct headless_screen_t *scr = &dev->screen[screen_idx];
+	if(!scr->pixels)
+		return -ENOTSUP;
+
+	if(flush) {
+		dev->screen_flushes++;
+		return 0;
+	}
+
+	if(!pixels || !bytes)
+		return -1;
+
+	*pixels = scr->pixels;
+	*bytes = scr->bytes;
+	return 0;
+}
+
+static void
+headless_script_free(struct ctlra_headless_t *dev)
+{
+	free(dev->script);
+	dev->script = 0;
+	dev->script_count = 0;
+	dev->script_idx = 0;
+	dev->script_loop = 0;
+}
+
+static int32_t
+headless_disconnect(struct ctlra_dev_t *base)
+{
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	headless_script_free(dev);
+	for(int i = 0; i < CTLRA_NUM_SCREENS_MAX; i++)
+		free(dev->screen[i].pixels);
+	free(dev->lights);
+	free(dev->feedback);
+	free(dev);
+	return 0;
+}
+
+static inline int
+headless_check(struct ctlra_dev_t *base)
+{
+	return base && base->poll == headless_poll;
+}
+
+int32_t
+ctlra_headless_event_push(struct ctlra_dev_t *base,
+			  const struct ctlra_event_t *event)
+{
+	if(!headless_check(base) || !event)
+		return -EINVAL;
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+
+	uint32_t head = dev->queue_head;
+	uint32_t tail = __atomic_load_n(&dev->queue_tail, __ATOMIC_ACQUIRE);
+	if(head - tail >= HEADLESS_QUEUE_SIZE)
+		return -ENOSPC;
+
+	dev->queue[head & (HEADLESS_QUEUE_SIZE - 1)] = *event;
+	__atomic_store_n(&dev->queue_head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static int
+headless_script_parse_line(char *line, struct headless_script_event_t *se,
+			   uint64_t *loop)
+{
+	char type[16];
+	unsigned long long poll;
+	uint32_t id;
+	char value[32];
+
+	/* skip comments and empty lines */
+	char *c = line;
+	while(*c == ' ' || *c == '\t')
+		c++;
+	if(*c == '#' || *c == '\n' || *c == '\0')
+		return 0;
+
+	int n = sscanf(c, "%llu %15s %u %31s", &poll, type, &id, value);
+	if(n == 2 && strcmp(type, "loop") == 0) {
+		*loop = poll;
+		return 0;
+	}
+	if(n != 4)
+		return -EINVAL;
+
+	memset(se, 0, sizeof(*se));
+	se->poll = poll;
+	float v = strtof(value, 0);
+	struct ctlra_event_t *e = &se->event;
+
+	if(strcmp(type, "button") == 0) {
+		e->type = CTLRA_EVENT_BUTTON;
+		e->button.id = id;
+		e->button.pressed = v > 0.f;
+	} else if(strcmp(type, "encoder") == 0) {
+		e->type = CTLRA_EVENT_ENCODER;
+		e->encoder.id = id;
+		if(strchr(value, '.')) {
+			e->encoder.flags = CTLRA_EVENT_ENCODER_FLAG_FLOAT;
+			e->encoder.delta_float = v;
+		} else {
+			e->encoder.flags = CTLRA_EVENT_ENCODER_FLAG_INT;
+			e->encoder.delta = (int32_t)v;
+		}
+	} else if(strcmp(type, "slider") == 0) {
+		e->type = CTLRA_EVENT_SLIDER;
+		e->slider.id = id;
+		e->slider.value = v;
+	} else if(strcmp(type, "grid") == 0) {
+		e->type = CTLRA_EVENT_GRID;
+		e->grid.id = 0;
+		e->grid.pos = id;
+		e->grid.flags = CTLRA_EVENT_GRID_FLAG_BUTTON |
+				CTLRA_EVENT_GRID_FLAG_PRESSURE;
+		e->grid.pressed = v > 0.f;
+		e->grid.pressure = v;
+	} else {
+		return -EINVAL;
+	}
+
+	return 1;
+}
+
+int32_t
+ctlra_headless_script_load(struct ctlra_dev_t *base, const char *path)
+{
+	if(!headless_check(base) || !path)
+		return -EINVAL;
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	struct ctlra_t *ctlra = base->ctlra_context;
+
+	FILE *f = fopen(path, "r");
+	if(!f) {
+		CTLRA_ERROR(ctlra, "failed to open script %s\n", path);
+		return -ENOENT;
+	}
+
+	struct headless_script_event_t *script = 0;
+	uint32_t count = 0;
+	uint32_t size = 0;
+	uint64_t loop = 0;
+	int32_t ret = 0;
+	uint32_t line_no = 0;
+	char line[256];
+
+	while(fgets(line, sizeof(line), f)) {
+		line_no++;
+		struct headless_script_event_t se;
+		int r = headless_script_parse_line(line, &se, &loop);
+		if(r < 0) {
+			CTLRA_ERROR(ctlra, "%s:%u: invalid script line\n",
+				    path, line_no);
+			ret = r;
+			goto out;
+		}
+		if(r == 0)
+			continue;
+
+		if(count && se.poll < script[count-1].poll) {
+			CTLRA_ERROR(ctlra, "%s:%u: poll goes backwards\n",
+				    path, line_no);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		if(count == size) {
+			size = size ? size * 2 : 64;
+			void *tmp = realloc(script, size * sizeof(*script));
+			if(!tmp) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			script = tmp;
+		}
+		script[count++] = se;
+	}
+
+	headless_script_free(dev);
+	dev->script = script;
+	dev->script_count = count;
+	dev->script_loop = loop;
+	dev->poll_count = 0;
+	script = 0;
+	CTLRA_INFO(ctlra, "loaded %u scripted events from %s\n", count, path);
+out:
+	free(script);
+	fclose(f);
+	return ret;
+}
+
+int32_t
+ctlra_headless_light_get(struct ctlra_dev_t *base, uint32_t light_id,
+			 uint32_t *light_status)
+{
+	if(!headless_check(base) || !light_status)
+		return -EINVAL;
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	if(light_id >= dev->light_count)
+		return -EINVAL;
+	*light_status = dev->lights[light_id];
+	return 0;
+}
+
+int32_t
+ctlra_headless_feedback_get(struct ctlra_dev_t *base, uint32_t fb_id,
+			    float *value)
+{
+	if(!headless_check(base) || !value)
+		return -EINVAL;
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	if(fb_id >= dev->light_count)
+		return -EINVAL;
+	*value = dev->feedback[fb_id];
+	return 0;
+}
+
+int32_t
+ctlra_headless_flush_count_get(struct ctlra_dev_t *base,
+			       uint64_t *light_flushes,
+			       uint64_t *screen_flushes)
+{
+	if(!headless_check(base))
+		return -EINVAL;
+	struct ctlra_headless_t *dev = (struct ctlra_headless_t *)base;
+	if(light_flushes)
+		*light_flushes = dev->light_flushes;
+	if(screen_flushes)
+		*screen_flushes = dev->screen_flushes;
+	return 0;
+}
+
+/* The number of light ids used by the device, from the info struct */
+static uint32_t
+headless_light_count(const struct ctlra_dev_info_t *info)
+{
+	uint32_t max = 0;
+	for(int t = 0; t < CTLRA_EVENT_T_COUNT; t++) {
+		if(t == CTLRA_EVENT_GRID || !info->control_info[t])
+			continue;
+		for(uint32_t i = 0; i < info->control_count[t]; i++) {
+			const struct ctlra_item_info_t *item =
+				&info->control_info[t][i];
+			if(item->fb_id > max)
+				max = item->fb_id;
+			/* LED strips use a range of light ids */
+			if((item->flags & CTLRA_ITEM_FB_LED_STRIP) &&
+			   item->params[1] > max)
+				max = item->params[1];
+		}
+	}
+	for(uint32_t g = 0; g < info->control_count[CTLRA_EVENT_GRID] &&
+			    g < CTLRA_NUM_GRIDS_MAX; g++) {
+		const struct ctlra_grid_info_t *gi = &info->grid_info[g];
+		uint32_t end = gi->info.params[0] + gi->x * gi->y;
+		if(end > max)
+			max = end;
+	}
+	return max + 1;
+}
+
+static int
+headless_screens_create(struct ctlra_headless_t *dev,
+			const struct ctlra_dev_info_t *info)
+{
+	const struct ctlra_item_info_t *items =
+		info->control_info[CTLRA_FEEDBACK_ITEM];
+	if(!items)
+		return 0;
+
+	int screen_idx = 0;
+	for(uint32_t i = 0; i < info->control_count[CTLRA_FEEDBACK_ITEM]; i++) {
+		if(!(items[i].flags & CTLRA_ITEM_FB_SCREEN))
+			continue;
+		if(screen_idx >= CTLRA_NUM_SCREENS_MAX)
+			break;
+
+		/* params[2] is bits per pixel, screens that leave it unset
+		 * are RGB 565 */
+		uint32_t bpp = items[i].params[2] ? items[i].params[2] : 16;
+		uint32_t bytes = items[i].params[0] * items[i].params[1] *
+				 bpp / 8;
+		/* one extra byte, see over-run check in screen redraw */
+		dev->screen[screen_idx].pixels = calloc(1, bytes + 1);
+		if(!dev->screen[screen_idx].pixels)
+			return -ENOMEM;
+		dev->screen[screen_idx].bytes = bytes;
+		screen_idx++;
+	}
+	return 0;
+}
+
+struct ctlra_dev_t *
+ctlra_headless_connect(ctlra_event_func event_func, void *userdata,
+		       void *future)
+{
+	static uint32_t instance_count;
+
+	const struct ctlra_dev_info_t *info = future;
+	if(!info)
+		return 0;
+
+	struct ctlra_headless_t *dev = calloc(1, sizeof(struct ctlra_headless_t));
+	if(!dev)
+		goto fail;
+
+	/* reuse the existing info from the device backend, then update */
+	dev->base.info = *info;
+	uint32_t instance = instance_count++;
+	snprintf(dev->base.info.serial, sizeof(dev->base.info.serial),
+		 "headless-%u", instance);
+	dev->base.info.serial_number = instance;
+
+	dev->light_count = headless_light_count(info);
+	dev->lights = calloc(dev->light_count, sizeof(uint32_t));
+	dev->feedback = calloc(dev->light_count, sizeof(float));
+	if(!dev->lights || !dev->feedback)
+		goto fail;
+
+	if(headless_screens_create(dev, info))
+		goto fail;
+
+	dev->base.poll = headless_poll;
+	dev->base.disconnect = headless_disconnect;
+	dev->base.light_set = headless_light_set;
+	dev->base.grid_light_set = headless_grid_light_set;
+	dev->base.feedback_set = headless_feedback_set;
+	dev->base.light_flush = headless_light_flush;
+	dev->base.screen_get_data = headless_screen_get_data;
+
+	dev->base.event_func = event_func;
+	dev->base.event_func_userdata = userdata;
+
+	return (struct ctlra_dev_t *)dev;
+fail:
+	if(dev)
+		headless_disconnect(&dev->base);
+	return 0;
+}
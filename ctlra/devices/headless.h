@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OPENAV_CTLRA_HEADLESS_H
+#define OPENAV_CTLRA_HEADLESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+struct ctlra_dev_t;
+struct ctlra_event_t;
+
+/* The headless backend virtualizes any registered device without a UI.
+ * Feedback from the application is stored in plain memory, where it can
+ * be inspected, and input events are injected programmatically or from a
+ * script file. Create instances with *ctlra_dev_virtualize_headless*.
+ *
+ * The functions below only operate on headless devices, and return
+ * -EINVAL when passed any other device.
+ */
+
+/** Queue an event, delivered to the application on the next poll of the
+ * device. May be called from one thread other than the one that calls
+ * ctlra_idle_iter(), eg: a load-generator thread.
+ * @retval 0 Event queued
+ * @retval -ENOSPC The event queue is full
+ */
+int32_t ctlra_headless_event_push(struct ctlra_dev_t *dev,
+				  const struct ctlra_event_t *event);
+
+/** Load a script of events. Each line is a poll number (counted from
+ * when the script is loaded) followed by the event, eg:
+ *
+ *     # poll  type     id   value
+ *     0       button   3    1
+ *     2       button   3    0
+ *     4       slider   0    0.75
+ *     4       encoder  1    -2
+ *     5       encoder  0    0.01
+ *     8       grid     12   0.8
+ *     16      loop
+ *
+ * Encoder values containing a '.' are sent as float deltas. A grid value
+ * above zero presses the pad with that pressure, zero releases it. The
+ * optional *loop* line restarts the script at that poll.
+ * @retval 0 Script loaded, replacing any previous script
+ * @retval <0 Error opening or parsing the file
+ */
+int32_t ctlra_headless_script_load(struct ctlra_dev_t *dev,
+				   const char *path);
+
+/** Retrieve the last light_status set for *light_id* */
+int32_t ctlra_headless_light_get(struct ctlra_dev_t *dev,
+				 uint32_t light_id,
+				 uint32_t *light_status);
+
+/** Retrieve the last value set for feedback item *fb_id* */
+int32_t ctlra_headless_feedback_get(struct ctlra_dev_t *dev,
+				    uint32_t fb_id,
+				    float *value);
+
+/** Retrieve the number of light flushes and screen flushes performed */
+int32_t ctlra_headless_flush_count_get(struct ctlra_dev_t *dev,
+				       uint64_t *light_flushes,
+				       uint64_t *screen_flushes);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* OPENAV_CTLRA_HEADLESS_H */
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "impl.h"
+#include "hid.h"
+
+#define CTLRA_DRIVER_VENDOR (0x0)
+#define CTLRA_DRIVER_DEVICE (0x0)
+#define USB_HANDLE_IDX     (0x0)
+
+/* interrupt reads are at least a full speed packet, so a report larger
+ * than the descriptor promises does not overflow the transfer */
+#define HID_READ_MIN 64
+#define HID_READ_MAX CTLRA_HID_REPORT_MAX
+
+/* usages of application collections that must stay with the kernel */
+#define HID_PAGE_DESKTOP  0x01
+#define HID_USAGE_MOUSE   0x02
+#define HID_USAGE_KEYBOARD 0x06
+#define HID_USAGE_KEYPAD  0x07
+#define HID_PAGE_FIDO     0xF1D0
+
+/* Represents any HID controller, driven by its report descriptor */
+struct hid_generic_t {
+	struct ctlra_dev_t base;
+	uint8_t endpoint;
+	uint32_t read_size;
+	uint8_t read_buf[HID_READ_MAX];
+	struct ctlra_hid_plan_t *plan;
+	/* event storage for one report, plan->event_max entries */
+	struct ctlra_event_t *events;
+	struct ctlra_event_t **event_ptrs;
+};
+
+static uint32_t
+hid_generic_poll(struct ctlra_dev_t *base)
+{
+	struct hid_generic_t *dev = (struct hid_generic_t *)base;
+	ctlra_dev_impl_usb_interrupt_read(base, USB_HANDLE_IDX,
+					  dev->endpoint, dev->read_buf,
+					  dev->read_size);
+	return 0;
+}
+
+static void
+hid_generic_usb_read_cb(struct ctlra_dev_t *base, uint32_t endpoint,
+			uint8_t *data, uint32_t size)
+{
+	struct hid_generic_t *dev = (struct hid_generic_t *)base;
+	(void)endpoint;
+
+	uint32_t count = ctlra_impl_hid_plan_decode(dev->plan, data, size,
+						    dev->events);
+	if(count && dev->base.event_func)
+		dev->base.event_func(&dev->base, count, dev->event_ptrs,
+				     dev->base.event_func_userdata);
+}
+
+static void
+hid_generic_light_set(struct ctlra_dev_t *base, uint32_t light_id,
+		      uint32_t light_status)
+{
+	/* output reports are not mapped to lights */
+	(void)base;
+	(void)light_id;
+	(void)light_status;
+}
+
+static int32_t
+hid_generic_disconnect(struct ctlra_dev_t *base)
+{
+	struct hid_generic_t *dev = (struct hid_generic_t *)base;
+	ctlra_dev_impl_usb_close(base);
+	free(dev->plan);
+	free(dev->events);
+	free(dev->event_ptrs);
+	free(dev);
+	return 0;
+}
+
+static int
+hid_generic_plan_usable(const struct ctlra_hid_plan_t *plan)
+{
+	if(plan->app_usage_page == HID_PAGE_FIDO)
+		return 0;
+	if(plan->app_usage_page == HID_PAGE_DESKTOP &&
+	   (plan->app_usage == HID_USAGE_MOUSE ||
+	    plan->app_usage == HID_USAGE_KEYBOARD ||
+	    plan->app_usage == HID_USAGE_KEYPAD))
+		return 0;
+	return 1;
+}
+
+struct ctlra_dev_info_t ctlra_hid_generic_info;
+
+struct ctlra_dev_t *
+ctlra_hid_generic_connect(ctlra_event_func event_func, void *userdata,
+			  void *future)
+{
+	struct ctlra_hid_generic_future_t *hid = future;
+	if(!hid)
+		return 0;
+
+	/* reject before claiming the interface: devices that are not used
+	 * keep their kernel driver */
+	struct ctlra_hid_plan_t *plan =
+		ctlra_impl_hid_plan_create(hid->desc, hid->desc_size);
+	if(!plan || !hid_generic_plan_usable(plan) ||
+	   plan->report_bytes > HID_READ_MAX) {
+		free(plan);
+		return 0;
+	}
+
+	struct hid_generic_t *dev = calloc(1, sizeof(struct hid_generic_t));
+	if(!dev)
+		goto fail;
+	dev->plan = plan;
+	dev->endpoint = hid->endpoint;
+	dev->base.ctlra_context = hid->ctlra;
+
+	uint32_t n = plan->event_max;
+	dev->events = calloc(n, sizeof(struct ctlra_event_t));
+	dev->event_ptrs = calloc(n, sizeof(struct ctlra_event_t *));
+	if(!dev->events || !dev->event_ptrs)
+		goto fail;
+	for(uint32_t i = 0; i < n; i++)
+		dev->event_ptrs[i] = &dev->events[i];
+
+	dev->read_size = plan->report_bytes;
+	if(dev->read_size < HID_READ_MIN)
+		dev->read_size = HID_READ_MIN;
+
+	int err = ctlra_dev_impl_usb_open(&dev->base, hid->vid, hid->pid);
+	if(err)
+		goto fail;
+
+	err = ctlra_dev_impl_usb_open_interface(&dev->base, hid->interface,
+						USB_HANDLE_IDX);
+	if(err)
+		goto fail;
+
+	/* keep the USB ids and serial that usb_open filled in */
+	struct ctlra_dev_info_t usb = dev->base.info;
+	dev->base.info = ctlra_hid_generic_info;
+	dev->base.info.vendor_id = usb.vendor_id;
+	dev->base.info.device_id = usb.device_id;
+	dev->base.info.serial_number = usb.serial_number;
+	memcpy(dev->base.info.serial, usb.serial, sizeof(usb.serial));
+	if(hid->vendor[0])
+		snprintf(dev->base.info.vendor, sizeof(dev->base.info.vendor),
+			 "%s", hid->vendor);
+	if(hid->device[0])
+		snprintf(dev->base.info.device, sizeof(dev->base.info.device),
+			 "%s", hid->device);
+	dev->base.info.control_count[CTLRA_EVENT_BUTTON] = plan->buttons;
+	dev->base.info.control_count[CTLRA_EVENT_SLIDER] = plan->sliders;
+	dev->base.info.control_count[CTLRA_EVENT_ENCODER] = plan->encoders;
+
+	dev->base.poll = hid_generic_poll;
+	dev->base.disconnect = hid_generic_disconnect;
+	dev->base.light_set = hid_generic_light_set;
+	dev->base.usb_read_cb = hid_generic_usb_read_cb;
+
+	dev->base.event_func = event_func;
+	dev->base.event_func_userdata = userdata;
+
+	return (struct ctlra_dev_t *)dev;
+fail:
+	free(plan);
+	if(dev) {
+		free(dev->events);
+		free(dev->event_ptrs);
+	}
+	free(dev);
+	return 0;
+}
+
+struct ctlra_dev_info_t ctlra_hid_generic_info = {
+	.vendor    = "HID",
+	.device    = "Generic Controller",
+	.vendor_id = CTLRA_DRIVER_VENDOR,
+	.device_id = CTLRA_DRIVER_DEVICE,
+};
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "impl.h"
+#include "jog_wheel.h"
+
+/* USB full-speed interrupt endpoints report at most every 1 ms */
+#define JOG_PERIOD_INIT_NS 1000000.
+#define JOG_PERIOD_MIN_NS   250000.
+#define JOG_PERIOD_MAX_NS 20000000.
+#define JOG_STOP_NS_DEFAULT 20000000ull
+
+void
+ctlra_jog_wheel_init(struct ctlra_jog_wheel_t *jw, uint32_t raw_range,
+		     uint32_t counts_per_turn)
+{
+	memset(jw, 0, sizeof(*jw));
+	jw->raw_range = raw_range;
+	jw->counts_per_turn = counts_per_turn;
+	jw->period_ns = JOG_PERIOD_INIT_NS;
+}
+
+static void
+jog_wheel_publish(struct ctlra_jog_wheel_t *jw)
+{
+	uint32_t seq = jw->seq;
+	__atomic_store_n(&jw->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	jw->pub.position = jw->x;
+	jw->pub.velocity = jw->v;
+	jw->pub.touched = jw->touched;
+	jw->pub.time_ns = jw->t_ns;
+	/* extrapolate up to when the next report is late */
+	jw->pub_horizon_ns = 2 * jw->period_ns;
+	jw->pub_stop_ns = jw->stop_ns;
+	__atomic_store_n(&jw->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int32_t
+ctlra_jog_wheel_config(struct ctlra_jog_wheel_t *jw,
+		       const struct ctlra_jog_wheel_opts_t *opts)
+{
+	if(!opts) {
+		__atomic_store_n(&jw->enabled, 0, __ATOMIC_RELEASE);
+		return 0;
+	}
+	if(!(opts->alpha > 0.f && opts->alpha <= 1.f) ||
+	   !(opts->beta > 0.f && opts->beta < 2.f))
+		return -EINVAL;
+
+	jw->alpha = opts->alpha;
+	jw->beta = opts->beta;
+	jw->stop_ns = opts->stop_ms ? opts->stop_ms * 1000000ull :
+		      JOG_STOP_NS_DEFAULT;
+	/* restart the estimate on the next report */
+	jw->t_ns = 0;
+	jw->x = jw->counts / (double)jw->counts_per_turn;
+	jw->v = 0;
+	jog_wheel_publish(jw);
+	__atomic_store_n(&jw->enabled, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+uint64_t
+ctlra_jog_wheel_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int32_t
+ctlra_jog_wheel_update(struct ctlra_jog_wheel_t *jw, uint32_t raw,
+		       uint64_t now_ns)
+{
+	/* wrap the counter difference into +/- half its range. Signed, as
+	 * an unsigned modulo is only right for power of two ranges */
+	int32_t delta = 0;
+	if(jw->raw_valid) {
+		int64_t range = jw->raw_range;
+		int64_t d = ((int64_t)raw - jw->raw_last) % range;
+		if(d >= range / 2)
+			d -= range;
+		else if(d < -range / 2)
+			d += range;
+		delta = d;
+	}
+	jw->raw_last = raw;
+	jw->raw_valid = 1;
+	jw->counts += delta;
+
+	if(!jw->enabled)
+		return delta;
+
+	double meas = jw->counts / (double)jw->counts_per_turn;
+
+	/* first report, or first after the wheel stopped: restart */
+	if(jw->t_ns == 0 ||
+	   (now_ns > jw->t_ns && now_ns - jw->t_ns > jw->stop_ns)) {
+		jw->t_ns = now_ns;
+		jw->x = meas;
+		jw->v = 0;
+		jog_wheel_publish(jw);
+		return delta;
+	}
+
+	/* Delay-locked loop: reports are read in bursts, so the time a
+	 * report is handled jitters. Track the report period, and move the
+	 * expected report time only part way to the measured time. A
+	 * report that is much later than expected resynchronizes. */
+	double expect = jw->t_ns + jw->period_ns;
+	double err = (double)now_ns - expect;
+	uint64_t t;
+	if(err > 4 * jw->period_ns) {
+		t = now_ns;
+	} else {
+		t = expect + err * 0.125;
+		jw->period_ns += err * 0.01;
+		if(jw->period_ns < JOG_PERIOD_MIN_NS)
+			jw->period_ns = JOG_PERIOD_MIN_NS;
+		if(jw->period_ns > JOG_PERIOD_MAX_NS)
+			jw->period_ns = JOG_PERIOD_MAX_NS;
+	}
+	if(t <= jw->t_ns)
+		t = jw->t_ns + JOG_PERIOD_MIN_NS;
+	double dt = (t - jw->t_ns) * 1e-9;
+	jw->t_ns = t;
+
+	/* alpha-beta filter */
+	double x = jw->x + jw->v * dt;
+	double r = meas - x;
+	jw->x = x + jw->alpha * r;
+	jw->v = jw->v + (jw->beta / dt) * r;
+
+	jog_wheel_publish(jw);
+	return delta;
+}
+
+void
+ctlra_jog_wheel_touch(struct ctlra_jog_wheel_t *jw, int touched,
+		      uint64_t now_ns)
+{
+	if(jw->touched == !!touched)
+		return;
+	jw->touched = !!touched;
+	if(!jw->enabled || !jw->t_ns)
+		return;
+
+	/* a hand landing on the wheel stops or redirects it: restart the
+	 * estimate at the touch, rather than extrapolate the old speed */
+	if(touched) {
+		jw->t_ns = now_ns;
+		jw->x = jw->counts / (double)jw->counts_per_turn;
+		jw->v = 0;
+	}
+	jog_wheel_publish(jw);
+}
+
+int32_t
+ctlra_jog_wheel_read(struct ctlra_jog_wheel_t *jw, uint64_t now_ns,
+		     struct ctlra_jog_wheel_state_t *state)
+{
+	if(!__atomic_load_n(&jw->enabled, __ATOMIC_ACQUIRE))
+		return -EINVAL;
+
+	struct ctlra_jog_wheel_state_t s;
+	uint64_t horizon, stop;
+	for(;;) {
+		uint32_t s1 = __atomic_load_n(&jw->seq, __ATOMIC_ACQUIRE);
+		if(s1 & 1)
+			continue;
+		s = jw->pub;
+		horizon = jw->pub_horizon_ns;
+		stop = jw->pub_stop_ns;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(s1 == __atomic_load_n(&jw->seq, __ATOMIC_RELAXED))
+			break;
+	}
+
+	if(now_ns && s.time_ns && now_ns > s.time_ns) {
+		uint64_t elapsed = now_ns - s.time_ns;
+		if(elapsed > stop) {
+			/* no report for a while: the wheel stands still */
+			s.velocity = 0.f;
+		} else {
+			if(elapsed > horizon)
+				elapsed = horizon;
+			s.position += s.velocity * (elapsed * 1e-9);
+			s.time_ns += elapsed;
+		}
+	}
+
+	*state = s;
+	return 0;
+}
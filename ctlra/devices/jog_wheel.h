@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OPENAV_CTLRA_JOG_WHEEL_H
+#define OPENAV_CTLRA_JOG_WHEEL_H
+
+#include <stdint.h>
+
+#include "ctlra.h"
+
+/* Jog wheel motion estimate, shared by drivers with jog wheels. The
+ * driver calls update() with the raw wrapping counter of the wheel for
+ * every USB report that contains it, and touch() when the touch sensor
+ * of the wheel changes. update() returns the movement in counts since
+ * the previous report, for the encoder event of the wheel. Touching the
+ * wheel restarts the estimate at rest, from the time of the touch.
+ *
+ * While enabled, the report times are smoothed by a delay-locked loop,
+ * which removes the jitter of reports being handled in bursts, and an
+ * alpha-beta filter estimates position and velocity. The estimate is
+ * published under a seqlock, so read() can run on the audio thread. */
+
+struct ctlra_jog_wheel_t {
+	/* raw counter decoding, always active */
+	uint32_t raw_range;
+	uint32_t counts_per_turn;
+	uint32_t raw_last;
+	uint8_t raw_valid;
+	int64_t counts;
+
+	uint8_t enabled;
+	uint8_t touched;
+	float alpha;
+	float beta;
+	uint64_t stop_ns;
+
+	/* smoothed time of the last report, and the report period */
+	uint64_t t_ns;
+	double period_ns;
+
+	/* filter state, in turns and turns per second */
+	double x;
+	double v;
+
+	/* published estimate, written under seq */
+	uint32_t seq;
+	struct ctlra_jog_wheel_state_t pub;
+	uint64_t pub_horizon_ns;
+	uint64_t pub_stop_ns;
+};
+
+void ctlra_jog_wheel_init(struct ctlra_jog_wheel_t *jw, uint32_t raw_range,
+			  uint32_t counts_per_turn);
+
+/* Apply options from ctlra_dev_jog_wheel_config(), NULL disables */
+int32_t ctlra_jog_wheel_config(struct ctlra_jog_wheel_t *jw,
+			       const struct ctlra_jog_wheel_opts_t *opts);
+
+/* Current time in CLOCK_MONOTONIC nanoseconds, to pass to update() and
+ * touch(): take it once per report */
+uint64_t ctlra_jog_wheel_now(void);
+
+int32_t ctlra_jog_wheel_update(struct ctlra_jog_wheel_t *jw, uint32_t raw,
+			       uint64_t now_ns);
+
+void ctlra_jog_wheel_touch(struct ctlra_jog_wheel_t *jw, int touched,
+			   uint64_t now_ns);
+
+/* Safe to call from any thread while the driver updates the wheel */
+int32_t ctlra_jog_wheel_read(struct ctlra_jog_wheel_t *jw, uint64_t now_ns,
+			     struct ctlra_jog_wheel_state_t *state);
+
+#endif /* OPENAV_CTLRA_JOG_WHEEL_H */
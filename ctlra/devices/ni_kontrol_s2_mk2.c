@@ -29,6 +29,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
@@ -36,6 +37,7 @@
 
 #include "ni_kontrol_s2_mk2.h"
 #include "impl.h"
+#include "jog_wheel.h"
 
 #define CTLRA_DRIVER_VENDOR (0x17cc)
 #define CTLRA_DRIVER_DEVICE (0x1320)
@@ -379,16 +381,16 @@ static struct ctlra_item_info_t encoders_info[] = {
 /* 8 cue buttons with RGB each, 8 brightness only */
 #define LED_DECK_COUNT (8*3 + 8)
 
+#define JOG_WHEEL_COUNT 2
+#define JOG_COUNTS_PER_TURN 1024
+
 /* Represents the the hardware device */
 struct ni_kontrol_s2_mk2_t {
 	/* base handles usb i/o etc */
 	struct ctlra_dev_t base;
 	/* current value of each controller is stored here */
 	float hw_values[CONTROLS_SIZE];
-	uint8_t jog_wheels[2];
-	uint8_t jog_wheels_value[2];
-	uint32_t jog_wheels_quadrant[2];
-	uint32_t jog_wheels_1024_value[2];
+	struct ctlra_jog_wheel_t jog_wheels[JOG_WHEEL_COUNT];
 	/* current values for stepped encoders */
 	uint8_t encoder_values[ENCODER_COUNT];
 	/* current state of the lights, only flush on dirty */
@@ -447,41 +449,22 @@ void ni_kontrol_s2_mk2_usb_read_cb(struct ctlra_dev_t *base, uint32_t endpoint,
 
 	switch(size) {
 	case 17: { /* buttons and jog wheels */
-		const uint8_t jog_offset[2] = {1, 5};
-		for(int i = 0; i < 2; i++) {
-			/* Algorithm works, but can be improved for readability and
-			 * efficiency. PRs welcome :) */
-			uint8_t new_pos = buf[jog_offset[i]];
-			if(new_pos != dev->jog_wheels[i]) {
-				/* detect 255 based wrap */
-				int32_t diff = new_pos - dev->jog_wheels[i];
-				dev->jog_wheels_quadrant[i] -= (diff > 200);
-				dev->jog_wheels_quadrant[i] += (diff < -200);
-
-				dev->jog_wheels_value[i] += diff;
-
-				/* calculate 1024 based "full circle" value */
-				int nv = (255 * (dev->jog_wheels_quadrant[i] % 4))
-					+ dev->jog_wheels_value[i];
-				dev->jog_wheels[i] = new_pos;
-
-				int delta_1024 = dev->jog_wheels_1024_value[i] - nv;
-				dev->jog_wheels_1024_value[i] = nv;
-
-				/* handle 1024 based value wrap */
-				if(delta_1024 > 800)
-					delta_1024 -= 1024;
-				if(delta_1024 < -800)
-					delta_1024 += 1024;
-
-				float delta_01 = delta_1024 / 1024.f;
-
+		const uint8_t jog_offset[JOG_WHEEL_COUNT] = {1, 5};
+		const uint64_t now = ctlra_jog_wheel_now();
+		for(int i = 0; i < JOG_WHEEL_COUNT; i++) {
+			/* the wheel counter wraps 4 times per turn */
+			int32_t delta = ctlra_jog_wheel_update(&dev->jog_wheels[i],
+							buf[jog_offset[i]], now);
+			/* touch sensors of the wheel tops, byte 10 */
+			ctlra_jog_wheel_touch(&dev->jog_wheels[i],
+					      buf[10] & (1 << i), now);
+			if(delta) {
 				struct ctlra_event_t event = {
 					.type = CTLRA_EVENT_ENCODER,
 					.encoder  = {
 						.id = i,
 						.flags = CTLRA_EVENT_ENCODER_FLAG_FLOAT,
-						.delta_float = -delta_01,
+						.delta_float = delta / (float)JOG_COUNTS_PER_TURN,
 					}
 				};
 				struct ctlra_event_t *e = {&event};
@@ -627,6 +610,30 @@ ni_kontrol_s2_mk2_light_flush(struct ctlra_dev_t *base, uint32_t force)
 
 }
 
+static int32_t
+ni_kontrol_s2_mk2_jog_wheel_config(struct ctlra_dev_t *base,
+				   const struct ctlra_jog_wheel_opts_t *opts)
+{
+	struct ni_kontrol_s2_mk2_t *dev = (struct ni_kontrol_s2_mk2_t *)base;
+	for(int i = 0; i < JOG_WHEEL_COUNT; i++) {
+		int32_t ret = ctlra_jog_wheel_config(&dev->jog_wheels[i], opts);
+		if(ret)
+			return ret;
+	}
+	return 0;
+}
+
+static int32_t
+ni_kontrol_s2_mk2_jog_wheel_read(struct ctlra_dev_t *base, uint32_t wheel_id,
+				 uint64_t now_ns,
+				 struct ctlra_jog_wheel_state_t *state)
+{
+	struct ni_kontrol_s2_mk2_t *dev = (struct ni_kontrol_s2_mk2_t *)base;
+	if(wheel_id >= JOG_WHEEL_COUNT)
+		return -EINVAL;
+	return ctlra_jog_wheel_read(&dev->jog_wheels[wheel_id], now_ns, state);
+}
+
 static int32_t
 ni_kontrol_s2_mk2_disconnect(struct ctlra_dev_t *base)
 {
@@ -677,6 +684,12 @@ ctlra_ni_kontrol_s2_mk2_connect(ctlra_event_func event_func,
 	dev->base.light_set = ni_kontrol_s2_mk2_light_set;
 	dev->base.light_flush = ni_kontrol_s2_mk2_light_flush;
 	dev->base.usb_read_cb = ni_kontrol_s2_mk2_usb_read_cb;
+	dev->base.jog_wheel_config = ni_kontrol_s2_mk2_jog_wheel_config;
+	dev->base.jog_wheel_read = ni_kontrol_s2_mk2_jog_wheel_read;
+
+	for(int i = 0; i < JOG_WHEEL_COUNT; i++)
+		ctlra_jog_wheel_init(&dev->jog_wheels[i], 256,
+				     JOG_COUNTS_PER_TURN);
 
 	dev->base.event_func = event_func;
 	dev->base.event_func_userdata = userdata;
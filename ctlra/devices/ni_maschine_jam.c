@@ -434,6 +434,9 @@ void ni_machine_jam_usb_read_cb(struct ctlra_dev_t *base, uint32_t endpoint,
 	struct ni_maschine_jam_t *dev = (struct ni_maschine_jam_t *)base;
 	switch(size) {
 	case 49: {
+		/* touchstrips only, skip when sliders are masked out */
+		if(!ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_SLIDER))
+			break;
 		static uint8_t old[49];
 		int i = 49;
 		int do_lights = 0;
@@ -508,7 +511,10 @@ void ni_machine_jam_usb_read_cb(struct ctlra_dev_t *base, uint32_t endpoint,
 			},
 		};
 		struct ctlra_event_t *e = {&event};
-		for(int r = 0; r < 8; r++) {
+		/* Skip decoding sections the application has masked out */
+		const int want_grid =
+			ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_GRID);
+		for(int r = 0; want_grid && r < 8; r++) {
 			uint16_t d = *(uint16_t *)&data[4+r];// & 0x3fc;
 			/* columns */
 			for(int c = 0; c < 6; c++) {
@@ -543,7 +549,9 @@ void ni_machine_jam_usb_read_cb(struct ctlra_dev_t *base, uint32_t endpoint,
 		}
 
 		/* buttons */
-		for(uint32_t i = 0; i < BUTTONS_SIZE; i++) {
+		const int want_buttons =
+			ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_BUTTON);
+		for(uint32_t i = 0; want_buttons && i < BUTTONS_SIZE; i++) {
 			int id     = buttons[i].event_id;
 			int offset = buttons[i].buf_byte_offset;
 			int mask   = buttons[i].mask;
@@ -579,7 +587,9 @@ void ni_machine_jam_usb_read_cb(struct ctlra_dev_t *base, uint32_t endpoint,
 
 		/* encoder */
 		uint8_t encoder_now = (data[1] & 0xf);
-		if(dev->encoder != encoder_now) {
+		if(!ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_ENCODER)) {
+			dev->encoder = encoder_now;
+		} else if(dev->encoder != encoder_now) {
 			int dir = ctlra_dev_encoder_wrap_16(encoder_now,
 							    dev->encoder);
 			dev->encoder = encoder_now;
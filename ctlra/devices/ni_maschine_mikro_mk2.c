@@ -30,6 +30,7 @@
 */
 
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -47,6 +48,7 @@
 
 #include "ni_maschine_mikro_mk2.h"
 #include "impl.h"
+#include "pad_filter.h"
 
 #define CTLRA_DRIVER_VENDOR (0x17cc)
 #define CTLRA_DRIVER_DEVICE (0x1200)
@@ -200,10 +202,6 @@ static struct ctlra_item_info_t feedback_info[] = {
 #define LIGHTS_SIZE (80)
 
 #define NPADS                  (16)
-/* KERNEL_LENGTH must be a power of 2 for masking */
-#define KERNEL_LENGTH          (8)
-#define KERNEL_MASK            (KERNEL_LENGTH-1)
-#define PAD_SENSITIVITY        (650)
 /* Screen: 1 byte endpoint, 8 bytes header, 256 bytes binary data */
 #define SCREEN_XFER_SIZE (1 + 8 + 256)
 
@@ -224,10 +222,7 @@ struct ni_maschine_mikro_mk2_t {
 	/* Store the current encoder value */
 	uint8_t encoder_value;
 	/* Pressure filtering for note-onset detection */
-	uint8_t pad_idx[NPADS];
-	uint16_t pads[NPADS];
-	uint16_t pad_avg[NPADS];
-	uint16_t pad_pressures[NPADS*KERNEL_LENGTH];
+	struct ctlra_pad_filter_t pad_filter;
 
 	uint8_t screen_data[SCREEN_XFER_SIZE*4];
 };
@@ -254,17 +249,27 @@ static uint32_t ni_maschine_mikro_mk2_poll(struct ctlra_dev_t *base)
 void
 ni_maschine_mikro_mk2_light_flush(struct ctlra_dev_t *base, uint32_t force);
 
-typedef uint16_t elem_type;
-
-int compare(const void *f1, const void *f2)
-{
-	return ( *(elem_type*)f1 > *(elem_type*)f2) ? 1 : -1;
-}
+/* The pads are noisy, and report continuously: smooth the readings, and
+ * keep a wide hysteresis between the on and off thresholds */
+static const struct ctlra_grid_pad_opts_t pad_defaults = {
+	.smoothing = 0.5f,
+	.on_threshold = 550 / 4096.f,
+	.off_threshold = 100 / 4096.f,
+	.velocity_full = 0.45f,
+	.velocity_curve = 1.5f,
+};
 
-elem_type qsort_median(elem_type * array, int n)
+static int32_t
+ni_maschine_mikro_mk2_grid_pad_config(struct ctlra_dev_t *base,
+				      uint32_t grid_id, uint32_t square,
+				      const struct ctlra_grid_pad_opts_t *opts)
 {
-	qsort(array, n, sizeof(elem_type), compare);
-	return array[n/2];
+	struct ni_maschine_mikro_mk2_t *dev =
+		(struct ni_maschine_mikro_mk2_t *)base;
+	if(grid_id != 0)
+		return -EINVAL;
+	/* grid squares are numbered in pad report order */
+	return ctlra_pad_filter_config(&dev->pad_filter, square, opts);
 }
 
 void
@@ -284,21 +289,19 @@ ni_maschine_mikro_mk2_usb_read_cb(struct ctlra_dev_t *base,
 
 		switch(nbytes) {
 		case 65: {
+			uint16_t raw[NPADS];
 			int i;
-			for (i = 0; i < NPADS; i++) {
-				uint16_t new = ((data[i*2+2] & 0xf) << 8) |
-						 data[i*2+1];
+			for (i = 0; i < NPADS; i++)
+				raw[i] = ((data[i*2+2] & 0xf) << 8) | data[i*2+1];
 
-				uint8_t idx = dev->pad_idx[i]++ & KERNEL_MASK;
-
-				uint16_t total = 0;
-				for(int j = 0; j < KERNEL_LENGTH; j++) {
-					int idx = i*KERNEL_LENGTH + j;
-					total += dev->pad_pressures[idx];
-				}
+			uint16_t pressed, released;
+			ctlra_pad_filter_run(&dev->pad_filter, raw,
+					     &pressed, &released);
+			uint16_t changed = pressed | released;
 
-				dev->pad_avg[i] = total / KERNEL_LENGTH;
-				dev->pad_pressures[i*KERNEL_LENGTH + idx] = new;
+			for (i = 0; changed; i++, changed >>= 1) {
+				if(!(changed & 1))
+					continue;
 
 				struct ctlra_event_t event = {
 					.type = CTLRA_EVENT_GRID,
@@ -311,34 +314,17 @@ ni_maschine_mikro_mk2_usb_read_cb(struct ctlra_dev_t *base,
 				};
 				struct ctlra_event_t *e = {&event};
 
-				uint16_t med = qsort_median(
-					&dev->pad_pressures[i*KERNEL_LENGTH],
-					KERNEL_LENGTH);
-
-				if(med > 550 && dev->pads[i] == 0) {
-					/* TODO: improve velocity linearity */
-					float velo = (med - 550) / 3500.f;
-					float v2 = velo * velo * velo * velo;
-					float fin = (velo - v2) * 3;
-					fin = fin > 1.0f ? 1.0f : fin;
-					fin = fin < 0.0f ? 0.0f : fin;
-					e->grid.pressure = fin;
-					dev->base.event_func(&dev->base, 1, &e,
-					                     dev->base.event_func_userdata);
-					dev->lights[NI_MASCHINE_MIKRO_MK2_LED_PAD_1+3+i*3] = 0x7f;
-					dev->lights_dirty = 1;
-					ni_maschine_mikro_mk2_light_flush(&dev->base, 1);
-					dev->pads[i] = 2000;
-				} else if(med < 100 && dev->pads[i] > 0) {
-					dev->lights[NI_MASCHINE_MIKRO_MK2_LED_PAD_1+3+i*3] = 0;
-					dev->lights_dirty = 1;
-					ni_maschine_mikro_mk2_light_flush(&dev->base, 1);
-					dev->pads[i] = 0;
-					event.grid.pressed = 0;
-					event.grid.pressure = 0.f;
-					dev->base.event_func(&dev->base, 1, &e,
-					                     dev->base.event_func_userdata);
-				}
+				int press = (pressed >> i) & 1;
+				event.grid.pressed = press;
+				event.grid.pressure = press ?
+					dev->pad_filter.velocity[i] : 0.f;
+				dev->base.event_func(&dev->base, 1, &e,
+						     dev->base.event_func_userdata);
+
+				dev->lights[NI_MASCHINE_MIKRO_MK2_LED_PAD_1+3+i*3] =
+					press ? 0x7f : 0;
+				dev->lights_dirty = 1;
+				ni_maschine_mikro_mk2_light_flush(&dev->base, 1);
 			}
 		}
 		break;
@@ -562,6 +548,8 @@ ctlra_ni_maschine_mikro_mk2_connect(ctlra_event_func event_func,
 	if(!dev)
 		goto fail;
 
+	ctlra_pad_filter_init(&dev->pad_filter, &pad_defaults);
+
 	int err = ctlra_dev_impl_usb_open(&dev->base,
 					  CTLRA_DRIVER_VENDOR,
 					  CTLRA_DRIVER_DEVICE);
@@ -602,6 +590,7 @@ ctlra_ni_maschine_mikro_mk2_connect(ctlra_event_func event_func,
 	dev->base.disconnect = ni_maschine_mikro_mk2_disconnect;
 	dev->base.light_set = ni_maschine_mikro_mk2_light_set;
 	dev->base.light_flush = ni_maschine_mikro_mk2_light_flush;
+	dev->base.grid_pad_config = ni_maschine_mikro_mk2_grid_pad_config;
 	dev->base.screen_get_data = ni_maschine_mikro_mk2_screen_get_data;
 
 	dev->base.event_func = event_func;
@@ -31,6 +31,7 @@
 */
 
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -42,6 +43,8 @@
 
 #include "ni_maschine_mikro_mk3.h"
 #include "impl.h"
+#include "pad_filter.h"
+#include "pad_pressure.h"
 
 // Uncomment to debug pad on/off
 //#define CTLRA_MIKRO_MK3_PADS 1
@@ -160,9 +163,6 @@ static const struct ni_maschine_mikro_mk3_ctlra_t buttons[] = {
 #define LIGHTS_SIZE (80)
 
 #define NPADS                  (16)
-/* KERNEL_LENGTH must be a power of 2 for masking */
-#define KERNEL_LENGTH          (8)
-#define KERNEL_MASK            (KERNEL_LENGTH-1)
 
 static const uint8_t pad_idx_light_mapping[] = {
     NI_MASCHINE_MIKRO_MK3_LED_PAD1,
@@ -216,9 +216,10 @@ struct ni_maschine_mikro_mk3_t
 	uint8_t encoder_value, encoder_init;
 	uint16_t touchstrip_value;
 	/* Pressure filtering for note-onset detection */
-	uint16_t pad_hit;
-	uint16_t pad_idx[NPADS];
-	uint16_t pad_pressures[NPADS * KERNEL_LENGTH];
+	struct ctlra_pad_filter_t pad_filter;
+	uint16_t pad_raw[NPADS];
+	/* Optional continuous pressure stream */
+	struct ctlra_pad_pressure_t pressure;
 
 	struct ni_screen_t screen_top;
 	struct ni_screen_t screen_bottom;
@@ -269,11 +270,9 @@ ni_maschine_mikro_mk3_pads_decode_set(struct ni_maschine_mikro_mk3_t *dev,
 	};
 	struct ctlra_event_t *e = {&event};
 
-	/* pre-process pressed pads into bitmask. Keep state from before,
-	 * the messages will update only those that have changed */
-	uint16_t pad_pressures[16] = {0};
-	uint16_t rpt_pressed = dev->pad_hit;
-	int flush_lights = 0;
+	/* Update the raw readings of the pads listed in this set. Keep
+	 * readings from before, the messages only list pads that changed */
+	uint16_t pad_listed = 0;
 	uint8_t d1, d2;
 	int i;
 	for(i = 0; i < 16; i++) {
@@ -285,49 +284,56 @@ ni_maschine_mikro_mk3_pads_decode_set(struct ni_maschine_mikro_mk3_t *dev,
 		/* pad number is zero when list of pads has ended */
 		if(p == 0 && d1 == 0)
 			break;
+		if(p >= NPADS)
+			continue;
 
-		/* software threshold for gentle release */
-		uint16_t pressure = ((d1 & 0xf) << 8) | d2;
-		if(pressure > 128)
-			rpt_pressed |= 1 << p;
-		else
-			rpt_pressed &= ~(1 << p);
-
-		/* store pressure value for setting in event later */
-		pad_pressures[p] = pressure;
+		dev->pad_raw[p] = ((d1 & 0xf) << 8) | d2;
+		pad_listed |= 1 << p;
 	}
 
+	/* thresholds with hysteresis decide press and release */
+	uint16_t pressed, released;
+	ctlra_pad_filter_run(&dev->pad_filter, dev->pad_raw,
+			     &pressed, &released);
+
 	for(int i = 0; i < 16; i++) {
-		/* detect state change */
-		int current = (dev->pad_hit & (1 << i));
-		int new     = (rpt_pressed  & (1 << i));
+		uint16_t bit = 1 << i;
+		int state_change = ((pressed | released) & bit) != 0;
+		int held = (dev->pad_filter.held & bit) != 0;
 
 #ifdef CTLRA_MIKRO_MK3_PRESSURE_DEBUG
-        int state_change = (current != new);
-		int pressure_change = pad_pressures[i] != dev->pad_pressures[i];
-
-		printf("[msg_idx:%d]: pad %2d state (CH %d, V %d) pressure(CH %d, V %d)\n",
-		       msg_idx, i, state_change, new > 0, pressure_change,
-		       pad_pressures[i]);
+		printf("[msg_idx:%d]: pad %2d state (CH %d, V %d) listed %d pressure %d\n",
+		       msg_idx, i, state_change, held, (pad_listed & bit) != 0,
+		       dev->pad_raw[i]);
 #endif
 
-		/* Pressure value */
-		if(current == new) {
+		/* rotate grid to match order on device (but zero
+		 * based counting instead of 1 based). */
+		int pos = (3-(i/4))*4 + (i%4);
+
+		/* Pressure value: only pads listed in this set have a
+		 * new reading, stream it if the pad is held */
+		if(!state_change) {
+			if(held && (pad_listed & bit))
+				ctlra_pad_pressure_sample(&dev->pressure,
+					msg_idx, i, pos,
+					dev->pad_raw[i] * (1 / 4096.f));
 			continue;
 		}
 
-		/* rotate grid to match order on device (but zero
-		 * based counting instead of 1 based). */
-		event.grid.pos = (3-(i/4))*4 + (i%4);
-		int press = new > 0;
+		event.grid.pos = pos;
+		int press = (pressed & bit) != 0;
 		event.grid.pressed = press;
-		event.grid.pressure = pad_pressures[i] * (1 / 4096.f) * press;
+		event.grid.pressure = press ? dev->pad_filter.velocity[i] : 0.f;
 
+		/* keep pressure events ordered before the press/release */
+		ctlra_pad_pressure_flush(&dev->pressure, &dev->base);
 		dev->base.event_func(&dev->base, 1, &e,
 				     dev->base.event_func_userdata);
+		if(press)
+			ctlra_pad_pressure_hit(&dev->pressure, msg_idx, i,
+					       dev->pad_raw[i] * (1 / 4096.f));
 	}
-
-	dev->pad_hit = rpt_pressed;
 }
 
 static void
@@ -368,17 +374,23 @@ ni_maschine_mikro_mk3_pads(struct ni_maschine_mikro_mk3_t *dev,
 	}
 	printf("\n");
 #endif
-	/* call for Set A, then again for set B */
+	/* call for Set A, then again for set B. Both sets are used for
+	 * the pressure stream, doubling its time resolution */
+	ctlra_pad_pressure_report_begin(&dev->pressure);
 	ni_maschine_mikro_mk3_pads_decode_set(dev, &buf[0], 0);
 	ni_maschine_mikro_mk3_pads_decode_set(dev, &buf[64], 1);
+	ctlra_pad_pressure_flush(&dev->pressure, &dev->base);
 };
 
 void ni_maschine_mikro_mk3_decode_button(struct ni_maschine_mikro_mk3_t *dev,
         uint8_t *data) {
     uint8_t *buf = data;
+    struct ctlra_dev_t *base = &dev->base;
 
+    /* Skip decoding sections the application has masked out */
     uint16_t v = buf[10] | (buf[11] << 8);
-    if (v && v != dev->touchstrip_value) {
+    if (ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_SLIDER) &&
+        v && v != dev->touchstrip_value) {
         struct ctlra_event_t event = {
                 .type = CTLRA_EVENT_SLIDER,
                 .slider = {
@@ -393,7 +405,8 @@ void ni_maschine_mikro_mk3_decode_button(struct ni_maschine_mikro_mk3_t *dev,
     }
 
     /* Buttons */
-    for (uint32_t i = 0; i < BUTTONS_SIZE; i++) {
+    int want_buttons = ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_BUTTON);
+    for (uint32_t i = 0; want_buttons && i < BUTTONS_SIZE; i++) {
         int id = buttons[i].event_id;
         int offset = buttons[i].buf_byte_offset;
         int mask = buttons[i].mask;
@@ -420,8 +433,11 @@ void ni_maschine_mikro_mk3_decode_button(struct ni_maschine_mikro_mk3_t *dev,
     /* Main Encoder */
     int8_t enc = buf[7] & 0x0f;
 
-    /* Skip first event, it will be always send */
-    if (!dev->encoder_init) {
+    /* Skip first event, it will be always send. Reinitialize when
+     * unmasked, instead of sending all movement while masked at once */
+    if (!ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_ENCODER)) {
+        dev->encoder_init = 0;
+    } else if (!dev->encoder_init) {
         dev->encoder_value = enc;
         dev->encoder_init = 1;
     } else if (enc != dev->encoder_value) {
@@ -464,7 +480,8 @@ ni_maschine_mikro_mk3_usb_read_cb(struct ctlra_dev_t *base,
         /* Looks like after pressing pads, sometimes this message is being sent, it contains single 64 byte message for pad and 14 byte message for buttons */
         case 78: {
             ni_maschine_mikro_mk3_decode_button(dev, buf + 64);
-            ni_maschine_mikro_mk3_pads_decode_set(dev, &buf[0], 0);
+            if(ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_GRID))
+                ni_maschine_mikro_mk3_pads_decode_set(dev, &buf[0], 0);
         } break;
             /* Return of LED state, after update written to device */
         case 81: {
@@ -473,7 +490,8 @@ ni_maschine_mikro_mk3_usb_read_cb(struct ctlra_dev_t *base,
             }
         } break;
         case 128:
-            ni_maschine_mikro_mk3_pads(dev, data);
+            if(ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_GRID))
+                ni_maschine_mikro_mk3_pads(dev, data);
             break;
         case 14:
             ni_maschine_mikro_mk3_decode_button(dev, buf);
@@ -554,6 +572,41 @@ static void ni_maschine_mikro_mk3_light_set(struct ctlra_dev_t *base,
 	}
 }
 
+/* The pads report only changes, and are quiet at rest: no smoothing,
+ * and a small threshold for gentle releases */
+static const struct ctlra_grid_pad_opts_t pad_defaults = {
+	.smoothing = 0.f,
+	.on_threshold = 128.5f / 4096.f,
+	.off_threshold = 128.5f / 4096.f,
+	.velocity_full = 1.f,
+	.velocity_curve = 1.f,
+};
+
+static int32_t
+ni_maschine_mikro_mk3_grid_pad_config(struct ctlra_dev_t *base, uint32_t grid_id,
+      			   uint32_t square,
+      			   const struct ctlra_grid_pad_opts_t *opts)
+{
+	struct ni_maschine_mikro_mk3_t *dev = (struct ni_maschine_mikro_mk3_t *)base;
+	if(grid_id != 0)
+		return -EINVAL;
+	/* the grid is rotated from the pad report order, see decode */
+	if(square != CTLRA_GRID_SQUARE_ALL && square < NPADS)
+		square = (3-(square/4))*4 + (square%4);
+	return ctlra_pad_filter_config(&dev->pad_filter, square, opts);
+}
+
+static int32_t
+ni_maschine_mikro_mk3_grid_pressure_stream(struct ctlra_dev_t *base, uint32_t grid_id,
+			const struct ctlra_grid_pressure_opts_t *opts)
+{
+	struct ni_maschine_mikro_mk3_t *dev = (struct ni_maschine_mikro_mk3_t *)base;
+	/* only one grid, the 16 pads */
+	if(grid_id != 0)
+		return -EINVAL;
+	return ctlra_pad_pressure_config(&dev->pressure, grid_id, opts);
+}
+
 void
 ni_maschine_mikro_mk3_light_flush(struct ctlra_dev_t *base, uint32_t force)
 {
@@ -632,6 +685,8 @@ ctlra_ni_maschine_mikro_mk3_connect(ctlra_event_func event_func,
 	if(!dev)
 		goto fail;
 
+	ctlra_pad_filter_init(&dev->pad_filter, &pad_defaults);
+
 	int err = ctlra_dev_impl_usb_open(&dev->base,
 					  CTLRA_DRIVER_VENDOR,
 					  CTLRA_DRIVER_DEVICE);
@@ -672,6 +727,8 @@ ctlra_ni_maschine_mikro_mk3_connect(ctlra_event_func event_func,
 	dev->base.disconnect = ni_maschine_mikro_mk3_disconnect;
 	dev->base.light_set = ni_maschine_mikro_mk3_light_set;
 	dev->base.light_flush = ni_maschine_mikro_mk3_light_flush;
+	dev->base.grid_pressure_stream = ni_maschine_mikro_mk3_grid_pressure_stream;
+	dev->base.grid_pad_config = ni_maschine_mikro_mk3_grid_pad_config;
 
 	dev->base.event_func = event_func;
 	dev->base.event_func_userdata = userdata;
@@ -30,6 +30,7 @@
 */
 
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -40,6 +41,8 @@
 #include <sys/time.h>
 
 #include "impl.h"
+#include "pad_filter.h"
+#include "pad_pressure.h"
 
 // Uncomment to debug pad on/off
 //#define CTLRA_MK3_PADS 1
@@ -387,9 +390,6 @@ static struct ctlra_item_info_t encoder_info[] = {
 #define LIGHTS_PADS_SIZE (80)
 
 #define NPADS                  (16)
-/* KERNEL_LENGTH must be a power of 2 for masking */
-#define KERNEL_LENGTH          (8)
-#define KERNEL_MASK            (KERNEL_LENGTH-1)
 
 
 /* TODO: Refactor out screen impl, and push to ctlra_ni_screen.h ? */
@@ -451,9 +451,10 @@ struct ni_maschine_mk3_t {
 	uint16_t touchstrip_value, touchstrip_init;
 	/* Pressure filtering for note-onset detection */
 	uint64_t pad_last_msg_time;
-	uint16_t pad_hit;
-	uint16_t pad_idx[NPADS];
-	uint16_t pad_pressures[NPADS*KERNEL_LENGTH];
+	struct ctlra_pad_filter_t pad_filter;
+	uint16_t pad_raw[NPADS];
+	/* Optional continuous pressure stream */
+	struct ctlra_pad_pressure_t pressure;
 
 	struct ni_screen_t screen_left;
 	struct ni_screen_t screen_right;
@@ -513,11 +514,9 @@ ni_maschine_mk3_pads_decode_set(struct ni_maschine_mk3_t *dev,
 	};
 	struct ctlra_event_t *e = {&event};
 
-	/* pre-process pressed pads into bitmask. Keep state from before,
-	 * the messages will update only those that have changed */
-	uint16_t pad_pressures[16] = {0};
-	uint16_t rpt_pressed = dev->pad_hit;
-	int flush_lights = 0;
+	/* Update the raw readings of the pads listed in this set. Keep
+	 * readings from before, the messages only list pads that changed */
+	uint16_t pad_listed = 0;
 	uint8_t d1, d2;
 	int i;
 	for(i = 0; i < 16; i++) {
@@ -529,51 +528,56 @@ ni_maschine_mk3_pads_decode_set(struct ni_maschine_mk3_t *dev,
 		/* pad number is zero when list of pads has ended */
 		if(p == 0 && d1 == 0)
 			break;
+		if(p >= NPADS)
+			continue;
 
-		/* software threshold for gentle release */
-		uint16_t pressure = ((d1 & 0xf) << 8) | d2;
-		if(pressure > 128)
-			rpt_pressed |= 1 << p;
-		else
-			rpt_pressed &= ~(1 << p);
-
-		/* store pressure value for setting in event later */
-		pad_pressures[p] = pressure;
+		dev->pad_raw[p] = ((d1 & 0xf) << 8) | d2;
+		pad_listed |= 1 << p;
 	}
 
-	for(int i = 0; i < 16; i++) {
-		/* detect state change */
-		int current = (dev->pad_hit & (1 << i));
-		int new     = (rpt_pressed  & (1 << i));
+	/* thresholds with hysteresis decide press and release */
+	uint16_t pressed, released;
+	ctlra_pad_filter_run(&dev->pad_filter, dev->pad_raw,
+			     &pressed, &released);
 
-		int state_change = (current != new);
-		int pressure_change = pad_pressures[i] != dev->pad_pressures[i];
+	for(int i = 0; i < 16; i++) {
+		uint16_t bit = 1 << i;
+		int state_change = ((pressed | released) & bit) != 0;
+		int held = (dev->pad_filter.held & bit) != 0;
 
 #ifdef CTLRA_MK3_PRESSURE_DEBUG
-		printf("[msg_idx:%d]: pad %2d state (CH %d, V %d) pressure(CH %d, V %d)\n",
-		       msg_idx, i, state_change, new > 0, pressure_change,
-		       pad_pressures[i]);
+		printf("[msg_idx:%d]: pad %2d state (CH %d, V %d) listed %d pressure %d\n",
+		       msg_idx, i, state_change, held, (pad_listed & bit) != 0,
+		       dev->pad_raw[i]);
 #endif
 
-		/* Pressure value */
-		if(current == new) {
+		/* Pressure value: only pads listed in this set have a
+		 * new reading, stream it if the pad is held */
+		if(!state_change) {
+			if(held && (pad_listed & bit))
+				ctlra_pad_pressure_sample(&dev->pressure,
+					msg_idx, i, i,
+					dev->pad_raw[i] * (1 / 4096.f));
 			continue;
 		}
 
 		event.grid.pos = i;
-		int press = new > 0;
+		int press = (pressed & bit) != 0;
 		event.grid.pressed = press;
-		event.grid.pressure = pad_pressures[i] * (1 / 4096.f) * press;
+		event.grid.pressure = press ? dev->pad_filter.velocity[i] : 0.f;
 
+		/* keep pressure events ordered before the press/release */
+		ctlra_pad_pressure_flush(&dev->pressure, &dev->base);
 		dev->base.event_func(&dev->base, 1, &e,
 				     dev->base.event_func_userdata);
+		if(press)
+			ctlra_pad_pressure_hit(&dev->pressure, msg_idx, i,
+					       dev->pad_raw[i] * (1 / 4096.f));
 #ifdef CTLRA_MK3_PADS
 		dev->lights_pads[25+i] = dev->pad_colour * event.grid.pressed;
 		ni_maschine_mk3_light_flush(&dev->base, 1);
 #endif
 	}
-
-	dev->pad_hit = rpt_pressed;
 }
 
 static void
@@ -614,9 +618,12 @@ ni_maschine_mk3_pads(struct ni_maschine_mk3_t *dev,
 	}
 	printf("\n");
 #endif
-	/* call for Set A, then again for set B */
+	/* call for Set A, then again for set B. Both sets are used for
+	 * the pressure stream, doubling its time resolution */
+	ctlra_pad_pressure_report_begin(&dev->pressure);
 	ni_maschine_mk3_pads_decode_set(dev, &buf[0], 0);
 	ni_maschine_mk3_pads_decode_set(dev, &buf[64], 1);
+	ctlra_pad_pressure_flush(&dev->pressure, &dev->base);
 };
 
 void
@@ -635,15 +642,22 @@ ni_maschine_mk3_usb_read_cb(struct ctlra_dev_t *base,
 		/* Return of LED state, after update written to device */
 		} break;
 	case 128:
-		ni_maschine_mk3_pads(dev, data);
+		if(ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_GRID))
+			ni_maschine_mk3_pads(dev, data);
 		break;
 	case 42: {
+		/* Skip decoding sections the application has masked out */
+		const int want_buttons =
+			ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_BUTTON);
+		const int want_encoders =
+			ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_ENCODER);
+
 		/* pedal */
 		// AG: 0x40 = bit mask for pedal; we *must* test for this
 		// specific value, since other bits of this byte may also be
 		// set by some of the buttons (see below)
 		int pedal = buf[3] & 0x40;
-		if(pedal != dev->pedal) {
+		if(want_buttons && pedal != dev->pedal) {
 			struct ctlra_event_t event[] = {
 				{ .type = CTLRA_EVENT_BUTTON,
 				  .button  = {
@@ -659,7 +673,10 @@ ni_maschine_mk3_usb_read_cb(struct ctlra_dev_t *base,
 
 		/* touchstrip: dont send event if 0, as this is release */
 		uint16_t v = *((uint16_t *)&buf[30]);
-		if(!dev->touchstrip_init) {
+		if(!ctlra_dev_impl_event_type_wanted(base, CTLRA_EVENT_SLIDER)) {
+			/* resync when unmasked */
+			dev->touchstrip_init = 0;
+		} else if(!dev->touchstrip_init) {
 			dev->touchstrip_value = v;
 			dev->touchstrip_init = 1;
 		} else if(v && v != dev->touchstrip_value) {
@@ -677,7 +694,7 @@ ni_maschine_mk3_usb_read_cb(struct ctlra_dev_t *base,
 		}
 
 		/* Buttons */
-		for(uint32_t i = 0; i < BUTTONS_SIZE; i++) {
+		for(uint32_t i = 0; want_buttons && i < BUTTONS_SIZE; i++) {
 			int id     = buttons[i].event_id;
 			int offset = buttons[i].buf_byte_offset;
 			int mask   = buttons[i].mask;
@@ -710,6 +727,15 @@ ni_maschine_mk3_usb_read_cb(struct ctlra_dev_t *base,
 			}
 		}
 
+		/* Encoders reinitialize their reference value when unmasked,
+		 * instead of sending the movement while masked as one delta */
+		if(!want_encoders) {
+			for(uint32_t i = 0; i < 8; i++)
+				dev->hw_init[BUTTONS_SIZE + i] = 0;
+			dev->encoder_init = 0;
+			break;
+		}
+
 		/* 8 float-style endless encoders under screen */
 		for(uint32_t i = 0; i < 8; i++) {
 			uint16_t v = *((uint16_t *)&buf[12+i*2]);
@@ -850,6 +876,39 @@ static void ni_maschine_mk3_light_set(struct ctlra_dev_t *base,
 	}
 }
 
+/* The pads report only changes, and are quiet at rest: no smoothing,
+ * and a small threshold for gentle releases */
+static const struct ctlra_grid_pad_opts_t pad_defaults = {
+	.smoothing = 0.f,
+	.on_threshold = 128.5f / 4096.f,
+	.off_threshold = 128.5f / 4096.f,
+	.velocity_full = 1.f,
+	.velocity_curve = 1.f,
+};
+
+static int32_t
+ni_maschine_mk3_grid_pad_config(struct ctlra_dev_t *base, uint32_t grid_id,
+			   uint32_t square,
+			   const struct ctlra_grid_pad_opts_t *opts)
+{
+	struct ni_maschine_mk3_t *dev = (struct ni_maschine_mk3_t *)base;
+	if(grid_id != 0)
+		return -EINVAL;
+	/* grid squares are numbered in pad report order */
+	return ctlra_pad_filter_config(&dev->pad_filter, square, opts);
+}
+
+static int32_t
+ni_maschine_mk3_grid_pressure_stream(struct ctlra_dev_t *base, uint32_t grid_id,
+			const struct ctlra_grid_pressure_opts_t *opts)
+{
+	struct ni_maschine_mk3_t *dev = (struct ni_maschine_mk3_t *)base;
+	/* only one grid, the 16 pads */
+	if(grid_id != 0)
+		return -EINVAL;
+	return ctlra_pad_pressure_config(&dev->pressure, grid_id, opts);
+}
+
 void
 ni_maschine_mk3_light_flush(struct ctlra_dev_t *base, uint32_t force)
 {
@@ -1110,6 +1169,8 @@ ctlra_ni_maschine_mk3_connect(ctlra_event_func event_func,
 	if(!dev)
 		goto fail;
 
+	ctlra_pad_filter_init(&dev->pad_filter, &pad_defaults);
+
 	int err = ctlra_dev_impl_usb_open(&dev->base,
 					  CTLRA_DRIVER_VENDOR,
 					  CTLRA_DRIVER_DEVICE);
@@ -1168,6 +1229,8 @@ ctlra_ni_maschine_mk3_connect(ctlra_event_func event_func,
 	dev->base.disconnect = ni_maschine_mk3_disconnect;
 	dev->base.light_set = ni_maschine_mk3_light_set;
 	dev->base.light_flush = ni_maschine_mk3_light_flush;
+	dev->base.grid_pressure_stream = ni_maschine_mk3_grid_pressure_stream;
+	dev->base.grid_pad_config = ni_maschine_mk3_grid_pad_config;
 	dev->base.screen_get_data = ni_maschine_mk3_screen_get_data;
 
 	dev->base.event_func = event_func;
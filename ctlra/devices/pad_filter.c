@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include "pad_filter.h"
+
+static int
+pad_filter_opts_valid(const struct ctlra_grid_pad_opts_t *o)
+{
+	/* written to reject NaN too */
+	return o->smoothing >= 0.f && o->smoothing < 1.f &&
+	       o->on_threshold >= 0.f && o->on_threshold <= 1.f &&
+	       o->off_threshold >= 0.f && o->off_threshold <= o->on_threshold &&
+	       o->velocity_full > 0.f && o->velocity_curve > 0.f;
+}
+
+static void
+pad_filter_apply(struct ctlra_pad_filter_t *pf, uint32_t pad,
+		 const struct ctlra_grid_pad_opts_t *o)
+{
+	uint32_t v = pad / 4;
+	uint32_t l = pad % 4;
+	pf->alpha[v][l] = 1.f - o->smoothing;
+	pf->on[v][l] = o->on_threshold;
+	pf->off[v][l] = o->off_threshold;
+	pf->vel_scale[pad] = 1.f / o->velocity_full;
+	pf->vel_curve[pad] = o->velocity_curve;
+}
+
+void
+ctlra_pad_filter_init(struct ctlra_pad_filter_t *pf,
+		      const struct ctlra_grid_pad_opts_t *defaults)
+{
+	memset(pf, 0, sizeof(*pf));
+	pf->defaults = *defaults;
+	for(int i = 0; i < CTLRA_PAD_FILTER_PADS; i++)
+		pad_filter_apply(pf, i, defaults);
+}
+
+int32_t
+ctlra_pad_filter_config(struct ctlra_pad_filter_t *pf, uint32_t pad,
+			const struct ctlra_grid_pad_opts_t *opts)
+{
+	if(!opts)
+		opts = &pf->defaults;
+	if(!pad_filter_opts_valid(opts))
+		return -EINVAL;
+
+	if(pad == CTLRA_GRID_SQUARE_ALL) {
+		for(int i = 0; i < CTLRA_PAD_FILTER_PADS; i++)
+			pad_filter_apply(pf, i, opts);
+		return 0;
+	}
+	if(pad >= CTLRA_PAD_FILTER_PADS)
+		return -EINVAL;
+	pad_filter_apply(pf, pad, opts);
+	return 0;
+}
+
+void
+ctlra_pad_filter_run(struct ctlra_pad_filter_t *pf,
+		     const uint16_t raw[CTLRA_PAD_FILTER_PADS],
+		     uint16_t *pressed, uint16_t *released)
+{
+	uint32_t above = 0;
+	uint32_t below = 0;
+
+	for(int v = 0; v < CTLRA_PAD_FILTER_VECS; v++) {
+		const uint16_t *r = &raw[v * 4];
+		ctlra_pad_v4f x = {r[0], r[1], r[2], r[3]};
+		x *= 1 / 4096.f;
+
+		ctlra_pad_v4f l = pf->level[v];
+		l += pf->alpha[v] * (x - l);
+		pf->level[v] = l;
+
+		/* comparisons give all ones (-1) in lanes that are true */
+		ctlra_pad_v4i a = l > pf->on[v];
+		ctlra_pad_v4i b = l < pf->off[v];
+		for(int j = 0; j < 4; j++) {
+			above |= (a[j] & 1) << (v * 4 + j);
+			below |= (b[j] & 1) << (v * 4 + j);
+		}
+	}
+
+	uint16_t on = above & ~pf->held;
+	uint16_t off = below & pf->held;
+	pf->held = (pf->held | on) & ~off;
+	*pressed = on;
+	*released = off;
+
+	/* pow() only for the pads that were hit, rare compared to reports */
+	for(int i = 0; on; i++, on >>= 1) {
+		if(!(on & 1))
+			continue;
+		float vel = pf->level[i / 4][i % 4] * pf->vel_scale[i];
+		vel = vel > 1.f ? 1.f : vel;
+		pf->velocity[i] = powf(vel, pf->vel_curve[i]);
+	}
+}
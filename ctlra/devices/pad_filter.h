@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OPENAV_CTLRA_PAD_FILTER_H
+#define OPENAV_CTLRA_PAD_FILTER_H
+
+#include <stdint.h>
+
+#include "ctlra.h"
+
+/* Pad conditioning, shared by drivers with pressure sensitive pads. It
+ * turns raw 12 bit sensor readings into press and release decisions and
+ * press velocities. The state of all pads is stored as struct of arrays,
+ * so one report is processed in a single vector pass: a one pole IIR
+ * smooths each reading, and on/off thresholds give hysteresis. Options
+ * are per pad, and can be changed at runtime with the config function.
+ *
+ * Lanes are indexed by the pad number in the device reports, drivers map
+ * grid squares to pads before calling config. */
+
+#define CTLRA_PAD_FILTER_PADS 16
+#define CTLRA_PAD_FILTER_VECS (CTLRA_PAD_FILTER_PADS / 4)
+
+typedef float ctlra_pad_v4f __attribute__((vector_size(16)));
+typedef int32_t ctlra_pad_v4i __attribute__((vector_size(16)));
+
+struct ctlra_pad_filter_t {
+	/* smoothed pressure of each pad */
+	ctlra_pad_v4f level[CTLRA_PAD_FILTER_VECS];
+	/* IIR coefficient, 1 - smoothing */
+	ctlra_pad_v4f alpha[CTLRA_PAD_FILTER_VECS];
+	ctlra_pad_v4f on[CTLRA_PAD_FILTER_VECS];
+	ctlra_pad_v4f off[CTLRA_PAD_FILTER_VECS];
+	/* velocity = pow(min(level * vel_scale, 1), vel_curve) */
+	float vel_scale[CTLRA_PAD_FILTER_PADS];
+	float vel_curve[CTLRA_PAD_FILTER_PADS];
+
+	/* velocity of pads pressed in the last run */
+	float velocity[CTLRA_PAD_FILTER_PADS];
+	/* bitmask of pads currently pressed */
+	uint16_t held;
+
+	struct ctlra_grid_pad_opts_t defaults;
+};
+
+/* Reset all state, and apply *defaults* to every pad */
+void ctlra_pad_filter_init(struct ctlra_pad_filter_t *pf,
+			   const struct ctlra_grid_pad_opts_t *defaults);
+
+/* Apply *opts* to *pad*, or all pads with CTLRA_GRID_SQUARE_ALL. NULL
+ * restores the defaults. Returns -EINVAL for invalid pad or options */
+int32_t ctlra_pad_filter_config(struct ctlra_pad_filter_t *pf,
+				uint32_t pad,
+				const struct ctlra_grid_pad_opts_t *opts);
+
+/* Process one reading for every pad. *pressed* and *released* are set to
+ * bitmasks of pads that changed state, pressed pads have their velocity
+ * stored in pf->velocity. */
+void ctlra_pad_filter_run(struct ctlra_pad_filter_t *pf,
+			  const uint16_t raw[CTLRA_PAD_FILTER_PADS],
+			  uint16_t *pressed, uint16_t *released);
+
+#endif /* OPENAV_CTLRA_PAD_FILTER_H */
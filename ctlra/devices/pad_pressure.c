@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "impl.h"
+#include "pad_pressure.h"
+
+int32_t
+ctlra_pad_pressure_config(struct ctlra_pad_pressure_t *pp, uint32_t grid_id,
+			  const struct ctlra_grid_pressure_opts_t *opts)
+{
+	pp->count = 0;
+	if(!opts) {
+		pp->enabled = 0;
+		return 0;
+	}
+	if(opts->deadband < 0.f || opts->deadband > 1.f)
+		return -EINVAL;
+
+	pp->grid_id = grid_id;
+	pp->deadband = opts->deadband;
+	pp->min_interval_ns = opts->max_rate_hz ?
+			      1000000000ull / opts->max_rate_hz : 0;
+	for(int i = 0; i < CTLRA_PAD_PRESSURE_PADS; i++) {
+		pp->last_value[i] = 0.f;
+		pp->last_ns[i] = 0;
+	}
+	pp->enabled = 1;
+	return 0;
+}
+
+void
+ctlra_pad_pressure_report_begin(struct ctlra_pad_pressure_t *pp)
+{
+	if(!pp->enabled)
+		return;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+	/* The sets in a report were sampled evenly over the time since the
+	 * previous report, the last one just now. Clamp the interval, so
+	 * the first report after a pause doesn't spread sets by seconds. */
+	uint64_t interval = now - pp->last_report_ns;
+	if(pp->last_report_ns == 0 || interval > 10000000)
+		interval = 1000000;
+	pp->last_report_ns = now;
+	for(int i = 0; i < CTLRA_PAD_PRESSURE_SETS; i++)
+		pp->set_ns[i] = now - (interval * (CTLRA_PAD_PRESSURE_SETS - 1 - i)) /
+					CTLRA_PAD_PRESSURE_SETS;
+}
+
+void
+ctlra_pad_pressure_hit(struct ctlra_pad_pressure_t *pp, uint32_t set,
+		       uint32_t pad, float value)
+{
+	if(!pp->enabled || pad >= CTLRA_PAD_PRESSURE_PADS)
+		return;
+	pp->last_value[pad] = value;
+	pp->last_ns[pad] = pp->set_ns[set];
+}
+
+void
+ctlra_pad_pressure_sample(struct ctlra_pad_pressure_t *pp, uint32_t set,
+			  uint32_t pad, uint32_t pos, float value)
+{
+	if(!pp->enabled || pad >= CTLRA_PAD_PRESSURE_PADS)
+		return;
+
+	uint64_t t = pp->set_ns[set];
+	if(fabsf(value - pp->last_value[pad]) < pp->deadband ||
+	   value == pp->last_value[pad])
+		return;
+	if(t - pp->last_ns[pad] < pp->min_interval_ns)
+		return;
+	if(pp->count == CTLRA_PAD_PRESSURE_BATCH)
+		return;
+
+	struct ctlra_event_t *e = &pp->events[pp->count];
+	e->type = CTLRA_EVENT_GRID;
+	e->grid.id = pp->grid_id;
+	e->grid.pos = pos;
+	e->grid.flags = CTLRA_EVENT_GRID_FLAG_PRESSURE;
+	e->grid.pressure = value;
+	e->grid.pressed = 1;
+	pp->event_ptrs[pp->count] = e;
+	pp->count++;
+
+	pp->last_value[pad] = value;
+	pp->last_ns[pad] = t;
+}
+
+void
+ctlra_pad_pressure_flush(struct ctlra_pad_pressure_t *pp,
+			 struct ctlra_dev_t *dev)
+{
+	if(!pp->count)
+		return;
+	dev->event_func(dev, pp->count, pp->event_ptrs,
+			dev->event_func_userdata);
+	pp->count = 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OPENAV_CTLRA_PAD_PRESSURE_H
+#define OPENAV_CTLRA_PAD_PRESSURE_H
+
+#include <stdint.h>
+
+#include "ctlra.h"
+
+/* Continuous pad pressure stream, shared by drivers with pressure
+ * sensitive pads. The driver calls report_begin() for each USB report,
+ * sample() for every pressure reading of a held pad, hit() when a pad is
+ * pressed, and flush() before sending a press/release event and at the
+ * end of the report. Samples pass a deadband and a per pad rate limit,
+ * and the survivors are delivered as one batch of events.
+ *
+ * Reports may hold multiple sets of readings taken at evenly spaced
+ * times (the NI Mk3 pads report two), *set* selects the reading time. */
+
+#define CTLRA_PAD_PRESSURE_PADS 16
+#define CTLRA_PAD_PRESSURE_SETS 2
+
+struct ctlra_pad_pressure_t {
+	uint8_t enabled;
+	uint32_t grid_id;
+	float deadband;
+	uint64_t min_interval_ns;
+
+	/* estimated time of each set of the current report */
+	uint64_t last_report_ns;
+	uint64_t set_ns[CTLRA_PAD_PRESSURE_SETS];
+
+	/* last value sent for each pad, and when */
+	float last_value[CTLRA_PAD_PRESSURE_PADS];
+	uint64_t last_ns[CTLRA_PAD_PRESSURE_PADS];
+
+	/* batch of events pending delivery */
+	uint32_t count;
+#define CTLRA_PAD_PRESSURE_BATCH (CTLRA_PAD_PRESSURE_PADS * CTLRA_PAD_PRESSURE_SETS)
+	struct ctlra_event_t events[CTLRA_PAD_PRESSURE_BATCH];
+	struct ctlra_event_t *event_ptrs[CTLRA_PAD_PRESSURE_BATCH];
+};
+
+/* Apply options from ctlra_dev_grid_pressure_stream(), NULL disables */
+int32_t ctlra_pad_pressure_config(struct ctlra_pad_pressure_t *pp,
+				  uint32_t grid_id,
+				  const struct ctlra_grid_pressure_opts_t *opts);
+
+void ctlra_pad_pressure_report_begin(struct ctlra_pad_pressure_t *pp);
+
+/* A pad was pressed with *value*: the stream continues from there */
+void ctlra_pad_pressure_hit(struct ctlra_pad_pressure_t *pp, uint32_t set,
+			    uint32_t pad, float value);
+
+/* A new pressure reading for held *pad*, reported at grid *pos* */
+void ctlra_pad_pressure_sample(struct ctlra_pad_pressure_t *pp,
+			       uint32_t set, uint32_t pad, uint32_t pos,
+			       float value);
+
+/* Deliver pending pressure events to the application */
+void ctlra_pad_pressure_flush(struct ctlra_pad_pressure_t *pp,
+			      struct ctlra_dev_t *dev);
+
+#endif /* OPENAV_CTLRA_PAD_PRESSURE_H */
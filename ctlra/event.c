@@ -1,9 +1,119 @@
 #include <stdint.h>
+#include <string.h>
 #include "event.h"
 
+_Static_assert(sizeof(struct ctlra_event_compact_t) == 16,
+	       "compact events must stay 16 bytes");
+
 const char *ctlra_event_type_names[] = {
 	"Button",
 	"Encoder",
 	"Slider",
 	"Grid",
 };
+
+int
+ctlra_event_to_compact(const struct ctlra_event_t *e,
+		       struct ctlra_event_compact_t *c)
+{
+	uint32_t id = 0;
+	uint8_t flags = 0;
+
+	c->pos = 0;
+	c->unused = 0;
+	c->value = 0.f;
+	c->time_delta = 0;
+
+	switch(e->type) {
+	case CTLRA_EVENT_BUTTON:
+		id = e->button.id;
+		if(e->button.pressed)
+			flags |= CTLRA_EVENT_COMPACT_PRESSED;
+		if(e->button.has_pressure) {
+			flags |= CTLRA_EVENT_COMPACT_PRESSURE;
+			c->value = e->button.pressure;
+		}
+		break;
+	case CTLRA_EVENT_ENCODER:
+		id = e->encoder.id;
+		if(e->encoder.flags & CTLRA_EVENT_ENCODER_FLAG_FLOAT) {
+			flags |= CTLRA_EVENT_COMPACT_FLOAT;
+			c->value = e->encoder.delta_float;
+		} else {
+			c->delta = e->encoder.delta;
+		}
+		break;
+	case CTLRA_EVENT_SLIDER:
+		id = e->slider.id;
+		c->value = e->slider.value;
+		break;
+	case CTLRA_EVENT_GRID:
+		id = e->grid.id;
+		c->pos = e->grid.pos;
+		if(e->grid.flags & CTLRA_EVENT_GRID_FLAG_BUTTON) {
+			flags |= CTLRA_EVENT_COMPACT_BUTTON;
+			if(e->grid.pressed)
+				flags |= CTLRA_EVENT_COMPACT_PRESSED;
+		}
+		if(e->grid.flags & CTLRA_EVENT_GRID_FLAG_PRESSURE) {
+			flags |= CTLRA_EVENT_COMPACT_PRESSURE;
+			c->value = e->grid.pressure;
+		}
+		break;
+	default:
+		return -1;
+	}
+
+	if(id > UINT16_MAX)
+		return -1;
+
+	c->type = e->type;
+	c->flags = flags;
+	c->id = id;
+	return 0;
+}
+
+void
+ctlra_event_from_compact(const struct ctlra_event_compact_t *c,
+			 struct ctlra_event_t *e)
+{
+	memset(e, 0, sizeof(*e));
+	e->type = c->type;
+
+	switch(c->type) {
+	case CTLRA_EVENT_BUTTON:
+		e->button.id = c->id;
+		e->button.pressed = !!(c->flags & CTLRA_EVENT_COMPACT_PRESSED);
+		e->button.has_pressure =
+			!!(c->flags & CTLRA_EVENT_COMPACT_PRESSURE);
+		e->button.pressure = c->value;
+		break;
+	case CTLRA_EVENT_ENCODER:
+		e->encoder.id = c->id;
+		if(c->flags & CTLRA_EVENT_COMPACT_FLOAT) {
+			e->encoder.flags = CTLRA_EVENT_ENCODER_FLAG_FLOAT;
+			e->encoder.delta_float = c->value;
+		} else {
+			e->encoder.flags = CTLRA_EVENT_ENCODER_FLAG_INT;
+			e->encoder.delta = c->delta;
+		}
+		break;
+	case CTLRA_EVENT_SLIDER:
+		e->slider.id = c->id;
+		e->slider.value = c->value;
+		break;
+	case CTLRA_EVENT_GRID:
+		e->grid.id = c->id;
+		e->grid.pos = c->pos;
+		if(c->flags & CTLRA_EVENT_COMPACT_BUTTON) {
+			e->grid.flags |= CTLRA_EVENT_GRID_FLAG_BUTTON;
+			e->grid.pressed =
+				!!(c->flags & CTLRA_EVENT_COMPACT_PRESSED);
+		}
+		if(c->flags & CTLRA_EVENT_COMPACT_PRESSURE) {
+			e->grid.flags |= CTLRA_EVENT_GRID_FLAG_PRESSURE;
+			e->grid.pressure = c->value;
+		}
+		break;
+	}
+}
@@ -149,6 +149,59 @@ typedef void (*ctlra_event_func)(struct ctlra_dev_t* dev,
 				struct ctlra_event_t** event,
 				void *userdata);
 
+#define CTLRA_EVENT_COMPACT_PRESSED  (1<<0)
+#define CTLRA_EVENT_COMPACT_PRESSURE (1<<1)
+#define CTLRA_EVENT_COMPACT_BUTTON   (1<<2)
+#define CTLRA_EVENT_COMPACT_FLOAT    (1<<3)
+
+/** A compact, fixed size representation of any event. Compact events are
+ * delivered as a contiguous array, so they can be iterated linearly, or
+ * copied straight into a ring buffer. Four events fit in a cache line.
+ */
+struct ctlra_event_compact_t {
+	/** The type of this event, see *enum ctlra_event_type_t* */
+	uint8_t type;
+	/** Bitmask of CTLRA_EVENT_COMPACT_* flags:
+	 * - PRESSED: button or grid square is pressed
+	 * - PRESSURE: *value* holds the pressure of a button or grid square
+	 * - BUTTON: the grid event has a button component (see PRESSED)
+	 * - FLOAT: the encoder delta is *value*, otherwise *delta*
+	 */
+	uint8_t flags;
+	/** The id of the control, or of the grid for grid events */
+	uint16_t id;
+	/** The position of the square in the grid, 0 for other types */
+	uint16_t pos;
+	uint16_t unused;
+	union {
+		/** Slider position, pressure, or float encoder delta */
+		float value;
+		/** Stepped encoder delta */
+		int32_t delta;
+	};
+	/** Nanoseconds since the previous event from this device was
+	 * received, saturating at UINT32_MAX */
+	uint32_t time_delta;
+} __attribute__((aligned(16)));
+
+/** Callback function that is called with a contiguous array of events.
+ * Register it with *ctlra_dev_set_event_compact_func*. */
+typedef void (*ctlra_event_compact_func)(struct ctlra_dev_t* dev,
+					 uint32_t num_events,
+					 const struct ctlra_event_compact_t *events,
+					 void *userdata);
+
+/** Convert an event to the compact representation. The *time_delta* of
+ * *out* is set to 0. Ids above UINT16_MAX are not representable, in which
+ * case -1 is returned and *out* is not valid. */
+int ctlra_event_to_compact(const struct ctlra_event_t *event,
+			   struct ctlra_event_compact_t *out);
+
+/** Convert a compact event back to a *struct ctlra_event_t*, so
+ * existing event handling code can be used with compact events. */
+void ctlra_event_from_compact(const struct ctlra_event_compact_t *event,
+			      struct ctlra_event_t *out);
+
 /** Callback function that is called to update the feedback on the device,
  * eg for leds, buttons and screens */
 typedef void (*ctlra_feedback_func)(struct ctlra_dev_t *dev,
@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hid.h"
+#include "event.h"
+
+/* Bounds of the descriptors accepted, far above any real controller */
+#define HID_FIELDS_MAX 1024
+#define HID_USAGES_MAX 256
+#define HID_STACK_MAX  4
+
+/* item types and tags, HID 1.11 section 6.2.2 */
+#define HID_TYPE_MAIN   0
+#define HID_TYPE_GLOBAL 1
+#define HID_TYPE_LOCAL  2
+
+#define HID_MAIN_INPUT          0x8
+#define HID_MAIN_OUTPUT         0x9
+#define HID_MAIN_COLLECTION     0xA
+#define HID_MAIN_FEATURE        0xB
+#define HID_MAIN_END_COLLECTION 0xC
+
+#define HID_GLOBAL_USAGE_PAGE   0x0
+#define HID_GLOBAL_LOGICAL_MIN  0x1
+#define HID_GLOBAL_LOGICAL_MAX  0x2
+#define HID_GLOBAL_REPORT_SIZE  0x7
+#define HID_GLOBAL_REPORT_ID    0x8
+#define HID_GLOBAL_REPORT_COUNT 0x9
+#define HID_GLOBAL_PUSH         0xA
+#define HID_GLOBAL_POP          0xB
+
+#define HID_LOCAL_USAGE         0x0
+#define HID_LOCAL_USAGE_MIN     0x1
+#define HID_LOCAL_USAGE_MAX     0x2
+
+#define HID_INPUT_CONSTANT (1 << 0)
+#define HID_INPUT_VARIABLE (1 << 1)
+#define HID_INPUT_RELATIVE (1 << 2)
+
+#define HID_COLLECTION_APPLICATION 1
+
+struct hid_global_t {
+	uint16_t usage_page;
+	int32_t  logical_min;
+	int32_t  logical_max;
+	uint32_t report_size;
+	uint32_t report_count;
+	uint8_t  report_id;
+};
+
+struct hid_local_t {
+	uint32_t usages[HID_USAGES_MAX];
+	uint32_t usage_count;
+	uint32_t usage_min;
+	uint32_t usage_max;
+	uint8_t  has_min;
+	uint8_t  has_max;
+};
+
+struct hid_parser_t {
+	struct hid_global_t global;
+	struct hid_global_t stack[HID_STACK_MAX];
+	uint32_t stack_depth;
+	struct hid_local_t local;
+
+	uint32_t depth;
+	uint32_t app_usage;
+	uint8_t  has_report_ids;
+	uint8_t  has_app;
+
+	/* input bit offset of each report id, excluding the id byte */
+	uint32_t bit_offset[256];
+
+	/* application usage and control counts of the plan */
+	struct ctlra_hid_plan_t head;
+	/* bit offset of each field, the id byte is added when finished */
+	uint32_t field_bits[HID_FIELDS_MAX];
+	struct ctlra_hid_field_t fields[HID_FIELDS_MAX];
+	uint32_t field_count;
+};
+
+/* The usage of control *i* of the current main item: listed usages are
+ * used in order, then a usage range, and the last usage repeats */
+static uint32_t
+hid_usage_get(const struct hid_local_t *l, uint32_t i)
+{
+	if(i < l->usage_count)
+		return l->usages[i];
+	if(l->has_min) {
+		uint32_t u = l->usage_min + (i - l->usage_count);
+		if(l->has_max && u > l->usage_max)
+			u = l->usage_max;
+		return u;
+	}
+	if(l->usage_count)
+		return l->usages[l->usage_count - 1];
+	return 0;
+}
+
+static void
+hid_field_add(struct hid_parser_t *p, uint8_t kind, uint32_t bit,
+	      uint32_t usage)
+{
+	struct ctlra_hid_plan_t *plan = &p->head;
+	const struct hid_global_t *g = &p->global;
+
+	/* extend a run of buttons when this bit directly follows it */
+	if(kind == CTLRA_HID_BUTTONS && p->field_count) {
+		struct ctlra_hid_field_t *prev = &p->fields[p->field_count - 1];
+		uint32_t prev_bit = p->field_bits[p->field_count - 1];
+		if(prev->kind == CTLRA_HID_BUTTONS &&
+		   prev->report_id == g->report_id &&
+		   prev->bits < 32 &&
+		   prev_bit + prev->bits == bit) {
+			prev->bits++;
+			plan->buttons++;
+			return;
+		}
+	}
+
+	if(p->field_count >= HID_FIELDS_MAX)
+		return;
+
+	if(!p->has_app) {
+		plan->app_usage_page = p->app_usage >> 16;
+		plan->app_usage = p->app_usage & 0xFFFF;
+		p->has_app = 1;
+	}
+
+	struct ctlra_hid_field_t *f = &p->fields[p->field_count];
+	p->field_bits[p->field_count] = bit;
+	p->field_count++;
+
+	f->kind = kind;
+	f->report_id = g->report_id;
+	f->usage_page = usage >> 16;
+	f->usage = usage & 0xFFFF;
+	f->logical_min = g->logical_min;
+	f->is_signed = g->logical_min < 0;
+
+	switch(kind) {
+	case CTLRA_HID_BUTTONS:
+		f->bits = 1;
+		f->id = plan->buttons++;
+		break;
+	case CTLRA_HID_SLIDER:
+		f->bits = g->report_size;
+		f->id = plan->sliders++;
+		f->scale = 1.f / ((int64_t)g->logical_max - g->logical_min);
+		break;
+	case CTLRA_HID_ENCODER:
+		f->bits = g->report_size;
+		f->id = plan->encoders++;
+		/* relative values are deltas, always signed */
+		f->is_signed = 1;
+		break;
+	}
+}
+
+static int32_t
+hid_input_add(struct hid_parser_t *p, uint32_t flags)
+{
+	const struct hid_global_t *g = &p->global;
+	uint32_t *offset = &p->bit_offset[g->report_id];
+
+	/* the whole report, and room for its id byte, must fit a read */
+	uint64_t bits = (uint64_t)g->report_size * g->report_count;
+	if(*offset + bits > (CTLRA_HID_REPORT_MAX - 1) * 8)
+		return -EINVAL;
+
+	/* constants are padding. Arrays report the usages of pressed
+	 * keys, as used by keyboards, and are not controller inputs. */
+	int skip = (flags & HID_INPUT_CONSTANT) ||
+		   !(flags & HID_INPUT_VARIABLE) ||
+		   g->report_size == 0 || g->report_size > 32;
+
+	int relative = flags & HID_INPUT_RELATIVE;
+
+	for(uint32_t i = 0; !skip && i < g->report_count &&
+	    p->field_count < HID_FIELDS_MAX; i++) {
+		uint32_t bit = *offset + i * g->report_size;
+		uint32_t usage = hid_usage_get(&p->local, i);
+
+		if(relative) {
+			hid_field_add(p, CTLRA_HID_ENCODER, bit, usage);
+		} else if(g->report_size == 1) {
+			hid_field_add(p, CTLRA_HID_BUTTONS, bit, usage);
+		} else if(g->logical_max > g->logical_min) {
+			hid_field_add(p, CTLRA_HID_SLIDER, bit, usage);
+		}
+	}
+
+	*offset += bits;
+	return 0;
+}
+
+struct ctlra_hid_plan_t *
+ctlra_impl_hid_plan_build(const struct ctlra_hid_field_t *fields,
+			  uint32_t count, uint8_t has_report_ids)
+{
+	if(count == 0 || count > UINT16_MAX)
+		return 0;
+
+	/* the values share the allocation, after the fields */
+	struct ctlra_hid_plan_t *plan = calloc(1, sizeof(*plan) + count *
+		(sizeof(struct ctlra_hid_field_t) + sizeof(int32_t)));
+	if(!plan)
+		return 0;
+	plan->values = (int32_t *)&plan->fields[count];
+	plan->field_count = count;
+	plan->has_report_ids = has_report_ids;
+
+	uint32_t counts[256] = {0};
+	for(uint32_t i = 0; i < count; i++)
+		counts[fields[i].report_id]++;
+
+	plan->index[0] = 0;
+	for(uint32_t i = 0; i < 256; i++)
+		plan->index[i + 1] = plan->index[i] + counts[i];
+
+	uint32_t fill[256];
+	for(uint32_t i = 0; i < 256; i++)
+		fill[i] = plan->index[i];
+
+	for(uint32_t i = 0; i < count; i++) {
+		struct ctlra_hid_field_t f = fields[i];
+		f.byte += f.shift / 8;
+		f.shift %= 8;
+		f.bytes = (f.shift + f.bits + 7) / 8;
+		f.mask = f.bits == 32 ? 0xFFFFFFFF : (1u << f.bits) - 1;
+
+		uint32_t end = f.byte + f.bytes;
+		if(end > CTLRA_HID_REPORT_MAX) {
+			free(plan);
+			return 0;
+		}
+		if(end > plan->report_bytes)
+			plan->report_bytes = end;
+
+		uint32_t *ctls = &plan->sliders;
+		uint32_t span = 1;
+		if(f.kind == CTLRA_HID_BUTTONS) {
+			ctls = &plan->buttons;
+			span = f.bits;
+		} else if(f.kind != CTLRA_HID_SLIDER) {
+			ctls = &plan->encoders;
+		}
+		if(f.id + span > *ctls)
+			*ctls = f.id + span;
+		plan->event_max += span;
+
+		/* sliders report their first reading, counters need one to
+		 * compare against, buttons start released */
+		uint32_t idx = fill[f.report_id]++;
+		plan->fields[idx] = f;
+		plan->values[idx] = (f.kind == CTLRA_HID_SLIDER ||
+				     f.kind == CTLRA_HID_COUNTER) ?
+				    INT32_MIN : 0;
+	}
+	return plan;
+}
+
+struct ctlra_hid_plan_t *
+ctlra_impl_hid_plan_create(const uint8_t *desc, uint32_t size)
+{
+	struct hid_parser_t *p = calloc(1, sizeof(*p));
+	if(!p)
+		return 0;
+	struct ctlra_hid_plan_t *plan = 0;
+
+	uint32_t i = 0;
+	while(i < size) {
+		uint8_t prefix = desc[i++];
+
+		/* long items carry no controls, skip them */
+		if(prefix == 0xFE) {
+			if(i + 2 > size)
+				goto fail;
+			i += 2 + desc[i];
+			continue;
+		}
+
+		uint32_t len = prefix & 0x3;
+		if(len == 3)
+			len = 4;
+		if(i + len > size)
+			goto fail;
+
+		uint32_t data = 0;
+		for(uint32_t b = 0; b < len; b++)
+			data |= (uint32_t)desc[i + b] << (8 * b);
+		/* sign extend for logical minimum and maximum */
+		int32_t sdata = data;
+		if(len == 1)
+			sdata = (int8_t)data;
+		else if(len == 2)
+			sdata = (int16_t)data;
+		i += len;
+
+		uint8_t type = (prefix >> 2) & 0x3;
+		uint8_t tag = prefix >> 4;
+		struct hid_global_t *g = &p->global;
+		struct hid_local_t *l = &p->local;
+
+		switch(type) {
+		case HID_TYPE_MAIN:
+			switch(tag) {
+			case HID_MAIN_INPUT:
+				if(hid_input_add(p, data))
+					goto fail;
+				break;
+			case HID_MAIN_COLLECTION:
+				if(p->depth == 0 &&
+				   data == HID_COLLECTION_APPLICATION)
+					p->app_usage = hid_usage_get(l, 0);
+				p->depth++;
+				break;
+			case HID_MAIN_END_COLLECTION:
+				if(p->depth)
+					p->depth--;
+				break;
+			/* output and feature reports use their own offsets,
+			 * and are not decoded */
+			case HID_MAIN_OUTPUT:
+			case HID_MAIN_FEATURE:
+			default:
+				break;
+			}
+			memset(l, 0, sizeof(*l));
+			break;
+		case HID_TYPE_GLOBAL:
+			switch(tag) {
+			case HID_GLOBAL_USAGE_PAGE:
+				g->usage_page = data;
+				break;
+			case HID_GLOBAL_LOGICAL_MIN:
+				g->logical_min = sdata;
+				break;
+			case HID_GLOBAL_LOGICAL_MAX:
+				/* a positive range may set the top bit of
+				 * its maximum, eg: 0 to 255 in one byte */
+				g->logical_max = sdata;
+				if(g->logical_min >= 0 && sdata < g->logical_min)
+					g->logical_max = data;
+				break;
+			case HID_GLOBAL_REPORT_SIZE:
+				g->report_size = data;
+				break;
+			case HID_GLOBAL_REPORT_ID:
+				if(data == 0 || data > 255)
+					goto fail;
+				g->report_id = data;
+				p->has_report_ids = 1;
+				break;
+			case HID_GLOBAL_REPORT_COUNT:
+				g->report_count = data;
+				break;
+			case HID_GLOBAL_PUSH:
+				if(p->stack_depth >= HID_STACK_MAX)
+					goto fail;
+				p->stack[p->stack_depth++] = *g;
+				break;
+			case HID_GLOBAL_POP:
+				if(p->stack_depth == 0)
+					goto fail;
+				*g = p->stack[--p->stack_depth];
+				break;
+			}
+			break;
+		case HID_TYPE_LOCAL: {
+			/* four byte usages carry their own usage page */
+			uint32_t usage = len == 4 ? data :
+					 ((uint32_t)g->usage_page << 16) | data;
+			switch(tag) {
+			case HID_LOCAL_USAGE:
+				if(l->usage_count < HID_USAGES_MAX)
+					l->usages[l->usage_count++] = usage;
+				break;
+			case HID_LOCAL_USAGE_MIN:
+				l->usage_min = usage;
+				l->has_min = 1;
+				break;
+			case HID_LOCAL_USAGE_MAX:
+				l->usage_max = usage;
+				l->has_max = 1;
+				break;
+			}
+			} break;
+		default:
+			break;
+		}
+	}
+
+	/* the report id byte precedes the fields when ids are used */
+	uint32_t id_bits = p->has_report_ids ? 8 : 0;
+	for(uint32_t f = 0; f < p->field_count; f++) {
+		uint32_t bit = p->field_bits[f] + id_bits;
+		p->fields[f].byte = bit / 8;
+		p->fields[f].shift = bit % 8;
+	}
+
+	plan = ctlra_impl_hid_plan_build(p->fields, p->field_count,
+					 p->has_report_ids);
+	if(!plan)
+		goto fail;
+	plan->app_usage_page = p->head.app_usage_page;
+	plan->app_usage = p->head.app_usage;
+
+	/* trailing padding is part of the report too */
+	for(uint32_t r = 0; r < 256; r++) {
+		uint32_t bytes = (p->bit_offset[r] + 7 + id_bits) / 8;
+		if(p->bit_offset[r] && bytes > plan->report_bytes)
+			plan->report_bytes = bytes;
+	}
+	free(p);
+	return plan;
+
+fail:
+	free(p);
+	free(plan);
+	return 0;
+}
+
+uint32_t
+ctlra_impl_hid_plan_decode(struct ctlra_hid_plan_t *plan,
+			   const uint8_t *data, uint32_t size,
+			   struct ctlra_event_t *events)
+{
+	if(size == 0)
+		return 0;
+
+	uint32_t id = plan->has_report_ids ? data[0] : 0;
+	uint32_t count = 0;
+
+	for(uint32_t i = plan->index[id]; i < plan->index[id + 1]; i++) {
+		const struct ctlra_hid_field_t *f = &plan->fields[i];
+		/* short reports leave the missing fields unchanged */
+		if(f->byte + f->bytes > size)
+			continue;
+
+		uint64_t raw = 0;
+		for(uint32_t b = 0; b < f->bytes; b++)
+			raw |= (uint64_t)data[f->byte + b] << (8 * b);
+		uint32_t v = (raw >> f->shift) & f->mask;
+
+		switch(f->kind) {
+		case CTLRA_HID_BUTTONS: {
+			uint32_t changed = v ^ (uint32_t)plan->values[i];
+			if(!changed)
+				continue;
+			plan->values[i] = v;
+			while(changed) {
+				uint32_t bit = __builtin_ctz(changed);
+				changed &= changed - 1;
+				events[count++] = (struct ctlra_event_t) {
+					.type = CTLRA_EVENT_BUTTON,
+					.button = {
+						.id = f->id + bit,
+						.pressed = (v >> bit) & 1,
+					},
+				};
+			}
+			} break;
+		case CTLRA_HID_SLIDER: {
+			int32_t s = v;
+			if(f->is_signed && f->bits < 32)
+				s = (int32_t)(v << (32 - f->bits)) >>
+				    (32 - f->bits);
+			if(s == plan->values[i])
+				continue;
+			plan->values[i] = s;
+			float value = ((int64_t)s - f->logical_min) * f->scale;
+			value = value < 0.f ? 0.f : value > 1.f ? 1.f : value;
+			events[count++] = (struct ctlra_event_t) {
+				.type = CTLRA_EVENT_SLIDER,
+				.slider = {
+					.id = f->id,
+					.value = value,
+				},
+			};
+			} break;
+		case CTLRA_HID_COUNTER: {
+			int32_t last = plan->values[i];
+			if(last == (int32_t)v)
+				continue;
+			plan->values[i] = v;
+			if(last == INT32_MIN)
+				continue;
+			/* the shortest way round the wrap is the movement */
+			uint32_t d = (v - (uint32_t)last) & f->mask;
+			int32_t delta = d;
+			if(f->bits < 32)
+				delta = (int32_t)(d << (32 - f->bits)) >>
+					(32 - f->bits);
+			events[count++] = (struct ctlra_event_t) {
+				.type = CTLRA_EVENT_ENCODER,
+				.encoder = {
+					.id = f->id,
+					.flags = CTLRA_EVENT_ENCODER_FLAG_INT,
+					.delta = delta,
+				},
+			};
+			} break;
+		case CTLRA_HID_ENCODER: {
+			int32_t s = v;
+			if(f->bits < 32)
+				s = (int32_t)(v << (32 - f->bits)) >>
+				    (32 - f->bits);
+			/* relative: every non-zero report is a movement */
+			if(s == 0)
+				continue;
+			events[count++] = (struct ctlra_event_t) {
+				.type = CTLRA_EVENT_ENCODER,
+				.encoder = {
+					.id = f->id,
+					.flags = CTLRA_EVENT_ENCODER_FLAG_INT,
+					.delta = s,
+				},
+			};
+			} break;
+		}
+	}
+	return count;
+}
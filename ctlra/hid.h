@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CTLRA_HID_H
+#define CTLRA_HID_H
+
+#include <stdint.h>
+
+struct ctlra_t;
+struct ctlra_event_t;
+
+/* HID report descriptor compiler for the generic HID backend. The
+ * descriptor is parsed once at connect, and every input field that maps
+ * to a Ctlra control becomes an entry of a flat table, sorted by report
+ * id. Decoding a report then walks only the entries of that report id,
+ * extracting each field with a precomputed byte offset, shift and mask,
+ * and emits events for the fields whose value changed. Runs of 1 bit
+ * buttons are merged into a single entry of up to 32 bits, so a report
+ * of idle buttons costs one load and compare. */
+
+#define CTLRA_HID_BUTTONS 0
+#define CTLRA_HID_SLIDER  1
+#define CTLRA_HID_ENCODER 2
+/* absolute counter that wraps, reported as an encoder delta */
+#define CTLRA_HID_COUNTER 3
+
+struct ctlra_hid_field_t {
+	/* location in the report, including the report id byte */
+	uint16_t byte;
+	uint8_t  shift;
+	/* bytes to load, 1 to 5 */
+	uint8_t  bytes;
+	uint32_t mask;
+	/* CTLRA_HID_* */
+	uint8_t  kind;
+	uint8_t  is_signed;
+	/* width of the field, or number of buttons in a run */
+	uint8_t  bits;
+	uint8_t  report_id;
+	/* control id, the first button of a run */
+	uint16_t id;
+	int32_t  logical_min;
+	/* 1 / (logical_max - logical_min) for sliders */
+	float    scale;
+	/* HID usage of the (first) control, for names */
+	uint16_t usage_page;
+	uint16_t usage;
+};
+
+struct ctlra_hid_plan_t {
+	/* application collection the first input belongs to */
+	uint16_t app_usage_page;
+	uint16_t app_usage;
+	uint8_t  has_report_ids;
+	/* largest input report in bytes, including the id byte */
+	uint16_t report_bytes;
+	/* events one report can produce at most */
+	uint32_t event_max;
+	/* number of buttons, sliders and encoders */
+	uint32_t buttons;
+	uint32_t sliders;
+	uint32_t encoders;
+
+	/* fields of report id N are fields[index[N]] to fields[index[N+1]] */
+	uint16_t index[257];
+	uint32_t field_count;
+	/* last decoded value of each field */
+	int32_t *values;
+	struct ctlra_hid_field_t fields[];
+};
+
+/* Compile a report descriptor. Returns the plan, to be released with
+ * free(), or NULL if the descriptor is malformed or has no inputs. */
+struct ctlra_hid_plan_t *
+ctlra_impl_hid_plan_create(const uint8_t *desc, uint32_t size);
+
+/* Build a plan from a table of fields, for devices described by other
+ * means than a report descriptor. Only the byte, shift, bits, kind,
+ * report_id, id, logical_min, scale and is_signed members of *fields*
+ * are used, and the shift may exceed 7. Returns NULL on error. */
+struct ctlra_hid_plan_t *
+ctlra_impl_hid_plan_build(const struct ctlra_hid_field_t *fields,
+			  uint32_t count, uint8_t has_report_ids);
+
+/* Decode an input report into *events*, which must hold plan->event_max
+ * entries. Returns the number of events written. */
+uint32_t ctlra_impl_hid_plan_decode(struct ctlra_hid_plan_t *plan,
+				    const uint8_t *data, uint32_t size,
+				    struct ctlra_event_t *events);
+
+#define CTLRA_HID_DESCRIPTOR_MAX 4096
+/* largest input report accepted, in bytes including the id byte */
+#define CTLRA_HID_REPORT_MAX 1024
+
+/* Passed as the *future* of the generic HID connect function. The report
+ * descriptor is read before the interface is claimed, so a device the
+ * backend rejects stays with its kernel driver */
+struct ctlra_hid_generic_future_t {
+	struct ctlra_t *ctlra;
+	uint16_t vid;
+	uint16_t pid;
+	uint8_t  interface;
+	/* interrupt IN endpoint of the interface */
+	uint8_t  endpoint;
+	char vendor[32];
+	char device[32];
+	uint32_t desc_size;
+	uint8_t desc[CTLRA_HID_DESCRIPTOR_MAX];
+};
+
+#endif /* CTLRA_HID_H */
@@ -101,6 +101,19 @@ typedef int32_t (*ctlra_dev_impl_grid_light_set)(struct ctlra_dev_t *dev,
 						uint32_t grid_id,
 						uint32_t light_id,
 						uint32_t light_status);
+typedef int32_t (*ctlra_dev_impl_grid_pressure_stream)(struct ctlra_dev_t *dev,
+			uint32_t grid_id,
+			const struct ctlra_grid_pressure_opts_t *opts);
+typedef int32_t (*ctlra_dev_impl_grid_pad_config)(struct ctlra_dev_t *dev,
+			uint32_t grid_id,
+			uint32_t square,
+			const struct ctlra_grid_pad_opts_t *opts);
+typedef int32_t (*ctlra_dev_impl_jog_wheel_config)(struct ctlra_dev_t *dev,
+			const struct ctlra_jog_wheel_opts_t *opts);
+typedef int32_t (*ctlra_dev_impl_jog_wheel_read)(struct ctlra_dev_t *dev,
+			uint32_t wheel_id,
+			uint64_t now_ns,
+			struct ctlra_jog_wheel_state_t *state);
 typedef const char* (*ctlra_dev_impl_control_get_name)
 						(const struct ctlra_dev_t *dev,
 						enum ctlra_event_type_t type,
@@ -135,6 +148,9 @@ struct ctlra_dev_t {
 	uint8_t usb_interface[CTLRA_USB_IFACE_PER_DEV];
 	/* linked list of outstanding async transfers */
 	void *usb_async_next;
+	/* guards the list and in-flight counts: with screen shards, xfers
+	 * are submitted and completed on different threads */
+	uint8_t usb_async_lock;
 	/* statistics of USB backend */
 #define USB_XFER_INT_READ 0
 #define USB_XFER_INT_WRITE 1
@@ -167,6 +183,34 @@ struct ctlra_dev_t {
 	ctlra_feedback_func feedback_func;
 	void *event_func_userdata;
 
+	/* Compact event delivery: when set, event_func is a shim that
+	 * appends to compact_events, which are delivered after poll */
+	ctlra_event_compact_func event_compact_func;
+	uint32_t compact_count;
+	uint64_t compact_last_ns;
+#define CTLRA_EVENT_COMPACT_BATCH 64
+	struct ctlra_event_compact_t compact_events[CTLRA_EVENT_COMPACT_BATCH];
+
+	/* Event stage: when event masks or coalescing are set, event_func
+	 * is a shim that drops unwanted events, merges encoder/slider events
+	 * per id, and passes the rest on to stage_next in order */
+	uint8_t stage_active;
+	ctlra_event_func stage_next;
+	/* bitmasks of types not wanted, and types with an id range */
+	uint32_t event_types_masked;
+	uint32_t event_types_ranged;
+	uint32_t event_id_first[CTLRA_EVENT_T_COUNT];
+	uint32_t event_id_count[CTLRA_EVENT_T_COUNT];
+	uint32_t coalesce_types;
+	uint32_t coalesce_count;
+	/* Control state snapshot, updated by the event stage inside a
+	 * seqlock: state_seq is odd while the writer updates the table */
+	float *state;
+	uint32_t state_seq;
+	struct ctlra_dev_state_layout_t state_layout;
+#define CTLRA_EVENT_COALESCE_MAX 32
+	struct ctlra_event_t coalesce_events[CTLRA_EVENT_COALESCE_MAX];
+
 	/* Function pointers to poll events from device */
 	ctlra_dev_impl_poll poll;
 	ctlra_dev_impl_disconnect disconnect;
@@ -176,6 +220,10 @@ struct ctlra_dev_t {
 	ctlra_dev_impl_feedback_set feedback_set;
 	ctlra_dev_impl_feedback_digits feedback_digits;
 	ctlra_dev_impl_grid_light_set grid_light_set;
+	ctlra_dev_impl_grid_pressure_stream grid_pressure_stream;
+	ctlra_dev_impl_grid_pad_config grid_pad_config;
+	ctlra_dev_impl_jog_wheel_config jog_wheel_config;
+	ctlra_dev_impl_jog_wheel_read jog_wheel_read;
 	ctlra_dev_impl_light_flush light_flush;
 	ctlra_dev_impl_usb_read_cb usb_read_cb;
 
@@ -184,6 +232,8 @@ struct ctlra_dev_t {
 	ctlra_screen_redraw_cb screen_redraw_cb;
 	void *screen_redraw_ud;
 	struct timespec screen_last_redraw;
+	/* screen shard redrawing this device, see shard.c */
+	void *shard;
 
 	/* Function pointer to retrive info about a particular control */
 	ctlra_dev_impl_control_get_name control_get_name;
@@ -254,6 +304,18 @@ struct ctlra_t
 	/* USB backend context */
 	struct libusb_context *ctx;
 	uint8_t usb_initialized;
+	/* Hotplug helper thread state, private to usb.c */
+	void *usb_hotplug;
+	/* Devices closed but with USB writes still draining, see usb.c */
+	void *usb_parked;
+	/* set by ctlra_exit(): device closes are drained as one batch */
+	uint8_t usb_teardown;
+
+	/* Screen shard threads, private to shard.c */
+	void *shards;
+	uint32_t shard_count;
+	/* set when opts.rt_policy is not permitted, see rt.c */
+	uint8_t rt_denied;
 
 	/* Linked list of devices currently in use */
 	struct ctlra_dev_t *dev_list;
@@ -287,12 +349,21 @@ struct ctlra_dev_connect_func_t {
 	uint32_t pid;
 	ctlra_dev_connect_func connect;
 	struct ctlra_dev_info_t *info;
+	/* passed to connect, eg: the description of a described device */
+	void *future;
 };
 
-// TODO: check does this registration system even help
-#define CTLRA_MAX_DEVICES 64
+/* Registry of drivers, compiled in and described. The array grows as
+ * drivers register, so it does not depend on constructor order. */
 extern uint32_t __ctlra_device_count;
-extern struct ctlra_dev_connect_func_t __ctlra_devices[CTLRA_MAX_DEVICES];
+extern struct ctlra_dev_connect_func_t *__ctlra_devices;
+/* Append a driver to the registry, returns 0 or -ENOMEM. Not thread
+ * safe: drivers register from constructors, or before ctlra_create() */
+int32_t ctlra_impl_device_register(const struct ctlra_dev_connect_func_t *d);
+
+/* Client side of shm.h, called by ctlra_probe(): connects to all shared
+ * devices and returns the number accepted by the application */
+int ctlra_impl_shm_probe(struct ctlra_t *ctlra);
 
 
 #define CTLRA_DEVICE_REGISTER(name)				\
@@ -304,7 +375,7 @@ static const struct ctlra_dev_connect_func_t __ctlra_dev = {	\
 };								\
 __attribute__((constructor(102)))				\
 static void ctlra_ ## name ## _register() {			\
-	__ctlra_devices[__ctlra_device_count++] = __ctlra_dev;	\
+	ctlra_impl_device_register(&__ctlra_dev);		\
 }
 
 
@@ -327,6 +398,15 @@ static inline int8_t ctlra_dev_encoder_wrap_16(uint8_t newer, uint8_t older)
 	return (dir * 2) - 1;
 }
 
+/* Helper for drivers to skip decoding sections of a report, when the
+ * application has masked out all events of that type */
+static inline int
+ctlra_dev_impl_event_type_wanted(const struct ctlra_dev_t *dev,
+				 enum ctlra_event_type_t type)
+{
+	return !(dev->event_types_masked & (1u << type));
+}
+
 #ifdef __cplusplus
 }
 #endif
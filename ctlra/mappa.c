@@ -0,0 +1,1128 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "impl.h"
+#include "mappa.h"
+
+#define MAPPA_DEVS_MAX 16
+/* curve LUTs have one guard entry for the interpolation at 1.f */
+#define MAPPA_LUT_SIZE 256
+/* value change of an integer encoder step */
+#define MAPPA_ENCODER_STEP (1.f / 64)
+#define MAPPA_LINE_MAX 256
+
+#define MAPPA_ALIGN(s) (((s) + 7) & ~(size_t)7)
+
+enum mappa_curve_t {
+	MAPPA_CURVE_LIN = 0,
+	MAPPA_CURVE_LOG,
+	MAPPA_CURVE_EXP,
+	MAPPA_CURVE_INV,
+	MAPPA_CURVE_COUNT,
+};
+
+static const char *mappa_curve_names[] = {
+	"lin", "log", "exp", "inv",
+};
+
+/* config keys for controls use the ctlra_event_type_t, lights follow */
+#define MAPPA_LIGHT      (CTLRA_EVENT_T_COUNT)
+#define MAPPA_GRID_LIGHT (CTLRA_EVENT_T_COUNT + 1)
+
+static const char *mappa_type_names[] = {
+	[CTLRA_EVENT_BUTTON] = "button",
+	[CTLRA_EVENT_ENCODER] = "encoder",
+	[CTLRA_EVENT_SLIDER] = "slider",
+	[CTLRA_EVENT_GRID] = "grid",
+	[CTLRA_FEEDBACK_ITEM] = NULL,
+	[MAPPA_LIGHT] = "light",
+	[MAPPA_GRID_LIGHT] = "grid_light",
+};
+
+#define MAPPA_BIND_NONE   0
+#define MAPPA_BIND_TARGET 1
+#define MAPPA_BIND_HOLD   2
+#define MAPPA_BIND_SWITCH 3
+
+/* A binding as read from the config file */
+struct mappa_cfg_bind_t {
+	uint8_t type;
+	uint8_t kind;
+	uint8_t curve;
+	uint32_t id;
+	float min;
+	float max;
+	uint32_t color;
+	/* target, source or layer name */
+	char name[MAPPA_NAME_MAX];
+};
+
+struct mappa_cfg_layer_t {
+	char name[MAPPA_NAME_MAX];
+	struct mappa_cfg_bind_t *binds;
+	uint32_t count;
+};
+
+struct mappa_cfg_t {
+	char vendor[CTLRA_STR_MAX];
+	char device[CTLRA_STR_MAX];
+	char serial[CTLRA_DEV_SERIAL_MAX];
+	struct mappa_cfg_layer_t *layers;
+	uint32_t layer_count;
+	struct mappa_cfg_t *next;
+};
+
+/* A registered target or source */
+struct mappa_entry_t {
+	char name[MAPPA_NAME_MAX];
+	mappa_target_float_func target;
+	mappa_source_float_func source;
+	void *userdata;
+	void *token;
+	uint32_t token_size;
+	uint8_t used;
+};
+
+struct mappa_registry_t {
+	struct mappa_entry_t *entries;
+	uint32_t count;
+	uint32_t size;
+};
+
+/* Compiled form of the bindings. A program is one allocation, built by
+ * the compile thread and never modified after it is published: the event
+ * dispatch reads it without locking. */
+struct mappa_func_t {
+	mappa_target_float_func target;
+	mappa_source_float_func source;
+	void *userdata;
+	void *token;
+	uint32_t token_size;
+	uint32_t id;
+};
+
+struct mappa_slot_t {
+	/* target id + 1, or layer index for hold/switch */
+	uint16_t index;
+	uint8_t kind;
+	uint8_t curve;
+	float min;
+	float range;
+};
+
+struct mappa_light_t {
+	/* source id + 1 */
+	uint16_t source;
+	uint8_t grid;
+	uint32_t id;
+	uint32_t color;
+};
+
+struct mappa_layer_t {
+	/* slots of each control type, indexed by control id */
+	uint32_t offset[CTLRA_EVENT_T_COUNT];
+	uint32_t count[CTLRA_EVENT_T_COUNT];
+	struct mappa_slot_t *slots;
+	struct mappa_light_t *lights;
+	uint32_t light_count;
+};
+
+struct mappa_prog_t {
+	/* stack of retired programs waiting to be freed */
+	struct mappa_prog_t *next;
+	struct mappa_func_t *targets;
+	struct mappa_func_t *sources;
+	struct mappa_layer_t *layers[MAPPA_DEVS_MAX];
+	uint32_t layer_count[MAPPA_DEVS_MAX];
+};
+
+/* Dispatch state of a device, only touched from the mappa_iter() thread */
+struct mappa_dev_t {
+	struct mappa_t *m;
+	struct ctlra_dev_t *dev;
+	uint32_t idx;
+	uint16_t layer;
+	/* layer to return to when the held control is released */
+	uint16_t latched;
+	uint8_t holding;
+	uint8_t hold_type;
+	uint32_t hold_id;
+	float *enc;
+	uint32_t enc_count;
+};
+
+struct mappa_t {
+	struct ctlra_t *ctlra;
+	struct mappa_dev_t devs[MAPPA_DEVS_MAX];
+	float lut[MAPPA_CURVE_COUNT][MAPPA_LUT_SIZE + 1];
+
+	/* program in use by the dispatch */
+	struct mappa_prog_t *prog;
+	/* atomic: compiled program not yet picked up by mappa_iter() */
+	struct mappa_prog_t *pending;
+	/* atomic: programs replaced by mappa_iter(), freed by the thread */
+	struct mappa_prog_t *retired;
+
+	pthread_t thread;
+	/* lock protects everything below, never taken by the dispatch */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t want;
+	uint32_t built;
+	uint8_t quit;
+	struct mappa_registry_t targets;
+	struct mappa_registry_t sources;
+	struct mappa_cfg_t *cfgs;
+	struct ctlra_dev_info_t info[MAPPA_DEVS_MAX];
+	uint8_t present[MAPPA_DEVS_MAX];
+};
+
+static void
+mappa_lut_init(struct mappa_t *m)
+{
+	/* steepness of the log and exp curves */
+	const float k = 4.f;
+	const float ek = expf(k) - 1.f;
+	for(int i = 0; i <= MAPPA_LUT_SIZE; i++) {
+		float x = i / (float)MAPPA_LUT_SIZE;
+		m->lut[MAPPA_CURVE_LIN][i] = x;
+		m->lut[MAPPA_CURVE_LOG][i] = logf(1.f + ek * x) / k;
+		m->lut[MAPPA_CURVE_EXP][i] = (expf(k * x) - 1.f) / ek;
+		m->lut[MAPPA_CURVE_INV][i] = 1.f - x;
+	}
+}
+
+static inline float
+mappa_lut(const float *lut, float v)
+{
+	if(v <= 0.f)
+		return lut[0];
+	if(v >= 1.f)
+		return lut[MAPPA_LUT_SIZE];
+	float x = v * MAPPA_LUT_SIZE;
+	uint32_t i = (uint32_t)x;
+	return lut[i] + (lut[i + 1] - lut[i]) * (x - i);
+}
+
+static void
+mappa_control_counts(const struct ctlra_dev_info_t *info, uint32_t *counts)
+{
+	counts[CTLRA_EVENT_BUTTON] = info->control_count[CTLRA_EVENT_BUTTON];
+	counts[CTLRA_EVENT_ENCODER] = info->control_count[CTLRA_EVENT_ENCODER];
+	counts[CTLRA_EVENT_SLIDER] = info->control_count[CTLRA_EVENT_SLIDER];
+	/* grid events are indexed by the square of grid 0 */
+	counts[CTLRA_EVENT_GRID] = info->control_count[CTLRA_EVENT_GRID] ?
+		info->grid_info[0].x * info->grid_info[0].y : 0;
+	counts[CTLRA_FEEDBACK_ITEM] = 0;
+}
+
+static struct mappa_cfg_t *
+mappa_cfg_find(struct mappa_t *m, const struct ctlra_dev_info_t *info)
+{
+	/* newest config first */
+	for(struct mappa_cfg_t *c = m->cfgs; c; c = c->next) {
+		if(strcmp(c->vendor, info->vendor) ||
+		   strcmp(c->device, info->device))
+			continue;
+		if(c->serial[0] && strcmp(c->serial, info->serial))
+			continue;
+		return c;
+	}
+	return NULL;
+}
+
+static int
+mappa_cfg_layer_find(const struct mappa_cfg_t *c, const char *name)
+{
+	for(uint32_t i = 0; i < c->layer_count; i++)
+		if(strcmp(c->layers[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+static uint32_t
+mappa_cfg_light_count(const struct mappa_cfg_layer_t *l)
+{
+	uint32_t n = 0;
+	for(uint32_t i = 0; i < l->count; i++)
+		n += l->binds[i].type >= MAPPA_LIGHT;
+	return n;
+}
+
+static void
+mappa_cfg_free(struct mappa_cfg_t *c)
+{
+	for(uint32_t i = 0; i < c->layer_count; i++)
+		free(c->layers[i].binds);
+	free(c->layers);
+	free(c);
+}
+
+/* returns id + 1 of the named entry, or 0 */
+static uint32_t
+mappa_registry_find(const struct mappa_registry_t *r, const char *name)
+{
+	for(uint32_t i = 0; i < r->count; i++)
+		if(r->entries[i].used && strcmp(r->entries[i].name, name) == 0)
+			return i + 1;
+	return 0;
+}
+
+static size_t
+mappa_registry_token_size(const struct mappa_registry_t *r)
+{
+	size_t size = 0;
+	for(uint32_t i = 0; i < r->count; i++)
+		if(r->entries[i].used)
+			size += MAPPA_ALIGN(r->entries[i].token_size);
+	return size;
+}
+
+static void *
+mappa_take(uint8_t **mem, size_t size)
+{
+	void *ret = *mem;
+	*mem += MAPPA_ALIGN(size);
+	return ret;
+}
+
+static void
+mappa_funcs_copy(const struct mappa_registry_t *r, struct mappa_func_t *f,
+		 uint8_t **mem)
+{
+	for(uint32_t i = 0; i < r->count; i++) {
+		const struct mappa_entry_t *e = &r->entries[i];
+		if(!e->used)
+			continue;
+		f[i].target = e->target;
+		f[i].source = e->source;
+		f[i].userdata = e->userdata;
+		f[i].token_size = e->token_size;
+		f[i].id = i;
+		if(e->token_size) {
+			f[i].token = mappa_take(mem, e->token_size);
+			memcpy(f[i].token, e->token, e->token_size);
+		}
+	}
+}
+
+static void
+mappa_layer_compile(struct mappa_t *m, const struct mappa_cfg_t *cfg,
+		    const struct mappa_cfg_layer_t *cl,
+		    struct mappa_layer_t *l)
+{
+	uint32_t n = 0;
+	for(uint32_t i = 0; i < cl->count; i++) {
+		const struct mappa_cfg_bind_t *b = &cl->binds[i];
+		if(b->type >= MAPPA_LIGHT) {
+			uint32_t s = mappa_registry_find(&m->sources, b->name);
+			if(!s)
+				continue;
+			struct mappa_light_t *light = &l->lights[n++];
+			light->source = s;
+			light->grid = b->type == MAPPA_GRID_LIGHT;
+			light->id = b->id;
+			light->color = b->color & 0xffffff;
+			continue;
+		}
+		if(b->id >= l->count[b->type]) {
+			CTLRA_WARN(m->ctlra, "%s %s: %s.%d out of range\n",
+				   cfg->device, cl->name,
+				   mappa_type_names[b->type], b->id);
+			continue;
+		}
+
+		struct mappa_slot_t *s = &l->slots[l->offset[b->type] + b->id];
+		s->curve = b->curve;
+		s->min = b->min;
+		s->range = b->max - b->min;
+		if(b->kind == MAPPA_BIND_TARGET) {
+			/* targets may be added later, that recompiles */
+			s->index = mappa_registry_find(&m->targets, b->name);
+			s->kind = s->index ? MAPPA_BIND_TARGET : MAPPA_BIND_NONE;
+		} else if(b->kind == MAPPA_BIND_HOLD ||
+			  b->kind == MAPPA_BIND_SWITCH) {
+			int layer = mappa_cfg_layer_find(cfg, b->name);
+			if(layer < 0) {
+				CTLRA_WARN(m->ctlra, "%s %s: no layer %s\n",
+					   cfg->device, cl->name, b->name);
+				continue;
+			}
+			s->index = layer;
+			s->kind = b->kind;
+		}
+	}
+	l->light_count = n;
+}
+
+/* Called with the lock held */
+static struct mappa_prog_t *
+mappa_compile(struct mappa_t *m)
+{
+	struct mappa_cfg_t *cfg[MAPPA_DEVS_MAX] = {0};
+	uint32_t counts[MAPPA_DEVS_MAX][CTLRA_EVENT_T_COUNT];
+	uint32_t nt = m->targets.count;
+	uint32_t ns = m->sources.count;
+
+	size_t size = MAPPA_ALIGN(sizeof(struct mappa_prog_t));
+	size += MAPPA_ALIGN(nt * sizeof(struct mappa_func_t));
+	size += MAPPA_ALIGN(ns * sizeof(struct mappa_func_t));
+	size += mappa_registry_token_size(&m->targets);
+	size += mappa_registry_token_size(&m->sources);
+
+	for(int i = 0; i < MAPPA_DEVS_MAX; i++) {
+		if(!m->present[i])
+			continue;
+		cfg[i] = mappa_cfg_find(m, &m->info[i]);
+		if(!cfg[i])
+			continue;
+		mappa_control_counts(&m->info[i], counts[i]);
+		uint32_t controls = 0;
+		for(int t = 0; t < CTLRA_EVENT_T_COUNT; t++)
+			controls += counts[i][t];
+		size += MAPPA_ALIGN(cfg[i]->layer_count *
+				    sizeof(struct mappa_layer_t));
+		for(uint32_t l = 0; l < cfg[i]->layer_count; l++) {
+			uint32_t lights =
+				mappa_cfg_light_count(&cfg[i]->layers[l]);
+			size += MAPPA_ALIGN(controls *
+					    sizeof(struct mappa_slot_t));
+			size += MAPPA_ALIGN(lights *
+					    sizeof(struct mappa_light_t));
+		}
+	}
+
+	uint8_t *mem = calloc(1, size);
+	if(!mem)
+		return NULL;
+
+	struct mappa_prog_t *p = mappa_take(&mem, sizeof(*p));
+	p->targets = mappa_take(&mem, nt * sizeof(struct mappa_func_t));
+	p->sources = mappa_take(&mem, ns * sizeof(struct mappa_func_t));
+	mappa_funcs_copy(&m->targets, p->targets, &mem);
+	mappa_funcs_copy(&m->sources, p->sources, &mem);
+
+	for(int i = 0; i < MAPPA_DEVS_MAX; i++) {
+		if(!cfg[i])
+			continue;
+		uint32_t lc = cfg[i]->layer_count;
+		p->layers[i] = mappa_take(&mem, lc * sizeof(struct mappa_layer_t));
+		p->layer_count[i] = lc;
+
+		uint32_t controls = 0;
+		struct mappa_layer_t proto = {0};
+		for(int t = 0; t < CTLRA_EVENT_T_COUNT; t++) {
+			proto.offset[t] = controls;
+			proto.count[t] = counts[i][t];
+			controls += counts[i][t];
+		}
+
+		for(uint32_t l = 0; l < lc; l++) {
+			const struct mappa_cfg_layer_t *cl = &cfg[i]->layers[l];
+			struct mappa_layer_t *layer = &p->layers[i][l];
+			*layer = proto;
+			layer->slots = mappa_take(&mem, controls *
+						  sizeof(struct mappa_slot_t));
+			layer->lights = mappa_take(&mem,
+					mappa_cfg_light_count(cl) *
+					sizeof(struct mappa_light_t));
+			mappa_layer_compile(m, cfg[i], cl, layer);
+		}
+	}
+
+	return p;
+}
+
+static void
+mappa_retired_free(struct mappa_t *m)
+{
+	struct mappa_prog_t *p = __atomic_exchange_n(&m->retired, NULL,
+						     __ATOMIC_ACQUIRE);
+	while(p) {
+		struct mappa_prog_t *next = p->next;
+		free(p);
+		p = next;
+	}
+}
+
+static void *
+mappa_compile_thread(void *ud)
+{
+	struct mappa_t *m = ud;
+
+	pthread_mutex_lock(&m->lock);
+	for(;;) {
+		while(!m->quit && m->built == m->want)
+			pthread_cond_wait(&m->cond, &m->lock);
+		if(m->quit)
+			break;
+		m->built = m->want;
+		struct mappa_prog_t *p = mappa_compile(m);
+		pthread_mutex_unlock(&m->lock);
+
+		if(p) {
+			/* a program that was never picked up is unused */
+			struct mappa_prog_t *old =
+				__atomic_exchange_n(&m->pending, p,
+						    __ATOMIC_ACQ_REL);
+			free(old);
+		} else {
+			CTLRA_ERROR(m->ctlra, "%s\n", "out of memory");
+		}
+		mappa_retired_free(m);
+
+		pthread_mutex_lock(&m->lock);
+	}
+	pthread_mutex_unlock(&m->lock);
+
+	return NULL;
+}
+
+/* Called with the lock held */
+static void
+mappa_rebuild(struct mappa_t *m)
+{
+	m->want++;
+	pthread_cond_signal(&m->cond);
+}
+
+static void
+mappa_install(struct mappa_t *m, struct mappa_prog_t *p)
+{
+	struct mappa_prog_t *old = m->prog;
+	m->prog = p;
+
+	for(int i = 0; i < MAPPA_DEVS_MAX; i++) {
+		struct mappa_dev_t *d = &m->devs[i];
+		if(d->layer >= p->layer_count[i] ||
+		   d->latched >= p->layer_count[i]) {
+			d->layer = 0;
+			d->latched = 0;
+			d->holding = 0;
+		}
+	}
+
+	if(!old)
+		return;
+	old->next = __atomic_load_n(&m->retired, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&m->retired, &old->next, old, 1,
+					   __ATOMIC_RELEASE,
+					   __ATOMIC_RELAXED))
+		;
+}
+
+static void
+mappa_event_func(struct ctlra_dev_t* dev, uint32_t num_events,
+		 struct ctlra_event_t** events, void *userdata)
+{
+	struct mappa_dev_t *d = userdata;
+	struct mappa_t *m = d->m;
+	const struct mappa_prog_t *p = m->prog;
+	if(!p || !p->layer_count[d->idx])
+		return;
+
+	for(uint32_t i = 0; i < num_events; i++) {
+		struct ctlra_event_t *e = events[i];
+		uint32_t type = e->type;
+		uint32_t id;
+		float v;
+
+		switch(type) {
+		case CTLRA_EVENT_BUTTON:
+			id = e->button.id;
+			v = e->button.pressed;
+			break;
+		case CTLRA_EVENT_ENCODER:
+			id = e->encoder.id;
+			if(id >= d->enc_count)
+				continue;
+			/* encoders are relative: the value is accumulated */
+			v = d->enc[id];
+			if(e->encoder.flags & CTLRA_EVENT_ENCODER_FLAG_FLOAT)
+				v += e->encoder.delta_float;
+			else
+				v += e->encoder.delta * MAPPA_ENCODER_STEP;
+			v = v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+			d->enc[id] = v;
+			break;
+		case CTLRA_EVENT_SLIDER:
+			id = e->slider.id;
+			v = e->slider.value;
+			break;
+		case CTLRA_EVENT_GRID:
+			id = e->grid.pos;
+			if(e->grid.flags & CTLRA_EVENT_GRID_FLAG_PRESSURE)
+				v = e->grid.pressure;
+			else
+				v = e->grid.pressed ? 1.f : 0.f;
+			break;
+		default:
+			continue;
+		}
+
+		/* the held control may not be bound in the held layer */
+		if(d->holding && type == d->hold_type && id == d->hold_id) {
+			if(v == 0.f) {
+				d->layer = d->latched;
+				d->holding = 0;
+			}
+			continue;
+		}
+
+		const struct mappa_layer_t *l = &p->layers[d->idx][d->layer];
+		if(id >= l->count[type])
+			continue;
+		const struct mappa_slot_t *s = &l->slots[l->offset[type] + id];
+
+		switch(s->kind) {
+		case MAPPA_BIND_TARGET: {
+			const struct mappa_func_t *f = &p->targets[s->index - 1];
+			float out = s->min + mappa_lut(m->lut[s->curve], v) *
+				    s->range;
+			f->target(f->id, out, f->token, f->token_size,
+				  f->userdata);
+			break;
+			}
+		case MAPPA_BIND_HOLD:
+			if(v > 0.f && !d->holding) {
+				d->latched = d->layer;
+				d->layer = s->index;
+				d->holding = 1;
+				d->hold_type = type;
+				d->hold_id = id;
+			}
+			break;
+		case MAPPA_BIND_SWITCH:
+			if(v > 0.f) {
+				d->layer = s->index;
+				d->holding = 0;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void
+mappa_feedback_func(struct ctlra_dev_t *dev, void *userdata)
+{
+	struct mappa_dev_t *d = userdata;
+	const struct mappa_prog_t *p = d->m->prog;
+	if(!p || !p->layer_count[d->idx])
+		return;
+
+	const struct mappa_layer_t *l = &p->layers[d->idx][d->layer];
+	for(uint32_t i = 0; i < l->light_count; i++) {
+		const struct mappa_light_t *light = &l->lights[i];
+		const struct mappa_func_t *f = &p->sources[light->source - 1];
+		float v = 0.f;
+		f->source(&v, f->token, f->token_size, f->userdata);
+		v = v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+		uint32_t status = ((uint32_t)(v * 0x7f) << 24) | light->color;
+		if(light->grid)
+			ctlra_dev_grid_light_set(dev, 0, light->id, status);
+		else
+			ctlra_dev_light_set(dev, light->id, status);
+	}
+	if(l->light_count)
+		ctlra_dev_light_flush(dev, 0);
+}
+
+static void
+mappa_remove_func(struct ctlra_dev_t *dev, int unexpected_removal,
+		  void *userdata)
+{
+	struct mappa_dev_t *d = userdata;
+	struct mappa_t *m = d->m;
+
+	pthread_mutex_lock(&m->lock);
+	m->present[d->idx] = 0;
+	mappa_rebuild(m);
+	pthread_mutex_unlock(&m->lock);
+
+	free(d->enc);
+	d->enc = NULL;
+	d->dev = NULL;
+}
+
+static int
+mappa_accept_func(struct ctlra_t *ctlra, const struct ctlra_dev_info_t *info,
+		  struct ctlra_dev_t *dev, void *userdata)
+{
+	struct mappa_t *m = userdata;
+	int i;
+	for(i = 0; i < MAPPA_DEVS_MAX; i++)
+		if(!m->devs[i].dev)
+			break;
+	if(i == MAPPA_DEVS_MAX) {
+		CTLRA_WARN(ctlra, "no free slot for %s %s\n",
+			   info->vendor, info->device);
+		return 0;
+	}
+
+	struct mappa_dev_t *d = &m->devs[i];
+	memset(d, 0, sizeof(*d));
+	d->m = m;
+	d->dev = dev;
+	d->idx = i;
+	d->enc_count = info->control_count[CTLRA_EVENT_ENCODER];
+	if(d->enc_count) {
+		d->enc = calloc(d->enc_count, sizeof(float));
+		if(!d->enc) {
+			d->dev = NULL;
+			return 0;
+		}
+	}
+
+	/* the device slot may still hold a program for a removed device:
+	 * control ids are bounds checked, and the rebuild replaces it */
+	pthread_mutex_lock(&m->lock);
+	m->info[i] = *info;
+	m->present[i] = 1;
+	mappa_rebuild(m);
+	pthread_mutex_unlock(&m->lock);
+
+	ctlra_dev_set_event_func(dev, mappa_event_func);
+	ctlra_dev_set_feedback_func(dev, mappa_feedback_func);
+	ctlra_dev_set_remove_func(dev, mappa_remove_func);
+	ctlra_dev_set_callback_userdata(dev, d);
+	return 1;
+}
+
+struct mappa_t *
+mappa_create(const struct mappa_opts_t *opts)
+{
+	struct mappa_t *m = calloc(1, sizeof(*m));
+	if(!m)
+		return NULL;
+
+	mappa_lut_init(m);
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->cond, NULL);
+
+	m->ctlra = ctlra_create(opts ? opts->ctlra_opts : NULL);
+	if(!m->ctlra)
+		goto fail;
+
+	if(pthread_create(&m->thread, NULL, mappa_compile_thread, m)) {
+		ctlra_exit(m->ctlra);
+		goto fail;
+	}
+
+	ctlra_probe(m->ctlra, mappa_accept_func, m);
+	return m;
+
+fail:
+	pthread_cond_destroy(&m->cond);
+	pthread_mutex_destroy(&m->lock);
+	free(m);
+	return NULL;
+}
+
+void
+mappa_iter(struct mappa_t *m)
+{
+	struct mappa_prog_t *p = __atomic_exchange_n(&m->pending, NULL,
+						     __ATOMIC_ACQ_REL);
+	if(p)
+		mappa_install(m, p);
+
+	ctlra_idle_iter(m->ctlra);
+}
+
+static void
+mappa_registry_free(struct mappa_registry_t *r)
+{
+	for(uint32_t i = 0; i < r->count; i++)
+		free(r->entries[i].token);
+	free(r->entries);
+}
+
+void
+mappa_destroy(struct mappa_t *m)
+{
+	if(!m)
+		return;
+
+	/* removes the devices, which requests a rebuild */
+	ctlra_exit(m->ctlra);
+
+	pthread_mutex_lock(&m->lock);
+	m->quit = 1;
+	pthread_cond_signal(&m->cond);
+	pthread_mutex_unlock(&m->lock);
+	pthread_join(m->thread, NULL);
+
+	free(m->pending);
+	free(m->prog);
+	mappa_retired_free(m);
+
+	mappa_registry_free(&m->targets);
+	mappa_registry_free(&m->sources);
+	while(m->cfgs) {
+		struct mappa_cfg_t *next = m->cfgs->next;
+		mappa_cfg_free(m->cfgs);
+		m->cfgs = next;
+	}
+
+	pthread_cond_destroy(&m->cond);
+	pthread_mutex_destroy(&m->lock);
+	free(m);
+}
+
+/* Called with the lock held */
+static struct mappa_entry_t *
+mappa_registry_add(struct mappa_registry_t *r, const char *name,
+		   void *userdata, void *token, uint32_t token_size,
+		   uint32_t *id, int32_t *err)
+{
+	if(!name || !id || (token_size && !token) ||
+	   strlen(name) >= MAPPA_NAME_MAX) {
+		*err = -EINVAL;
+		return NULL;
+	}
+	if(mappa_registry_find(r, name)) {
+		*err = -EEXIST;
+		return NULL;
+	}
+	/* slots store id + 1 as 16 bits */
+	if(r->count >= UINT16_MAX - 1) {
+		*err = -ENOSPC;
+		return NULL;
+	}
+
+	if(r->count == r->size) {
+		uint32_t size = r->size ? r->size * 2 : 16;
+		void *e = realloc(r->entries, size * sizeof(*r->entries));
+		if(!e) {
+			*err = -ENOMEM;
+			return NULL;
+		}
+		r->entries = e;
+		r->size = size;
+	}
+
+	struct mappa_entry_t *e = &r->entries[r->count];
+	memset(e, 0, sizeof(*e));
+	if(token_size) {
+		e->token = malloc(token_size);
+		if(!e->token) {
+			*err = -ENOMEM;
+			return NULL;
+		}
+		memcpy(e->token, token, token_size);
+		e->token_size = token_size;
+	}
+	strcpy(e->name, name);
+	e->userdata = userdata;
+	e->used = 1;
+
+	/* ids are not reused, a stale id can not alias a new entry */
+	*id = r->count++;
+	*err = 0;
+	return e;
+}
+
+static int32_t
+mappa_registry_remove(struct mappa_t *m, struct mappa_registry_t *r,
+		      uint32_t id)
+{
+	pthread_mutex_lock(&m->lock);
+	if(id >= r->count || !r->entries[id].used) {
+		pthread_mutex_unlock(&m->lock);
+		return -EINVAL;
+	}
+	struct mappa_entry_t *e = &r->entries[id];
+	e->used = 0;
+	free(e->token);
+	e->token = NULL;
+	mappa_rebuild(m);
+	pthread_mutex_unlock(&m->lock);
+	return 0;
+}
+
+int32_t
+mappa_target_add(struct mappa_t *m, const struct mappa_target_t *t,
+		 uint32_t *target_id, void *token, uint32_t token_size)
+{
+	if(!m || !t || !t->func)
+		return -EINVAL;
+
+	int32_t ret;
+	pthread_mutex_lock(&m->lock);
+	struct mappa_entry_t *e = mappa_registry_add(&m->targets, t->name,
+						     t->userdata, token,
+						     token_size, target_id,
+						     &ret);
+	if(e) {
+		e->target = t->func;
+		mappa_rebuild(m);
+	}
+	pthread_mutex_unlock(&m->lock);
+	return ret;
+}
+
+int32_t
+mappa_target_remove(struct mappa_t *m, uint32_t target_id)
+{
+	return mappa_registry_remove(m, &m->targets, target_id);
+}
+
+int32_t
+mappa_source_add(struct mappa_t *m, const struct mappa_source_t *s,
+		 uint32_t *source_id, void *token, uint32_t token_size)
+{
+	if(!m || !s || !s->func)
+		return -EINVAL;
+
+	int32_t ret;
+	pthread_mutex_lock(&m->lock);
+	struct mappa_entry_t *e = mappa_registry_add(&m->sources, s->name,
+						     s->userdata, token,
+						     token_size, source_id,
+						     &ret);
+	if(e) {
+		e->source = s->func;
+		mappa_rebuild(m);
+	}
+	pthread_mutex_unlock(&m->lock);
+	return ret;
+}
+
+int32_t
+mappa_source_remove(struct mappa_t *m, uint32_t source_id)
+{
+	return mappa_registry_remove(m, &m->sources, source_id);
+}
+
+static char *
+mappa_strip(char *s)
+{
+	while(*s == ' ' || *s == '\t')
+		s++;
+	char *end = s + strlen(s);
+	while(end > s && (end[-1] == ' ' || end[-1] == '\t' ||
+			  end[-1] == '\n' || end[-1] == '\r'))
+		*--end = 0;
+	return s;
+}
+
+static int32_t
+mappa_cfg_layer_add(struct mappa_cfg_t *c, const char *name)
+{
+	if(!*name || strlen(name) >= MAPPA_NAME_MAX ||
+	   mappa_cfg_layer_find(c, name) >= 0 ||
+	   c->layer_count >= UINT16_MAX)
+		return -EINVAL;
+	void *l = realloc(c->layers, (c->layer_count + 1) *
+			  sizeof(struct mappa_cfg_layer_t));
+	if(!l)
+		return -ENOMEM;
+	c->layers = l;
+	struct mappa_cfg_layer_t *layer = &c->layers[c->layer_count++];
+	memset(layer, 0, sizeof(*layer));
+	strcpy(layer->name, name);
+	return 0;
+}
+
+static struct mappa_cfg_bind_t *
+mappa_cfg_bind_get(struct mappa_cfg_layer_t *l, uint8_t type, uint32_t id)
+{
+	for(uint32_t i = 0; i < l->count; i++)
+		if(l->binds[i].type == type && l->binds[i].id == id)
+			return &l->binds[i];
+
+	void *b = realloc(l->binds, (l->count + 1) *
+			  sizeof(struct mappa_cfg_bind_t));
+	if(!b)
+		return NULL;
+	l->binds = b;
+	struct mappa_cfg_bind_t *bind = &l->binds[l->count++];
+	memset(bind, 0, sizeof(*bind));
+	bind->type = type;
+	bind->id = id;
+	bind->max = 1.f;
+	bind->color = 0xffffff;
+	return bind;
+}
+
+/* Parse one "<type>.<id>[.<attr>] = <value>" line of a layer */
+static int32_t
+mappa_cfg_bind(struct mappa_cfg_layer_t *l, char *key, const char *val)
+{
+	char *dot = strchr(key, '.');
+	if(!dot || strlen(val) >= MAPPA_NAME_MAX)
+		return -EINVAL;
+	*dot = 0;
+
+	uint32_t type;
+	uint32_t types = sizeof(mappa_type_names) / sizeof(mappa_type_names[0]);
+	for(type = 0; type < types; type++)
+		if(mappa_type_names[type] &&
+		   strcmp(mappa_type_names[type], key) == 0)
+			break;
+	if(type == types)
+		return -EINVAL;
+
+	char *end;
+	uint32_t id = strtoul(dot + 1, &end, 10);
+	if(end == dot + 1 || (*end && *end != '.'))
+		return -EINVAL;
+	const char *attr = *end ? end + 1 : NULL;
+	int light = type >= MAPPA_LIGHT;
+
+	struct mappa_cfg_bind_t *b = mappa_cfg_bind_get(l, type, id);
+	if(!b)
+		return -ENOMEM;
+
+	if(!attr) {
+		strcpy(b->name, val);
+		if(!light)
+			b->kind = MAPPA_BIND_TARGET;
+	} else if(!light && strcmp(attr, "curve") == 0) {
+		for(b->curve = 0; b->curve < MAPPA_CURVE_COUNT; b->curve++)
+			if(strcmp(mappa_curve_names[b->curve], val) == 0)
+				break;
+		if(b->curve == MAPPA_CURVE_COUNT)
+			return -EINVAL;
+	} else if(!light && strcmp(attr, "min") == 0) {
+		b->min = strtof(val, NULL);
+	} else if(!light && strcmp(attr, "max") == 0) {
+		b->max = strtof(val, NULL);
+	} else if(!light && strcmp(attr, "hold") == 0) {
+		strcpy(b->name, val);
+		b->kind = MAPPA_BIND_HOLD;
+	} else if(!light && strcmp(attr, "switch") == 0) {
+		strcpy(b->name, val);
+		b->kind = MAPPA_BIND_SWITCH;
+	} else if(light && strcmp(attr, "color") == 0) {
+		b->color = strtoul(val, NULL, 16);
+	} else {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int32_t
+mappa_add_config_file(struct mappa_t *m, const char *file)
+{
+	if(!m || !file)
+		return -EINVAL;
+
+	FILE *f = fopen(file, "r");
+	if(!f)
+		return -errno;
+
+	struct mappa_cfg_t *c = calloc(1, sizeof(*c));
+	if(!c) {
+		fclose(f);
+		return -ENOMEM;
+	}
+
+	enum { SECTION_OTHER, SECTION_DEVICE, SECTION_LAYER } section;
+	section = SECTION_OTHER;
+	char line[MAPPA_LINE_MAX];
+	uint32_t lineno = 0;
+	int32_t ret = 0;
+
+	while(!ret && fgets(line, sizeof(line), f)) {
+		lineno++;
+		char *s = mappa_strip(line);
+		if(!*s || *s == '#' || *s == ';')
+			continue;
+
+		if(*s == '[') {
+			char *end = strchr(s, ']');
+			if(!end) {
+				ret = -EINVAL;
+				break;
+			}
+			*end = 0;
+			section = SECTION_OTHER;
+			if(strcmp(s + 1, "device") == 0) {
+				section = SECTION_DEVICE;
+			} else if(strncmp(s + 1, "layer.", 6) == 0) {
+				section = SECTION_LAYER;
+				ret = mappa_cfg_layer_add(c, s + 7);
+			}
+			continue;
+		}
+
+		char *eq = strchr(s, '=');
+		if(!eq) {
+			ret = -EINVAL;
+			break;
+		}
+		*eq = 0;
+		char *key = mappa_strip(s);
+		char *val = mappa_strip(eq + 1);
+
+		if(section == SECTION_DEVICE) {
+			if(strcmp(key, "vendor") == 0)
+				snprintf(c->vendor, sizeof(c->vendor), "%s", val);
+			else if(strcmp(key, "device") == 0)
+				snprintf(c->device, sizeof(c->device), "%s", val);
+			else if(strcmp(key, "serial") == 0)
+				snprintf(c->serial, sizeof(c->serial), "%s", val);
+		} else if(section == SECTION_LAYER) {
+			ret = mappa_cfg_bind(&c->layers[c->layer_count - 1],
+					     key, val);
+		}
+	}
+	fclose(f);
+
+	if(ret) {
+		CTLRA_WARN(m->ctlra, "%s:%d: invalid line\n", file, lineno);
+		mappa_cfg_free(c);
+		return ret == -ENOMEM ? ret : -EINVAL;
+	}
+	if(!c->device[0] || !c->layer_count) {
+		CTLRA_WARN(m->ctlra, "%s: no [device] or [layer.*] section\n",
+			   file);
+		mappa_cfg_free(c);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&m->lock);
+	c->next = m->cfgs;
+	m->cfgs = c;
+	mappa_rebuild(m);
+	pthread_mutex_unlock(&m->lock);
+	return 0;
+}
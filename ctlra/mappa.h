@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OPENAV_CTLRA_MAPPA_H
+#define OPENAV_CTLRA_MAPPA_H
+
+#include <stdint.h>
+
+#include "ctlra.h"
+
+/** @file
+ * Mappa maps controller events onto application *targets*, and
+ * application state (*sources*) back onto the lights of the controller.
+ * The bindings are loaded from ini files: one file describes one device
+ * model, with one or more layers of bindings:
+ *
+ *     [device]
+ *     vendor = Native Instruments
+ *     device = Maschine Mk3
+ *
+ *     [layer.base]
+ *     slider.0 = volume
+ *     slider.0.curve = log
+ *     encoder.2 = filter
+ *     encoder.2.min = 0.1
+ *     button.4.hold = shift
+ *     light.7 = playing
+ *     light.7.color = 00ff00
+ *
+ *     [layer.shift]
+ *     slider.0 = pan
+ *
+ * Control keys are *button*, *encoder*, *slider* and *grid*, followed by
+ * the control id. The optional *curve* (lin, log, exp, inv), *min* and
+ * *max* scale the value passed to the target. A *hold* binding switches
+ * to the named layer while the control is held, *switch* latches it. The
+ * first layer in the file is active when the device is connected. Lights
+ * are bound by *light* and *grid_light* keys to a source, whose value
+ * sets the brightness of *color*.
+ *
+ * Bindings are compiled into flat per-layer tables indexed by the control
+ * id, so dispatching an event is an array lookup. Adding targets, sources
+ * or config files recompiles the tables on a helper thread, and the new
+ * tables are swapped in by mappa_iter(): remapping never blocks the
+ * event handling.
+ */
+
+#define MAPPA_NAME_MAX 32
+
+struct mappa_t;
+
+/** Called with the mapped value of a control bound to the target. The
+ * *token* is a copy of the one passed to mappa_target_add() */
+typedef void (*mappa_target_float_func)(uint32_t target_id,
+					float value,
+					void *token,
+					uint32_t token_size,
+					void *userdata);
+
+/** Called to read the value of a source, in the range 0.f to 1.f */
+typedef void (*mappa_source_float_func)(float *value,
+					void *token,
+					uint32_t token_size,
+					void *userdata);
+
+/** An application parameter that controls can be mapped to */
+struct mappa_target_t {
+	/** Name used to bind the target in config files */
+	const char *name;
+	mappa_target_float_func func;
+	void *userdata;
+};
+
+/** Application state that lights can be mapped to */
+struct mappa_source_t {
+	/** Name used to bind the source in config files */
+	const char *name;
+	mappa_source_float_func func;
+	void *userdata;
+};
+
+struct mappa_opts_t {
+	/** Options for the ctlra context created by mappa, or NULL */
+	const struct ctlra_create_opts_t *ctlra_opts;
+};
+
+/** Create a mappa instance: this creates a ctlra context and accepts
+ * every device found. Pass NULL *opts* for defaults. */
+struct mappa_t *mappa_create(const struct mappa_opts_t *opts);
+
+/** Poll the devices, dispatch events to targets, and update lights from
+ * sources. Call this regularly from a single thread. */
+void mappa_iter(struct mappa_t *m);
+
+/** Disconnect the devices and free the mappa instance */
+void mappa_destroy(struct mappa_t *m);
+
+/** Add a target. The *token* is copied, and passed to the target func on
+ * every call. The id of the new target is returned in *target_id*.
+ * @retval 0 Success
+ * @retval -EINVAL Invalid arguments
+ * @retval -EEXIST A target with the same name exists
+ * @retval -ENOMEM Out of memory
+ */
+int32_t mappa_target_add(struct mappa_t *m,
+			 const struct mappa_target_t *t,
+			 uint32_t *target_id,
+			 void *token,
+			 uint32_t token_size);
+
+/** Remove a target: controls bound to it are unbound.
+ * @retval 0 Success
+ * @retval -EINVAL No target with *target_id* exists
+ */
+int32_t mappa_target_remove(struct mappa_t *m, uint32_t target_id);
+
+/** Add a source, see mappa_target_add() for details */
+int32_t mappa_source_add(struct mappa_t *m,
+			 const struct mappa_source_t *s,
+			 uint32_t *source_id,
+			 void *token,
+			 uint32_t token_size);
+
+/** Remove a source, see mappa_target_remove() for details */
+int32_t mappa_source_remove(struct mappa_t *m, uint32_t source_id);
+
+/** Load the bindings of a device from an ini file. Files loaded later
+ * take precedence for the same device.
+ * @retval 0 Success
+ * @retval -errno Failed to open the file
+ * @retval -EINVAL Parse error, the line is printed as a warning
+ */
+int32_t mappa_add_config_file(struct mappa_t *m, const char *file);
+
+#endif /* OPENAV_CTLRA_MAPPA_H */
@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <jack/ringbuffer.h>
+
+#include "midi_jack.h"
+
+#define RING_SIZE (16 * 1024)
+
+// Maximum size of (sysex) message we expect to deal with on input.
+#define MAX_MSG_SIZE 1024
+
+/* header of each message in the rings, followed by the MIDI bytes */
+struct midi_jack_msg_t {
+	uint64_t time_us;
+	uint32_t size;
+};
+
+struct ctlra_midi_jack_t {
+	jack_client_t *client;
+	jack_port_t *port_in;
+	jack_port_t *port_out;
+	/* application -> process callback */
+	jack_ringbuffer_t *ring_out;
+	/* process callback -> ctlra_midi_jack_input_poll() */
+	jack_ringbuffer_t *ring_in;
+	ctlra_midi_input_cb input_cb;
+	void *input_cb_ud;
+};
+
+static uint64_t
+midi_jack_monotonic_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void
+midi_jack_process_output(struct ctlra_midi_jack_t *m, jack_nframes_t nframes)
+{
+	void *out = jack_port_get_buffer(m->port_out, nframes);
+	jack_midi_clear_buffer(out);
+
+	jack_nframes_t cycle_frames;
+	jack_time_t cycle_us;
+	jack_time_t next_us;
+	float period_us;
+	if(jack_get_cycle_times(m->client, &cycle_frames, &cycle_us,
+				&next_us, &period_us) || next_us <= cycle_us)
+		return;
+
+	/* The JACK clock may not be CLOCK_MONOTONIC: map event times */
+	int64_t offset = (int64_t)midi_jack_monotonic_us() -
+			 (int64_t)jack_get_time();
+	const jack_time_t span = next_us - cycle_us;
+	const int64_t window = (int64_t)cycle_us - (int64_t)span;
+
+	jack_nframes_t last = 0;
+	struct midi_jack_msg_t hdr;
+	while(jack_ringbuffer_read_space(m->ring_out) >= sizeof(hdr)) {
+		jack_ringbuffer_peek(m->ring_out, (char *)&hdr, sizeof(hdr));
+		/* the bytes are written after the header */
+		if(jack_ringbuffer_read_space(m->ring_out) < sizeof(hdr) + hdr.size)
+			break;
+		int64_t t = (int64_t)hdr.time_us - offset;
+
+		/* captured during this cycle: play it in the next one */
+		if(t >= (int64_t)cycle_us)
+			break;
+
+		jack_nframes_t frame = 0;
+		if(t > window)
+			frame = (uint64_t)(t - window) * nframes / span;
+		if(frame >= nframes)
+			frame = nframes - 1;
+		/* late or reordered events must not go back in time */
+		if(frame < last)
+			frame = last;
+		last = frame;
+
+		jack_ringbuffer_read_advance(m->ring_out, sizeof(hdr));
+		jack_midi_data_t *data = jack_midi_event_reserve(out, frame,
+								 hdr.size);
+		if(data)
+			jack_ringbuffer_read(m->ring_out, (char *)data,
+					     hdr.size);
+		else
+			jack_ringbuffer_read_advance(m->ring_out, hdr.size);
+	}
+}
+
+static void
+midi_jack_process_input(struct ctlra_midi_jack_t *m, jack_nframes_t nframes)
+{
+	void *in = jack_port_get_buffer(m->port_in, nframes);
+	uint32_t count = jack_midi_get_event_count(in);
+
+	for(uint32_t i = 0; i < count; i++) {
+		jack_midi_event_t ev;
+		if(jack_midi_event_get(&ev, in, i))
+			continue;
+		if(ev.size == 0 || ev.size > MAX_MSG_SIZE)
+			continue;
+
+		struct midi_jack_msg_t hdr = {
+			.time_us = 0,
+			.size = ev.size,
+		};
+		if(jack_ringbuffer_write_space(m->ring_in) <
+		   sizeof(hdr) + ev.size)
+			break;
+		jack_ringbuffer_write(m->ring_in, (char *)&hdr, sizeof(hdr));
+		jack_ringbuffer_write(m->ring_in, (char *)ev.buffer, ev.size);
+	}
+}
+
+static int
+midi_jack_process(jack_nframes_t nframes, void *arg)
+{
+	struct ctlra_midi_jack_t *m = arg;
+	midi_jack_process_output(m, nframes);
+	midi_jack_process_input(m, nframes);
+	return 0;
+}
+
+struct ctlra_midi_jack_t *ctlra_midi_jack_open(const char *name,
+					       ctlra_midi_input_cb cb,
+					       void *userdata)
+{
+	struct ctlra_midi_jack_t *m = calloc(1, sizeof(struct ctlra_midi_jack_t));
+	if(!m) return 0;
+
+	jack_status_t status;
+	m->client = jack_client_open(name, JackNoStartServer, &status);
+	if(!m->client) {
+		fprintf(stderr, "%s: failed to open client, status %d\n",
+			__func__, status);
+		free(m);
+		return 0;
+	}
+
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s_input", name);
+	m->port_in = jack_port_register(m->client, buf,
+					JACK_DEFAULT_MIDI_TYPE,
+					JackPortIsInput, 0);
+	snprintf(buf, sizeof(buf), "%s_output", name);
+	m->port_out = jack_port_register(m->client, buf,
+					 JACK_DEFAULT_MIDI_TYPE,
+					 JackPortIsOutput, 0);
+	m->ring_out = jack_ringbuffer_create(RING_SIZE);
+	m->ring_in = jack_ringbuffer_create(RING_SIZE);
+	if(!m->port_in || !m->port_out || !m->ring_out || !m->ring_in) {
+		fprintf(stderr, "%s: failed to create ports\n", __func__);
+		goto fail;
+	}
+	/* keep the process callback from page faulting on the rings */
+	jack_ringbuffer_mlock(m->ring_out);
+	jack_ringbuffer_mlock(m->ring_in);
+
+	/* Keep callback / ud */
+	m->input_cb = cb;
+	m->input_cb_ud = userdata;
+
+	jack_set_process_callback(m->client, midi_jack_process, m);
+	if(jack_activate(m->client)) {
+		fprintf(stderr, "%s: failed to activate client\n", __func__);
+		goto fail;
+	}
+
+	return m;
+fail:
+	jack_client_close(m->client);
+	if(m->ring_out)
+		jack_ringbuffer_free(m->ring_out);
+	if(m->ring_in)
+		jack_ringbuffer_free(m->ring_in);
+	free(m);
+	return 0;
+}
+
+void ctlra_midi_jack_destroy(struct ctlra_midi_jack_t *m)
+{
+	jack_deactivate(m->client);
+	jack_client_close(m->client);
+	jack_ringbuffer_free(m->ring_out);
+	jack_ringbuffer_free(m->ring_in);
+	free(m);
+}
+
+int ctlra_midi_jack_output_write(struct ctlra_midi_jack_t *m,
+				 uint64_t time_ns, uint8_t nbytes,
+				 uint8_t *buffer)
+{
+	if(nbytes == 0 || !buffer)
+		return -EINVAL;
+
+	struct midi_jack_msg_t hdr = {
+		.time_us = time_ns ? time_ns / 1000 : midi_jack_monotonic_us(),
+		.size = nbytes,
+	};
+
+	if(jack_ringbuffer_write_space(m->ring_out) < sizeof(hdr) + nbytes)
+		return -ENOSPC;
+
+	jack_ringbuffer_write(m->ring_out, (char *)&hdr, sizeof(hdr));
+	jack_ringbuffer_write(m->ring_out, (char *)buffer, nbytes);
+
+	return nbytes;
+}
+
+int ctlra_midi_jack_input_poll(struct ctlra_midi_jack_t *m)
+{
+	uint8_t buffer[MAX_MSG_SIZE];
+	struct midi_jack_msg_t hdr;
+
+	while(jack_ringbuffer_read_space(m->ring_in) >= sizeof(hdr)) {
+		jack_ringbuffer_peek(m->ring_in, (char *)&hdr, sizeof(hdr));
+		if(jack_ringbuffer_read_space(m->ring_in) < sizeof(hdr) + hdr.size)
+			break;
+		jack_ringbuffer_read_advance(m->ring_in, sizeof(hdr));
+		jack_ringbuffer_read(m->ring_in, (char *)buffer, hdr.size);
+		m->input_cb(hdr.size, buffer, m->input_cb_ud);
+	}
+
+	return 0;
+}
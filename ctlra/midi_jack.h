@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CTLRA_MIDI_JACK_H
+#define CTLRA_MIDI_JACK_H
+
+#include <stdint.h>
+
+#include "midi.h"
+
+/* JACK MIDI backend. Output is queued from the application thread into a
+ * lock-free ring, and written in the JACK process callback at the frame
+ * matching the time the controller event was captured. Events captured
+ * during one JACK period are played in the next one, at the same offset:
+ * the latency is one period, without the jitter of the ALSA sequencer.
+ *
+ * Each ctlra_midi_jack_t has one writer: call output_write() and
+ * input_poll() from a single thread, eg: the ctlra_idle_iter() thread. */
+
+struct ctlra_midi_jack_t;
+
+/** Open a JACK client with a MIDI input and output port */
+struct ctlra_midi_jack_t *ctlra_midi_jack_open(const char *name,
+					       ctlra_midi_input_cb cb,
+					       void *userdata);
+
+/** Deactivate and close the JACK client */
+void ctlra_midi_jack_destroy(struct ctlra_midi_jack_t *m);
+
+/** Queue MIDI output that was captured at *time_ns*, in CLOCK_MONOTONIC
+ * nanoseconds, or 0 for now. Does not block or allocate.
+ * @retval nbytes Success
+ * @retval -EINVAL Invalid message
+ * @retval -ENOSPC The ring is full, the message is dropped
+ */
+int ctlra_midi_jack_output_write(struct ctlra_midi_jack_t *m,
+				 uint64_t time_ns, uint8_t nbytes,
+				 uint8_t *buffer);
+
+/** Call this to poll for input. This results in the callback getting
+ * called once for each input event */
+int ctlra_midi_jack_input_poll(struct ctlra_midi_jack_t *m);
+
+#endif /* CTLRA_MIDI_JACK_H */
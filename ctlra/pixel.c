@@ -0,0 +1,709 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ctlra.h"
+#include "pixel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CTLRA_PIXEL_X86 1
+#include <immintrin.h>
+#endif
+
+static inline uint16_t
+pixel_bswap_565(uint16_t px)
+{
+	return (px << 8) | (px >> 8);
+}
+
+/* Reference conversion from 888 to 565. The *254 scaling is kept so all
+ * kernels produce exactly the output of the original scalar code. */
+static inline uint16_t
+pixel_888_to_dev(uint32_t p)
+{
+	uint16_t r = (p >> 16) & 0xff;
+	uint16_t g = (p >>  8) & 0xff;
+	uint16_t b = (p      ) & 0xff;
+	uint16_t r_ = (r * 254) & (((1 << 5)-1) << 11);
+	uint16_t g_ = ((g * 254) >> 5) & (((1 << 6)-1) << 5);
+	uint16_t b_ = (b * 254) >> 11;
+	return pixel_bswap_565(r_ | g_ | b_);
+}
+
+/* Tails of the vector kernels are inlined, so they are compiled for the
+ * same instruction set and don't mix SSE and AVX encodings */
+static inline __attribute__((always_inline)) void
+row_565_tail(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	for(uint32_t i = 0; i < px; i++)
+		dst[i] = pixel_bswap_565(src[i]);
+}
+
+static inline __attribute__((always_inline)) void
+row_888_tail(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	for(uint32_t i = 0; i < px; i++)
+		dst[i] = pixel_888_to_dev(src[i]);
+}
+
+static inline uint64_t
+pixel_tile_bit(uint32_t px_idx)
+{
+	uint32_t tile = px_idx / CTLRA_SCREEN_TILE_W;
+	return 1ull << (tile > 63 ? 63 : tile);
+}
+
+/* Diff tails take the whole row and a start index, so that the tile
+ * bits are computed from the pixel's position in the row */
+static inline __attribute__((always_inline)) uint64_t
+row_565_diff_tail(uint16_t *dst, const uint16_t *src, uint32_t i,
+		  uint32_t px)
+{
+	uint64_t tiles = 0;
+	for(; i < px; i++) {
+		uint16_t v = pixel_bswap_565(src[i]);
+		if(v != dst[i])
+			tiles |= pixel_tile_bit(i);
+		dst[i] = v;
+	}
+	return tiles;
+}
+
+static inline __attribute__((always_inline)) uint64_t
+row_888_diff_tail(uint16_t *dst, const uint32_t *src, uint32_t i,
+		  uint32_t px)
+{
+	uint64_t tiles = 0;
+	for(; i < px; i++) {
+		uint16_t v = pixel_888_to_dev(src[i]);
+		if(v != dst[i])
+			tiles |= pixel_tile_bit(i);
+		dst[i] = v;
+	}
+	return tiles;
+}
+
+static void
+row_565_scalar(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	row_565_tail(dst, src, px);
+}
+
+static void
+row_888_scalar(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	row_888_tail(dst, src, px);
+}
+
+static uint64_t
+row_565_diff_scalar(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	return row_565_diff_tail(dst, src, 0, px);
+}
+
+static uint64_t
+row_888_diff_scalar(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	return row_888_diff_tail(dst, src, 0, px);
+}
+
+#ifdef CTLRA_PIXEL_X86
+/* SSE version:
+ *  - 8 px per SIMD register (uint16_t per pixel)
+ *  - One load, two shifts, one or, store
+ *  - Manually unrolled 4x to diminish loop overhead
+ *  - All loads at start make compilers emit code that uses
+ *    multiple vector registers: xmm0, xmm1, xmm2, xmm3
+ */
+__attribute__((target("sse2"))) static void
+row_565_sse2(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	uint32_t i = 0;
+	for(; i + 32 <= px; i += 32) {
+		__m128i input1 = _mm_loadu_si128((__m128i*)&src[i]);
+		__m128i input2 = _mm_loadu_si128((__m128i*)&src[i+8]);
+		__m128i input3 = _mm_loadu_si128((__m128i*)&src[i+16]);
+		__m128i input4 = _mm_loadu_si128((__m128i*)&src[i+24]);
+
+		__m128i blend1 = _mm_or_si128(_mm_slli_epi16(input1, 8),
+					      _mm_srli_epi16(input1, 8));
+		__m128i blend2 = _mm_or_si128(_mm_slli_epi16(input2, 8),
+					      _mm_srli_epi16(input2, 8));
+		__m128i blend3 = _mm_or_si128(_mm_slli_epi16(input3, 8),
+					      _mm_srli_epi16(input3, 8));
+		__m128i blend4 = _mm_or_si128(_mm_slli_epi16(input4, 8),
+					      _mm_srli_epi16(input4, 8));
+
+		_mm_storeu_si128((__m128i *)&dst[i], blend1);
+		_mm_storeu_si128((__m128i *)&dst[i+8], blend2);
+		_mm_storeu_si128((__m128i *)&dst[i+16], blend3);
+		_mm_storeu_si128((__m128i *)&dst[i+24], blend4);
+	}
+	for(; i + 8 <= px; i += 8) {
+		__m128i input = _mm_loadu_si128((__m128i*)&src[i]);
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 _mm_or_si128(_mm_slli_epi16(input, 8),
+					      _mm_srli_epi16(input, 8)));
+	}
+	row_565_tail(&dst[i], &src[i], px - i);
+}
+
+/* 888 conversion of 4 pixels in 32 bit lanes. The multiply by 254 is
+ * done as (x << 8) - (x << 1), as SSE2 has no 32 bit multiply. Returns
+ * the device pixels in the low 16 bits of each lane. */
+__attribute__((target("sse2"))) static inline __m128i
+pixel_888_to_dev_sse2(__m128i v)
+{
+	const __m128i v_ff = _mm_set1_epi32(0xff);
+	__m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), v_ff);
+	__m128i g = _mm_and_si128(_mm_srli_epi32(v,  8), v_ff);
+	__m128i b = _mm_and_si128(v, v_ff);
+	r = _mm_sub_epi32(_mm_slli_epi32(r, 8), _mm_slli_epi32(r, 1));
+	g = _mm_sub_epi32(_mm_slli_epi32(g, 8), _mm_slli_epi32(g, 1));
+	b = _mm_sub_epi32(_mm_slli_epi32(b, 8), _mm_slli_epi32(b, 1));
+
+	r = _mm_and_si128(r, _mm_set1_epi32(0xf800));
+	g = _mm_and_si128(_mm_srli_epi32(g, 5), _mm_set1_epi32(0x07e0));
+	b = _mm_srli_epi32(b, 11);
+	__m128i px = _mm_or_si128(_mm_or_si128(r, g), b);
+
+	/* Byteswap within the low 16 bits */
+	return _mm_or_si128(_mm_and_si128(_mm_slli_epi32(px, 8),
+					  _mm_set1_epi32(0xff00)),
+			    _mm_srli_epi32(px, 8));
+}
+
+/* Convert 8 pixels, packed to 16 bit device pixels */
+__attribute__((target("sse2"))) static inline __m128i
+pixel_888_pack8_sse2(const uint32_t *src)
+{
+	__m128i lo = pixel_888_to_dev_sse2(_mm_loadu_si128((__m128i *)&src[0]));
+	__m128i hi = pixel_888_to_dev_sse2(_mm_loadu_si128((__m128i *)&src[4]));
+	/* Sign extend the 16 bit results, so the saturating pack
+	 * keeps every bit */
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+	return _mm_packs_epi32(lo, hi);
+}
+
+__attribute__((target("sse2"))) static void
+row_888_sse2(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	uint32_t i = 0;
+	for(; i + 8 <= px; i += 8)
+		_mm_storeu_si128((__m128i *)&dst[i],
+				 pixel_888_pack8_sse2(&src[i]));
+	row_888_tail(&dst[i], &src[i], px - i);
+}
+
+/* Fused convert and diff: each iteration converts one tile width of
+ * pixels, XORs against the previous frame and stores, so the frame is
+ * streamed through once. A tile is dirty if any XOR result is non-zero. */
+__attribute__((target("sse2"))) static inline __m128i
+pixel_565_conv_diff_sse2(uint16_t *dst, __m128i v, __m128i diff)
+{
+	v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	diff = _mm_or_si128(diff, _mm_xor_si128(v,
+				_mm_loadu_si128((__m128i *)dst)));
+	_mm_storeu_si128((__m128i *)dst, v);
+	return diff;
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+pixel_888_conv_diff_sse2(uint16_t *dst, __m128i v, __m128i diff)
+{
+	diff = _mm_or_si128(diff, _mm_xor_si128(v,
+				_mm_loadu_si128((__m128i *)dst)));
+	_mm_storeu_si128((__m128i *)dst, v);
+	return diff;
+}
+
+__attribute__((target("sse2"))) static inline int
+pixel_nonzero_sse2(__m128i v)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))
+		!= 0xffff;
+}
+
+__attribute__((target("sse2"))) static uint64_t
+row_565_diff_sse2(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	uint64_t tiles = 0;
+	uint32_t i = 0;
+	for(; i + 32 <= px; i += 32) {
+		__m128i diff = _mm_setzero_si128();
+		for(int j = 0; j < 32; j += 8)
+			diff = pixel_565_conv_diff_sse2(&dst[i+j],
+				_mm_loadu_si128((__m128i *)&src[i+j]), diff);
+		if(pixel_nonzero_sse2(diff))
+			tiles |= pixel_tile_bit(i);
+	}
+	return tiles | row_565_diff_tail(dst, src, i, px);
+}
+
+__attribute__((target("sse2"))) static uint64_t
+row_888_diff_sse2(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	uint64_t tiles = 0;
+	uint32_t i = 0;
+	for(; i + 32 <= px; i += 32) {
+		__m128i diff = _mm_setzero_si128();
+		for(int j = 0; j < 32; j += 8)
+			diff = pixel_888_conv_diff_sse2(&dst[i+j],
+				pixel_888_pack8_sse2(&src[i+j]), diff);
+		if(pixel_nonzero_sse2(diff))
+			tiles |= pixel_tile_bit(i);
+	}
+	return tiles | row_888_diff_tail(dst, src, i, px);
+}
+
+/* AVX2 version:
+ *  - See notes on SSE above
+ *  - Avx2 has 256 bit registers, so 2X as effective
+ */
+__attribute__((target("avx2"))) static void
+row_565_avx2(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	uint32_t i = 0;
+	for(; i + 64 <= px; i += 64) {
+		__m256i input1 = _mm256_loadu_si256((__m256i *)&src[i]);
+		__m256i input2 = _mm256_loadu_si256((__m256i *)&src[i+16]);
+		__m256i input3 = _mm256_loadu_si256((__m256i *)&src[i+32]);
+		__m256i input4 = _mm256_loadu_si256((__m256i *)&src[i+48]);
+
+		__m256i blend1 = _mm256_or_si256(_mm256_slli_epi16(input1, 8),
+						 _mm256_srli_epi16(input1, 8));
+		__m256i blend2 = _mm256_or_si256(_mm256_slli_epi16(input2, 8),
+						 _mm256_srli_epi16(input2, 8));
+		__m256i blend3 = _mm256_or_si256(_mm256_slli_epi16(input3, 8),
+						 _mm256_srli_epi16(input3, 8));
+		__m256i blend4 = _mm256_or_si256(_mm256_slli_epi16(input4, 8),
+						 _mm256_srli_epi16(input4, 8));
+
+		_mm256_storeu_si256((__m256i *)&dst[i], blend1);
+		_mm256_storeu_si256((__m256i *)&dst[i+16], blend2);
+		_mm256_storeu_si256((__m256i *)&dst[i+32], blend3);
+		_mm256_storeu_si256((__m256i *)&dst[i+48], blend4);
+	}
+	for(; i + 16 <= px; i += 16) {
+		__m256i input = _mm256_loadu_si256((__m256i *)&src[i]);
+		_mm256_storeu_si256((__m256i *)&dst[i],
+				    _mm256_or_si256(_mm256_slli_epi16(input, 8),
+						    _mm256_srli_epi16(input, 8)));
+	}
+	row_565_tail(&dst[i], &src[i], px - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+pixel_888_to_dev_avx2(__m256i v)
+{
+	const __m256i v_ff = _mm256_set1_epi32(0xff);
+	__m256i r = _mm256_and_si256(_mm256_srli_epi32(v, 16), v_ff);
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(v,  8), v_ff);
+	__m256i b = _mm256_and_si256(v, v_ff);
+	r = _mm256_sub_epi32(_mm256_slli_epi32(r, 8), _mm256_slli_epi32(r, 1));
+	g = _mm256_sub_epi32(_mm256_slli_epi32(g, 8), _mm256_slli_epi32(g, 1));
+	b = _mm256_sub_epi32(_mm256_slli_epi32(b, 8), _mm256_slli_epi32(b, 1));
+
+	r = _mm256_and_si256(r, _mm256_set1_epi32(0xf800));
+	g = _mm256_and_si256(_mm256_srli_epi32(g, 5),
+			     _mm256_set1_epi32(0x07e0));
+	b = _mm256_srli_epi32(b, 11);
+	__m256i px = _mm256_or_si256(_mm256_or_si256(r, g), b);
+
+	return _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(px, 8),
+						_mm256_set1_epi32(0xff00)),
+			       _mm256_srli_epi32(px, 8));
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+pixel_888_pack16_avx2(const uint32_t *src)
+{
+	__m256i lo = pixel_888_to_dev_avx2(_mm256_loadu_si256((__m256i *)&src[0]));
+	__m256i hi = pixel_888_to_dev_avx2(_mm256_loadu_si256((__m256i *)&src[8]));
+	lo = _mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 16);
+	hi = _mm256_srai_epi32(_mm256_slli_epi32(hi, 16), 16);
+	/* The pack works per 128 bit lane, reorder the 64 bit
+	 * quarters to restore pixel order */
+	__m256i packed = _mm256_packs_epi32(lo, hi);
+	return _mm256_permute4x64_epi64(packed, 0xD8);
+}
+
+__attribute__((target("avx2"))) static void
+row_888_avx2(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	uint32_t i = 0;
+	for(; i + 16 <= px; i += 16)
+		_mm256_storeu_si256((__m256i *)&dst[i],
+				    pixel_888_pack16_avx2(&src[i]));
+	row_888_tail(&dst[i], &src[i], px - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+pixel_conv_diff_avx2(uint16_t *dst, __m256i v, __m256i diff)
+{
+	diff = _mm256_or_si256(diff, _mm256_xor_si256(v,
+				_mm256_loadu_si256((__m256i *)dst)));
+	_mm256_storeu_si256((__m256i *)dst, v);
+	return diff;
+}
+
+__attribute__((target("avx2"))) static uint64_t
+row_565_diff_avx2(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	uint64_t tiles = 0;
+	uint32_t i = 0;
+	for(; i + 32 <= px; i += 32) {
+		__m256i in1 = _mm256_loadu_si256((__m256i *)&src[i]);
+		__m256i in2 = _mm256_loadu_si256((__m256i *)&src[i+16]);
+		in1 = _mm256_or_si256(_mm256_slli_epi16(in1, 8),
+				      _mm256_srli_epi16(in1, 8));
+		in2 = _mm256_or_si256(_mm256_slli_epi16(in2, 8),
+				      _mm256_srli_epi16(in2, 8));
+		__m256i diff = pixel_conv_diff_avx2(&dst[i], in1,
+						    _mm256_setzero_si256());
+		diff = pixel_conv_diff_avx2(&dst[i+16], in2, diff);
+		if(!_mm256_testz_si256(diff, diff))
+			tiles |= pixel_tile_bit(i);
+	}
+	return tiles | row_565_diff_tail(dst, src, i, px);
+}
+
+__attribute__((target("avx2"))) static uint64_t
+row_888_diff_avx2(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	uint64_t tiles = 0;
+	uint32_t i = 0;
+	for(; i + 32 <= px; i += 32) {
+		__m256i diff = pixel_conv_diff_avx2(&dst[i],
+				pixel_888_pack16_avx2(&src[i]),
+				_mm256_setzero_si256());
+		diff = pixel_conv_diff_avx2(&dst[i+16],
+				pixel_888_pack16_avx2(&src[i+16]), diff);
+		if(!_mm256_testz_si256(diff, diff))
+			tiles |= pixel_tile_bit(i);
+	}
+	return tiles | row_888_diff_tail(dst, src, i, px);
+}
+
+/* AVX-512 version:
+ *  - Same steps as SSE: one load, two shifts, one or, store
+ *  - 16 bit shifts require the BW extension
+ */
+__attribute__((target("avx512f,avx512bw"))) static void
+row_565_avx512(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	uint32_t i = 0;
+	for(; i + 128 <= px; i += 128) {
+		__m512i input1 = _mm512_loadu_si512((__m512i *)&src[i+ 0]);
+		__m512i input2 = _mm512_loadu_si512((__m512i *)&src[i+32]);
+		__m512i input3 = _mm512_loadu_si512((__m512i *)&src[i+64]);
+		__m512i input4 = _mm512_loadu_si512((__m512i *)&src[i+96]);
+
+		__m512i blend1 = _mm512_or_si512(_mm512_slli_epi16(input1, 8),
+						 _mm512_srli_epi16(input1, 8));
+		__m512i blend2 = _mm512_or_si512(_mm512_slli_epi16(input2, 8),
+						 _mm512_srli_epi16(input2, 8));
+		__m512i blend3 = _mm512_or_si512(_mm512_slli_epi16(input3, 8),
+						 _mm512_srli_epi16(input3, 8));
+		__m512i blend4 = _mm512_or_si512(_mm512_slli_epi16(input4, 8),
+						 _mm512_srli_epi16(input4, 8));
+
+		_mm512_storeu_si512((__m512i *)&dst[i+ 0], blend1);
+		_mm512_storeu_si512((__m512i *)&dst[i+32], blend2);
+		_mm512_storeu_si512((__m512i *)&dst[i+64], blend3);
+		_mm512_storeu_si512((__m512i *)&dst[i+96], blend4);
+	}
+	/* Remaining pixels with masked loads and stores, no scalar tail */
+	for(; i < px; i += 32) {
+		uint32_t n = px - i < 32 ? px - i : 32;
+		__mmask32 mask = n == 32 ? 0xffffffffu : (1u << n) - 1;
+		__m512i input = _mm512_maskz_loadu_epi16(mask, &src[i]);
+		_mm512_mask_storeu_epi16(&dst[i], mask,
+					 _mm512_or_si512(_mm512_slli_epi16(input, 8),
+							 _mm512_srli_epi16(input, 8)));
+	}
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m256i
+pixel_888_pack16_avx512(const uint32_t *src)
+{
+	const __m512i v_ff = _mm512_set1_epi32(0xff);
+	__m512i v = _mm512_loadu_si512((__m512i *)src);
+	__m512i r = _mm512_and_si512(_mm512_srli_epi32(v, 16), v_ff);
+	__m512i g = _mm512_and_si512(_mm512_srli_epi32(v,  8), v_ff);
+	__m512i b = _mm512_and_si512(v, v_ff);
+	r = _mm512_sub_epi32(_mm512_slli_epi32(r, 8), _mm512_slli_epi32(r, 1));
+	g = _mm512_sub_epi32(_mm512_slli_epi32(g, 8), _mm512_slli_epi32(g, 1));
+	b = _mm512_sub_epi32(_mm512_slli_epi32(b, 8), _mm512_slli_epi32(b, 1));
+
+	r = _mm512_and_si512(r, _mm512_set1_epi32(0xf800));
+	g = _mm512_and_si512(_mm512_srli_epi32(g, 5),
+			     _mm512_set1_epi32(0x07e0));
+	b = _mm512_srli_epi32(b, 11);
+	__m512i px16 = _mm512_or_si512(_mm512_or_si512(r, g), b);
+	px16 = _mm512_or_si512(_mm512_and_si512(_mm512_slli_epi32(px16, 8),
+						_mm512_set1_epi32(0xff00)),
+			       _mm512_srli_epi32(px16, 8));
+
+	/* Truncating narrow from 32 to 16 bit lanes, in order */
+	return _mm512_cvtepi32_epi16(px16);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void
+row_888_avx512(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	uint32_t i = 0;
+	for(; i + 16 <= px; i += 16)
+		_mm256_storeu_si256((__m256i *)&dst[i],
+				    pixel_888_pack16_avx512(&src[i]));
+	row_888_tail(&dst[i], &src[i], px - i);
+}
+
+/* A tile is one 512 bit register of 565 pixels, the tail is handled with
+ * masked loads, compare and store */
+__attribute__((target("avx512f,avx512bw"))) static uint64_t
+row_565_diff_avx512(uint16_t *dst, const uint16_t *src, uint32_t px)
+{
+	uint64_t tiles = 0;
+	for(uint32_t i = 0; i < px; i += 32) {
+		uint32_t n = px - i < 32 ? px - i : 32;
+		__mmask32 mask = n == 32 ? 0xffffffffu : (1u << n) - 1;
+		__m512i input = _mm512_maskz_loadu_epi16(mask, &src[i]);
+		__m512i old = _mm512_maskz_loadu_epi16(mask, &dst[i]);
+		input = _mm512_or_si512(_mm512_slli_epi16(input, 8),
+					_mm512_srli_epi16(input, 8));
+		if(_mm512_mask_cmpneq_epi16_mask(mask, input, old))
+			tiles |= pixel_tile_bit(i);
+		_mm512_mask_storeu_epi16(&dst[i], mask, input);
+	}
+	return tiles;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static uint64_t
+row_888_diff_avx512(uint16_t *dst, const uint32_t *src, uint32_t px)
+{
+	uint64_t tiles = 0;
+	uint32_t i = 0;
+	for(; i + 32 <= px; i += 32) {
+		__m256i v1 = pixel_888_pack16_avx512(&src[i]);
+		__m256i v2 = pixel_888_pack16_avx512(&src[i+16]);
+		__m512i v = _mm512_inserti64x4(_mm512_castsi256_si512(v1),
+					       v2, 1);
+		__m512i old = _mm512_loadu_si512((__m512i *)&dst[i]);
+		if(_mm512_cmpneq_epi16_mask(v, old))
+			tiles |= pixel_tile_bit(i);
+		_mm512_storeu_si512((__m512i *)&dst[i], v);
+	}
+	return tiles | row_888_diff_tail(dst, src, i, px);
+}
+#endif /* CTLRA_PIXEL_X86 */
+
+/* In order of preference, slowest first */
+static const struct ctlra_pixel_kernels_t pixel_kernels[] = {
+	{ "scalar", row_565_scalar, row_888_scalar,
+	  row_565_diff_scalar, row_888_diff_scalar },
+#ifdef CTLRA_PIXEL_X86
+	{ "sse2",   row_565_sse2,   row_888_sse2,
+	  row_565_diff_sse2,   row_888_diff_sse2 },
+	{ "avx2",   row_565_avx2,   row_888_avx2,
+	  row_565_diff_avx2,   row_888_diff_avx2 },
+	{ "avx512", row_565_avx512, row_888_avx512,
+	  row_565_diff_avx512, row_888_diff_avx512 },
+#endif
+};
+#define PIXEL_KERNELS_COUNT (sizeof(pixel_kernels) / sizeof(pixel_kernels[0]))
+
+static const struct ctlra_pixel_kernels_t *pixel_active = &pixel_kernels[0];
+
+static int
+pixel_kernels_supported(const struct ctlra_pixel_kernels_t *k)
+{
+#ifdef CTLRA_PIXEL_X86
+	__builtin_cpu_init();
+	if(k->row_565 == row_565_sse2)
+		return __builtin_cpu_supports("sse2");
+	if(k->row_565 == row_565_avx2)
+		return __builtin_cpu_supports("avx2");
+	if(k->row_565 == row_565_avx512)
+		return __builtin_cpu_supports("avx512f") &&
+		       __builtin_cpu_supports("avx512bw");
+#endif
+	return 1;
+}
+
+uint32_t
+ctlra_impl_pixel_kernels_get(const struct ctlra_pixel_kernels_t **kernels,
+			     uint32_t max)
+{
+	uint32_t n = 0;
+	for(uint32_t i = 0; i < PIXEL_KERNELS_COUNT && n < max; i++) {
+		if(pixel_kernels_supported(&pixel_kernels[i]))
+			kernels[n++] = &pixel_kernels[i];
+	}
+	return n;
+}
+
+const char *
+ctlra_impl_pixel_init(void)
+{
+	const struct ctlra_pixel_kernels_t *supported[PIXEL_KERNELS_COUNT];
+	uint32_t n = ctlra_impl_pixel_kernels_get(supported,
+						  PIXEL_KERNELS_COUNT);
+	const struct ctlra_pixel_kernels_t *k = supported[n - 1];
+
+	const char *force = getenv("CTLRA_PIXEL_KERNEL");
+	for(uint32_t i = 0; force && i < n; i++) {
+		if(strcmp(force, supported[i]->name) == 0)
+			k = supported[i];
+	}
+
+	__atomic_store_n(&pixel_active, k, __ATOMIC_RELAXED);
+	return k->name;
+}
+
+void
+ctlra_impl_pixel_565_to_dev(uint8_t *device_data, uint32_t device_bytes,
+			    const uint8_t *input_data, uint32_t width,
+			    uint32_t height, uint32_t input_stride)
+{
+	const struct ctlra_pixel_kernels_t *k =
+		__atomic_load_n(&pixel_active, __ATOMIC_RELAXED);
+	const uint32_t row_bytes = width * sizeof(uint16_t);
+	if(row_bytes == 0)
+		return;
+	if(height > device_bytes / row_bytes)
+		height = device_bytes / row_bytes;
+
+	for(uint32_t j = 0; j < height; j++)
+		k->row_565((uint16_t *)&device_data[j * row_bytes],
+			   (const uint16_t *)&input_data[j * input_stride],
+			   width);
+}
+
+void
+ctlra_impl_pixel_888_to_dev(uint8_t *device_data, uint32_t device_bytes,
+			    const uint8_t *input_data, uint32_t width,
+			    uint32_t height, uint32_t input_stride)
+{
+	const struct ctlra_pixel_kernels_t *k =
+		__atomic_load_n(&pixel_active, __ATOMIC_RELAXED);
+	const uint32_t row_bytes = width * sizeof(uint16_t);
+	if(row_bytes == 0)
+		return;
+	if(height > device_bytes / row_bytes)
+		height = device_bytes / row_bytes;
+
+	for(uint32_t j = 0; j < height; j++)
+		k->row_888((uint16_t *)&device_data[j * row_bytes],
+			   (const uint32_t *)&input_data[j * input_stride],
+			   width);
+}
+
+/* Row loop shared by both diff conversions */
+static int
+pixel_to_dev_diff(uint8_t *device_data, uint32_t device_bytes,
+		  const uint8_t *input_data, uint32_t width, uint32_t height,
+		  uint32_t input_stride, uint64_t *tiles, uint32_t tiles_count,
+		  struct ctlra_screen_zone_t *zone, int is_888)
+{
+	const struct ctlra_pixel_kernels_t *k =
+		__atomic_load_n(&pixel_active, __ATOMIC_RELAXED);
+	const uint32_t row_bytes = width * sizeof(uint16_t);
+	if(row_bytes == 0)
+		return 0;
+	if(height > device_bytes / row_bytes)
+		height = device_bytes / row_bytes;
+
+	uint64_t all = 0;
+	uint32_t y0 = height;
+	uint32_t y1 = 0;
+	for(uint32_t j = 0; j < height; j++) {
+		uint16_t *dst = (uint16_t *)&device_data[j * row_bytes];
+		const uint8_t *src = &input_data[j * input_stride];
+		uint64_t row = is_888 ?
+			k->row_888_diff(dst, (const uint32_t *)src, width) :
+			k->row_565_diff(dst, (const uint16_t *)src, width);
+		if(!row)
+			continue;
+		all |= row;
+		if(j < y0)
+			y0 = j;
+		y1 = j + 1;
+		uint32_t t = j / CTLRA_SCREEN_TILE_H;
+		if(tiles && t < tiles_count)
+			tiles[t] |= row;
+	}
+
+	if(!all)
+		return 0;
+
+	if(zone) {
+		/* Tile aligned horizontally, exact rows vertically */
+		uint32_t x0 = __builtin_ctzll(all) * CTLRA_SCREEN_TILE_W;
+		uint32_t last = 63 - __builtin_clzll(all);
+		uint32_t x1 = last == 63 ? width :
+			      (last + 1) * CTLRA_SCREEN_TILE_W;
+		if(x1 > width)
+			x1 = width;
+		zone->x = x0;
+		zone->y = y0;
+		zone->w = x1 - x0;
+		zone->h = y1 - y0;
+	}
+	return 1;
+}
+
+int
+ctlra_impl_pixel_565_to_dev_diff(uint8_t *device_data, uint32_t device_bytes,
+				 const uint8_t *input_data, uint32_t width,
+				 uint32_t height, uint32_t input_stride,
+				 uint64_t *tiles, uint32_t tiles_count,
+				 struct ctlra_screen_zone_t *zone)
+{
+	return pixel_to_dev_diff(device_data, device_bytes, input_data,
+				 width, height, input_stride, tiles,
+				 tiles_count, zone, 0);
+}
+
+int
+ctlra_impl_pixel_888_to_dev_diff(uint8_t *device_data, uint32_t device_bytes,
+				 const uint8_t *input_data, uint32_t width,
+				 uint32_t height, uint32_t input_stride,
+				 uint64_t *tiles, uint32_t tiles_count,
+				 struct ctlra_screen_zone_t *zone)
+{
+	return pixel_to_dev_diff(device_data, device_bytes, input_data,
+				 width, height, input_stride, tiles,
+				 tiles_count, zone, 1);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CTLRA_PIXEL_H
+#define CTLRA_PIXEL_H
+
+#include <stdint.h>
+
+struct ctlra_screen_zone_t;
+
+/* Pixel conversion kernels for screen drawing. Each kernel set is built
+ * for a specific instruction set, and the best one supported by the host
+ * CPU is selected at runtime by ctlra_impl_pixel_init(). Device pixels
+ * are 565 with the bytes swapped, as the NI screens expect. */
+struct ctlra_pixel_kernels_t {
+	const char *name;
+	/* Convert *px* pixels of native endian 565 to device 565 */
+	void (*row_565)(uint16_t *dst, const uint16_t *src, uint32_t px);
+	/* Convert *px* pixels of xRGB 8888 (Cairo RGB24/ARGB32) to device */
+	void (*row_888)(uint16_t *dst, const uint32_t *src, uint32_t px);
+	/* Convert as above, comparing with the pixels in *dst* before they
+	 * are overwritten. Returns a mask of CTLRA_SCREEN_TILE_W wide
+	 * column tiles that changed. */
+	uint64_t (*row_565_diff)(uint16_t *dst, const uint16_t *src,
+				 uint32_t px);
+	uint64_t (*row_888_diff)(uint16_t *dst, const uint32_t *src,
+				 uint32_t px);
+};
+
+/* Select the kernels for this host. The CTLRA_PIXEL_KERNEL environment
+ * variable can force a kernel set by name, if the CPU supports it.
+ * Returns the name of the selected kernels. */
+const char *ctlra_impl_pixel_init(void);
+
+/* Retrieve all kernel sets the host supports, the fastest last.
+ * Returns the number of entries written to *kernels*. */
+uint32_t ctlra_impl_pixel_kernels_get(const struct ctlra_pixel_kernels_t **kernels,
+				      uint32_t max);
+
+/* Convert a whole surface of *width* x *height* pixels with rows of
+ * *input_stride* bytes, to a packed device buffer of *device_bytes*.
+ * Rows that do not fit in the device buffer are not converted. */
+void ctlra_impl_pixel_565_to_dev(uint8_t *device_data, uint32_t device_bytes,
+				 const uint8_t *input_data, uint32_t width,
+				 uint32_t height, uint32_t input_stride);
+void ctlra_impl_pixel_888_to_dev(uint8_t *device_data, uint32_t device_bytes,
+				 const uint8_t *input_data, uint32_t width,
+				 uint32_t height, uint32_t input_stride);
+
+/* Convert a whole surface as above, diffing against the previous frame
+ * that is in *device_data*. The changed tiles are OR-ed into *tiles*,
+ * which holds *tiles_count* rows of tiles, and the bounding box of the
+ * changed tiles, clipped to the surface, is written to *zone*.
+ * Returns 1 if any pixel changed, 0 otherwise. */
+int ctlra_impl_pixel_565_to_dev_diff(uint8_t *device_data,
+				     uint32_t device_bytes,
+				     const uint8_t *input_data,
+				     uint32_t width, uint32_t height,
+				     uint32_t input_stride,
+				     uint64_t *tiles, uint32_t tiles_count,
+				     struct ctlra_screen_zone_t *zone);
+int ctlra_impl_pixel_888_to_dev_diff(uint8_t *device_data,
+				     uint32_t device_bytes,
+				     const uint8_t *input_data,
+				     uint32_t width, uint32_t height,
+				     uint32_t input_stride,
+				     uint64_t *tiles, uint32_t tiles_count,
+				     struct ctlra_screen_zone_t *zone);
+
+#endif /* CTLRA_PIXEL_H */
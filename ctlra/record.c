@@ -0,0 +1,1009 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "record.h"
+
+/* The file is written in host byte order, little endian on every
+ * platform ctlra supports. Layout:
+ *   struct rec_file_hdr_t
+ *   blocks: struct rec_block_t, then *size* bytes of payload
+ *   an index block, then struct rec_trailer_t, once the recorder is
+ *   destroyed
+ */
+#define REC_MAGIC          "CTLRAREC"
+#define REC_VERSION        1
+#define REC_BLOCK_MAGIC    0x4b4c4243 /* CBLK */
+#define REC_TRAILER_MAGIC  0x58444943 /* CIDX */
+
+#define REC_BLOCK_EVENTS   0
+#define REC_BLOCK_SOURCES  1
+#define REC_BLOCK_INDEX    2
+
+/* payload of an event block is closed at this size, or once it spans
+ * REC_BLOCK_NS: a crash loses about that much of the recording */
+#define REC_BLOCK_BYTES    65536
+#define REC_BLOCK_NS       1000000000ull
+/* worst case size of one encoded event */
+#define REC_EVENT_BYTES    32
+/* writer sleep when the ring is empty */
+#define REC_WRITER_SLEEP_NS 10000000
+/* events passed to the event func in one call during replay */
+#define REC_BATCH_MAX      64
+
+#define REC_SOURCE_CHANGE  (1<<3)
+
+struct rec_file_hdr_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t unused;
+	/* CLOCK_REALTIME of time 0, in ns */
+	uint64_t start;
+};
+
+struct rec_block_t {
+	uint32_t magic;
+	uint16_t kind;
+	/* index blocks: the number of sources before the index entries */
+	uint16_t aux;
+	uint32_t size;
+	/* events, sources or index entries */
+	uint32_t count;
+	/* time of the first and last event of an event block */
+	uint64_t time;
+	uint64_t time_last;
+};
+
+struct rec_source_t {
+	uint32_t id;
+	uint32_t unique_id;
+	char vendor[CTLRA_STR_MAX];
+	char device[CTLRA_STR_MAX];
+	char serial[CTLRA_DEV_SERIAL_MAX];
+};
+
+struct rec_index_t {
+	/* file offset of the block header */
+	uint64_t offset;
+	uint64_t time;
+	uint64_t time_last;
+};
+
+struct rec_trailer_t {
+	uint32_t magic;
+	uint32_t unused;
+	/* file offset of the index block */
+	uint64_t offset;
+};
+
+/* An event in the ring */
+struct rec_entry_t {
+	uint64_t time;
+	uint32_t source;
+	uint32_t unused;
+	struct ctlra_event_compact_t event;
+};
+
+struct ctlra_recorder_t {
+	/* producer: written by the pushing thread */
+	uint32_t head __attribute__((aligned(64)));
+	uint64_t dropped;
+	struct timespec start;
+	struct ctlra_dev_t *devs[CTLRA_RECORD_SOURCES_MAX];
+	uint32_t source_count;
+	/* the last device pushed, and its source */
+	struct ctlra_dev_t *last_dev;
+	uint32_t last_source;
+
+	/* consumer: written by the writer thread */
+	uint32_t tail __attribute__((aligned(64)));
+	uint32_t sources_written;
+	int fd;
+	uint64_t offset;
+	int32_t error;
+	struct rec_index_t *index;
+	uint32_t index_count;
+	uint32_t index_size;
+	struct rec_block_t block;
+	uint8_t *payload;
+	uint32_t block_source;
+	uint64_t block_prev;
+
+	/* shared */
+	uint32_t mask __attribute__((aligned(64)));
+	int quit;
+	pthread_t thread;
+	struct rec_source_t sources[CTLRA_RECORD_SOURCES_MAX];
+	struct rec_entry_t *ring;
+};
+
+struct ctlra_replay_t {
+	const uint8_t *map;
+	uint64_t size;
+	struct rec_index_t *index;
+	uint32_t index_count;
+	struct ctlra_replay_source_t *sources;
+	uint32_t source_count;
+	uint64_t duration;
+	/* replay time reached by seek or play, the start of realtime play */
+	uint64_t playhead;
+	/* set while the event func runs, tell() is then the playhead */
+	uint8_t in_func;
+
+	/* decoder: the current block */
+	uint32_t block;
+	const uint8_t *pos;
+	const uint8_t *end;
+	uint32_t left;
+	uint64_t time;
+	uint32_t source;
+
+	/* the next event to replay, decoded ahead */
+	int has_next;
+	uint64_t next_time;
+	uint32_t next_source;
+	struct ctlra_event_compact_t next;
+};
+
+static inline uint8_t *
+rec_put_varint(uint8_t *p, uint64_t v)
+{
+	while(v >= 0x80) {
+		*p++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static inline const uint8_t *
+rec_get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	uint64_t r = 0;
+	for(uint32_t s = 0; s < 64 && p < end; s += 7) {
+		uint8_t b = *p++;
+		r |= (uint64_t)(b & 0x7f) << s;
+		if(!(b & 0x80)) {
+			*v = r;
+			return p;
+		}
+	}
+	return 0;
+}
+
+/* Whether the compact event carries a float *value* */
+static inline int
+rec_has_value(const struct ctlra_event_compact_t *e)
+{
+	switch(e->type) {
+	case CTLRA_EVENT_BUTTON:
+	case CTLRA_EVENT_GRID:
+		return e->flags & CTLRA_EVENT_COMPACT_PRESSURE;
+	case CTLRA_EVENT_ENCODER:
+		return e->flags & CTLRA_EVENT_COMPACT_FLOAT;
+	default:
+		return 1;
+	}
+}
+
+static inline uint64_t
+rec_now(const struct timespec *start)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)(ts.tv_sec - start->tv_sec) * 1000000000ull +
+	       ts.tv_nsec - start->tv_nsec;
+}
+
+/* Producer side */
+
+/* Stands for no device in last_dev and in the slots of removed devices.
+ * Unlike NULL, which records events of no device, no push can pass it */
+static const char rec_no_dev;
+#define REC_NO_DEV ((struct ctlra_dev_t *)&rec_no_dev)
+
+static void
+rec_drop(struct ctlra_recorder_t *rec, uint32_t num)
+{
+	__atomic_store_n(&rec->dropped, rec->dropped + num, __ATOMIC_RELAXED);
+}
+
+static uint32_t
+rec_source(struct ctlra_recorder_t *rec, struct ctlra_dev_t *dev)
+{
+	if(dev == rec->last_dev)
+		return rec->last_source;
+
+	uint32_t i;
+	for(i = 0; i < rec->source_count; i++)
+		if(rec->devs[i] == dev)
+			break;
+
+	if(i == rec->source_count) {
+		if(i == CTLRA_RECORD_SOURCES_MAX)
+			return UINT32_MAX;
+		struct rec_source_t *s = &rec->sources[i];
+		memset(s, 0, sizeof(*s));
+		s->id = i;
+		if(dev) {
+			struct ctlra_dev_info_t info;
+			ctlra_dev_get_info(dev, &info);
+			s->unique_id = info.unique_id;
+			memcpy(s->vendor, info.vendor, sizeof(s->vendor));
+			memcpy(s->device, info.device, sizeof(s->device));
+			memcpy(s->serial, info.serial, sizeof(s->serial));
+		}
+		rec->devs[i] = dev;
+		/* publishes the source to the writer */
+		__atomic_store_n(&rec->source_count, i + 1, __ATOMIC_RELEASE);
+	}
+
+	rec->last_dev = dev;
+	rec->last_source = i;
+	return i;
+}
+
+/* Returns the ring space for up to *num* events, counting the rest as
+ * dropped */
+static uint32_t
+rec_reserve(struct ctlra_recorder_t *rec, uint32_t num)
+{
+	uint32_t tail = __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE);
+	uint32_t space = rec->mask + 1 - (rec->head - tail);
+	if(num > space) {
+		rec_drop(rec, num - space);
+		num = space;
+	}
+	return num;
+}
+
+uint32_t
+ctlra_recorder_push(struct ctlra_recorder_t *rec, struct ctlra_dev_t *dev,
+		    uint32_t num_events, struct ctlra_event_t **events)
+{
+	uint32_t source = rec_source(rec, dev);
+	if(source == UINT32_MAX) {
+		rec_drop(rec, num_events);
+		return 0;
+	}
+	uint32_t n = rec_reserve(rec, num_events);
+	uint64_t time = rec_now(&rec->start);
+	uint32_t head = rec->head;
+	uint32_t written = 0;
+
+	for(uint32_t i = 0; i < n; i++) {
+		struct rec_entry_t *e = &rec->ring[(head + written) & rec->mask];
+		if(ctlra_event_to_compact(events[i], &e->event))
+			continue;
+		e->time = time;
+		e->source = source;
+		written++;
+	}
+
+	__atomic_store_n(&rec->head, head + written, __ATOMIC_RELEASE);
+	return written;
+}
+
+uint32_t
+ctlra_recorder_push_compact(struct ctlra_recorder_t *rec,
+			    struct ctlra_dev_t *dev, uint32_t num_events,
+			    const struct ctlra_event_compact_t *events)
+{
+	uint32_t source = rec_source(rec, dev);
+	if(source == UINT32_MAX) {
+		rec_drop(rec, num_events);
+		return 0;
+	}
+	uint32_t n = rec_reserve(rec, num_events);
+	uint64_t time = rec_now(&rec->start);
+	uint32_t head = rec->head;
+
+	for(uint32_t i = 0; i < n; i++) {
+		struct rec_entry_t *e = &rec->ring[(head + i) & rec->mask];
+		e->time = time;
+		e->source = source;
+		e->event = events[i];
+	}
+
+	__atomic_store_n(&rec->head, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+void
+ctlra_recorder_dev_removed(struct ctlra_recorder_t *rec,
+			   struct ctlra_dev_t *dev)
+{
+	for(uint32_t i = 0; i < rec->source_count; i++)
+		if(rec->devs[i] == dev)
+			rec->devs[i] = REC_NO_DEV;
+	if(rec->last_dev == dev) {
+		rec->last_dev = REC_NO_DEV;
+		rec->last_source = UINT32_MAX;
+	}
+}
+
+uint64_t
+ctlra_recorder_dropped(struct ctlra_recorder_t *rec)
+{
+	return __atomic_load_n(&rec->dropped, __ATOMIC_RELAXED);
+}
+
+/* Writer side */
+
+static void
+rec_write(struct ctlra_recorder_t *rec, const void *data, uint32_t size)
+{
+	const uint8_t *p = data;
+	while(size && !rec->error) {
+		ssize_t w = write(rec->fd, p, size);
+		if(w < 0) {
+			if(errno == EINTR)
+				continue;
+			rec->error = -errno;
+			break;
+		}
+		p += w;
+		size -= w;
+		rec->offset += w;
+	}
+}
+
+static void
+rec_block_write(struct ctlra_recorder_t *rec, uint32_t kind, uint32_t aux,
+		const void *payload, uint32_t size, uint32_t count)
+{
+	struct rec_block_t b = {
+		.magic = REC_BLOCK_MAGIC,
+		.kind = kind,
+		.aux = aux,
+		.size = size,
+		.count = count,
+	};
+	if(kind == REC_BLOCK_EVENTS) {
+		b.time = rec->block.time;
+		b.time_last = rec->block.time_last;
+	}
+	rec_write(rec, &b, sizeof(b));
+	rec_write(rec, payload, size);
+}
+
+static void
+rec_block_flush(struct ctlra_recorder_t *rec)
+{
+	if(!rec->block.count)
+		return;
+
+	if(rec->index_count == rec->index_size) {
+		uint32_t size = rec->index_size ? rec->index_size * 2 : 64;
+		void *index = realloc(rec->index, size * sizeof(*rec->index));
+		if(!index) {
+			rec->error = -ENOMEM;
+		} else {
+			rec->index = index;
+			rec->index_size = size;
+		}
+	}
+	if(!rec->error) {
+		rec->index[rec->index_count++] = (struct rec_index_t) {
+			.offset = rec->offset,
+			.time = rec->block.time,
+			.time_last = rec->block.time_last,
+		};
+	}
+
+	rec_block_write(rec, REC_BLOCK_EVENTS, 0, rec->payload,
+			rec->block.size, rec->block.count);
+	rec->block.size = 0;
+	rec->block.count = 0;
+}
+
+static void
+rec_encode(struct ctlra_recorder_t *rec, const struct rec_entry_t *e)
+{
+	if(rec->block.count &&
+	   (rec->block.size > REC_BLOCK_BYTES - REC_EVENT_BYTES ||
+	    e->time - rec->block.time >= REC_BLOCK_NS))
+		rec_block_flush(rec);
+
+	/* every block decodes on its own: the first event is relative to
+	 * the block time, and names its source */
+	int new_source = 0;
+	if(!rec->block.count) {
+		rec->block.time = e->time;
+		rec->block_prev = e->time;
+		new_source = 1;
+	}
+	new_source |= e->source != rec->block_source;
+
+	const struct ctlra_event_compact_t *ev = &e->event;
+	uint8_t *p = rec->payload + rec->block.size;
+	*p++ = (ev->type & 0x7) | (new_source ? REC_SOURCE_CHANGE : 0) |
+	       (ev->flags << 4);
+	if(new_source)
+		p = rec_put_varint(p, e->source);
+	p = rec_put_varint(p, e->time - rec->block_prev);
+	p = rec_put_varint(p, ev->id);
+	if(ev->type == CTLRA_EVENT_GRID)
+		p = rec_put_varint(p, ev->pos);
+
+	if(rec_has_value(ev)) {
+		memcpy(p, &ev->value, sizeof(ev->value));
+		p += sizeof(ev->value);
+	} else if(ev->type == CTLRA_EVENT_ENCODER) {
+		/* zigzag, small deltas of either sign take one byte */
+		int32_t d = ev->delta;
+		p = rec_put_varint(p, ((uint32_t)d << 1) ^ (uint32_t)(d >> 31));
+	}
+
+	rec->block.size = p - rec->payload;
+	rec->block.count++;
+	rec->block.time_last = e->time;
+	rec->block_prev = e->time;
+	rec->block_source = e->source;
+}
+
+/* Writes sources published since the last call */
+static void
+rec_sources_flush(struct ctlra_recorder_t *rec)
+{
+	uint32_t count = __atomic_load_n(&rec->source_count, __ATOMIC_ACQUIRE);
+	if(count == rec->sources_written)
+		return;
+	uint32_t first = rec->sources_written;
+	rec_block_write(rec, REC_BLOCK_SOURCES, 0, &rec->sources[first],
+			(count - first) * sizeof(struct rec_source_t),
+			count - first);
+	rec->sources_written = count;
+}
+
+/* Returns the number of events drained from the ring */
+static uint32_t
+rec_drain(struct ctlra_recorder_t *rec)
+{
+	uint32_t head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+	uint32_t tail = rec->tail;
+	if(head == tail)
+		return 0;
+
+	rec_sources_flush(rec);
+	for(uint32_t i = tail; i != head; i++)
+		rec_encode(rec, &rec->ring[i & rec->mask]);
+	__atomic_store_n(&rec->tail, head, __ATOMIC_RELEASE);
+	return head - tail;
+}
+
+static void *
+rec_writer_thread(void *ud)
+{
+	struct ctlra_recorder_t *rec = ud;
+	const struct timespec sleep = { 0, REC_WRITER_SLEEP_NS };
+
+	for(;;) {
+		int quit = __atomic_load_n(&rec->quit, __ATOMIC_ACQUIRE);
+		if(rec_drain(rec))
+			continue;
+		if(quit)
+			break;
+
+		/* close a block on a quiet device, so it reaches the disk */
+		if(rec->block.count &&
+		   rec_now(&rec->start) - rec->block.time >= REC_BLOCK_NS)
+			rec_block_flush(rec);
+		nanosleep(&sleep, 0);
+	}
+
+	rec_block_flush(rec);
+	rec_sources_flush(rec);
+	return 0;
+}
+
+struct ctlra_recorder_t *
+ctlra_recorder_create(const char *path, uint32_t ring_events)
+{
+	if(!path)
+		return 0;
+	if(!ring_events)
+		ring_events = CTLRA_RECORDER_RING_DEFAULT;
+	if(ring_events > (1u << 30))
+		return 0;
+
+	uint32_t size = 1;
+	while(size < ring_events)
+		size <<= 1;
+
+	struct ctlra_recorder_t *rec = 0;
+	if(posix_memalign((void **)&rec, 64, sizeof(*rec)))
+		return 0;
+	memset(rec, 0, sizeof(*rec));
+	rec->mask = size - 1;
+	rec->last_dev = REC_NO_DEV;
+	rec->last_source = UINT32_MAX;
+	rec->fd = -1;
+
+	rec->ring = malloc(size * sizeof(struct rec_entry_t));
+	rec->payload = malloc(REC_BLOCK_BYTES);
+	if(!rec->ring || !rec->payload)
+		goto fail;
+	/* no page faults on the first pass through the ring */
+	memset(rec->ring, 0, size * sizeof(struct rec_entry_t));
+
+	rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(rec->fd < 0)
+		goto fail;
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	clock_gettime(CLOCK_MONOTONIC, &rec->start);
+	struct rec_file_hdr_t hdr = {
+		.magic = REC_MAGIC,
+		.version = REC_VERSION,
+		.start = now.tv_sec * 1000000000ull + now.tv_nsec,
+	};
+	rec_write(rec, &hdr, sizeof(hdr));
+	if(rec->error)
+		goto fail;
+
+	if(pthread_create(&rec->thread, 0, rec_writer_thread, rec))
+		goto fail;
+
+	return rec;
+
+fail:
+	if(rec->fd >= 0)
+		close(rec->fd);
+	free(rec->payload);
+	free(rec->ring);
+	free(rec);
+	return 0;
+}
+
+int32_t
+ctlra_recorder_destroy(struct ctlra_recorder_t *rec)
+{
+	if(!rec)
+		return -EINVAL;
+
+	__atomic_store_n(&rec->quit, 1, __ATOMIC_RELEASE);
+	pthread_join(rec->thread, 0);
+
+	/* the index block holds all sources, then the index entries */
+	uint32_t sources = rec->sources_written;
+	struct rec_trailer_t trailer = {
+		.magic = REC_TRAILER_MAGIC,
+		.offset = rec->offset,
+	};
+	struct rec_block_t b = {
+		.magic = REC_BLOCK_MAGIC,
+		.kind = REC_BLOCK_INDEX,
+		.aux = sources,
+		.size = sources * sizeof(struct rec_source_t) +
+			rec->index_count * sizeof(struct rec_index_t),
+		.count = rec->index_count,
+	};
+	rec_write(rec, &b, sizeof(b));
+	rec_write(rec, rec->sources, sources * sizeof(struct rec_source_t));
+	rec_write(rec, rec->index,
+		  rec->index_count * sizeof(struct rec_index_t));
+	rec_write(rec, &trailer, sizeof(trailer));
+
+	int32_t ret = rec->error;
+	if(close(rec->fd) && !ret)
+		ret = -errno;
+
+	free(rec->index);
+	free(rec->payload);
+	free(rec->ring);
+	free(rec);
+	return ret;
+}
+
+/* Replay */
+
+/* Reads the block header at *offset*, if a whole block fits the file */
+static int
+rec_block_read(const struct ctlra_replay_t *r, uint64_t offset,
+	       struct rec_block_t *b)
+{
+	if(offset > r->size || r->size - offset < sizeof(*b))
+		return -EINVAL;
+	memcpy(b, r->map + offset, sizeof(*b));
+	if(b->magic != REC_BLOCK_MAGIC ||
+	   r->size - offset - sizeof(*b) < b->size)
+		return -EINVAL;
+	return 0;
+}
+
+static int
+rec_sources_add(struct ctlra_replay_t *r, const uint8_t *data,
+		uint32_t count)
+{
+	for(uint32_t i = 0; i < count; i++) {
+		struct rec_source_t s;
+		memcpy(&s, data + i * sizeof(s), sizeof(s));
+		if(s.id >= CTLRA_RECORD_SOURCES_MAX)
+			return -EINVAL;
+		if(s.id >= r->source_count) {
+			void *n = realloc(r->sources, (s.id + 1) *
+					  sizeof(*r->sources));
+			if(!n)
+				return -ENOMEM;
+			r->sources = n;
+			memset(&r->sources[r->source_count], 0,
+			       (s.id + 1 - r->source_count) *
+			       sizeof(*r->sources));
+			r->source_count = s.id + 1;
+		}
+		struct ctlra_replay_source_t *d = &r->sources[s.id];
+		memcpy(d->vendor, s.vendor, sizeof(d->vendor));
+		memcpy(d->device, s.device, sizeof(d->device));
+		memcpy(d->serial, s.serial, sizeof(d->serial));
+		d->vendor[sizeof(d->vendor) - 1] = 0;
+		d->device[sizeof(d->device) - 1] = 0;
+		d->serial[sizeof(d->serial) - 1] = 0;
+		d->unique_id = s.unique_id;
+	}
+	return 0;
+}
+
+static int
+rec_index_load(struct ctlra_replay_t *r)
+{
+	struct rec_trailer_t t;
+	struct rec_block_t b;
+	if(r->size < sizeof(struct rec_file_hdr_t) + sizeof(t))
+		return -EINVAL;
+	memcpy(&t, r->map + r->size - sizeof(t), sizeof(t));
+	if(t.magic != REC_TRAILER_MAGIC || rec_block_read(r, t.offset, &b) ||
+	   b.kind != REC_BLOCK_INDEX ||
+	   b.size != b.aux * sizeof(struct rec_source_t) +
+		     (uint64_t)b.count * sizeof(struct rec_index_t))
+		return -EINVAL;
+
+	const uint8_t *data = r->map + t.offset + sizeof(b);
+	int ret = rec_sources_add(r, data, b.aux);
+	if(ret)
+		return ret;
+
+	if(b.count) {
+		r->index = malloc(b.count * sizeof(struct rec_index_t));
+		if(!r->index)
+			return -ENOMEM;
+		memcpy(r->index, data + b.aux * sizeof(struct rec_source_t),
+		       b.count * sizeof(struct rec_index_t));
+	}
+	r->index_count = b.count;
+	return 0;
+}
+
+/* Rebuilds the index of a recording that was not closed, up to the first
+ * incomplete block */
+static int
+rec_index_scan(struct ctlra_replay_t *r)
+{
+	uint32_t size = 0;
+	uint64_t offset = sizeof(struct rec_file_hdr_t);
+	struct rec_block_t b;
+
+	for(; !rec_block_read(r, offset, &b);
+	    offset += sizeof(b) + b.size) {
+		const uint8_t *data = r->map + offset + sizeof(b);
+		if(b.kind == REC_BLOCK_SOURCES) {
+			if(b.size != (uint64_t)b.count *
+				     sizeof(struct rec_source_t) ||
+			   rec_sources_add(r, data, b.count))
+				break;
+			continue;
+		}
+		if(b.kind != REC_BLOCK_EVENTS)
+			break;
+
+		if(r->index_count == size) {
+			size = size ? size * 2 : 64;
+			void *n = realloc(r->index, size * sizeof(*r->index));
+			if(!n)
+				return -ENOMEM;
+			r->index = n;
+		}
+		r->index[r->index_count++] = (struct rec_index_t) {
+			.offset = offset,
+			.time = b.time,
+			.time_last = b.time_last,
+		};
+	}
+	return 0;
+}
+
+/* Starts decoding block *idx*. Returns 0 past the last block */
+static int
+rec_block_load(struct ctlra_replay_t *r, uint32_t idx)
+{
+	struct rec_block_t b;
+	r->block = idx;
+	r->left = 0;
+	if(idx >= r->index_count)
+		return 0;
+	if(rec_block_read(r, r->index[idx].offset, &b) ||
+	   b.kind != REC_BLOCK_EVENTS)
+		return -EINVAL;
+
+	r->pos = r->map + r->index[idx].offset + sizeof(b);
+	r->end = r->pos + b.size;
+	r->left = b.count;
+	r->time = b.time;
+	return 0;
+}
+
+/* Decodes the next event into r->next */
+static int
+rec_next(struct ctlra_replay_t *r)
+{
+	r->has_next = 0;
+	while(!r->left) {
+		if(r->block >= r->index_count)
+			return 0;
+		int ret = rec_block_load(r, r->block + 1);
+		if(ret)
+			return ret;
+	}
+
+	const uint8_t *p = r->pos;
+	uint64_t source = r->source, dt, id, pos = 0, delta;
+	struct ctlra_event_compact_t *e = &r->next;
+
+	if(p >= r->end)
+		return -EINVAL;
+	uint8_t tag = *p++;
+	memset(e, 0, sizeof(*e));
+	e->type = tag & 0x7;
+	e->flags = tag >> 4;
+
+	if(tag & REC_SOURCE_CHANGE)
+		p = rec_get_varint(p, r->end, &source);
+	if(p)
+		p = rec_get_varint(p, r->end, &dt);
+	if(p)
+		p = rec_get_varint(p, r->end, &id);
+	if(p && e->type == CTLRA_EVENT_GRID)
+		p = rec_get_varint(p, r->end, &pos);
+	if(!p || e->type >= CTLRA_FEEDBACK_ITEM)
+		return -EINVAL;
+
+	e->id = id;
+	e->pos = pos;
+	if(rec_has_value(e)) {
+		if(r->end - p < (long)sizeof(e->value))
+			return -EINVAL;
+		memcpy(&e->value, p, sizeof(e->value));
+		p += sizeof(e->value);
+	} else if(e->type == CTLRA_EVENT_ENCODER) {
+		p = rec_get_varint(p, r->end, &delta);
+		if(!p)
+			return -EINVAL;
+		e->delta = (int32_t)((delta >> 1) ^ -(delta & 1));
+	}
+
+	r->pos = p;
+	r->left--;
+	r->time += dt;
+	r->source = source;
+	r->next_time = r->time;
+	r->next_source = source;
+	r->has_next = 1;
+	return 0;
+}
+
+struct ctlra_replay_t *
+ctlra_replay_open(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return 0;
+
+	struct stat st;
+	struct rec_file_hdr_t hdr;
+	const uint8_t *map = MAP_FAILED;
+	if(!fstat(fd, &st) && st.st_size >= (off_t)sizeof(hdr))
+		map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return 0;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	struct ctlra_replay_t *r = calloc(1, sizeof(*r));
+	if(!r || memcmp(hdr.magic, REC_MAGIC, sizeof(hdr.magic)) ||
+	   hdr.version != REC_VERSION)
+		goto fail;
+
+	r->map = map;
+	r->size = st.st_size;
+	if(rec_index_load(r)) {
+		free(r->index);
+		free(r->sources);
+		r->index = 0;
+		r->index_count = 0;
+		r->sources = 0;
+		r->source_count = 0;
+		if(rec_index_scan(r))
+			goto fail;
+	}
+
+	if(r->index_count)
+		r->duration = r->index[r->index_count - 1].time_last;
+	ctlra_replay_seek(r, 0);
+	return r;
+
+fail:
+	if(r) {
+		free(r->index);
+		free(r->sources);
+	}
+	free(r);
+	munmap((void *)map, st.st_size);
+	return 0;
+}
+
+uint64_t
+ctlra_replay_duration(struct ctlra_replay_t *r)
+{
+	return r->duration;
+}
+
+uint64_t
+ctlra_replay_tell(struct ctlra_replay_t *r)
+{
+	if(r->in_func)
+		return r->playhead;
+	return r->has_next ? r->next_time : r->duration;
+}
+
+uint32_t
+ctlra_replay_sources(struct ctlra_replay_t *r,
+		     const struct ctlra_replay_source_t **sources)
+{
+	if(sources)
+		*sources = r->sources;
+	return r->source_count;
+}
+
+int32_t
+ctlra_replay_source_bind(struct ctlra_replay_t *r, uint32_t source,
+			 struct ctlra_dev_t *dev)
+{
+	if(source >= r->source_count)
+		return -EINVAL;
+	r->sources[source].dev = dev;
+	return 0;
+}
+
+void
+ctlra_replay_seek(struct ctlra_replay_t *r, uint64_t time)
+{
+	/* the first block that ends at or after *time* */
+	uint32_t lo = 0, hi = r->index_count;
+	while(lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if(r->index[mid].time_last < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	r->has_next = 0;
+	r->playhead = time;
+	if(rec_block_load(r, lo))
+		return;
+	while(!rec_next(r) && r->has_next && r->next_time < time)
+		;
+}
+
+static void
+rec_sleep(uint64_t monotonic)
+{
+	struct timespec ts = {
+		.tv_sec = monotonic / 1000000000ull,
+		.tv_nsec = monotonic % 1000000000ull,
+	};
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+		;
+}
+
+int64_t
+ctlra_replay_play(struct ctlra_replay_t *r, ctlra_event_func func,
+		  void *userdata, uint64_t until, uint32_t flags)
+{
+	struct ctlra_event_t events[REC_BATCH_MAX];
+	struct ctlra_event_t *ptrs[REC_BATCH_MAX];
+	for(int i = 0; i < REC_BATCH_MAX; i++)
+		ptrs[i] = &events[i];
+
+	/* CLOCK_MONOTONIC of time 0 in the recording */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t base = ts.tv_sec * 1000000000ull + ts.tv_nsec - r->playhead;
+	int realtime = flags & CTLRA_REPLAY_REALTIME;
+
+	int64_t played = 0;
+	while(r->has_next && r->next_time < until) {
+		uint64_t time = r->next_time;
+		uint32_t source = r->next_source;
+
+		if(realtime)
+			rec_sleep(base + time);
+		r->playhead = time;
+
+		uint32_t n = 0;
+		int ret = 0;
+		do {
+			ctlra_event_from_compact(&r->next, &events[n++]);
+			ret = rec_next(r);
+		} while(!ret && n < REC_BATCH_MAX && r->has_next &&
+			r->next_time == time && r->next_source == source);
+
+		struct ctlra_dev_t *dev = source < r->source_count ?
+					  r->sources[source].dev : 0;
+		r->in_func = 1;
+		func(dev, n, ptrs, userdata);
+		r->in_func = 0;
+		played += n;
+		if(ret)
+			return ret;
+	}
+
+	/* a step of realtime play lasts until *until*, so the following
+	 * step keeps the timing of the recording */
+	if(until > r->playhead && until != UINT64_MAX) {
+		if(realtime)
+			rec_sleep(base + until);
+		r->playhead = until;
+	}
+	return played;
+}
+
+void
+ctlra_replay_close(struct ctlra_replay_t *r)
+{
+	if(!r)
+		return;
+	munmap((void *)r->map, r->size);
+	free(r->index);
+	free(r->sources);
+	free(r);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OPENAV_CTLRA_RECORD_H
+#define OPENAV_CTLRA_RECORD_H
+
+#include <stdint.h>
+
+#include "ctlra.h"
+
+/** @file
+ * Recording and replay of controller events. The recorder is fed from
+ * the event callback: each event is stamped and copied into a lock-free
+ * ring, and a writer thread streams the ring to disk. Pushing never
+ * blocks or allocates, so it is safe from a realtime thread.
+ *
+ * The file is a sequence of blocks, each holding the events of up to
+ * about a second, delta encoded against the previous event in the block.
+ * An index of the blocks is appended when the recorder is destroyed; a
+ * file that was never closed is still readable, its index is rebuilt by
+ * scanning the blocks. Seeking binary searches the index, and decodes
+ * one block at most.
+ *
+ * Events are recorded per *source*, one for each device pushed to the
+ * recorder. The vendor, device and serial of each source are stored in
+ * the file, so a replay can be routed to a matching device.
+ */
+
+struct ctlra_recorder_t;
+struct ctlra_replay_t;
+
+/** Default capacity of the recorder ring in events */
+#define CTLRA_RECORDER_RING_DEFAULT 16384
+/** Maximum number of sources in one recording */
+#define CTLRA_RECORD_SOURCES_MAX 64
+
+/** Create a recorder, writing to the file at *path*, which is truncated.
+ * *ring_events* is the ring capacity, rounded up to a power of two, or 0
+ * for CTLRA_RECORDER_RING_DEFAULT. Events pushed while the ring is full
+ * are dropped and counted.
+ * @retval 0 The file could not be created, or out of memory
+ */
+struct ctlra_recorder_t *ctlra_recorder_create(const char *path,
+					       uint32_t ring_events);
+
+/** Record events from *dev*, with the time of the call. Call this from
+ * the event callback; pushes must come from a single thread. A NULL *dev*
+ * records to a source of its own, as replays of unbound sources do.
+ * @retval The number of events recorded, the rest were dropped
+ */
+uint32_t ctlra_recorder_push(struct ctlra_recorder_t *rec,
+			     struct ctlra_dev_t *dev,
+			     uint32_t num_events,
+			     struct ctlra_event_t **events);
+
+/** Record compact events, see ctlra_recorder_push(). Call this from the
+ * compact event callback. */
+uint32_t ctlra_recorder_push_compact(struct ctlra_recorder_t *rec,
+				     struct ctlra_dev_t *dev,
+				     uint32_t num_events,
+				     const struct ctlra_event_compact_t *events);
+
+/** Forget *dev*: a device later allocated at the same address is recorded
+ * as a new source. Call this from the remove callback, on the thread that
+ * pushes events. */
+void ctlra_recorder_dev_removed(struct ctlra_recorder_t *rec,
+				struct ctlra_dev_t *dev);
+
+/** Returns the number of events dropped because the ring was full, or
+ * because their device would exceed CTLRA_RECORD_SOURCES_MAX sources */
+uint64_t ctlra_recorder_dropped(struct ctlra_recorder_t *rec);
+
+/** Write the remaining events and the index, and free the recorder.
+ * @retval 0 Success
+ * @retval -errno Writing the file failed, the recording may be truncated
+ */
+int32_t ctlra_recorder_destroy(struct ctlra_recorder_t *rec);
+
+/** A source of a recording, as passed to the replay function */
+struct ctlra_replay_source_t {
+	char vendor[CTLRA_STR_MAX];
+	char device[CTLRA_STR_MAX];
+	char serial[CTLRA_DEV_SERIAL_MAX];
+	/** unique_id of the device when it was recorded */
+	uint32_t unique_id;
+	/** Device passed to the event func for this source, or NULL. Set
+	 * it with ctlra_replay_source_bind() */
+	struct ctlra_dev_t *dev;
+};
+
+/** Open a recording for replay. The file is mapped, not read.
+ * @retval 0 The file could not be opened, or is not a recording
+ */
+struct ctlra_replay_t *ctlra_replay_open(const char *path);
+
+/** Returns the time of the last event, in nanoseconds from the start */
+uint64_t ctlra_replay_duration(struct ctlra_replay_t *r);
+
+/** Returns the time of the next event to replay. Called from the event
+ * func of ctlra_replay_play(), returns the time of the events passed */
+uint64_t ctlra_replay_tell(struct ctlra_replay_t *r);
+
+/** Returns the number of sources, and their details in *sources* */
+uint32_t ctlra_replay_sources(struct ctlra_replay_t *r,
+			      const struct ctlra_replay_source_t **sources);
+
+/** Pass *dev* to the event func for events of *source*, eg a device
+ * from ctlra_dev_virtualize_headless() with the vendor and device of the
+ * source. Events of unbound sources are passed with a NULL device.
+ * @retval 0 Success
+ * @retval -EINVAL No such source
+ */
+int32_t ctlra_replay_source_bind(struct ctlra_replay_t *r,
+				 uint32_t source,
+				 struct ctlra_dev_t *dev);
+
+/** Continue replay from the first event at or after *time* ns */
+void ctlra_replay_seek(struct ctlra_replay_t *r, uint64_t time);
+
+/** Replay with the original timing, sleeping until each event is due.
+ * Without this flag events are replayed as fast as possible. */
+#define CTLRA_REPLAY_REALTIME (1<<0)
+
+/** Replay the events up to (not including) *until* ns into *func*, or up
+ * to the end with UINT64_MAX. Events recorded in one push are passed in
+ * one call. The position is kept, so a replay can be continued in steps,
+ * eg from the main loop of the application. With CTLRA_REPLAY_REALTIME a
+ * step returns once *until* is due, so consecutive steps keep the timing
+ * of the recording.
+ * @retval The number of events replayed, or -errno for a corrupt file
+ */
+int64_t ctlra_replay_play(struct ctlra_replay_t *r,
+			  ctlra_event_func func,
+			  void *userdata,
+			  uint64_t until,
+			  uint32_t flags);
+
+/** Unmap the recording and free the replay */
+void ctlra_replay_close(struct ctlra_replay_t *r);
+
+#endif /* OPENAV_CTLRA_RECORD_H */
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "impl.h"
+#include "rt.h"
+
+/* stack touched by ctlra_impl_rt_prefault() */
+#define CTLRA_RT_STACK_PREFAULT (64 * 1024)
+
+static int
+ctlra_rt_impl_policy(uint32_t policy)
+{
+	switch(policy) {
+	case CTLRA_SCHED_OTHER: return SCHED_OTHER;
+	case CTLRA_SCHED_FIFO:  return SCHED_FIFO;
+	case CTLRA_SCHED_RR:    return SCHED_RR;
+	}
+	return -1;
+}
+
+struct ctlra_rt_check_t {
+	int policy;
+	struct sched_param param;
+	int ret;
+};
+
+static void *
+ctlra_rt_impl_check_thread(void *ud)
+{
+	struct ctlra_rt_check_t *c = ud;
+	c->ret = pthread_setschedparam(pthread_self(), c->policy, &c->param);
+	return NULL;
+}
+
+int32_t
+ctlra_rt_check(uint32_t policy, uint32_t priority)
+{
+	int p = ctlra_rt_impl_policy(policy);
+	if(p < 0)
+		return -EINVAL;
+	if(p == SCHED_OTHER)
+		return 0;
+	if(priority < (uint32_t)sched_get_priority_min(p) ||
+	   priority > (uint32_t)sched_get_priority_max(p))
+		return -EINVAL;
+
+	/* the rlimit is not the whole story (root, CAP_SYS_NICE), so try
+	 * it on a short lived thread, leaving the caller untouched */
+	struct ctlra_rt_check_t c = {
+		.policy = p,
+		.param = { .sched_priority = priority },
+	};
+	pthread_t t;
+	if(pthread_create(&t, NULL, ctlra_rt_impl_check_thread, &c))
+		return -EAGAIN;
+	pthread_join(t, NULL);
+
+	return c.ret ? -EPERM : 0;
+}
+
+static uint64_t
+ctlra_rt_impl_cpu_mask(struct ctlra_t *ctlra)
+{
+	uint64_t mask = 0;
+	for(int i = 0; i < 8; i++)
+		mask |= (uint64_t)ctlra->opts.rt_cpu_mask[i] << (8 * i);
+	return mask;
+}
+
+int32_t
+ctlra_impl_rt_cpu(struct ctlra_t *ctlra, uint32_t idx)
+{
+	uint64_t mask = ctlra_rt_impl_cpu_mask(ctlra);
+	uint32_t n = __builtin_popcountll(mask);
+	if(!n)
+		return -1;
+
+	idx %= n;
+	for(int32_t cpu = 0; cpu < 64; cpu++) {
+		if(!(mask & (1ull << cpu)))
+			continue;
+		if(idx-- == 0)
+			return cpu;
+	}
+	return -1;
+}
+
+void
+ctlra_impl_rt_thread(struct ctlra_t *ctlra, pthread_t thread, int32_t cpu)
+{
+	uint64_t mask = ctlra_rt_impl_cpu_mask(ctlra);
+	if(cpu >= 0 || mask) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if(cpu >= 0) {
+			CPU_SET(cpu, &set);
+		} else {
+			for(int i = 0; i < 64; i++)
+				if(mask & (1ull << i))
+					CPU_SET(i, &set);
+		}
+		int ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+		if(ret)
+			CTLRA_WARN(ctlra, "setting cpu affinity failed: %s\n",
+				   strerror(ret));
+	}
+
+	/* ctlra_impl_rt_init() already warned if this is denied */
+	int policy = ctlra_rt_impl_policy(ctlra->opts.rt_policy);
+	if(policy <= 0 || ctlra->rt_denied)
+		return;
+	struct sched_param param = {
+		.sched_priority = ctlra->opts.rt_priority,
+	};
+	int ret = pthread_setschedparam(thread, policy, &param);
+	if(ret)
+		CTLRA_WARN(ctlra, "setting rt priority %d failed: %s\n",
+			   param.sched_priority, strerror(ret));
+}
+
+void
+ctlra_impl_rt_prefault(struct ctlra_t *ctlra)
+{
+	if(!(ctlra->opts.rt_flags & CTLRA_RT_MLOCK))
+		return;
+	volatile uint8_t stack[CTLRA_RT_STACK_PREFAULT];
+	memset((void *)stack, 0, sizeof(stack));
+}
+
+void
+ctlra_impl_rt_init(struct ctlra_t *ctlra)
+{
+	const struct ctlra_create_opts_t *o = &ctlra->opts;
+
+	if(o->rt_flags & CTLRA_RT_MLOCK) {
+		if(mlockall(MCL_CURRENT | MCL_FUTURE)) {
+			struct rlimit rl = {0};
+			getrlimit(RLIMIT_MEMLOCK, &rl);
+			CTLRA_WARN(ctlra, "mlockall failed: %s, memlock limit %lu\n",
+				   strerror(errno), (unsigned long)rl.rlim_cur);
+		}
+		ctlra_impl_rt_prefault(ctlra);
+	}
+
+	if(o->rt_policy != CTLRA_SCHED_OTHER) {
+		int32_t ret = ctlra_rt_check(o->rt_policy, o->rt_priority);
+		ctlra->rt_denied = ret != 0;
+		if(ret == -EPERM) {
+			struct rlimit rl = {0};
+			getrlimit(RLIMIT_RTPRIO, &rl);
+			CTLRA_WARN(ctlra, "no permission for rt priority %d, "
+				   "RLIMIT_RTPRIO is %lu: controller input may "
+				   "lag under load\n", o->rt_priority,
+				   (unsigned long)rl.rlim_cur);
+		} else if(ret) {
+			CTLRA_WARN(ctlra, "invalid rt policy %d priority %d\n",
+				   o->rt_policy, o->rt_priority);
+		}
+	}
+
+	if(o->rt_flags & CTLRA_RT_CALLER)
+		ctlra_impl_rt_thread(ctlra, pthread_self(), -1);
+}
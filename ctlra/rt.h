@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CTLRA_RT_H
+#define CTLRA_RT_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct ctlra_t;
+
+/* Realtime setup from the ctlra_create() opts: mlockall(), the
+ * permission check, and the policy of the calling thread */
+void ctlra_impl_rt_init(struct ctlra_t *ctlra);
+/* Apply opts.rt_policy to *thread*, and pin it to *cpu*, or to
+ * opts.rt_cpu_mask if *cpu* is negative */
+void ctlra_impl_rt_thread(struct ctlra_t *ctlra, pthread_t thread,
+			  int32_t cpu);
+/* Returns the CPU for worker *idx* from opts.rt_cpu_mask, or -1 */
+int32_t ctlra_impl_rt_cpu(struct ctlra_t *ctlra, uint32_t idx);
+/* Call at the start of a worker thread: prefaults its stack */
+void ctlra_impl_rt_prefault(struct ctlra_t *ctlra);
+
+#endif /* CTLRA_RT_H */
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "impl.h"
+#include "rt.h"
+#include "shard.h"
+
+/* From ctlra.c */
+extern void ctlra_impl_screen_redraw(struct ctlra_t *ctlra,
+				     struct ctlra_dev_t *dev,
+				     uint32_t screen_idx);
+
+#define CTLRA_SHARDS_MAX 8
+#define CTLRA_SHARD_DEVS_MAX 16
+
+struct ctlra_shard_t {
+	struct ctlra_t *ctlra;
+	pthread_t thread;
+	/* held while redrawing, so detach waits for the device */
+	pthread_mutex_t lock;
+	struct ctlra_dev_t *devs[CTLRA_SHARD_DEVS_MAX];
+	/* only written by the ctlra_idle_iter() thread, under lock */
+	uint32_t count;
+	uint32_t idx;
+	uint8_t quit;
+};
+
+static void *
+ctlra_shard_thread(void *ud)
+{
+	struct ctlra_shard_t *s = ud;
+	struct ctlra_t *ctlra = s->ctlra;
+	const uint64_t period = ctlra->screen_redraw_ns;
+
+	ctlra_impl_rt_prefault(ctlra);
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while(!__atomic_load_n(&s->quit, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&s->lock);
+		for(uint32_t i = 0; i < s->count; i++) {
+			struct ctlra_dev_t *dev = s->devs[i];
+			if(dev->banished || !dev->screen_redraw_cb)
+				continue;
+			for(int j = 0; j < CTLRA_NUM_SCREENS_MAX; j++)
+				ctlra_impl_screen_redraw(ctlra, dev, j);
+		}
+		pthread_mutex_unlock(&s->lock);
+
+		uint64_t ns = next.tv_nsec + period;
+		next.tv_sec += ns / 1000000000;
+		next.tv_nsec = ns % 1000000000;
+
+		/* when a frame overran, start the next one now instead of
+		 * bursting to catch up */
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec > next.tv_sec ||
+		   (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+			next = now;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	return NULL;
+}
+
+/* Pin the shard to its CPU, and apply the rt policy from the opts */
+static void
+ctlra_shard_sched(struct ctlra_shard_t *s)
+{
+	int32_t cpu = ctlra_impl_rt_cpu(s->ctlra, s->idx);
+	if(cpu < 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if(cpus > 0)
+			cpu = (s->ctlra->opts.screen_shard_cpu + s->idx) % cpus;
+	}
+	ctlra_impl_rt_thread(s->ctlra, s->thread, cpu);
+}
+
+int
+ctlra_impl_shards_start(struct ctlra_t *ctlra)
+{
+	uint32_t n = ctlra->opts.screen_shards;
+	if(n > CTLRA_SHARDS_MAX) {
+		CTLRA_WARN(ctlra, "%d screen shards, limited to %d\n",
+			   n, CTLRA_SHARDS_MAX);
+		n = CTLRA_SHARDS_MAX;
+	}
+
+	struct ctlra_shard_t *shards = calloc(n, sizeof(*shards));
+	if(!shards)
+		return -ENOMEM;
+
+	uint32_t i;
+	for(i = 0; i < n; i++) {
+		struct ctlra_shard_t *s = &shards[i];
+		s->ctlra = ctlra;
+		s->idx = i;
+		pthread_mutex_init(&s->lock, NULL);
+		if(pthread_create(&s->thread, NULL, ctlra_shard_thread, s)) {
+			pthread_mutex_destroy(&s->lock);
+			break;
+		}
+		ctlra_shard_sched(s);
+	}
+
+	/* run with the shards that did start */
+	if(i == 0) {
+		free(shards);
+		return -EAGAIN;
+	}
+	ctlra->shards = shards;
+	ctlra->shard_count = i;
+	return 0;
+}
+
+void
+ctlra_impl_shards_stop(struct ctlra_t *ctlra)
+{
+	struct ctlra_shard_t *shards = ctlra->shards;
+	if(!shards)
+		return;
+
+	for(uint32_t i = 0; i < ctlra->shard_count; i++)
+		__atomic_store_n(&shards[i].quit, 1, __ATOMIC_RELAXED);
+	for(uint32_t i = 0; i < ctlra->shard_count; i++) {
+		pthread_join(shards[i].thread, NULL);
+		pthread_mutex_destroy(&shards[i].lock);
+	}
+
+	free(shards);
+	ctlra->shards = 0;
+	ctlra->shard_count = 0;
+}
+
+void
+ctlra_impl_shard_attach(struct ctlra_t *ctlra, struct ctlra_dev_t *dev)
+{
+	struct ctlra_shard_t *shards = ctlra->shards;
+	struct ctlra_shard_t *s = 0;
+
+	/* counts only change on this thread, no lock needed to read */
+	for(uint32_t i = 0; i < ctlra->shard_count; i++) {
+		if(shards[i].count == CTLRA_SHARD_DEVS_MAX)
+			continue;
+		if(!s || shards[i].count < s->count)
+			s = &shards[i];
+	}
+	/* all full: the screens stay on the ctlra_idle_iter() thread */
+	if(!s)
+		return;
+
+	pthread_mutex_lock(&s->lock);
+	s->devs[s->count++] = dev;
+	pthread_mutex_unlock(&s->lock);
+	dev->shard = s;
+
+	CTLRA_INFO(ctlra, "%s %s: screens on shard %d\n", dev->info.vendor,
+		   dev->info.device, s->idx);
+}
+
+void
+ctlra_impl_shard_detach(struct ctlra_dev_t *dev)
+{
+	struct ctlra_shard_t *s = dev->shard;
+	if(!s)
+		return;
+
+	pthread_mutex_lock(&s->lock);
+	for(uint32_t i = 0; i < s->count; i++) {
+		if(s->devs[i] == dev) {
+			s->devs[i] = s->devs[--s->count];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+	dev->shard = 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CTLRA_SHARD_H
+#define CTLRA_SHARD_H
+
+struct ctlra_t;
+struct ctlra_dev_t;
+
+/* Screen shards: worker threads, each pinned to a core and scheduled
+ * with opts.rt_policy, that run the screen redraw callbacks, pixel
+ * conversion and USB submission of the devices assigned to them.
+ * Devices are assigned when they first have a screen redraw callback in
+ * ctlra_idle_iter(), to the shard with the fewest devices. Input,
+ * feedback and all other callbacks stay on the thread running
+ * ctlra_idle_iter(). */
+
+/* Start opts.screen_shards threads, returns 0 or -errno */
+int ctlra_impl_shards_start(struct ctlra_t *ctlra);
+/* Stop and join the threads, after all devices are detached */
+void ctlra_impl_shards_stop(struct ctlra_t *ctlra);
+/* Hand the screens of *dev* to a shard */
+void ctlra_impl_shard_attach(struct ctlra_t *ctlra, struct ctlra_dev_t *dev);
+/* Take *dev* back from its shard: waits for a redraw in progress */
+void ctlra_impl_shard_detach(struct ctlra_dev_t *dev);
+
+#endif /* CTLRA_SHARD_H */
@@ -0,0 +1,574 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "impl.h"
+#include "shm.h"
+
+/* From ctlra.c */
+extern int ctlra_impl_get_id_by_vid_pid(uint32_t vid, uint32_t pid);
+extern int ctlra_impl_dev_publish(struct ctlra_t *ctlra,
+				  struct ctlra_dev_t *dev);
+extern int32_t ctlra_screen_get_data(struct ctlra_dev_t *dev,
+				     uint32_t screen_idx, uint8_t **pixels,
+				     uint32_t *bytes,
+				     struct ctlra_screen_zone_t *redraw,
+				     uint8_t flush);
+
+#define RING_MASK (CTLRA_SHM_RING_SIZE - 1)
+#define SHM_NAME_MAX 32
+/* idle iterations between checks for crashed clients / daemon */
+#define SHM_REAP_ITERS 1024
+
+static int
+shm_pid_alive(uint32_t pid)
+{
+	return pid && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+static void
+shm_name(char *name, uint32_t idx)
+{
+	snprintf(name, SHM_NAME_MAX, CTLRA_SHM_NAME "%u", idx);
+}
+
+static struct ctlra_shm_seg_t *
+shm_map(const char *name, int flags)
+{
+	int fd = shm_open(name, flags, 0600);
+	if(fd < 0)
+		return 0;
+
+	if(flags & O_CREAT) {
+		if(ftruncate(fd, sizeof(struct ctlra_shm_seg_t))) {
+			close(fd);
+			return 0;
+		}
+	} else {
+		struct stat st;
+		if(fstat(fd, &st) || st.st_size != sizeof(struct ctlra_shm_seg_t)) {
+			close(fd);
+			return 0;
+		}
+	}
+
+	void *mem = mmap(0, sizeof(struct ctlra_shm_seg_t),
+			 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return mem == MAP_FAILED ? 0 : mem;
+}
+
+static void
+shm_unmap(struct ctlra_shm_seg_t *seg)
+{
+	munmap(seg, sizeof(struct ctlra_shm_seg_t));
+}
+
+/* a segment left behind by a daemon that crashed */
+static int
+shm_stale(const char *name)
+{
+	struct ctlra_shm_seg_t *seg = shm_map(name, O_RDWR);
+	if(!seg)
+		return 1;
+	int stale = !shm_pid_alive(seg->daemon_pid);
+	shm_unmap(seg);
+	return stale;
+}
+
+/* -------------------------------------------------------------- Daemon */
+
+struct ctlra_shm_server_t {
+	struct ctlra_dev_t *dev;
+	struct ctlra_shm_seg_t *seg;
+	char name[SHM_NAME_MAX];
+	uint32_t reap_iter;
+	/* seq of the frame last sent to the device, for each region */
+	uint32_t seq_applied[CTLRA_SHM_REGION_COUNT];
+	/* lights as last sent to the device */
+	uint32_t lights[CTLRA_SHM_LIGHTS_MAX];
+	uint32_t grid_lights[CTLRA_NUM_GRIDS_MAX][CTLRA_SHM_GRID_SQUARES_MAX];
+	/* snapshot of the light region */
+	uint32_t lights_new[CTLRA_SHM_LIGHTS_MAX];
+	uint32_t grid_lights_new[CTLRA_NUM_GRIDS_MAX][CTLRA_SHM_GRID_SQUARES_MAX];
+};
+
+struct ctlra_shm_server_t *
+ctlra_shm_server_create(struct ctlra_dev_t *dev)
+{
+	struct ctlra_t *ctlra = dev->ctlra_context;
+	struct ctlra_shm_server_t *s = calloc(1, sizeof(*s));
+	if(!s)
+		return 0;
+
+	for(uint32_t i = 0; i < CTLRA_SHM_DEVS_MAX && !s->seg; i++) {
+		shm_name(s->name, i);
+		const int flags = O_RDWR | O_CREAT | O_EXCL;
+		s->seg = shm_map(s->name, flags);
+		if(!s->seg && errno == EEXIST && shm_stale(s->name)) {
+			shm_unlink(s->name);
+			s->seg = shm_map(s->name, flags);
+		}
+	}
+	if(!s->seg) {
+		CTLRA_ERROR(ctlra, "no shared memory segment for %s\n",
+			    dev->info.device);
+		free(s);
+		return 0;
+	}
+
+	struct ctlra_shm_seg_t *seg = s->seg;
+	seg->version = CTLRA_SHM_VERSION;
+	seg->size = sizeof(*seg);
+	seg->daemon_pid = getpid();
+	seg->alive = 1;
+	seg->vendor_id = dev->info.vendor_id;
+	seg->device_id = dev->info.device_id;
+	memcpy(seg->serial, dev->info.serial, sizeof(seg->serial));
+
+	for(int i = 0; i < CTLRA_NUM_SCREENS_MAX; i++) {
+		uint8_t *px;
+		uint32_t bytes;
+		struct ctlra_screen_zone_t zone;
+		int32_t ret = ctlra_screen_get_data(dev, i, &px, &bytes,
+						    &zone, 0);
+		if(ret == 0 && bytes <= CTLRA_SHM_SCREEN_BYTES)
+			seg->screen_bytes[i] = bytes;
+	}
+
+	s->dev = dev;
+	/* clients only use segments with a valid magic */
+	__atomic_store_n(&seg->magic, CTLRA_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	CTLRA_INFO(ctlra, "sharing %s as %s\n", dev->info.device, s->name);
+	return s;
+}
+
+void
+ctlra_shm_server_destroy(struct ctlra_shm_server_t *s)
+{
+	if(!s)
+		return;
+	__atomic_store_n(&s->seg->alive, 0, __ATOMIC_RELEASE);
+	shm_unlink(s->name);
+	shm_unmap(s->seg);
+	free(s);
+}
+
+void
+ctlra_shm_server_events(struct ctlra_shm_server_t *s, uint32_t num_events,
+			struct ctlra_event_t **events)
+{
+	for(int c = 0; c < CTLRA_SHM_CLIENTS_MAX; c++) {
+		struct ctlra_shm_client_t *cl = &s->seg->clients[c];
+		if(!__atomic_load_n(&cl->pid, __ATOMIC_ACQUIRE))
+			continue;
+
+		uint32_t head = cl->head;
+		uint32_t tail = __atomic_load_n(&cl->tail, __ATOMIC_ACQUIRE);
+		for(uint32_t i = 0; i < num_events; i++) {
+			if(head - tail >= CTLRA_SHM_RING_SIZE) {
+				cl->dropped++;
+				continue;
+			}
+			cl->events[head & RING_MASK] = *events[i];
+			head++;
+		}
+		__atomic_store_n(&cl->head, head, __ATOMIC_RELEASE);
+	}
+}
+
+/* free the slot and regions of clients that exited without cleanup */
+static void
+shm_server_reap(struct ctlra_shm_server_t *s)
+{
+	struct ctlra_shm_seg_t *seg = s->seg;
+	for(uint32_t c = 0; c < CTLRA_SHM_CLIENTS_MAX; c++) {
+		uint32_t pid = __atomic_load_n(&seg->clients[c].pid,
+					       __ATOMIC_ACQUIRE);
+		if(!pid || shm_pid_alive(pid))
+			continue;
+
+		for(int r = 0; r < CTLRA_SHM_REGION_COUNT; r++) {
+			struct ctlra_shm_region_t *reg = &seg->regions[r];
+			if(__atomic_load_n(&reg->owner, __ATOMIC_ACQUIRE) != c + 1)
+				continue;
+			/* drop a half written frame */
+			uint32_t seq = (reg->seq + 1) & ~1u;
+			__atomic_store_n(&reg->seq, seq, __ATOMIC_RELEASE);
+			s->seq_applied[r] = seq;
+			__atomic_store_n(&reg->owner, 0, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&seg->clients[c].pid, 0, __ATOMIC_RELEASE);
+	}
+}
+
+/* Start reading a region: returns the seq of a new complete frame, or 0 */
+static uint32_t
+shm_server_region_begin(struct ctlra_shm_server_t *s, int r)
+{
+	struct ctlra_shm_region_t *reg = &s->seg->regions[r];
+	uint32_t seq = __atomic_load_n(&reg->seq, __ATOMIC_ACQUIRE);
+	if((seq & 1) || seq == s->seq_applied[r])
+		return 0;
+	return seq;
+}
+
+/* Finish reading a region: non-zero if the frame read is consistent */
+static int
+shm_server_region_end(struct ctlra_shm_server_t *s, int r, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&s->seg->regions[r].seq, __ATOMIC_RELAXED) != seq)
+		return 0;
+	s->seq_applied[r] = seq;
+	return 1;
+}
+
+int
+ctlra_shm_server_feedback(struct ctlra_shm_server_t *s)
+{
+	struct ctlra_shm_seg_t *seg = s->seg;
+	if(++s->reap_iter >= SHM_REAP_ITERS) {
+		s->reap_iter = 0;
+		shm_server_reap(s);
+	}
+
+	const int r = CTLRA_SHM_REGION_LIGHTS;
+	if(!__atomic_load_n(&seg->regions[r].owner, __ATOMIC_ACQUIRE))
+		return 0;
+
+	uint32_t seq = shm_server_region_begin(s, r);
+	if(!seq)
+		return 1;
+	memcpy(s->lights_new, seg->lights, sizeof(s->lights_new));
+	memcpy(s->grid_lights_new, seg->grid_lights,
+	       sizeof(s->grid_lights_new));
+	if(!shm_server_region_end(s, r, seq))
+		return 1;
+
+	/* only send lights that changed */
+	for(uint32_t i = 0; i < CTLRA_SHM_LIGHTS_MAX; i++) {
+		if(s->lights_new[i] == s->lights[i])
+			continue;
+		s->lights[i] = s->lights_new[i];
+		ctlra_dev_light_set(s->dev, i, s->lights[i]);
+	}
+	for(uint32_t g = 0; g < CTLRA_NUM_GRIDS_MAX; g++) {
+		for(uint32_t i = 0; i < CTLRA_SHM_GRID_SQUARES_MAX; i++) {
+			uint32_t v = s->grid_lights_new[g][i];
+			if(v == s->grid_lights[g][i])
+				continue;
+			s->grid_lights[g][i] = v;
+			ctlra_dev_grid_light_set(s->dev, g, i, v);
+		}
+	}
+	ctlra_dev_light_flush(s->dev, 0);
+	return 1;
+}
+
+int32_t
+ctlra_shm_server_screen(struct ctlra_shm_server_t *s, uint32_t screen_idx,
+			uint8_t *pixels, uint32_t bytes,
+			struct ctlra_screen_zone_t *redraw)
+{
+	struct ctlra_shm_seg_t *seg = s->seg;
+	if(screen_idx >= CTLRA_NUM_SCREENS_MAX)
+		return -1;
+
+	const int r = CTLRA_SHM_REGION_SCREEN + screen_idx;
+	if(!__atomic_load_n(&seg->regions[r].owner, __ATOMIC_ACQUIRE))
+		return -1;
+
+	uint32_t seq = shm_server_region_begin(s, r);
+	if(!seq)
+		return 0;
+	uint32_t n = seg->screen_bytes[screen_idx];
+	memcpy(pixels, seg->screens[screen_idx], n < bytes ? n : bytes);
+	*redraw = seg->screen_zone[screen_idx];
+	return shm_server_region_end(s, r, seq);
+}
+
+/* -------------------------------------------------------------- Client */
+
+struct ctlra_shm_dev_t {
+	struct ctlra_dev_t base;
+	struct ctlra_shm_seg_t *seg;
+	struct ctlra_shm_client_t *client;
+	/* owner value of this client, slot + 1 */
+	uint32_t owner;
+	/* regions with a frame being written, seq is odd */
+	uint32_t writing;
+	uint32_t reap_iter;
+};
+
+/* Own region *r* and start a frame. Returns 0 if another client owns it */
+static int
+shm_client_region_write(struct ctlra_shm_dev_t *dev, int r)
+{
+	if(dev->writing & (1 << r))
+		return 1;
+
+	struct ctlra_shm_region_t *reg = &dev->seg->regions[r];
+	uint32_t owner = __atomic_load_n(&reg->owner, __ATOMIC_ACQUIRE);
+	if(owner != dev->owner) {
+		uint32_t expected = 0;
+		if(owner || !__atomic_compare_exchange_n(&reg->owner,
+					&expected, dev->owner, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return 0;
+	}
+
+	__atomic_store_n(&reg->seq, reg->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	dev->writing |= 1 << r;
+	return 1;
+}
+
+/* Complete the frame in region *r*, the daemon picks it up */
+static void
+shm_client_region_commit(struct ctlra_shm_dev_t *dev, int r)
+{
+	if(!(dev->writing & (1 << r)))
+		return;
+	struct ctlra_shm_region_t *reg = &dev->seg->regions[r];
+	__atomic_store_n(&reg->seq, reg->seq + 1, __ATOMIC_RELEASE);
+	dev->writing &= ~(1 << r);
+}
+
+static uint32_t
+shm_client_poll(struct ctlra_dev_t *base)
+{
+	struct ctlra_shm_dev_t *dev = (struct ctlra_shm_dev_t *)base;
+	struct ctlra_shm_seg_t *seg = dev->seg;
+	if(base->banished)
+		return 0;
+
+	if(++dev->reap_iter >= SHM_REAP_ITERS) {
+		dev->reap_iter = 0;
+		if(!shm_pid_alive(seg->daemon_pid))
+			seg->alive = 0;
+	}
+	if(!__atomic_load_n(&seg->alive, __ATOMIC_ACQUIRE)) {
+		ctlra_dev_impl_banish(base);
+		return 0;
+	}
+
+	/* events are delivered in place, from the ring */
+	struct ctlra_shm_client_t *cl = dev->client;
+	uint32_t head = __atomic_load_n(&cl->head, __ATOMIC_ACQUIRE);
+	uint32_t tail = cl->tail;
+	while(tail != head) {
+		struct ctlra_event_t *events[64];
+		uint32_t n = 0;
+		while(tail != head && n < 64)
+			events[n++] = &cl->events[tail++ & RING_MASK];
+		if(base->event_func)
+			base->event_func(base, n, events,
+					 base->event_func_userdata);
+		__atomic_store_n(&cl->tail, tail, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+static void
+shm_client_light_set(struct ctlra_dev_t *base, uint32_t light_id,
+		     uint32_t light_status)
+{
+	struct ctlra_shm_dev_t *dev = (struct ctlra_shm_dev_t *)base;
+	if(light_id >= CTLRA_SHM_LIGHTS_MAX ||
+	   !shm_client_region_write(dev, CTLRA_SHM_REGION_LIGHTS))
+		return;
+	dev->seg->lights[light_id] = light_status;
+}
+
+static int32_t
+shm_client_grid_light_set(struct ctlra_dev_t *base, uint32_t grid_id,
+			  uint32_t light_id, uint32_t light_status)
+{
+	struct ctlra_shm_dev_t *dev = (struct ctlra_shm_dev_t *)base;
+	if(grid_id >= CTLRA_NUM_GRIDS_MAX ||
+	   light_id >= CTLRA_SHM_GRID_SQUARES_MAX)
+		return -EINVAL;
+	if(!shm_client_region_write(dev, CTLRA_SHM_REGION_LIGHTS))
+		return -EBUSY;
+	dev->seg->grid_lights[grid_id][light_id] = light_status;
+	return 0;
+}
+
+static void
+shm_client_light_flush(struct ctlra_dev_t *base, uint32_t force)
+{
+	struct ctlra_shm_dev_t *dev = (struct ctlra_shm_dev_t *)base;
+	shm_client_region_commit(dev, CTLRA_SHM_REGION_LIGHTS);
+}
+
+static int32_t
+shm_client_screen_get_data(struct ctlra_dev_t *base, uint32_t screen_idx,
+			   uint8_t **pixels, uint32_t *bytes,
+			   struct ctlra_screen_zone_t *redraw, uint8_t flush)
+{
+	struct ctlra_shm_dev_t *dev = (struct ctlra_shm_dev_t *)base;
+	struct ctlra_shm_seg_t *seg = dev->seg;
+	if(screen_idx >= CTLRA_NUM_SCREENS_MAX ||
+	   !seg->screen_bytes[screen_idx])
+		return -ENOTSUP;
+
+	const int r = CTLRA_SHM_REGION_SCREEN + screen_idx;
+	if(flush) {
+		seg->screen_zone[screen_idx] = *redraw;
+		shm_client_region_commit(dev, r);
+		return 0;
+	}
+
+	if(!shm_client_region_write(dev, r))
+		return -EBUSY;
+	/* the application draws straight into shared memory */
+	*pixels = seg->screens[screen_idx];
+	*bytes = seg->screen_bytes[screen_idx];
+	return 0;
+}
+
+static int32_t
+shm_client_disconnect(struct ctlra_dev_t *base)
+{
+	struct ctlra_shm_dev_t *dev = (struct ctlra_shm_dev_t *)base;
+	struct ctlra_shm_seg_t *seg = dev->seg;
+
+	for(int r = 0; r < CTLRA_SHM_REGION_COUNT; r++) {
+		shm_client_region_commit(dev, r);
+		uint32_t owner = dev->owner;
+		__atomic_compare_exchange_n(&seg->regions[r].owner, &owner, 0,
+					    0, __ATOMIC_ACQ_REL,
+					    __ATOMIC_ACQUIRE);
+	}
+	__atomic_store_n(&dev->client->pid, 0, __ATOMIC_RELEASE);
+
+	shm_unmap(seg);
+	free(dev);
+	return 0;
+}
+
+static struct ctlra_shm_dev_t *
+shm_client_connect(struct ctlra_t *ctlra, struct ctlra_shm_seg_t *seg)
+{
+	if(__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != CTLRA_SHM_MAGIC ||
+	   seg->version != CTLRA_SHM_VERSION || seg->size != sizeof(*seg) ||
+	   !__atomic_load_n(&seg->alive, __ATOMIC_ACQUIRE) ||
+	   seg->daemon_pid == (uint32_t)getpid() ||
+	   !shm_pid_alive(seg->daemon_pid))
+		return 0;
+
+	/* the client uses the info of its own copy of the driver */
+	int id = ctlra_impl_get_id_by_vid_pid(seg->vendor_id, seg->device_id);
+	if(id < 0) {
+		CTLRA_WARN(ctlra, "no driver for shared device %04x:%04x\n",
+			   seg->vendor_id, seg->device_id);
+		return 0;
+	}
+
+	struct ctlra_shm_dev_t *dev = calloc(1, sizeof(*dev));
+	if(!dev)
+		return 0;
+
+	uint32_t pid = getpid();
+	for(uint32_t c = 0; c < CTLRA_SHM_CLIENTS_MAX; c++) {
+		uint32_t expected = 0;
+		struct ctlra_shm_client_t *cl = &seg->clients[c];
+		if(__atomic_compare_exchange_n(&cl->pid, &expected, pid, 0,
+					       __ATOMIC_ACQ_REL,
+					       __ATOMIC_ACQUIRE)) {
+			/* start with the next event, not stale ones */
+			__atomic_store_n(&cl->tail,
+					 __atomic_load_n(&cl->head,
+							 __ATOMIC_ACQUIRE),
+					 __ATOMIC_RELEASE);
+			dev->client = cl;
+			dev->owner = c + 1;
+			break;
+		}
+	}
+	if(!dev->client) {
+		CTLRA_WARN(ctlra, "shared device %04x:%04x has no free slot\n",
+			   seg->vendor_id, seg->device_id);
+		free(dev);
+		return 0;
+	}
+
+	dev->seg = seg;
+	dev->base.info = *__ctlra_devices[id].info;
+	memcpy(dev->base.info.serial, seg->serial, sizeof(seg->serial));
+	dev->base.ctlra_context = ctlra;
+
+	dev->base.poll = shm_client_poll;
+	dev->base.disconnect = shm_client_disconnect;
+	dev->base.light_set = shm_client_light_set;
+	dev->base.grid_light_set = shm_client_grid_light_set;
+	dev->base.light_flush = shm_client_light_flush;
+	dev->base.screen_get_data = shm_client_screen_get_data;
+
+	return dev;
+}
+
+int
+ctlra_impl_shm_probe(struct ctlra_t *ctlra)
+{
+	int accepted = 0;
+	char name[SHM_NAME_MAX];
+
+	for(uint32_t i = 0; i < CTLRA_SHM_DEVS_MAX; i++) {
+		shm_name(name, i);
+		struct ctlra_shm_seg_t *seg = shm_map(name, O_RDWR);
+		if(!seg)
+			continue;
+
+		struct ctlra_shm_dev_t *dev = shm_client_connect(ctlra, seg);
+		if(!dev) {
+			shm_unmap(seg);
+			continue;
+		}
+
+		CTLRA_INFO(ctlra, "connecting to shared %s via %s\n",
+			   dev->base.info.device, name);
+		accepted += ctlra_impl_dev_publish(ctlra, &dev->base);
+	}
+
+	return accepted;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2017, OpenAV Productions,
+ * Harry van Haaren <harryhaaren@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CTLRA_SHM_H
+#define CTLRA_SHM_H
+
+#include <stdint.h>
+
+#include "ctlra.h"
+#include "event.h"
+
+/* Sharing a device between processes. One process, the daemon, owns the
+ * USB device and shares it through a POSIX shared memory segment. Other
+ * processes find the segments in ctlra_probe(), and use the device
+ * through the normal ctlra_dev_* API, without touching USB.
+ *
+ * The segment holds an event ring for each client, written by the daemon
+ * and read in place by the client, and regions for the lights and each
+ * screen. A client draws straight into a region, which it owns from its
+ * first write until it disconnects or exits: writes from other clients
+ * are ignored meanwhile. Regions are seqlock protected, the daemon only
+ * sends complete frames to the device. */
+
+#define CTLRA_SHM_MAGIC       0x52544c43 /* "CLTR" */
+#define CTLRA_SHM_VERSION     1
+#define CTLRA_SHM_DEVS_MAX    16
+#define CTLRA_SHM_CLIENTS_MAX 8
+#define CTLRA_SHM_RING_SIZE   512 /* power of two */
+#define CTLRA_SHM_LIGHTS_MAX  256
+#define CTLRA_SHM_GRID_SQUARES_MAX 128
+#define CTLRA_SHM_SCREEN_BYTES (480 * 272 * 2)
+
+/* Segment names are CTLRA_SHM_NAME followed by the index */
+#define CTLRA_SHM_NAME "/ctlra."
+
+#define CTLRA_SHM_REGION_LIGHTS 0
+#define CTLRA_SHM_REGION_SCREEN 1 /* + screen index */
+#define CTLRA_SHM_REGION_COUNT  (1 + CTLRA_NUM_SCREENS_MAX)
+
+struct ctlra_shm_region_t {
+	/* client slot + 1 of the owner, 0 if free. Claimed with CAS */
+	uint32_t owner;
+	/* odd while the owner writes, even for a complete frame */
+	uint32_t seq;
+};
+
+struct ctlra_shm_client_t {
+	/* pid of the client, 0 if the slot is free. Claimed with CAS */
+	uint32_t pid;
+	/* written by the daemon */
+	uint32_t head;
+	uint32_t dropped;
+	/* written by the client */
+	uint32_t tail __attribute__((aligned(64)));
+	struct ctlra_event_t events[CTLRA_SHM_RING_SIZE]
+		__attribute__((aligned(64)));
+};
+
+struct ctlra_shm_seg_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t daemon_pid;
+	/* cleared when the daemon removes the device */
+	uint32_t alive;
+
+	uint32_t vendor_id;
+	uint32_t device_id;
+	char serial[CTLRA_DEV_SERIAL_MAX];
+
+	struct ctlra_shm_region_t regions[CTLRA_SHM_REGION_COUNT];
+	uint32_t lights[CTLRA_SHM_LIGHTS_MAX];
+	uint32_t grid_lights[CTLRA_NUM_GRIDS_MAX][CTLRA_SHM_GRID_SQUARES_MAX];
+	/* size of each screen, 0 if the device has no such screen */
+	uint32_t screen_bytes[CTLRA_NUM_SCREENS_MAX];
+	/* part of the screen changed by the last frame */
+	struct ctlra_screen_zone_t screen_zone[CTLRA_NUM_SCREENS_MAX];
+
+	struct ctlra_shm_client_t clients[CTLRA_SHM_CLIENTS_MAX];
+
+	/* the slack allows the one byte over-run check of screen redraws */
+	uint8_t screens[CTLRA_NUM_SCREENS_MAX][CTLRA_SHM_SCREEN_BYTES + 64]
+		__attribute__((aligned(64)));
+};
+
+/* Daemon side */
+struct ctlra_shm_server_t;
+
+/** Share *dev* with other processes. Call from the accept callback.
+ * @retval 0 Failed to create the shared memory segment */
+struct ctlra_shm_server_t *ctlra_shm_server_create(struct ctlra_dev_t *dev);
+
+/** Stop sharing, clients see the device as removed */
+void ctlra_shm_server_destroy(struct ctlra_shm_server_t *s);
+
+/** Publish events to all clients, call from the event callback */
+void ctlra_shm_server_events(struct ctlra_shm_server_t *s,
+			     uint32_t num_events,
+			     struct ctlra_event_t **events);
+
+/** Apply light writes of clients, call from the feedback callback.
+ * @retval 1 A client owns the lights, the daemon should leave them
+ * @retval 0 No client owns the lights */
+int ctlra_shm_server_feedback(struct ctlra_shm_server_t *s);
+
+/** Copy a client frame to *pixels*, and its changed part to *redraw*.
+ * Call from the screen redraw callback.
+ * @retval -1 No client owns the screen, the daemon may draw it
+ * @retval 0 No new frame
+ * @retval 1 A new frame was copied, return 1 to flush it */
+int32_t ctlra_shm_server_screen(struct ctlra_shm_server_t *s,
+				uint32_t screen_idx, uint8_t *pixels,
+				uint32_t bytes,
+				struct ctlra_screen_zone_t *redraw);
+
+#endif /* CTLRA_SHM_H */
@@ -4,8 +4,14 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
 
 #include "impl.h"
+#include "usb.h"
+#include "hid.h"
 
 #include <libusb.h>
 
@@ -30,9 +36,16 @@ int libusb_set_auto_detach_kernel_driver() {return 0xcafe;}
 /* From cltra.c */
 extern int ctlra_impl_get_id_by_vid_pid(uint32_t vid, uint32_t pid);
 extern int ctlra_impl_accept_dev(struct ctlra_t *ctlra, int dev_id);
+extern struct ctlra_dev_t *ctlra_impl_dev_bringup(struct ctlra_t *ctlra,
+						  int dev_id);
+extern int ctlra_impl_dev_publish(struct ctlra_t *ctlra,
+				  struct ctlra_dev_t *dev);
 extern int ctlra_impl_dev_get_by_vid_pid(struct ctlra_t *ctlra, int32_t vid,
 					 int32_t pid, struct ctlra_dev_t **out_dev);
 
+/* Drives HID controllers without a dedicated driver */
+CTLRA_DEVICE_DECL(hid_generic);
+
 /* struct to track async USB transfers */
 struct usb_async_t {
 	struct usb_async_t *next;
@@ -43,6 +56,36 @@ struct usb_async_t {
 
 #include <assert.h>
 
+/* Hotplugged devices are brought up (opened, serial read, driver
+ * connected) on a helper thread, so the input of the other devices is
+ * not stalled while ctlra_idle_iter() handles the arrival. The ready
+ * device is pushed onto a lock-free stack, and the main loop publishes
+ * it to the device list and the application accept callback. */
+struct ctlra_usb_hotplug_work_t {
+	struct ctlra_usb_hotplug_work_t *next;
+	libusb_device *dev;
+};
+
+struct ctlra_usb_hotplug_t {
+	struct ctlra_t *ctlra;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* FIFO of arrived devices and quit flag, protected by lock */
+	struct ctlra_usb_hotplug_work_t *work_head;
+	struct ctlra_usb_hotplug_work_t *work_tail;
+	uint8_t quit;
+	/* devices ready to publish, linked by dev_list_next */
+	struct ctlra_dev_t *ready;
+};
+
+/* Set on the hotplug helper thread. Transfers a driver makes while it
+ * connects there are synchronous, so no transfer completes on the main
+ * thread before the device is published */
+static __thread uint8_t usb_bringup_sync;
+/* context of the helper thread, devices have none until published */
+static __thread struct ctlra_t *usb_bringup_ctlra;
+
 static inline int __attribute__ ((unused))
 ctlra_usb_impl_xfer_validate(struct ctlra_dev_t *dev)
 {
@@ -68,14 +111,75 @@ ctlra_usb_impl_xfer_validate(struct ctlra_dev_t *dev)
 #define XFER_VALIDATE(dev)
 #endif
 
+/* The async list and in-flight counts of a device are updated by the
+ * thread submitting an xfer and by the thread handling its completion.
+ * These differ when a screen shard submits the screen writes. */
+static inline void
+ctlra_usb_impl_async_lock(struct ctlra_dev_t *dev)
+{
+	while(__atomic_test_and_set(&dev->usb_async_lock, __ATOMIC_ACQUIRE))
+		;
+}
+
+static inline void
+ctlra_usb_impl_async_unlock(struct ctlra_dev_t *dev)
+{
+	__atomic_clear(&dev->usb_async_lock, __ATOMIC_RELEASE);
+}
+
+/* Insert *async* at the head of the list, and count it in flight. This
+ * is done before submitting, as the xfer may complete right away. */
+static void
+ctlra_usb_impl_async_link(struct ctlra_dev_t *dev, struct usb_async_t *async,
+			  int stat_idx)
+{
+	ctlra_usb_impl_async_lock(dev);
+	XFER_VALIDATE(dev);
+	struct usb_async_t *dev_current = dev->usb_async_next;
+	if(dev_current)
+		dev_current->prev = async;
+	async->next = dev_current;
+	async->prev = 0;
+	dev->usb_async_next = async;
+	dev->usb_xfer_counts[stat_idx]++;
+	XFER_VALIDATE(dev);
+	ctlra_usb_impl_async_unlock(dev);
+}
+
+static void
+ctlra_usb_impl_async_unlink(struct ctlra_dev_t *dev,
+			    struct usb_async_t *async, int stat_idx)
+{
+	ctlra_usb_impl_async_lock(dev);
+	XFER_VALIDATE(dev);
+	struct usb_async_t *next = async->next;
+	struct usb_async_t *prev = async->prev;
+	if(next)
+		next->prev = prev;
+	if(prev)
+		prev->next = next;
+	else
+		dev->usb_async_next = next;
+	dev->usb_xfer_counts[stat_idx]--;
+	XFER_VALIDATE(dev);
+	ctlra_usb_impl_async_unlock(dev);
+}
+
+/* Cancel the in-flight xfers of *dev*. If *cb* is non-NULL, only xfers
+ * that complete into *cb* are cancelled, which allows cancelling the
+ * reads of a device while its final writes still drain. */
 static inline void
-ctlra_usb_impl_xfer_release(struct ctlra_dev_t *dev)
+ctlra_usb_impl_xfer_release(struct ctlra_dev_t *dev, libusb_transfer_cb_fn cb)
 {
 	struct ctlra_t *c = dev->ctlra_context;
 	struct usb_async_t *current = dev->usb_async_next;
 
 	int i = 0;
 	while(current) {
+		if(cb && current->xfer->callback != cb) {
+			current = current->next;
+			continue;
+		}
 		CTLRA_DRIVER(c, "async free %d : %p\n", i, current);
 		int ret = libusb_cancel_transfer(current->xfer);
 		if(ret) {
@@ -115,6 +219,266 @@ static int ctlra_usb_impl_get_serial(struct libusb_device_handle *handle,
 	return -1;
 }
 
+/* Finds the first HID interface of *dev* that is not a boot keyboard or
+ * mouse, and has an interrupt IN endpoint. Returns the interface number,
+ * or -1 */
+static int
+ctlra_usb_impl_hid_interface(libusb_device *dev, uint8_t *endpoint,
+			     uint8_t *config)
+{
+	struct libusb_config_descriptor *cfg;
+	if(libusb_get_active_config_descriptor(dev, &cfg) != LIBUSB_SUCCESS)
+		return -1;
+
+	int ret = -1;
+	for(int i = 0; i < cfg->bNumInterfaces && ret < 0; i++) {
+		const struct libusb_interface *iface = &cfg->interface[i];
+		if(!iface->num_altsetting)
+			continue;
+		const struct libusb_interface_descriptor *alt =
+			&iface->altsetting[0];
+		if(alt->bInterfaceClass != LIBUSB_CLASS_HID ||
+		   alt->bInterfaceProtocol != 0)
+			continue;
+		for(int e = 0; e < alt->bNumEndpoints; e++) {
+			const struct libusb_endpoint_descriptor *ep =
+				&alt->endpoint[e];
+			if((ep->bmAttributes & 0x3) ==
+			   LIBUSB_TRANSFER_TYPE_INTERRUPT &&
+			   (ep->bEndpointAddress & LIBUSB_ENDPOINT_IN)) {
+				*endpoint = ep->bEndpointAddress;
+				ret = alt->bInterfaceNumber;
+				break;
+			}
+		}
+	}
+	*config = cfg->bConfigurationValue;
+	libusb_free_config_descriptor(cfg);
+	return ret;
+}
+
+/* Reads the report descriptor of an interface bound to the kernel HID
+ * driver from sysfs, without claiming the interface. Returns the length,
+ * or -1 if the interface has no HID device in sysfs */
+static int
+ctlra_usb_impl_hid_sysfs_descriptor(libusb_device *dev, uint8_t config,
+				    int iface, uint8_t *data, uint32_t size)
+{
+	uint8_t ports[USB_PATH_MAX];
+	int n = libusb_get_port_numbers(dev, ports, sizeof(ports));
+	if(n <= 0)
+		return -1;
+
+	char path[256];
+	int len = snprintf(path, sizeof(path), "/sys/bus/usb/devices/%d-%d",
+			   libusb_get_bus_number(dev), ports[0]);
+	for(int i = 1; i < n; i++)
+		len += snprintf(path + len, sizeof(path) - len, ".%d",
+				ports[i]);
+	len += snprintf(path + len, sizeof(path) - len, ":%d.%d",
+			config, iface);
+
+	DIR *dir = opendir(path);
+	if(!dir)
+		return -1;
+
+	/* the HID device is named bus:vid:pid.instance */
+	int ret = -1;
+	struct dirent *e;
+	while(ret < 0 && (e = readdir(dir))) {
+		unsigned b, v, p, inst;
+		if(sscanf(e->d_name, "%4x:%4x:%4x.%4x", &b, &v, &p, &inst) != 4)
+			continue;
+		char file[512];
+		int flen = snprintf(file, sizeof(file), "%s/%s/report_descriptor",
+				    path, e->d_name);
+		if(flen < 0 || (size_t)flen >= sizeof(file))
+			continue;
+		int fd = open(file, O_RDONLY | O_CLOEXEC);
+		if(fd < 0)
+			continue;
+		ssize_t r = read(fd, data, size);
+		close(fd);
+		if(r > 0)
+			ret = r;
+	}
+	closedir(dir);
+	return ret;
+}
+
+/* Reads the report descriptor of *iface* into *data*. Interfaces with a
+ * kernel driver are read from sysfs. Otherwise the descriptor is asked
+ * for on *handle*, which only claims the interface for the transfer.
+ * Returns the length, or <0 on error */
+static int
+ctlra_usb_impl_hid_descriptor(struct ctlra_t *ctlra, libusb_device *dev,
+			      libusb_device_handle *handle, uint8_t config,
+			      int iface, uint8_t *data, uint32_t size)
+{
+	int ret = ctlra_usb_impl_hid_sysfs_descriptor(dev, config, iface,
+						      data, size);
+	if(ret > 0 || !handle)
+		return ret;
+
+	ret = libusb_control_transfer(handle,
+				      LIBUSB_ENDPOINT_IN |
+				      LIBUSB_RECIPIENT_INTERFACE,
+				      LIBUSB_REQUEST_GET_DESCRIPTOR,
+				      LIBUSB_DT_REPORT << 8, iface,
+				      data, size, 1000);
+	if(ret < 0)
+		CTLRA_WARN(ctlra, "HID report descriptor read failed: %s\n",
+			   libusb_error_name(ret));
+	return ret;
+}
+
+/* Connect the generic HID backend to *dev*, returns the device to be
+ * published with ctlra_impl_dev_publish(), or NULL */
+static struct ctlra_dev_t *
+ctlra_usb_impl_hid_bringup(struct ctlra_t *ctlra, libusb_device *dev)
+{
+	struct libusb_device_descriptor desc;
+	if(libusb_get_device_descriptor(dev, &desc) != LIBUSB_SUCCESS)
+		return 0;
+
+	uint8_t endpoint = 0, config = 0;
+	int iface = ctlra_usb_impl_hid_interface(dev, &endpoint, &config);
+	if(iface < 0)
+		return 0;
+
+	struct ctlra_hid_generic_future_t *future = calloc(1, sizeof(*future));
+	if(!future)
+		return 0;
+	future->ctlra = ctlra;
+	future->vid = desc.idVendor;
+	future->pid = desc.idProduct;
+	future->interface = iface;
+	future->endpoint = endpoint;
+
+	libusb_device_handle *handle = 0;
+	if(libusb_open(dev, &handle) != LIBUSB_SUCCESS)
+		handle = 0;
+	if(handle && desc.iManufacturer)
+		libusb_get_string_descriptor_ascii(handle, desc.iManufacturer,
+			(uint8_t *)future->vendor, sizeof(future->vendor));
+	if(handle && desc.iProduct)
+		libusb_get_string_descriptor_ascii(handle, desc.iProduct,
+			(uint8_t *)future->device, sizeof(future->device));
+	int len = ctlra_usb_impl_hid_descriptor(ctlra, dev, handle, config,
+						iface, future->desc,
+						sizeof(future->desc));
+	if(handle)
+		libusb_close(handle);
+
+	struct ctlra_dev_t *new_dev = 0;
+	if(len > 0) {
+		future->desc_size = len;
+		CTLRA_INFO(ctlra, "generic HID for %04x:%04x interface %d\n",
+			   desc.idVendor, desc.idProduct, iface);
+		new_dev = CTLRA_DEVICE_FUNC(hid_generic)(0x0, 0 /* userdata */,
+							 future);
+	}
+	free(future);
+
+	if(new_dev) {
+		new_dev->ctlra_context = ctlra;
+		new_dev->dev_list_next = 0;
+	}
+	return new_dev;
+}
+
+/* Bring up a newly arrived USB device: returns the connected device, to
+ * be published with ctlra_impl_dev_publish(), or NULL */
+static struct ctlra_dev_t *
+ctlra_usb_impl_dev_arrived(struct ctlra_t *ctlra, libusb_device *dev)
+{
+	struct libusb_device_descriptor desc;
+	int ret = libusb_get_device_descriptor(dev, &desc);
+	if(ret != LIBUSB_SUCCESS) {
+		CTLRA_ERROR(ctlra, "libusb err device desc: %d\n", ret);
+		return 0;
+	}
+
+	libusb_device_handle *handle = 0;
+	ret = libusb_open(dev, &handle);
+	if(ret != LIBUSB_SUCCESS)
+		return 0;
+	uint8_t buf[255];
+	ret = ctlra_usb_impl_get_serial(handle, desc.iSerialNumber,
+				  buf, 255);
+	if(ret)
+		snprintf((char *)buf, sizeof(buf), "---");
+
+	CTLRA_INFO(ctlra, "Device attached: %04x:%04x, serial %s\n",
+		   desc.idVendor, desc.idProduct, buf);
+	/* Quirks:
+	 * Here we can handle strange hotplug issues. For example,
+	 * controllers that have a USB hub integrated show as the
+	 * hub first (so the hotplug picks up that VID/PID pair,
+	 * not the device itself for some reason). Here we can
+	 * modify the VID/PID pair based on known corner cases:
+	 */
+	uint32_t quirk_vid = desc.idVendor;
+	uint32_t quirk_pid = desc.idProduct;
+	switch(quirk_vid) {
+	case 0x17cc:
+		/* NI Kontrol D2, change PID from 0x1403 (hub) back
+		 * to the normal PID of 0x1400 */
+		if(quirk_pid == 0x1403)
+			quirk_pid = 0x1400;
+		break;
+	default: break;
+	};
+
+	/* close the handle, it was only opened to retrieve the serial.
+	 * The driver opens its own handle when connecting. */
+	libusb_close(handle);
+
+	int id = ctlra_impl_get_id_by_vid_pid(quirk_vid, quirk_pid);
+	if(id < 0 && ctlra->opts.flags_usb_hid_generic)
+		return ctlra_usb_impl_hid_bringup(ctlra, dev);
+	if(id < 0) {
+		CTLRA_WARN(ctlra, "Ctlra does not support hotplugged device %x %x\n",
+			   quirk_vid, quirk_pid);
+		return 0;
+	}
+
+	return ctlra_impl_dev_bringup(ctlra, id);
+}
+
+int ctlra_impl_usb_hid_probe(struct ctlra_t *ctlra)
+{
+	if(!ctlra->opts.flags_usb_hid_generic)
+		return 0;
+
+	libusb_device **devs;
+	ssize_t cnt = libusb_get_device_list(NULL, &devs);
+	if(cnt < 0)
+		return 0;
+
+	int accepted = 0;
+	for(ssize_t i = 0; i < cnt; i++) {
+		struct libusb_device_descriptor desc;
+		if(libusb_get_device_descriptor(devs[i], &desc))
+			continue;
+		/* devices with their own driver were probed already */
+		if(ctlra_impl_get_id_by_vid_pid(desc.idVendor,
+						desc.idProduct) >= 0)
+			continue;
+		struct ctlra_dev_t *open;
+		if(ctlra_impl_dev_get_by_vid_pid(ctlra, desc.idVendor,
+						 desc.idProduct, &open) == 0)
+			continue;
+
+		struct ctlra_dev_t *dev =
+			ctlra_usb_impl_hid_bringup(ctlra, devs[i]);
+		if(dev)
+			accepted += ctlra_impl_dev_publish(ctlra, dev);
+	}
+	libusb_free_device_list(devs, 1);
+	return accepted;
+}
+
 static int ctlra_usb_impl_hotplug_cb(libusb_context *ctx,
                                      libusb_device *dev,
                                      libusb_hotplug_event event,
@@ -176,62 +540,89 @@ static int ctlra_usb_impl_hotplug_cb(libusb_context *ctx,
 	}
 
 	if(event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+		struct ctlra_usb_hotplug_t *hp = ctlra->usb_hotplug;
+		if(!hp) {
+			struct ctlra_dev_t *new_dev =
+				ctlra_usb_impl_dev_arrived(ctlra, dev);
+			if(new_dev)
+				ctlra_impl_dev_publish(ctlra, new_dev);
+			return 0;
+		}
 
-		libusb_device_handle *handle = 0;
-		ret = libusb_open(dev, &handle);
-		if(ret != LIBUSB_SUCCESS)
+		struct ctlra_usb_hotplug_work_t *work = malloc(sizeof(*work));
+		if(!work)
 			return -1;
-		uint8_t buf[255];
-		ret = ctlra_usb_impl_get_serial(handle, desc.iSerialNumber,
-					  buf, 255);
-		if(ret)
-			snprintf((char *)buf, sizeof(buf), "---");
-
-		CTLRA_INFO(ctlra, "Device attached: %04x:%04x, serial %s\n",
-			   desc.idVendor, desc.idProduct, buf);
-		/* Quirks:
-		 * Here we can handle strange hotplug issues. For example,
-		 * controllers that have a USB hub integrated show as the
-		 * hub first (so the hotplug picks up that VID/PID pair,
-		 * not the device itself for some reason). Here we can
-		 * modify the VID/PID pair based on known corner cases:
-		 */
-		uint32_t quirk_vid = desc.idVendor;
-		uint32_t quirk_pid = desc.idProduct;
-		switch(quirk_vid) {
-		case 0x17cc:
-			/* NI Kontrol D2, change PID from 0x1403 (hub) back
-			 * to the normal PID of 0x1400 */
-			if(quirk_pid == 0x1403)
-				quirk_pid = 0x1400;
-			break;
-		default: break;
-		};
+		work->next = 0;
+		work->dev = libusb_ref_device(dev);
+
+		pthread_mutex_lock(&hp->lock);
+		if(hp->work_tail)
+			hp->work_tail->next = work;
+		else
+			hp->work_head = work;
+		hp->work_tail = work;
+		pthread_cond_signal(&hp->cond);
+		pthread_mutex_unlock(&hp->lock);
+		return 0;
+	}
 
-		int id = ctlra_impl_get_id_by_vid_pid(quirk_vid, quirk_pid);
-		if(id < 0) {
-			/* Device is not supported by Ctlra, so release
-			 * the libusb handle which was opened to retrieve
-			 * the serial from the device */
-			CTLRA_WARN(ctlra, "Ctlra does not support hotplugged device %x %x\n",
-				   quirk_vid, quirk_pid);
-			libusb_close(handle);
-			return -1;
-		}
+	return 0;
+}
 
-		int accepted = ctlra_impl_accept_dev(ctlra, id);
-		if(!accepted)
-			libusb_close(handle);
+/* Take all devices the helper thread has brought up, oldest first */
+static struct ctlra_dev_t *
+ctlra_usb_impl_hotplug_take(struct ctlra_usb_hotplug_t *hp)
+{
+	struct ctlra_dev_t *dev = __atomic_exchange_n(&hp->ready, 0,
+						      __ATOMIC_ACQUIRE);
+	struct ctlra_dev_t *fifo = 0;
+	while(dev) {
+		struct ctlra_dev_t *next = dev->dev_list_next;
+		dev->dev_list_next = fifo;
+		fifo = dev;
+		dev = next;
+	}
+	return fifo;
+}
 
-		/* close the handle, since its no longer needed with
-		 * the device set up. This is different in the hotplug
-		 * path than the present-on-probe path, but also works.
-		 */
-		libusb_close(handle);
+static void *
+ctlra_usb_impl_hotplug_thread(void *ud)
+{
+	struct ctlra_usb_hotplug_t *hp = ud;
+	usb_bringup_sync = 1;
+	usb_bringup_ctlra = hp->ctlra;
+
+	pthread_mutex_lock(&hp->lock);
+	for(;;) {
+		while(!hp->work_head && !hp->quit)
+			pthread_cond_wait(&hp->cond, &hp->lock);
+		if(hp->quit)
+			break;
 
-		return 0;
-	}
+		struct ctlra_usb_hotplug_work_t *work = hp->work_head;
+		hp->work_head = work->next;
+		if(!hp->work_head)
+			hp->work_tail = 0;
+		pthread_mutex_unlock(&hp->lock);
+
+		struct ctlra_dev_t *dev =
+			ctlra_usb_impl_dev_arrived(hp->ctlra, work->dev);
+		libusb_unref_device(work->dev);
+		free(work);
+
+		if(dev) {
+			dev->dev_list_next = __atomic_load_n(&hp->ready,
+							     __ATOMIC_RELAXED);
+			while(!__atomic_compare_exchange_n(&hp->ready,
+						&dev->dev_list_next, dev, 1,
+						__ATOMIC_RELEASE,
+						__ATOMIC_RELAXED))
+				;
+		}
 
+		pthread_mutex_lock(&hp->lock);
+	}
+	pthread_mutex_unlock(&hp->lock);
 	return 0;
 }
 
@@ -242,6 +633,73 @@ void ctlra_impl_usb_idle_iter(struct ctlra_t *ctlra)
 	 * 2nd: timeval to wait - 0 returns as if non blocking
 	 * 3rd: int* to completed event - unused by Ctlra */
 	libusb_handle_events_timeout_completed(ctlra->ctx, &tv, NULL);
+
+	/* publish devices brought up by the hotplug helper thread */
+	struct ctlra_usb_hotplug_t *hp = ctlra->usb_hotplug;
+	if(hp && __atomic_load_n(&hp->ready, __ATOMIC_RELAXED)) {
+		struct ctlra_dev_t *dev = ctlra_usb_impl_hotplug_take(hp);
+		while(dev) {
+			struct ctlra_dev_t *next = dev->dev_list_next;
+			ctlra_impl_dev_publish(ctlra, dev);
+			dev = next;
+		}
+	}
+}
+
+static void
+ctlra_usb_impl_hotplug_start(struct ctlra_t *ctlra)
+{
+	struct ctlra_usb_hotplug_t *hp = calloc(1, sizeof(*hp));
+	if(!hp)
+		return;
+	hp->ctlra = ctlra;
+	pthread_mutex_init(&hp->lock, 0);
+	pthread_cond_init(&hp->cond, 0);
+
+	if(pthread_create(&hp->thread, 0, ctlra_usb_impl_hotplug_thread,
+			  hp)) {
+		CTLRA_WARN(ctlra, "hotplug thread failed, using sync %d\n", 0);
+		pthread_cond_destroy(&hp->cond);
+		pthread_mutex_destroy(&hp->lock);
+		free(hp);
+		return;
+	}
+	ctlra->usb_hotplug = hp;
+}
+
+static void
+ctlra_usb_impl_hotplug_stop(struct ctlra_t *ctlra)
+{
+	struct ctlra_usb_hotplug_t *hp = ctlra->usb_hotplug;
+	if(!hp)
+		return;
+
+	pthread_mutex_lock(&hp->lock);
+	hp->quit = 1;
+	pthread_cond_signal(&hp->cond);
+	pthread_mutex_unlock(&hp->lock);
+	pthread_join(hp->thread, 0);
+	ctlra->usb_hotplug = 0;
+
+	while(hp->work_head) {
+		struct ctlra_usb_hotplug_work_t *work = hp->work_head;
+		hp->work_head = work->next;
+		libusb_unref_device(work->dev);
+		free(work);
+	}
+
+	/* devices that were brought up but never published */
+	struct ctlra_dev_t *dev = ctlra_usb_impl_hotplug_take(hp);
+	while(dev) {
+		struct ctlra_dev_t *next = dev->dev_list_next;
+		if(dev->disconnect)
+			dev->disconnect(dev);
+		dev = next;
+	}
+
+	pthread_cond_destroy(&hp->cond);
+	pthread_mutex_destroy(&hp->lock);
+	free(hp);
 }
 
 int ctlra_dev_impl_usb_init(struct ctlra_t *ctlra)
@@ -284,6 +742,8 @@ int ctlra_dev_impl_usb_init(struct ctlra_t *ctlra)
 					       &hp[0]);
 	if (ret != LIBUSB_SUCCESS)
 		CTLRA_WARN(ctlra, "hotplug register failure: %d\n", ret);
+	else if(!ctlra->opts.flags_usb_sync_hotplug)
+		ctlra_usb_impl_hotplug_start(ctlra);
 
 	return 0;
 }
@@ -302,7 +762,8 @@ int ctlra_dev_impl_usb_open(struct ctlra_dev_t *ctlra_dev, int vid,
 	if (cnt < 0)
 		goto fail;
 
-	struct ctlra_t *ctlra = ctlra_dev->ctlra_context;
+	struct ctlra_t *ctlra = ctlra_dev->ctlra_context ?
+				ctlra_dev->ctlra_context : usb_bringup_ctlra;
 
 	while ((dev = devs[i++]) != NULL) {
 		struct libusb_device_descriptor desc;
@@ -353,7 +814,8 @@ int ctlra_dev_impl_usb_open_interface(struct ctlra_dev_t *ctlra_dev,
                                       int interface,
                                       int handle_idx)
 {
-	struct ctlra_t *ctlra = ctlra_dev->ctlra_context;
+	struct ctlra_t *ctlra = ctlra_dev->ctlra_context ?
+				ctlra_dev->ctlra_context : usb_bringup_ctlra;
 
 	if(handle_idx >= CTLRA_USB_IFACE_PER_DEV) {
 		CTLRA_ERROR(ctlra,
@@ -384,6 +846,7 @@ int ctlra_dev_impl_usb_open_interface(struct ctlra_dev_t *ctlra_dev,
 			CTLRA_ERROR(ctlra,
 				    "Enable auto-kernel unclaiming err: %d\n",
 				    ret);
+			libusb_close(handle);
 			return -1;
 		}
 	} else {
@@ -401,6 +864,7 @@ int ctlra_dev_impl_usb_open_interface(struct ctlra_dev_t *ctlra_dev,
 			CTLRA_ERROR(ctlra,
 				    "Kernel has claimed the interface (%d): Stop other applications using this device and retry\n",
 				    kernel_active);
+		libusb_close(handle);
 		return -1;
 	}
 
@@ -465,29 +929,14 @@ static void ctlra_usb_xfr_done_generic(struct libusb_transfer *xfr,
 		break;
 	}
 
-	dev->usb_xfer_counts[stat_idx]--;
-
 	/* get async from xfr->buffer address, see usb_async_t struct */
 	struct usb_async_t *async = (struct usb_async_t *)
 		(((uint8_t *)xfr->buffer) - offsetof(struct usb_async_t, malloc_mem));
 	CTLRA_DRIVER(ctlra, "free %s async @ %p\n",
 		     read == 1 ? "read" : "write", async);
 
-	XFER_VALIDATE(dev);
-
 	/* remove node from double linked list*/
-	struct usb_async_t *next = async->next;
-	struct usb_async_t *prev = async->prev;
-	CTLRA_DRIVER(ctlra, "async = %p, next %p, prev %p\n", async, next, prev);
-	if(next)
-		next->prev = prev;
-	if(prev) {
-		prev->next = next;
-	} else {
-		dev->usb_async_next = next;
-	}
-
-	XFER_VALIDATE(dev);
+	ctlra_usb_impl_async_unlink(dev, async, stat_idx);
 
 	free(async);
 
@@ -514,6 +963,10 @@ int ctlra_dev_impl_usb_interrupt_read(struct ctlra_dev_t *dev, uint32_t idx,
 	int transferred;
 	struct ctlra_t *ctlra = dev->ctlra_context;
 
+	/* no reads before the device is published, it has no event func */
+	if(usb_bringup_sync)
+		return 0;
+
 /* we can use synchronous reads too, but the latency builds up of the
  * timeout. AKA: with 6 devices, at 100 ms each, 600ms between a re-poll
  * of the USB device - totally unacceptable.
@@ -549,17 +1002,8 @@ int ctlra_dev_impl_usb_interrupt_read(struct ctlra_dev_t *dev, uint32_t idx,
 	 * pointer at the start of the block, before the libusb xfer mem */
 	struct usb_async_t *async = malloc(size + sizeof(struct usb_async_t));
 
-	XFER_VALIDATE(dev);
-
 	/* insert at head into double-linked list for device */
-	struct usb_async_t *dev_current = dev->usb_async_next;
-	if(dev_current)
-		dev_current->prev = async;
-	async->next = dev_current;
-	async->prev = 0;
-	dev->usb_async_next = async;
-
-	XFER_VALIDATE(dev);
+	ctlra_usb_impl_async_link(dev, async, USB_XFER_INFLIGHT_READ);
 
 	/* back-pointer from async to xfer */
 	async->xfer = xfr;
@@ -584,8 +1028,9 @@ int ctlra_dev_impl_usb_interrupt_read(struct ctlra_dev_t *dev, uint32_t idx,
 	 * impact of these IO errors - so just free buffers and next iter
 	 * of reads will catch any data if available */
 	if(res) {
+		ctlra_usb_impl_async_unlink(dev, async, USB_XFER_INFLIGHT_READ);
 		libusb_free_transfer(xfr);
-		free(usb_data);
+		free(async);
 		if(res == LIBUSB_ERROR_IO)
 			return 0;
 
@@ -593,8 +1038,6 @@ int ctlra_dev_impl_usb_interrupt_read(struct ctlra_dev_t *dev, uint32_t idx,
 		return -1;
 	}
 
-
-	dev->usb_xfer_counts[USB_XFER_INFLIGHT_READ]++;
 	dev->usb_xfer_counts[USB_XFER_INT_READ]++;
 	CTLRA_DRIVER(ctlra, "async int read @ %p\n", async);
 
@@ -638,6 +1081,31 @@ int ctlra_dev_impl_usb_interrupt_read(struct ctlra_dev_t *dev, uint32_t idx,
 
 }
 
+/* Synchronous write, used while a driver connects on the hotplug helper
+ * thread. A short timeout bounds how long a connect can take. */
+static int
+ctlra_usb_impl_write_sync(struct ctlra_dev_t *dev, uint32_t idx,
+			  uint32_t endpoint, uint8_t *data, uint32_t size,
+			  int bulk)
+{
+	const uint32_t timeout = 100;
+	int transferred = 0;
+	int r;
+	if(bulk)
+		r = libusb_bulk_transfer(dev->usb_handle[idx], endpoint, data,
+					 size, &transferred, timeout);
+	else
+		r = libusb_interrupt_transfer(dev->usb_handle[idx], endpoint,
+					      data, size, &transferred,
+					      timeout);
+	if(r < 0) {
+		CTLRA_DRIVER(usb_bringup_ctlra, "bring-up write error %s\n",
+			     libusb_error_name(r));
+		return r == LIBUSB_ERROR_TIMEOUT ? 0 : r;
+	}
+	return transferred;
+}
+
 int ctlra_dev_impl_usb_interrupt_write(struct ctlra_dev_t *dev, uint32_t idx,
                                        uint32_t endpoint, uint8_t *data,
                                        uint32_t size)
@@ -646,6 +1114,10 @@ int ctlra_dev_impl_usb_interrupt_write(struct ctlra_dev_t *dev, uint32_t idx,
 	struct ctlra_t *ctlra = dev->ctlra_context;
 	const uint32_t timeout = 0;
 
+	if(usb_bringup_sync)
+		return ctlra_usb_impl_write_sync(dev, idx, endpoint, data,
+						 size, 0);
+
 	int inf = dev->usb_xfer_counts[USB_XFER_INFLIGHT_WRITE];
 	if(inf >= CTLRA_ASYNC_READ_MAX) {
 		dev->usb_xfer_counts[USB_XFER_ERROR]++;
@@ -664,14 +1136,7 @@ int ctlra_dev_impl_usb_interrupt_write(struct ctlra_dev_t *dev, uint32_t idx,
 		dev->usb_xfer_counts[USB_XFER_ERROR]++;
 		return -ENOSPC;
 	}
-	XFER_VALIDATE(dev);
-	struct usb_async_t *dev_current = dev->usb_async_next;
-	if(dev_current)
-		dev_current->prev = async;
-	async->next = dev_current;
-	async->prev = 0;
-	dev->usb_async_next = async;
-	XFER_VALIDATE(dev);
+	ctlra_usb_impl_async_link(dev, async, USB_XFER_INFLIGHT_WRITE);
 
 	/* back-pointer from async to xfer */
 	async->xfer = xfr;
@@ -689,14 +1154,14 @@ int ctlra_dev_impl_usb_interrupt_write(struct ctlra_dev_t *dev, uint32_t idx,
 					       banish it if required */
 				       timeout);
 	if(libusb_submit_transfer(xfr) < 0) {
+		ctlra_usb_impl_async_unlink(dev, async, USB_XFER_INFLIGHT_WRITE);
 		libusb_free_transfer(xfr);
-		free(usb_data);
+		free(async);
 		//printf("error submitting data!!\n");
 		return -1;
 	}
 
 	dev->usb_xfer_counts[USB_XFER_INT_WRITE]++;
-	dev->usb_xfer_counts[USB_XFER_INFLIGHT_WRITE]++;
 
 	/* do we want to return the size here? */
 	/* This read op is async - there *IS* no data written yet */
@@ -727,6 +1192,10 @@ int ctlra_dev_impl_usb_bulk_write(struct ctlra_dev_t *dev, uint32_t idx,
 	struct ctlra_t *ctlra = dev->ctlra_context;
 	const uint32_t timeout = 0;
 
+	if(usb_bringup_sync)
+		return ctlra_usb_impl_write_sync(dev, idx, endpoint, data,
+						 size, 1);
+
 	int inf = dev->usb_xfer_counts[USB_XFER_INFLIGHT_WRITE];
 	if(inf >= CTLRA_ASYNC_READ_MAX) {
 		dev->usb_xfer_counts[USB_XFER_BULK_ERROR]++;
@@ -745,14 +1214,7 @@ int ctlra_dev_impl_usb_bulk_write(struct ctlra_dev_t *dev, uint32_t idx,
 		dev->usb_xfer_counts[USB_XFER_BULK_ERROR]++;
 		return -ENOSPC;
 	}
-	XFER_VALIDATE(dev);
-	struct usb_async_t *dev_current = dev->usb_async_next;
-	if(dev_current)
-		dev_current->prev = async;
-	async->next = dev_current;
-	async->prev = 0;
-	dev->usb_async_next = async;
-	XFER_VALIDATE(dev);
+	ctlra_usb_impl_async_link(dev, async, USB_XFER_INFLIGHT_WRITE);
 
 	/* back-pointer from async to xfer */
 	async->xfer = xfr;
@@ -769,6 +1231,7 @@ int ctlra_dev_impl_usb_bulk_write(struct ctlra_dev_t *dev, uint32_t idx,
 					       banish it if required */
 				       timeout);
 	if(libusb_submit_transfer(xfr) < 0) {
+		ctlra_usb_impl_async_unlink(dev, async, USB_XFER_INFLIGHT_WRITE);
 		libusb_free_transfer(xfr);
 		free(async);
 		dev->usb_xfer_counts[USB_XFER_BULK_ERROR]++;
@@ -777,7 +1240,6 @@ int ctlra_dev_impl_usb_bulk_write(struct ctlra_dev_t *dev, uint32_t idx,
 	}
 
 	dev->usb_xfer_counts[USB_XFER_BULK_WRITE]++;
-	dev->usb_xfer_counts[USB_XFER_INFLIGHT_WRITE]++;
 
 	/* do we want to return the size here? */
 	/* This read op is async - there *IS* no data written yet */
@@ -835,42 +1297,11 @@ void ctlra_dev_usb_stats_debug(struct ctlra_dev_t *dev)
 	}
 }
 
-void ctlra_dev_impl_usb_close(struct ctlra_dev_t *dev)
+static void
+ctlra_usb_impl_release_handles(struct ctlra_dev_t *dev)
 {
 	struct ctlra_t *ctlra = dev->ctlra_context;
 
-	struct timeval tv = {
-		.tv_sec = 0,
-		.tv_usec = 1,
-	};
-
-	/* if there are inflight writes, these are often to disable any
-	 * LEDs or lights on the device. If so, wait a bit, to be nice :)
-	 */
-	int wait_count = 0;
-	do {
-		libusb_handle_events_timeout(ctlra->ctx, &tv);
-	} while(dev->usb_xfer_counts[USB_XFER_INFLIGHT_WRITE] &&
-		wait_count++ < 10000);
-
-	int32_t inf_writes = dev->usb_xfer_counts[USB_XFER_INFLIGHT_WRITE];
-	if(inf_writes)
-		CTLRA_WARN(ctlra, "[%s] inflight writes at close = %d\n"
-				  "     Some lights on the device may still be on\n",
-			   dev->info.device, inf_writes);
-
-	ctlra_usb_impl_xfer_release(dev);
-
-	libusb_context *ctx = ctlra->ctx;
-
-	int ret = libusb_handle_events_timeout_completed(ctlra->ctx, &tv, 0);
-	int32_t inf_cancels = dev->usb_xfer_counts[USB_XFER_INFLIGHT_CANCEL];
-	if(ret || inf_cancels) {
-		CTLRA_WARN(ctlra,
-			   "[%s] inflight cancels at close = %d, ret %d\n",
-			   dev->info.device, inf_cancels, ret);
-	}
-
 	for(int i = 0; i < CTLRA_USB_IFACE_PER_DEV; i++) {
 
 		if(dev->usb_handle[i]) {
@@ -885,16 +1316,180 @@ void ctlra_dev_impl_usb_close(struct ctlra_dev_t *dev)
 
 			/* close() takes a handle* ptr... */
 			libusb_close(dev->usb_handle[i]);
+			dev->usb_handle[i] = 0;
 		}
 	}
+}
+
+#define CTLRA_USB_TEARDOWN_MS_DEFAULT 1000
+#define CTLRA_USB_CANCEL_MS 50
+
+/* A closed device whose final writes are still in flight. Drivers free
+ * their dev_t straight after ctlra_dev_impl_usb_close(), so the USB state
+ * is moved to a shadow dev_t, and the xfers are re-pointed at it. */
+struct ctlra_usb_parked_t {
+	struct ctlra_usb_parked_t *next;
+	struct ctlra_dev_t shadow;
+};
+
+static void
+ctlra_usb_impl_parked_read_cb(struct ctlra_dev_t *dev, uint32_t endpoint,
+			      uint8_t *data, uint32_t size)
+{
+	/* device is gone, drop any data that arrives */
+}
+
+static uint64_t
+ctlra_usb_impl_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static int
+ctlra_usb_impl_parked_pending(struct ctlra_t *ctlra, int writes_only)
+{
+	int pending = 0;
+	struct ctlra_usb_parked_t *p = ctlra->usb_parked;
+	for(; p; p = p->next) {
+		uint32_t *counts = p->shadow.usb_xfer_counts;
+		if(writes_only)
+			pending += counts[USB_XFER_INFLIGHT_WRITE];
+		else
+			pending += p->shadow.usb_async_next != 0;
+	}
+	return pending;
+}
+
+/* Handle libusb events until nothing is pending, or *deadline* passes */
+static void
+ctlra_usb_impl_parked_wait(struct ctlra_t *ctlra, uint64_t deadline,
+			   int writes_only)
+{
+	uint64_t now = ctlra_usb_impl_now_ms();
+	while(now < deadline &&
+	      ctlra_usb_impl_parked_pending(ctlra, writes_only)) {
+		uint64_t left = deadline - now;
+		struct timeval tv = {
+			.tv_sec = left / 1000,
+			.tv_usec = (left % 1000) * 1000,
+		};
+		libusb_handle_events_timeout_completed(ctlra->ctx, &tv, 0);
+		now = ctlra_usb_impl_now_ms();
+	}
+}
+
+void ctlra_impl_usb_teardown(struct ctlra_t *ctlra)
+{
+	if(!ctlra->usb_parked)
+		return;
+
+	uint32_t timeout = ctlra->opts.teardown_timeout_ms;
+	if(timeout == 0)
+		timeout = CTLRA_USB_TEARDOWN_MS_DEFAULT;
+
+	/* if there are inflight writes, these are often to disable any
+	 * LEDs or lights on the device. All devices are waited on at the
+	 * same time, with one deadline, to be nice but bounded :)
+	 */
+	uint64_t start = ctlra_usb_impl_now_ms();
+	ctlra_usb_impl_parked_wait(ctlra, start + timeout, 1);
+	uint64_t drained = ctlra_usb_impl_now_ms();
+
+	struct ctlra_usb_parked_t *p;
+	for(p = ctlra->usb_parked; p; p = p->next) {
+		struct ctlra_dev_t *dev = &p->shadow;
+		int32_t inf_writes = dev->usb_xfer_counts[USB_XFER_INFLIGHT_WRITE];
+		if(inf_writes)
+			CTLRA_WARN(ctlra, "[%s] inflight writes at close = %d\n"
+					  "     Some lights on the device may still be on\n",
+				   dev->info.device, inf_writes);
+		ctlra_usb_impl_xfer_release(dev, ctlra_usb_xfr_write_done_cb);
+	}
+
+	ctlra_usb_impl_parked_wait(ctlra, drained + CTLRA_USB_CANCEL_MS, 0);
+
+	while(ctlra->usb_parked) {
+		p = ctlra->usb_parked;
+		ctlra->usb_parked = p->next;
+
+		struct ctlra_dev_t *dev = &p->shadow;
+		int32_t inf_cancels = dev->usb_xfer_counts[USB_XFER_INFLIGHT_CANCEL];
+		if(inf_cancels || dev->usb_async_next) {
+			CTLRA_WARN(ctlra,
+				   "[%s] inflight cancels at close = %d\n",
+				   dev->info.device, inf_cancels);
+		}
+
+		ctlra_usb_impl_release_handles(dev);
+		ctlra_dev_usb_stats_debug(dev);
+
+		/* libusb still owns xfers pointing at the shadow: leak it
+		 * rather than have a late completion touch freed memory */
+		if(!dev->usb_async_next)
+			free(p);
+	}
+
+	CTLRA_INFO(ctlra, "usb writes drain time = %d msecs.\n",
+		   (int)(drained - start));
+}
+
+void ctlra_dev_impl_usb_close(struct ctlra_dev_t *dev)
+{
+	struct ctlra_t *ctlra = dev->ctlra_context;
+
+	/* the hotplug helper only does sync transfers, and a driver that
+	 * fails to connect has no context yet: nothing to drain */
+	if(usb_bringup_sync || !ctlra) {
+		ctlra_usb_impl_release_handles(dev);
+		return;
+	}
+
+	struct ctlra_usb_parked_t *p = calloc(1, sizeof(*p));
+	if(!p) {
+		CTLRA_ERROR(ctlra, "[%s] no memory to park device at close\n",
+			    dev->info.device);
+		ctlra_usb_impl_xfer_release(dev, 0);
+		ctlra_usb_impl_release_handles(dev);
+		return;
+	}
 
-	ctlra_dev_usb_stats_debug(dev);
-	CTLRA_INFO(ctlra, "[%s] usb writes drain time = %d usecs.\n",
-		   dev->info.device, wait_count);
+	struct ctlra_dev_t *shadow = &p->shadow;
+	shadow->ctlra_context = ctlra;
+	shadow->usb_read_cb = ctlra_usb_impl_parked_read_cb;
+	snprintf(shadow->info.device, sizeof(shadow->info.device), "%s",
+		 dev->info.device);
+	memcpy(shadow->usb_handle, dev->usb_handle, sizeof(dev->usb_handle));
+	memcpy(shadow->usb_interface, dev->usb_interface,
+	       sizeof(dev->usb_interface));
+	memcpy(shadow->usb_xfer_counts, dev->usb_xfer_counts,
+	       sizeof(dev->usb_xfer_counts));
+
+	shadow->usb_async_next = dev->usb_async_next;
+	struct usb_async_t *async = shadow->usb_async_next;
+	for(; async; async = async->next)
+		async->xfer->user_data = shadow;
+
+	dev->usb_async_next = 0;
+	memset(dev->usb_handle, 0, sizeof(dev->usb_handle));
+
+	/* reads never complete on their own, cancel now. Writes are left
+	 * to drain, they usually turn off the lights of the device */
+	ctlra_usb_impl_xfer_release(shadow, ctlra_usb_xfr_done_cb);
+
+	p->next = ctlra->usb_parked;
+	ctlra->usb_parked = p;
+
+	/* ctlra_exit() drains all devices at once, otherwise drain now */
+	if(!ctlra->usb_teardown)
+		ctlra_impl_usb_teardown(ctlra);
 }
 
 void ctlra_impl_usb_shutdown(struct ctlra_t *ctlra)
 {
+	ctlra_usb_impl_hotplug_stop(ctlra);
+	ctlra_impl_usb_teardown(ctlra);
 
 	if(ctlra->opts.flags_usb_no_own_context)
 		libusb_exit(NULL);
@@ -38,8 +38,13 @@ struct ctlra_t;
 int ctlra_dev_impl_usb_init(struct ctlra_t *ctlra);
 /* For polling hotplug / other events */
 void ctlra_impl_usb_idle_iter(struct ctlra_t *ctlra);
+/* Drain writes of closed devices, release their interfaces */
+void ctlra_impl_usb_teardown(struct ctlra_t *ctlra);
 /* For cleaning up the USB subsystem */
 void ctlra_impl_usb_shutdown(struct ctlra_t *ctlra);
+/* Connect HID devices without a driver to the generic HID backend, if
+ * opts.flags_usb_hid_generic is set. Returns the number accepted */
+int ctlra_impl_usb_hid_probe(struct ctlra_t *ctlra);
 /* Print stats for a specific USB based dev_t */
 void ctlra_dev_usb_stats_debug(struct ctlra_dev_t *dev);
 
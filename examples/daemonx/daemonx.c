@@ -9,11 +9,10 @@
 #include <fnmatch.h>
 #include <time.h>
 
-#include <cairo/cairo.h>
-
 #include "ctlra.h"
-#include "ctlra_cairo.h"
+#include "ctlra_scene.h"
 #include "midi.h"
+#include "shm.h"
 
 static volatile uint32_t done, screen_count;
 
@@ -27,6 +26,10 @@ static volatile int num_devs, auto_exit;
 // AG: maximum number of devices to open (zero means any number).
 static int max_devs;
 
+// Share the opened devices with other processes through shared memory; a
+// ctlra_probe() in another process then picks them up like local devices.
+static int share;
+
 // AG: Color palette for mapping velocities, controller values etc. to
 // colors. For now, just map 0..7 to the customary ANSI terminal colors, we
 // might do something more comprehensive in the future.
@@ -105,6 +108,8 @@ uint8_t feedback_items = FB_ALL_ITEMS;
 struct daemon_t {
 	struct ctlra_dev_t* dev;
 	struct ctlra_midi_t *midi;
+	// shared memory segment, when devices are shared (-s)
+	struct ctlra_shm_server_t *shm;
 	// local copy of feedback options
 	uint8_t feedback, feedback_items;
 	// keep track of feedback items
@@ -119,7 +124,6 @@ struct daemon_t {
 	uint32_t *ctl_col;
 	uint8_t *ctl;
 	// display text
-	int char_width, char_height, ascent;
 	uint8_t screen_fg[2][SCREEN_ROWS][SCREEN_COLS];
 	uint8_t screen_bg[2][SCREEN_ROWS][SCREEN_COLS];
 	uint8_t screen_idx[2][SCREEN_ROWS][SCREEN_COLS];
@@ -137,9 +141,10 @@ struct daemon_t {
 	uint8_t screenie[2];
 	// screen initialization and finalization
 	uint8_t screen_init[2], screen_fini[2];
-	// cairo surface and context
-        cairo_surface_t *img;
-        cairo_t *cr;
+	// retained screen contents, and the text rows and meters in them
+	struct ctlra_scene_t *scene[2];
+	int scene_row[2][SCREEN_ROWS+2];
+	int scene_meter[2][4];
 	struct ctlra_dev_info_t info;
 };
 
@@ -148,6 +153,9 @@ void daemon_feedback_func(struct ctlra_dev_t *dev, void *d)
 	struct daemon_t *daemon = d;
         ctlra_midi_input_poll(daemon->midi);
 
+	// a client driving the lights takes precedence over our own feedback
+	if (daemon->shm && ctlra_shm_server_feedback(daemon->shm)) return;
+
 	if (!(daemon->feedback)) return;
 
 	/* lights for grids */
@@ -538,6 +546,9 @@ void daemon_event_func(struct ctlra_dev_t* dev,
 	struct ctlra_midi_t *midi = daemon->midi;
 	uint8_t msg[3] = {0};
 
+	if (daemon->shm)
+		ctlra_shm_server_events(daemon->shm, num_events, events);
+
 	for(uint32_t i = 0; i < num_events; i++) {
 		struct ctlra_event_t *e = events[i];
 		int ret;
@@ -635,6 +646,44 @@ void daemon_event_func(struct ctlra_dev_t* dev,
 	}
 }
 
+// The screen is laid out as a grid of 8 text rows spaced 30px apart, with
+// the 6 rows of ordinary text output in rows 1-6. The MCP elements are
+// superimposed on that grid: RSM status in row 0, timecode in row 4, and the
+// scribble strips in rows 6 and 7. The meters are drawn on top of row 5.
+#define GRID_ROWS (SCREEN_ROWS+2)
+
+static int daemon_scene_create(struct daemon_t *daemon, uint32_t screen_idx)
+{
+	// the text grid uses fixed-width cells, so use a monospace font
+	struct ctlra_scene_t *scene =
+	  ctlra_scene_create(480, 272, "monospace", 24);
+	if (!scene) return -1;
+
+	uint32_t cw, asc;
+	ctlra_scene_font_metrics(scene, &cw, 0, &asc);
+	for (int i = 0; i < GRID_ROWS; i++) {
+	  daemon->scene_row[screen_idx][i] =
+	    ctlra_scene_text_add(scene, 5, (i+1)*30-asc, SCREEN_COLS);
+	  if (daemon->scene_row[screen_idx][i] < 0) goto fail;
+	}
+	const uint32_t meter_cols[7] = {
+	  ansi_colors[2], ansi_colors[2], ansi_colors[2], ansi_colors[2], // green
+	  ansi_colors[3], ansi_colors[3], // yellow
+	  ansi_colors[1], // red
+	};
+	for (int i = 0; i < 4; i++) {
+	  daemon->scene_meter[screen_idx][i] =
+	    ctlra_scene_meter_add(scene, i*120+1+5, 170, cw-2, 7, cw, 7,
+				  meter_cols, ansi_colors[0]);
+	  if (daemon->scene_meter[screen_idx][i] < 0) goto fail;
+	}
+	daemon->scene[screen_idx] = scene;
+	return 0;
+ fail:
+	ctlra_scene_destroy(scene);
+	return -1;
+}
+
 int32_t daemon_screen_redraw_func(struct ctlra_dev_t *dev,
 				  uint32_t screen_idx,
 				  uint8_t *pixel_data,
@@ -644,18 +693,25 @@ int32_t daemon_screen_redraw_func(struct ctlra_dev_t *dev,
 {
 	struct daemon_t *daemon = userdata;
 
-	if(!daemon->img) {
-		//daemon->img = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
-		daemon->img = cairo_image_surface_create(CAIRO_FORMAT_RGB16_565,
-							 480, 272);
-		daemon->cr = cairo_create(daemon->img);
+	if (screen_idx > 1)
+	  return 0;
+	// a client owning the screen supplies the frames
+	if (daemon->shm && !done) {
+	  int32_t ret = ctlra_shm_server_screen(daemon->shm, screen_idx,
+						pixel_data, bytes, redraw_zone);
+	  if (ret >= 0)
+	    return ret;
 	}
+	if (!daemon->scene[screen_idx] &&
+	    daemon_scene_create(daemon, screen_idx))
+	  return 0;
 
-	/* blank out bg */
-        cairo_t *cr = daemon->cr;
-	cairo_set_source_rgb(cr, 0, 0, 0);
-	cairo_rectangle(cr, 0, 0, 480, 272);
-	cairo_fill(cr);
+	// The scene retains what is on the screen, so we just describe the
+	// complete contents each frame, and only the cells and meters which
+	// actually changed get rendered and copied to the device.
+	struct ctlra_scene_t *scene = daemon->scene[screen_idx];
+	int *row = daemon->scene_row[screen_idx];
+	ctlra_scene_clear(scene);
 
 	// AG XXXFIXME: We need to go to considerable lengths here just to get
 	// the screen cleared before we exit; maybe this should be handled in
@@ -663,8 +719,7 @@ int32_t daemon_screen_redraw_func(struct ctlra_dev_t *dev,
 	if (done) {
 	  // simply clear the screen and bail out
 	  if (!daemon->screen_fini[screen_idx]) {
-	    ctlra_screen_cairo_to_device
-	      (dev, screen_idx, pixel_data, bytes, redraw_zone, daemon->img);
+	    ctlra_scene_to_device(scene, pixel_data, bytes, redraw_zone);
 	    daemon->screen_fini[screen_idx] = 1;
 	    screen_count--;
 	    return 1;
@@ -676,162 +731,86 @@ int32_t daemon_screen_redraw_func(struct ctlra_dev_t *dev,
 	  daemon->screen_init[screen_idx] = 1;
 	}
 
-#if 0
-	// uncomment this and edit as needed to choose a typeface different
-	// from cairo's default sans serif font
-	cairo_select_font_face(cr, "Mono",
-			       CAIRO_FONT_SLANT_NORMAL,
-			       CAIRO_FONT_WEIGHT_BOLD);
-#endif
-	cairo_set_font_size(cr, 24);
-	if (!daemon->char_width) {
-	  // estimate the average character width (should be about 15 with the
-	  // default font, otherwise we're probably in trouble)
-	  cairo_text_extents_t extents;
-	  cairo_text_extents(cr, "0123456789", &extents);
-	  daemon->char_width = round(extents.width/10.0);
-	  //fprintf(stderr, "char width = %d\n", daemon->char_width);
-	  cairo_font_extents_t fextents;
-	  cairo_font_extents(cr, &fextents);
-	  daemon->char_height = round(fextents.height);
-	  daemon->ascent = round(fextents.ascent);
-	}
-	int cw = daemon->char_width, ch = daemon->char_height,
-	  asc = daemon->ascent;
-
-	if(screen_idx <= 1) {
-	  if ((daemon->feedback_items&FB_TEXT)) {
-	    // 6 lines of text
-	    for (int i = 0; i < SCREEN_ROWS; i++) {
-	      if (*daemon->screen_text[screen_idx][i]) {
-		// AG: This is a super-simplistic implementation which spaces
-		// columns and lines evenly on a cw x 30 grid. Which is easy to
-		// use and works fine if all you want to do is throw up some
-		// bits of colored text on the screen somewhere. We could do
-		// something more comprehensive in order to properly deal with
-		// proportional fonts, but that seems overkill and would become
-		// much more complicated.
-		char *s = daemon->screen_text[screen_idx][i];
-		uint8_t fg = daemon->screen_fg[screen_idx][i][0];
-		uint8_t bg = daemon->screen_bg[screen_idx][i][0];
-		uint8_t idx = daemon->screen_idx[screen_idx][i][0];
-		int j = 0, l = strlen(s);
-		while (j < l) {
-		  uint32_t fgcol = ansi_col(fg);
-		  uint8_t fg_r = (fgcol&0xff0000)>>16,
-		    fg_g = (fgcol&0xff00)>>8, fg_b = (fgcol&0xff);
-		  uint32_t bgcol = ansi_col(bg);
-		  uint8_t bg_r = (bgcol&0xff0000)>>16,
-		    bg_g = (bgcol&0xff00)>>8, bg_b = (bgcol&0xff);
-		  char buf[SCREEN_COLS+1];
-		  int k = j;
-		  while (k < SCREEN_COLS &&
-			 daemon->screen_idx[screen_idx][i][k] == idx)
-		    k++;
-		  strncpy(buf, s+j, k-j); buf[k-j] = 0;
-		  //fprintf(stderr, "-> '%s' at %d,%d with %0x, %0x\n", buf, j*cw+5, (i+2)*30, fgcol, bgcol);
-		  cairo_text_extents_t extents;
-		  cairo_text_extents(cr, buf, &extents);
-		  int wd = round(extents.x_advance);
-		  cairo_set_source_rgb(cr, bg_r/255.f, bg_g/255.f, bg_b/255.f);
-		  cairo_rectangle(cr, j*cw+5, (i+2)*30-asc, wd, ch);
-		  cairo_fill(cr);
-		  cairo_set_source_rgb(cr, fg_r/255.f, fg_g/255.f, fg_b/255.f);
-		  cairo_move_to(cr, j*cw+5, (i+2)*30);
-		  cairo_show_text(cr, buf);
-		  j = k;
-		  if (k < SCREEN_COLS) {
-		    fg = daemon->screen_fg[screen_idx][i][k];
-		    bg = daemon->screen_bg[screen_idx][i][k];
-		    idx = daemon->screen_idx[screen_idx][i][k];
-		  }
-		}
-	      }
+	if ((daemon->feedback_items&FB_TEXT)) {
+	  // 6 lines of text
+	  for (int i = 0; i < SCREEN_ROWS; i++) {
+	    char *s = daemon->screen_text[screen_idx][i];
+	    for (int j = 0; s[j] && j < SCREEN_COLS; j++) {
+	      char buf[2] = { s[j], 0 };
+	      ctlra_scene_text_set(scene, row[i+1], j, buf,
+				   ansi_col(daemon->screen_fg[screen_idx][i][j]),
+				   ansi_col(daemon->screen_bg[screen_idx][i][j]));
 	    }
 	  }
-	  if (daemon->feedback&FB_MCP) {
-	    // MCP timecode display
-	    if (*daemon->timecode_h && screen_idx == 1 &&
-		(daemon->feedback_items&FB_TIMECODE)) {
-	      uint32_t col = ansi_col(7);
-	      uint8_t r = (col&0xff0000)>>16,
-		g = (col&0xff00)>>8, b = (col&0xff);
-	      char time_display[14];
-	      snprintf(time_display, 14, "%s %s %s %s",
-		       daemon->timecode_h, daemon->timecode_m,
-		       daemon->timecode_s, daemon->timecode_frames);
-	      cairo_set_source_rgb(cr, r/255.f, g/255.f, b/255.f);
-	      cairo_move_to(cr, 9*cw+5, 5*30);
-	      cairo_show_text(cr, time_display);
-	    }
-	    // RSM status
-	    if (daemon->feedback_items&FB_RSM) {
-	      for (int i = 0; i < 4; i++) {
-		int k = screen_idx*4+i;
-		for (int j = 0; j < 3; j++) {
-		  char *s = j==0?"R":j==1?"S":"M";
-		  uint32_t col = ansi_col(daemon->rsm_status[j][k]?j+1:0);
-		  uint8_t r = (col&0xff0000)>>16,
-		    g = (col&0xff00)>>8, b = (col&0xff);
-		  cairo_set_source_rgb(cr, r/255.f, g/255.f, b/255.f);
-		  cairo_move_to(cr, (i*8+2*j)*cw+5, 30);
-		  cairo_show_text(cr, s);
-		}
+	}
+	if (daemon->feedback&FB_MCP) {
+	  // MCP timecode display
+	  if (*daemon->timecode_h && screen_idx == 1 &&
+	      (daemon->feedback_items&FB_TIMECODE)) {
+	    char time_display[14];
+	    snprintf(time_display, 14, "%s %s %s %s",
+		     daemon->timecode_h, daemon->timecode_m,
+		     daemon->timecode_s, daemon->timecode_frames);
+	    ctlra_scene_text_set(scene, row[4], 9, time_display,
+				 ansi_col(7), ansi_colors[0]);
+	  }
+	  // RSM status
+	  if (daemon->feedback_items&FB_RSM) {
+	    for (int i = 0; i < 4; i++) {
+	      int k = screen_idx*4+i;
+	      for (int j = 0; j < 3; j++) {
+		char *s = j==0?"R":j==1?"S":"M";
+		uint32_t col = ansi_col(daemon->rsm_status[j][k]?j+1:0);
+		ctlra_scene_text_set(scene, row[0], i*8+2*j, s,
+				     col, ansi_colors[0]);
 	      }
 	    }
-	    // MCP scribble strips
-	    if (daemon->feedback_items&FB_STRIPS) {
-	      for (int i = 0; i < 4; i++) {
-		int c = screen_idx*4;
-		if (*daemon->scribble_text[c+i][0] ||
-		    *daemon->scribble_text[c+i][1]) {
-		  uint32_t col = daemon->scribble_col[c+i];
-		  uint8_t r = (col&0xff0000)>>16,
-		    g = (col&0xff00)>>8, b = (col&0xff);
-		  cairo_set_source_rgb(cr, r/255.f, g/255.f, b/255.f);
-		  cairo_move_to(cr, i*8*cw+5, 7*30);
-		  cairo_show_text(cr, daemon->scribble_text[c+i][0]);
-		  cairo_set_source_rgb(cr, r/255.f, g/255.f, b/255.f);
-		  cairo_rectangle(cr, i*8*cw+5, 8*30-asc, 7*cw, ch);
-		  cairo_fill(cr);
-		  cairo_set_source_rgb(cr, 0, 0, 0);
-		  cairo_move_to(cr, i*8*cw+5, 8*30);
-		  cairo_show_text(cr, daemon->scribble_text[c+i][1]);
-		}
+	  }
+	  // MCP scribble strips
+	  if (daemon->feedback_items&FB_STRIPS) {
+	    for (int i = 0; i < 4; i++) {
+	      int c = screen_idx*4;
+	      if (*daemon->scribble_text[c+i][0] ||
+		  *daemon->scribble_text[c+i][1]) {
+		uint32_t col = daemon->scribble_col[c+i];
+		ctlra_scene_text_set(scene, row[6], i*8,
+				     daemon->scribble_text[c+i][0],
+				     col, ansi_colors[0]);
+		// 2nd line is inverted, on a 7 character wide bar
+		ctlra_scene_text_set(scene, row[7], i*8, "       ",
+				     col, col);
+		ctlra_scene_text_set(scene, row[7], i*8,
+				     daemon->scribble_text[c+i][1],
+				     ansi_colors[0], col);
 	      }
 	    }
-	    // MCP meter display
-	    if (daemon->feedback_items&FB_STRIPS) {
-	      for (int i = 0; i < 4; i++) {
-		int c = screen_idx*4;
-		int val = daemon->meter[c+i];
-		int map[16] = {0,1,1,2,2,3,3,4,4,5,5,6,7,8,8,8};
-		for (int j = 0; j < 7; j++) {
-		  int col = j>=map[val] ? ansi_colors[0] // black
-		    : j>=6 ? ansi_colors[1] // red
-		    : j>=4 ? ansi_colors[3] // yellow
-		    : ansi_colors[2]; // green
-		  uint8_t r = (col&0xff0000)>>16,
-		    g = (col&0xff00)>>8, b = (col&0xff);
-		  cairo_set_source_rgb(cr, r/255.f, g/255.f, b/255.f);
-		  cairo_rectangle(cr, i*120+j*cw+1+5, 170, cw-2, 7);
-		  cairo_fill(cr);
-		}
-	      }
+	  }
+	  // MCP meter display
+	  if (daemon->feedback_items&FB_STRIPS) {
+	    for (int i = 0; i < 4; i++) {
+	      int c = screen_idx*4;
+	      int val = daemon->meter[c+i];
+	      int map[16] = {0,1,1,2,2,3,3,4,4,5,5,6,7,8,8,8};
+	      ctlra_scene_meter_set(scene, daemon->scene_meter[screen_idx][i],
+				    map[val]);
 	    }
 	  }
 	}
+
+	int32_t ret = ctlra_scene_to_device(scene, pixel_data, bytes,
+					    redraw_zone);
 	if (daemon->screenie[screen_idx]) {
 	  // take a screenshot, write to png file
 	  char name[PATH_MAX];
 	  snprintf(name, PATH_MAX, "screen%d.png", screen_idx);
-	  cairo_surface_write_to_png(daemon->img, name);
+	  ctlra_scene_write_png(scene, name);
 	  daemon->screenie[screen_idx] = 0;
 	}
-	ctlra_screen_cairo_to_device(dev, screen_idx, pixel_data, bytes,
-				     redraw_zone, daemon->img);
 
-	return 1;
+	// The zone is filled in, but partial updates are still experimental
+	// in the drivers, so request a full flush, and only when something
+	// changed.
+	return ret > 0;
 }
 
 // AG XXXFIXME: Work around a bug with libusb_handle_events_timeout_completed
@@ -855,9 +834,10 @@ void daemon_remove_func(struct ctlra_dev_t *dev, int unexpected_removal,
 			void *userdata)
 {
 	struct daemon_t *daemon = userdata;
+	ctlra_shm_server_destroy(daemon->shm);
 	ctlra_midi_destroy(daemon->midi);
-	cairo_destroy(daemon->cr);
-	cairo_surface_destroy(daemon->img);
+	ctlra_scene_destroy(daemon->scene[0]);
+	ctlra_scene_destroy(daemon->scene[1]);
 	if (daemon->grid) free(daemon->grid);
 	if (daemon->grid_col) free(daemon->grid_col);
 	if (daemon->but) free(daemon->but);
@@ -960,6 +940,12 @@ int accept_dev_func(struct ctlra_t *ctlra,
 	  }
 	}
 
+	if (share) {
+		daemon->shm = ctlra_shm_server_create(dev);
+		if (!daemon->shm)
+			printf("daemon: could not share %s\n", info->device);
+	}
+
 	ctlra_dev_set_event_func(dev, daemon_event_func);
 	ctlra_dev_set_feedback_func(dev, daemon_feedback_func);
 	ctlra_dev_set_screen_feedback_func(dev, daemon_screen_redraw_func);
@@ -986,7 +972,7 @@ int main(int argc, char **argv)
 {
   int opt;
   char *devname = 0;
-  while ((opt = getopt(argc, argv, "d:f::i:hn:q")) != -1) {
+  while ((opt = getopt(argc, argv, "d:f::i:hn:qs")) != -1) {
     switch (opt) {
     case 'd':
       devname = optarg;
@@ -1028,9 +1014,12 @@ int main(int argc, char **argv)
     case 'q':
       auto_exit = 1;
       break;
+    case 's':
+      share = 1;
+      break;
     case 'h':
     default:
-      printf("Usage: %s [-h] [-d name] [-f[opts]] [-i opts] [-n count] [-q]\n", argv[0]);
+      printf("Usage: %s [-h] [-d name] [-f[opts]] [-i opts] [-n count] [-q] [-s]\n", argv[0]);
       printf("-h: print this message and exit\n");
       printf("-d: connect only to devices matching the given name\n");
       printf("    name can also be the vendor:device spec in hex, and may contain wildcards\n");
@@ -1043,6 +1032,7 @@ int main(int argc, char **argv)
       printf("    x = text, t = timecode, s = scribble/meter strips, r = RSM indicators\n");
       printf("-n: maximum number of devices to open\n");
       printf("-q: quit automatically if no devices are present\n");
+      printf("-s: share devices with other ctlra programs via shared memory\n");
       exit(0);
     }
   }
@@ -1062,24 +1052,8 @@ int main(int argc, char **argv)
     usleep(1000);
   }
 
-  // AG: Another awful kludge here. The screens have already been cleared at
-  // this point, but apparently we need to give it some extra time so that any
-  // remaining data can be flushed. I found that if we don't do this, the
-  // screens might not be properly reinitialized and aren't usable any more if
-  // we rerun daemonx afterwards. At least that's what happens on my Maschine
-  // Mk3, YMMV. XXXFIXME: This really should be handled in ctlra_exit() in
-  // some way, maybe we need an extra screen finalization callback there?
-  struct timespec now, then;
-  int err = clock_gettime(CLOCK_MONOTONIC_RAW, &then);
-  while(!err) {
-    if ((err = clock_gettime(CLOCK_MONOTONIC_RAW, &now))) break;
-    double secs = now.tv_sec - then.tv_sec;
-    double nanos = now.tv_nsec - then.tv_nsec;
-    if (secs*1e9 + nanos > 1e9) break;
-    ctlra_idle_iter(ctlra);
-    usleep(100000);
-  }
-
+  // ctlra_exit() waits (bounded) for the final screen and light writes of
+  // all devices to complete, so the screens are left in a usable state.
   ctlra_exit(ctlra);
 
   return 0;
@@ -0,0 +1,165 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+/* the checks are the test, keep them in release builds */
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+
+#include "ctlra.h"
+
+/* Tests loading device descriptions: a device without lights, one with
+ * lights, and files the loader must refuse. The described devices are
+ * virtualized, as no hardware is expected to be present. */
+
+static const char *desc_plain =
+	"[device]\n"
+	"vendor = Describe Test\n"
+	"device = Plain\n"
+	"vid = 0xfff0\n"
+	"pid = 0x0001\n"
+	"in = 0x81\n"
+	"size = 4\n"
+	"# light_bytes without lights: no light report is sent\n"
+	"light_bytes = 8\n"
+	"\n"
+	"[button.0]\n"
+	"name = Play\n"
+	"byte = 0\n"
+	"mask = 0x01\n"
+	"\n"
+	"[slider.0]\n"
+	"name = Volume\n"
+	"byte = 1\n"
+	"bits = 12\n";
+
+static const char *desc_lights =
+	"[device]\n"
+	"vendor = Describe Test\n"
+	"device = Lights\n"
+	"vid = 0xfff0\n"
+	"pid = 0x0002\n"
+	"in = 0x81              # trailing comments are allowed\n"
+	"size = 2\n"
+	"out = 0x01\n"
+	"light_report = 0x80    ; either style\n"
+	"light_bytes = 3\n"
+	"\n"
+	"[button.0]\n"
+	"name = Rec\n"
+	"byte = 0\n"
+	"mask = 0x01\n"
+	"light = 0\n"
+	"\n"
+	"[light.0]\n"
+	"channels = rgb\n";
+
+/* control outside the input report */
+static const char *desc_bad =
+	"[device]\n"
+	"vendor = Describe Test\n"
+	"device = Bad\n"
+	"vid = 0xfff0\n"
+	"pid = 0x0003\n"
+	"in = 0x81\n"
+	"size = 2\n"
+	"\n"
+	"[button.0]\n"
+	"byte = 9\n"
+	"mask = 0x01\n";
+
+/* the mask moves the bit past the end of the input report */
+static const char *desc_bad_mask =
+	"[device]\n"
+	"vendor = Describe Test\n"
+	"device = Bad Mask\n"
+	"vid = 0xfff0\n"
+	"pid = 0x0004\n"
+	"in = 0x81\n"
+	"size = 2\n"
+	"\n"
+	"[button.0]\n"
+	"byte = 1\n"
+	"mask = 0x100\n";
+
+static void write_file(const char *path, const char *data)
+{
+	FILE *f = fopen(path, "w");
+	assert(f);
+	fputs(data, f);
+	fclose(f);
+}
+
+int accept_dev_func(struct ctlra_t *ctlra,
+		    const struct ctlra_dev_info_t *info,
+		    struct ctlra_dev_t *dev,
+		    void *userdata)
+{
+	return 1;
+}
+
+static void check_device(struct ctlra_t *ctlra, const char *device,
+			 uint32_t buttons, uint32_t sliders,
+			 const char *button_name)
+{
+	struct ctlra_dev_t *dev =
+		ctlra_dev_virtualize_headless(ctlra, "Describe Test", device);
+	assert(dev);
+
+	struct ctlra_dev_info_t info;
+	ctlra_dev_get_info(dev, &info);
+	assert(info.control_count[CTLRA_EVENT_BUTTON] == buttons);
+	assert(info.control_count[CTLRA_EVENT_SLIDER] == sliders);
+	const char *name = ctlra_info_get_name(&info, CTLRA_EVENT_BUTTON, 0);
+	assert(name && strcmp(name, button_name) == 0);
+	printf("describe: %s ok\n", device);
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/ctlra_describe_XXXXXX";
+	char *made = mkdtemp(dir);
+	assert(made);
+
+	char plain[64], lights[64], bad[64], bad_mask[64];
+	snprintf(plain, sizeof(plain), "%s/plain.ctlra", dir);
+	snprintf(lights, sizeof(lights), "%s/lights.ctlra", dir);
+	snprintf(bad, sizeof(bad), "%s/bad.txt", dir);
+	snprintf(bad_mask, sizeof(bad_mask), "%s/bad_mask.txt", dir);
+	write_file(plain, desc_plain);
+	write_file(lights, desc_lights);
+	write_file(bad, desc_bad);
+	write_file(bad_mask, desc_bad_mask);
+
+	int32_t ret = ctlra_device_description_load(bad);
+	assert(ret == -EINVAL);
+	ret = ctlra_device_description_load(bad_mask);
+	assert(ret == -EINVAL);
+	ret = ctlra_device_description_load(plain);
+	assert(ret == 1);
+	/* the same vid and pid is refused */
+	ret = ctlra_device_description_load(plain);
+	assert(ret == -EEXIST);
+	/* a directory loads the .ctlra files not loaded yet */
+	ret = ctlra_device_description_load(dir);
+	assert(ret == 1);
+
+	struct ctlra_t *ctlra = ctlra_create(NULL);
+	assert(ctlra);
+	ctlra_probe(ctlra, accept_dev_func, 0x0);
+
+	check_device(ctlra, "Plain", 1, 1, "Play");
+	check_device(ctlra, "Lights", 1, 0, "Rec");
+
+	ctlra_exit(ctlra);
+
+	unlink(plain);
+	unlink(lights);
+	unlink(bad);
+	unlink(bad_mask);
+	rmdir(dir);
+	printf("describe: all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,119 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "ctlra.h"
+#include "devices/jog_wheel.h"
+
+/* Simulated jog wheel, checking the accuracy of the motion estimate. The
+ * wheel turns at a constant speed, with an 8 bit counter of 1024 counts
+ * per turn like the Kontrol S2 Mk2. It reports every 1 ms, but reports
+ * are handled in bursts of four with up to 200 us of jitter, as when the
+ * USB reads of several devices complete together. After settling, the
+ * estimated velocity must stay within 5% of the true speed. Touching the
+ * wheel must restart the estimate at rest, and a wheel without reports
+ * must read as stopped. Counters must also wrap correctly when their
+ * range is not a power of two. */
+
+#define RAW_RANGE       256
+#define COUNTS_PER_TURN 1024
+#define PERIOD_NS       1000000ull
+#define BURST           4
+#define TURNS_PER_SEC   0.5
+#define RUN_NS          2000000000ull
+#define SETTLE_NS       500000000ull
+#define MAX_ERROR       0.05
+
+static uint32_t raw_at(uint64_t t_ns)
+{
+	double turns = TURNS_PER_SEC * t_ns * 1e-9;
+	return (uint32_t)floor(turns * COUNTS_PER_TURN) % RAW_RANGE;
+}
+
+int main(int argc, char **argv)
+{
+	struct ctlra_jog_wheel_t jw;
+	ctlra_jog_wheel_init(&jw, RAW_RANGE, COUNTS_PER_TURN);
+
+	struct ctlra_jog_wheel_opts_t opts = {
+		.alpha = 0.2f,
+		.beta = 0.005f,
+	};
+	int err = ctlra_jog_wheel_config(&jw, &opts);
+	if(err) {
+		printf("config failed: %d\n", err);
+		return -1;
+	}
+
+	/* the clock starts at 1 s, time 0 means no report yet */
+	const uint64_t start = 1000000000ull;
+	srand(1);
+
+	double worst = 0;
+	int64_t counts = 0;
+	uint64_t t;
+	for(t = BURST * PERIOD_NS; t <= RUN_NS; t += BURST * PERIOD_NS) {
+		uint64_t handled = start + t + rand() % 200000;
+		for(int i = BURST - 1; i >= 0; i--) {
+			uint32_t raw = raw_at(t - i * PERIOD_NS);
+			counts += ctlra_jog_wheel_update(&jw, raw, handled);
+			handled += 2000;
+		}
+
+		struct ctlra_jog_wheel_state_t s;
+		ctlra_jog_wheel_read(&jw, handled, &s);
+		double error = fabs(s.velocity - TURNS_PER_SEC) / TURNS_PER_SEC;
+		if(t >= SETTLE_NS && error > worst)
+			worst = error;
+	}
+
+	int ret = 0;
+	double expect = TURNS_PER_SEC * RUN_NS * 1e-9 * COUNTS_PER_TURN;
+	printf("encoder counts: %lld, expected %.0f\n", (long long)counts,
+	       expect);
+	if(fabs(counts - expect) > 1)
+		ret = -1;
+
+	printf("worst velocity error after settling: %.2f%% (max %.0f%%)\n",
+	       worst * 100, MAX_ERROR * 100);
+	if(worst > MAX_ERROR)
+		ret = -1;
+
+	/* a touch stops the estimate at the time of the touch */
+	uint64_t touch_ns = start + t;
+	ctlra_jog_wheel_touch(&jw, 1, touch_ns);
+	struct ctlra_jog_wheel_state_t s;
+	ctlra_jog_wheel_read(&jw, 0, &s);
+	printf("after touch: velocity %.3f, touched %d, time %s\n",
+	       s.velocity, s.touched, s.time_ns == touch_ns ? "ok" : "wrong");
+	if(s.velocity != 0.f || !s.touched || s.time_ns != touch_ns)
+		ret = -1;
+
+	/* no reports for longer than the stop time: the wheel stands still */
+	ctlra_jog_wheel_touch(&jw, 0, touch_ns);
+	ctlra_jog_wheel_update(&jw, raw_at(t), touch_ns + PERIOD_NS);
+	ctlra_jog_wheel_update(&jw, raw_at(t + 8 * PERIOD_NS),
+			       touch_ns + 2 * PERIOD_NS);
+	ctlra_jog_wheel_read(&jw, touch_ns + 100 * PERIOD_NS, &s);
+	printf("without reports: velocity %.3f\n", s.velocity);
+	if(s.velocity != 0.f)
+		ret = -1;
+
+	/* counters with a range that is not a power of two wrap both ways */
+	struct ctlra_jog_wheel_t wrap;
+	ctlra_jog_wheel_init(&wrap, 1000, 1000);
+	int32_t d[4];
+	ctlra_jog_wheel_update(&wrap, 995, 0);
+	d[0] = ctlra_jog_wheel_update(&wrap, 3, 0);
+	d[1] = ctlra_jog_wheel_update(&wrap, 990, 0);
+	d[2] = ctlra_jog_wheel_update(&wrap, 500, 0);
+	d[3] = ctlra_jog_wheel_update(&wrap, 499, 0);
+	printf("wrap of 1000: %d %d %d %d\n", d[0], d[1], d[2], d[3]);
+	if(d[0] != 8 || d[1] != -13 || d[2] != -490 || d[3] != -1)
+		ret = -1;
+
+	printf("%s\n", ret ? "FAIL" : "ok");
+	return ret;
+}
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 /* Ctlra header */
@@ -41,16 +42,14 @@ static int file_modify_time(const char *path, time_t *new_time)
 	return 0;
 }
 
-struct script_t {
+/* One compiled version of the script. A new program is built by the
+ * compile thread, and published to the Ctlra callbacks with a single
+ * atomic pointer swap, so the callbacks always see a complete set of
+ * function pointers - either all from the old, or all from the new code.
+ */
+struct script_program_t {
 	/* A pointer to memory malloced for the generated code */
 	void *program;
-	/* The path of the script file */
-	char *filepath;
-	/* TCC should recompile the recompile and update when set */
-	uint8_t recompile;
-	uint8_t compile_failed;
-	/* Time the script file was last modified */
-	time_t time_modified;
 
 	/* Function pointer to get the USB device this script supports */
 	script_get_vid_pid get_vid_pid;
@@ -60,25 +59,44 @@ struct script_t {
 	script_feedback_func feedback_func;
 	script_screen_redraw_func screen_redraw_func;
 
+	/* Retired programs wait on this list until no callback can still
+	 * be running their code. See script_reclaim() */
+	struct script_program_t *retired_next;
+	uint64_t retired_epoch;
+};
+
+struct script_t {
+	/* The path of the script file */
+	char *filepath;
+	uint8_t compile_failed;
+	/* Time the script file was last modified */
+	time_t time_modified;
+
+	/* The last successfully compiled program. Loaded by the Ctlra
+	 * callbacks, swapped by the compile thread */
+	struct script_program_t *live;
+
+	/* Incremented by the Ctlra callbacks each time they return from
+	 * the script code. All callbacks run in the ctlra_idle_iter()
+	 * thread, so once the epoch is past the value stored when a
+	 * program was retired, its memory can be freed (RCU style). */
+	uint64_t epoch;
+
+	/* Background compilation, keeps TCC out of the event path */
+	pthread_t compile_thread;
+	uint8_t compile_thread_running;
+	volatile uint32_t compile_thread_quit;
+	struct script_program_t *retired;
+
 	/* The malloc() / free() memory from the script */
 	void *script_ud;
 };
 
-void script_free(struct script_t *s)
+static void script_program_free(struct script_program_t *p)
 {
-	if(s->program)
-		free(s->program);
-	if(s->filepath)
-		free(s->filepath);
-	free(s);
-}
-
-void script_reset(struct script_t *s)
-{
-	s->event_func = 0x0;
-	s->get_vid_pid = 0x0;
-	if(s->program)
-		free(s->program);
+	if(p->program)
+		free(p->program);
+	free(p);
 }
 
 struct loopa_symbol_t {
@@ -108,18 +126,21 @@ static struct loopa_symbol_t loopa_symbols[] = {
 
 #define LOOPA_SYMBOLS_SIZE (sizeof(loopa_symbols) / sizeof(loopa_symbols[0]))
 
-int script_compile_file(struct script_t *script)
+static struct script_program_t *script_program_compile(const char *filepath)
 {
-	script_reset(script);
-
-	printf("tcc_script example: compiling %s\n", script->filepath);
+	printf("tcc_script example: compiling %s\n", filepath);
 	TCCState *s;
-	script->compile_failed = 1;
+
+	struct script_program_t *p = calloc(1, sizeof(*p));
+	if(!p) {
+		error("failed to alloc script program\n");
+		return 0;
+	}
 
 	s = tcc_new();
 	if(!s) {
 		error("failed to create tcc context\n");
-		return -2;
+		goto fail;
 	}
 
 	tcc_set_error_func(s, 0x0, error_func);
@@ -130,57 +151,174 @@ int script_compile_file(struct script_t *script)
 		if (tcc_add_symbol(s, loopa_symbols[i].name,
 					 loopa_symbols[i].func_ptr)) {
 			error("failed to insert get rec() symbol\n");
-			tcc_delete(s);
-			return -1;
+			goto fail;
 		}
 	}
 
 	int ret;
-	ret = tcc_add_file(s, script->filepath);
+	ret = tcc_add_file(s, filepath);
 	if(ret < 0) {
 		printf("gracefully handling error now... \n");
-		return -1;
+		goto fail;
 	}
 
-	script->program = malloc(tcc_relocate(s, NULL));
-	if(!script->program) {
+	int size = tcc_relocate(s, NULL);
+	if(size < 0) {
+		error("failed to get size of program\n");
+		goto fail;
+	}
+	p->program = malloc(size);
+	if(!p->program) {
 		error("failed to alloc mem for program\n");
-		return -1;
+		goto fail;
 	}
 
-	ret = tcc_relocate(s, script->program);
-	if(ret < 0)
+	ret = tcc_relocate(s, p->program);
+	if(ret < 0) {
 		error("failed to relocate code to program memory\n");
+		goto fail;
+	}
 
-	script->get_vid_pid = (script_get_vid_pid)
-	                      tcc_get_symbol(s, "script_get_vid_pid");
-	if(!script->get_vid_pid)
+	p->get_vid_pid = (script_get_vid_pid)
+	                 tcc_get_symbol(s, "script_get_vid_pid");
+	if(!p->get_vid_pid)
 		error("failed to find script_get_vid_pid function\n");
 
-	script->event_func = (script_event_func)
-	                      tcc_get_symbol(s, "script_event_func");
-	if(!script->event_func)
+	p->event_func = (script_event_func)
+	                tcc_get_symbol(s, "script_event_func");
+	if(!p->event_func)
 		error("failed to find script_event_func function\n");
 
-	script->feedback_func = (script_feedback_func)
-	                      tcc_get_symbol(s, "script_feedback_func");
-	if(!script->feedback_func)
+	p->feedback_func = (script_feedback_func)
+	                   tcc_get_symbol(s, "script_feedback_func");
+	if(!p->feedback_func)
 		error("failed to find script_feedback_func\n");
 
-	script->screen_redraw_func = (script_screen_redraw_func)
-	                      tcc_get_symbol(s, "script_screen_redraw_func");
-	if(!script->feedback_func)
-		error("failed to find script_feedback_func\n");
+	p->screen_redraw_func = (script_screen_redraw_func)
+	                   tcc_get_symbol(s, "script_screen_redraw_func");
+	if(!p->screen_redraw_func)
+		error("failed to find script_screen_redraw_func\n");
 
 	tcc_delete(s);
+	return p;
+
+fail:
+	if(s)
+		tcc_delete(s);
+	script_program_free(p);
+	return 0;
+}
+
+/* Free retired programs that no callback can be executing anymore */
+static void script_reclaim(struct script_t *script, int force)
+{
+	uint64_t epoch = __atomic_load_n(&script->epoch, __ATOMIC_ACQUIRE);
+	struct script_program_t **iter = &script->retired;
+	while(*iter) {
+		struct script_program_t *p = *iter;
+		if(force || epoch > p->retired_epoch) {
+			*iter = p->retired_next;
+			script_program_free(p);
+			continue;
+		}
+		iter = &p->retired_next;
+	}
+}
+
+static void *script_compile_thread(void *data)
+{
+	struct script_t *script = data;
+
+	while(!script->compile_thread_quit) {
+		usleep(100 * 1000);
+		script_reclaim(script, 0);
+
+		/* Check if we need to recompile script based on modified
+		 * time of the script file, comparing with the compiled
+		 * modified time */
+		time_t new_time;
+		int err = file_modify_time(script->filepath, &new_time);
+		if(err || new_time <= script->time_modified)
+			continue;
+
+		/* store the time before compiling, so a save during the
+		 * compile triggers another one on the next iteration. A
+		 * failed compile is not retried until the file changes */
+		script->time_modified = new_time;
 
-	int err = file_modify_time(script->filepath,
-				   &script->time_modified);
+		printf("tcc: recompiling script %s\n", script->filepath);
+		struct script_program_t *p =
+			script_program_compile(script->filepath);
+		if(!p || !p->event_func) {
+			printf("tcc: compile failed, keeping last good script\n");
+			if(p)
+				script_program_free(p);
+			script->compile_failed = 1;
+			continue;
+		}
+		script->compile_failed = 0;
+
+		struct script_program_t *old =
+			__atomic_exchange_n(&script->live, p, __ATOMIC_ACQ_REL);
+		if(old) {
+			old->retired_epoch = __atomic_load_n(&script->epoch,
+							     __ATOMIC_ACQUIRE);
+			old->retired_next = script->retired;
+			script->retired = old;
+		}
+	}
+
+	return 0;
+}
+
+int script_compile_thread_start(struct script_t *script)
+{
+	int ret = pthread_create(&script->compile_thread, 0x0,
+				 script_compile_thread, script);
+	if(ret) {
+		printf("tcc: failed to start compile thread: %d\n", ret);
+		return -1;
+	}
+	script->compile_thread_running = 1;
+	return 0;
+}
+
+void script_free(struct script_t *s)
+{
+	if(s->compile_thread_running) {
+		s->compile_thread_quit = 1;
+		pthread_join(s->compile_thread, 0x0);
+	}
+	/* the caller guarantees no callback is running */
+	script_reclaim(s, 1);
+	if(s->live)
+		script_program_free(s->live);
+	if(s->filepath)
+		free(s->filepath);
+	free(s);
+}
+
+/* Compile the script synchronously, used for the initial compile only.
+ * Recompiles are handled by the compile thread. */
+int script_compile_file(struct script_t *script)
+{
+	script->compile_failed = 1;
+
+	time_t time_modified;
+	int err = file_modify_time(script->filepath, &time_modified);
 	if(err) {
 		printf("%s: error getting file modified time\n", __func__);
 		return -1;
 	}
 
+	struct script_program_t *p = script_program_compile(script->filepath);
+	if(!p)
+		return -1;
+
+	if(script->live)
+		script_program_free(script->live);
+	script->live = p;
+	script->time_modified = time_modified;
 	script->compile_failed = 0;
 	return 0;
 }
@@ -192,8 +330,11 @@ void tcc_feedback_func(struct ctlra_dev_t *dev, void *userdata)
 	 * from this function - one-way App->Ctlra updates only */
 
 	struct script_t *script = userdata;
-	if(script->feedback_func)
-		script->feedback_func(dev, userdata);
+	struct script_program_t *p = __atomic_load_n(&script->live,
+						     __ATOMIC_ACQUIRE);
+	if(p && p->feedback_func)
+		p->feedback_func(dev, userdata);
+	__atomic_fetch_add(&script->epoch, 1, __ATOMIC_RELEASE);
 }
 
 
@@ -203,16 +344,16 @@ int tcc_screen_redraw_proxy(struct ctlra_dev_t *dev, uint32_t screen_idx,
 			    void *userdata)
 {
 	struct script_t *script = userdata;
-
-	if(script->screen_redraw_func) {
-		int ret = script->screen_redraw_func(dev, screen_idx,
-						  pixel_data, bytes,
-						  zone, userdata);
-		return ret;
-	}
+	struct script_program_t *p = __atomic_load_n(&script->live,
+						     __ATOMIC_ACQUIRE);
 
 	/* zero means no redraw */
-	return 0;
+	int ret = 0;
+	if(p && p->screen_redraw_func)
+		ret = p->screen_redraw_func(dev, screen_idx, pixel_data,
+					    bytes, zone, userdata);
+	__atomic_fetch_add(&script->epoch, 1, __ATOMIC_RELEASE);
+	return ret;
 }
 
 void tcc_event_proxy(struct ctlra_dev_t* dev,
@@ -240,23 +381,15 @@ void tcc_event_proxy(struct ctlra_dev_t* dev,
 #endif
 
 
-	/* Check if we need to recompile script based on modified time of
-	 * the script file, comparing with the compiled modified time */
-	time_t new_time;
-	int err = file_modify_time(script->filepath,
-				   &new_time);
-	if(err) {
-		printf("%s: error getting file modified time\n", __func__);
-	}
-	if(new_time > script->time_modified) {
-		printf("tcc: recompiling script %s\n", script->filepath);
-		// trigger recompile, which will update modified timestamp
-		script_compile_file(script);
-	}
+	/* The compile thread watches the script file and swaps the live
+	 * program when it changes, no compiling or file access here */
+	struct script_program_t *p = __atomic_load_n(&script->live,
+						     __ATOMIC_ACQUIRE);
 
 	/* Handle events */
-	if(script->event_func)
-		script->event_func(dev, num_events, events, userdata);
+	if(p && p->event_func)
+		p->event_func(dev, num_events, events, userdata);
+	__atomic_fetch_add(&script->epoch, 1, __ATOMIC_RELEASE);
 }
 
 void sighndlr(int signal)
@@ -279,14 +412,6 @@ int accept_dev_func(struct ctlra_t *ctlra,
 		    struct ctlra_dev_t *dev,
                     void *userdata)
 {
-	/* here we use the Ctlra APIs to set callback functions to get
-	 * events and send feedback updates to/from the device */
-	ctlra_dev_set_event_func(dev, tcc_event_proxy);
-	ctlra_dev_set_feedback_func(dev, tcc_feedback_func);
-	//ctlra_dev_set_screen_feedback_func(dev, simple_screen_redraw_func);
-	//ctlra_dev_set_remove_func(dev, remove_dev_func);
-	ctlra_dev_set_callback_userdata(dev, userdata);
-
 	static int accepted;
 
 	/* Just one ctlra for now */
@@ -306,14 +431,14 @@ int accept_dev_func(struct ctlra_t *ctlra,
 		return 0;
 	}
 
-	if(!script->get_vid_pid) {
+	if(!script->live->get_vid_pid) {
 		script_free(script);
 		return 0;
 	}
 
 	int vid = -1;
 	int pid = -1;
-	script->get_vid_pid(&vid, &pid);
+	script->live->get_vid_pid(&vid, &pid);
 	if(vid != info->vendor_id || pid != info->device_id) {
 		script_free(script);
 		return 0;
@@ -322,6 +447,18 @@ int accept_dev_func(struct ctlra_t *ctlra,
 	printf("tcc: accepting %s %s, script = %p\n",
 	       info->vendor, info->device, script);
 
+	/* here we use the Ctlra APIs to set callback functions to get
+	 * events and send feedback updates to/from the device. The
+	 * proxies need the script as userdata to find the live program */
+	ctlra_dev_set_event_func(dev, tcc_event_proxy);
+	ctlra_dev_set_feedback_func(dev, tcc_feedback_func);
+	//ctlra_dev_set_screen_feedback_func(dev, simple_screen_redraw_func);
+	//ctlra_dev_set_remove_func(dev, remove_dev_func);
+	ctlra_dev_set_callback_userdata(dev, script);
+
+	/* watch the script for changes, and recompile in the background */
+	script_compile_thread_start(script);
+
 	accepted = 1;
 
 	return 1;
@@ -7,7 +7,7 @@
 #include <assert.h>
 #include <errno.h>
 
-#include <ctlra/mappa.h>
+#include "mappa.h"
 
 static volatile uint32_t done;
 
@@ -0,0 +1,187 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ctlra.h"
+#include "pixel.h"
+
+/* Benchmark of the screen pixel kernels. Every kernel set supported by
+ * the host is first checked against the scalar kernels, on a surface with
+ * padded rows and a width that is not a multiple of any vector size, then
+ * timed converting full screens of each device geometry. The diff column
+ * is the fused convert and compare of an unchanged frame, which is the
+ * cost of a static screen. */
+
+#define ITERS 2000
+
+struct geometry_t {
+	const char *name;
+	uint32_t width;
+	uint32_t height;
+};
+
+static const struct geometry_t geometries[] = {
+	{ "Maschine Mk3",      480, 272 },
+	{ "Kontrol D2",        480, 272 },
+	{ "Maschine Mikro Mk2", 128,  64 },
+	{ "odd size",          131,  37 },
+};
+
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int verify(const struct ctlra_pixel_kernels_t *ref,
+		  const struct ctlra_pixel_kernels_t *k)
+{
+	/* every 888 value of each channel appears across the rows: channel
+	 * c of pixel n is n * (2c + 1), a different order per channel. The
+	 * row padding is random. */
+	const uint32_t w = 131, h = 37, stride = 131 * 4 + 12;
+	uint8_t *src = malloc(stride * h);
+	uint16_t *out_ref = malloc(w * h * 2);
+	uint16_t *out = malloc(w * h * 2);
+	for(uint32_t i = 0; i < stride * h; i++)
+		src[i] = rand();
+	for(uint32_t j = 0; j < h; j++)
+		for(uint32_t x = 0; x < w; x++)
+			for(uint32_t c = 0; c < 4; c++)
+				src[j * stride + x * 4 + c] =
+					(j * w + x) * (2 * c + 1);
+
+	int err = 0;
+	for(uint32_t j = 0; j < h; j++) {
+		ref->row_888(&out_ref[j * w], (uint32_t *)&src[j * stride], w);
+		k->row_888(&out[j * w], (uint32_t *)&src[j * stride], w);
+	}
+	if(memcmp(out_ref, out, w * h * 2)) {
+		printf("  %s: 888 output differs from scalar\n", k->name);
+		err = 1;
+	}
+
+	for(uint32_t j = 0; j < h; j++) {
+		ref->row_565(&out_ref[j * w], (uint16_t *)&src[j * stride], w);
+		k->row_565(&out[j * w], (uint16_t *)&src[j * stride], w);
+	}
+	if(memcmp(out_ref, out, w * h * 2)) {
+		printf("  %s: 565 output differs from scalar\n", k->name);
+		err = 1;
+	}
+
+	/* diff kernels: change a few pixels, including in the tail of the
+	 * rows, and check the output and the changed tiles both match */
+	for(int is_888 = 0; is_888 < 2; is_888++) {
+		for(uint32_t j = 0; j < h; j++) {
+			ref->row_888(&out_ref[j * w], (uint32_t *)&src[j * stride], w);
+			k->row_888(&out[j * w], (uint32_t *)&src[j * stride], w);
+		}
+		src[5 * stride + 2 * 4] ^= 0xff;
+		src[9 * stride + 40 * 4 + 1] ^= 0x80;
+		src[36 * stride + 130 * 4] ^= 0x10;
+		for(uint32_t j = 0; j < h; j++) {
+			uint8_t *row = &src[j * stride];
+			uint64_t t_ref = is_888 ?
+				ref->row_888_diff(&out_ref[j * w], (uint32_t *)row, w) :
+				ref->row_565_diff(&out_ref[j * w], (uint16_t *)row, w);
+			uint64_t t = is_888 ?
+				k->row_888_diff(&out[j * w], (uint32_t *)row, w) :
+				k->row_565_diff(&out[j * w], (uint16_t *)row, w);
+			if(t != t_ref) {
+				printf("  %s: %s diff row %u tiles %llx, scalar %llx\n",
+				       k->name, is_888 ? "888" : "565", j,
+				       (unsigned long long)t,
+				       (unsigned long long)t_ref);
+				err = 1;
+			}
+		}
+		if(memcmp(out_ref, out, w * h * 2)) {
+			printf("  %s: diff output differs from scalar\n", k->name);
+			err = 1;
+		}
+	}
+
+	free(src);
+	free(out_ref);
+	free(out);
+	return err;
+}
+
+static double bench(const struct ctlra_pixel_kernels_t *k,
+		    const struct geometry_t *g, int is_888,
+		    uint8_t *src, uint16_t *dst)
+{
+	const uint32_t stride = g->width * (is_888 ? 4 : 2);
+	uint64_t start = time_ns();
+	for(int i = 0; i < ITERS; i++) {
+		for(uint32_t j = 0; j < g->height; j++) {
+			if(is_888)
+				k->row_888(&dst[j * g->width],
+					   (uint32_t *)&src[j * stride],
+					   g->width);
+			else
+				k->row_565(&dst[j * g->width],
+					   (uint16_t *)&src[j * stride],
+					   g->width);
+		}
+	}
+	return (time_ns() - start) / (double)ITERS;
+}
+
+/* Time a static frame: convert and compare, with nothing changing */
+static double bench_diff(const struct ctlra_pixel_kernels_t *k,
+			 const struct geometry_t *g, uint8_t *src,
+			 uint16_t *dst)
+{
+	const uint32_t stride = g->width * 4;
+	uint64_t start = time_ns();
+	for(int i = 0; i < ITERS; i++) {
+		for(uint32_t j = 0; j < g->height; j++)
+			k->row_888_diff(&dst[j * g->width],
+					(uint32_t *)&src[j * stride],
+					g->width);
+	}
+	return (time_ns() - start) / (double)ITERS;
+}
+
+int main()
+{
+	const struct ctlra_pixel_kernels_t *kernels[8];
+	uint32_t n = ctlra_impl_pixel_kernels_get(kernels, 8);
+	const char *selected = ctlra_impl_pixel_init();
+
+	int err = 0;
+	for(uint32_t i = 1; i < n; i++)
+		err |= verify(kernels[0], kernels[i]);
+	printf("kernels verified against scalar: %s\n", err ? "FAIL" : "ok");
+
+	uint8_t *src = malloc(480 * 272 * 4);
+	uint16_t *dst = malloc(480 * 272 * 2);
+	for(uint32_t i = 0; i < 480 * 272 * 4; i++)
+		src[i] = rand();
+
+	for(uint32_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++) {
+		printf("%s %ux%u, ns per frame:\n", geometries[g].name,
+		       geometries[g].width, geometries[g].height);
+		for(uint32_t i = 0; i < n; i++) {
+			double t565 = bench(kernels[i], &geometries[g], 0,
+					    src, dst);
+			double t888 = bench(kernels[i], &geometries[g], 1,
+					    src, dst);
+			double tdiff = bench_diff(kernels[i], &geometries[g],
+						  src, dst);
+			printf("  %-8s 565: %9.0f   888: %9.0f   888+diff: %9.0f\n",
+			       kernels[i]->name, t565, t888, tdiff);
+		}
+	}
+	printf("selected kernels: %s\n", selected);
+
+	free(src);
+	free(dst);
+	return err;
+}
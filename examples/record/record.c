@@ -0,0 +1,153 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "ctlra.h"
+#include "record.h"
+
+/* Records the events of all controllers to a file, or replays a file:
+ *   ctlra_record rec <file>
+ *   ctlra_record play <file> [start seconds] [fast]
+ */
+
+static volatile uint32_t done;
+static struct ctlra_recorder_t *rec;
+
+void record_event_func(struct ctlra_dev_t* dev, uint32_t num_events,
+		       struct ctlra_event_t** events, void *userdata)
+{
+	/* only copies the events into a ring: the writer thread of the
+	 * recorder does the disk I/O */
+	ctlra_recorder_push(rec, dev, num_events, events);
+}
+
+void record_remove_func(struct ctlra_dev_t *dev, int unexpected_removal,
+			void *userdata)
+{
+	ctlra_recorder_dev_removed(rec, dev);
+}
+
+int accept_dev_func(struct ctlra_t *ctlra,
+		    const struct ctlra_dev_info_t *info,
+		    struct ctlra_dev_t *dev,
+		    void *userdata)
+{
+	printf("record: recording %s %s\n", info->vendor, info->device);
+	ctlra_dev_set_event_func(dev, record_event_func);
+	ctlra_dev_set_remove_func(dev, record_remove_func);
+	return 1;
+}
+
+void replay_event_func(struct ctlra_dev_t* dev, uint32_t num_events,
+		       struct ctlra_event_t** events, void *userdata)
+{
+	struct ctlra_replay_t *r = userdata;
+	double t = ctlra_replay_tell(r) / 1e9;
+
+	for(uint32_t i = 0; i < num_events; i++) {
+		struct ctlra_event_t *e = events[i];
+		switch(e->type) {
+		case CTLRA_EVENT_BUTTON:
+			printf("%9.3f [%s] button %d\n", t,
+			       e->button.pressed ? " X " : "   ",
+			       e->button.id);
+			break;
+		case CTLRA_EVENT_ENCODER:
+			printf("%9.3f [%s] encoder %d\n", t,
+			       e->encoder.delta > 0 ? " ->" : "<- ",
+			       e->encoder.id);
+			break;
+		case CTLRA_EVENT_SLIDER:
+			printf("%9.3f [%03d] slider %d\n", t,
+			       (int)(e->slider.value * 100.f),
+			       e->slider.id);
+			break;
+		case CTLRA_EVENT_GRID:
+			printf("%9.3f [%s] grid %d\n", t,
+			       e->grid.pressed ? " X " : "   ",
+			       e->grid.pos);
+			break;
+		default:
+			break;
+		};
+	}
+}
+
+void sighndlr(int signal)
+{
+	done = 1;
+	printf("\n");
+}
+
+static int replay(const char *file, double start, uint32_t flags)
+{
+	struct ctlra_replay_t *r = ctlra_replay_open(file);
+	if(!r) {
+		printf("replay: cannot open %s\n", file);
+		return -1;
+	}
+
+	const struct ctlra_replay_source_t *sources;
+	uint32_t count = ctlra_replay_sources(r, &sources);
+	for(uint32_t i = 0; i < count; i++)
+		printf("replay: source %d: %s %s\n", i, sources[i].vendor,
+		       sources[i].device);
+	printf("replay: %.3f seconds\n", ctlra_replay_duration(r) / 1e9);
+
+	/* replay in steps of 100 ms, so ctrl-c is noticed */
+	ctlra_replay_seek(r, start * 1e9);
+	uint64_t until = ctlra_replay_tell(r);
+	int64_t ret = 0;
+	while(!done && ret >= 0 && until < ctlra_replay_duration(r)) {
+		until += 100 * 1000 * 1000;
+		ret = ctlra_replay_play(r, replay_event_func, r, until, flags);
+	}
+	if(ret < 0)
+		printf("replay: %s is corrupt\n", file);
+
+	ctlra_replay_close(r);
+	return ret < 0;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 3) {
+		printf("usage: %s rec <file>\n"
+		       "       %s play <file> [start seconds] [fast]\n",
+		       argv[0], argv[0]);
+		return -1;
+	}
+
+	signal(SIGINT, sighndlr);
+
+	if(strcmp(argv[1], "play") == 0) {
+		double start = argc > 3 ? atof(argv[3]) : 0;
+		uint32_t flags = argc > 4 ? 0 : CTLRA_REPLAY_REALTIME;
+		return replay(argv[2], start, flags);
+	}
+
+	rec = ctlra_recorder_create(argv[2], 0);
+	if(!rec) {
+		printf("record: cannot create %s\n", argv[2]);
+		return -1;
+	}
+
+	struct ctlra_t *ctlra = ctlra_create(NULL);
+	int num_devs = ctlra_probe(ctlra, accept_dev_func, 0x0);
+	printf("connected devices %d, ctrl-c to stop\n", num_devs);
+
+	while(!done) {
+		ctlra_idle_iter(ctlra);
+		usleep(1000);
+	}
+
+	ctlra_exit(ctlra);
+
+	uint64_t dropped = ctlra_recorder_dropped(rec);
+	if(dropped)
+		printf("record: %lu events dropped\n", (unsigned long)dropped);
+	return ctlra_recorder_destroy(rec);
+}
@@ -14,7 +14,7 @@
 
 static volatile uint32_t done;
 
-static Sequencer *sequencers[16];
+static SeqBank *bank;
 
 #define MODE_GROUP   0
 #define MODE_PADS    1
@@ -85,12 +85,12 @@ static struct mm_t
 void jam_feedback_func(struct ctlra_dev_t *dev, void *d)
 {
 	struct mm_t *mm = &mm_static;
-	struct Sequencer *sequencer = sequencers[mm->pattern_pad_id];
+	int seq = mm->pattern_pad_id;
 
 	uint8_t *grid_data = ni_maschine_jam_grid_get_data(dev);
 
 	for(int i = 0; i < 16; i++) {
-		int on = sequencer_get_step(sequencer, i);
+		int on = seq_bank_get_step(bank, seq, i);
 		grid_data[i] = on * 30;
 		if(on)
 			printf("%d on\n", i);
@@ -112,17 +112,17 @@ void demo_feedback_func(struct ctlra_dev_t *dev, void *d)
 	/* group, pads, sequencer modes */
 	struct mm_t *mm = &mm_static;
 	const struct col_t *col = &grp_col[mm->grp_id];
-	struct Sequencer *sequencer = sequencers[mm->pattern_pad_id];
+	int seq = mm->pattern_pad_id;
 
 	switch(mm->mode) {
 	case MODE_PATTERN: {
 		for(int i = 0; i < 16; i++) {
-			int on = sequencer_get_step(sequencer, i);
+			int on = seq_bank_get_step(bank, seq, i);
 			ctlra_dev_light_set(dev, NI_MASCHINE_MIKRO_MK2_LED_PAD_1 + i,
 					    col_dim(col, on ? 1.0 : 0.00));
 		}
-		int step = sequencer_get_current_step( sequencer );
-		int on = sequencer_get_step(sequencer, step % 16);
+		int step = seq_bank_get_current_step(bank, seq);
+		int on = seq_bank_get_step(bank, seq, step % 16);
 		ctlra_dev_light_set(dev, NI_MASCHINE_MIKRO_MK2_LED_PAD_1 + step,
 				    on ?  0x007f7f7f : 0x000f0f0f );
 		if(mm->shift_pressed) {
@@ -235,7 +235,8 @@ void demo_event_func(struct ctlra_dev_t* dev,
 					//printf("new pattern pad id %d\n", mm->pattern_pad_id);
 				}
 				else
-					sequencer_toggle_step(sequencer, e->grid.pos);
+					seq_bank_toggle_step(bank, mm->pattern_pad_id,
+							     e->grid.pos);
 			}
 			if(mm->mode == MODE_PADS && pr) {
 				message[0] = 0x90;
@@ -305,7 +306,7 @@ int accept_dev_func(const struct ctlra_dev_info_t *info,
 	return 1;
 }
 
-void seqEventCb(int frame, int note, int velocity, void* userdata )
+void seqEventCb(int seq, int frame, int note, int velocity, void* userdata )
 {
 	printf("%s: %d, %d : %d\n", __func__, frame, note, velocity);
 	if(static_mute)
@@ -330,13 +331,14 @@ int main()
 {
 	signal(SIGINT, sighndlr);
 
+	bank = seq_bank_new(SR, 16);
+	if(!bank)
+		return -1;
+	seq_bank_set_callback(bank, seqEventCb, 0x0);
 	for(int i = 0; i < 16; i++) {
-		struct Sequencer *sequencer = sequencer_new(SR);
-		sequencer_set_callback(sequencer, seqEventCb, 0x0);
-		sequencer_set_length(sequencer, SR * 0.8);
-		sequencer_set_num_steps(sequencer, 16);
-		sequencer_set_note(sequencer, i);
-		sequencers[i] = sequencer;
+		seq_bank_set_length(bank, i, SR * 0.8);
+		seq_bank_set_num_steps(bank, i, 16);
+		seq_bank_set_note(bank, i, i);
 	}
 
 	mm_static.mode = MODE_PADS;
@@ -349,14 +351,12 @@ int main()
 
 	while(!done) {
 		ctlra_idle_iter(ctlra);
-		for(int i = 0; i < 16; i++) {
-			struct Sequencer *sequencer = sequencers[i];
-			sequencer_process( sequencer, 128 );
-		}
+		seq_bank_process(bank, 128);
 		usleep(1000 * 1000 / sleep);
 	}
 
 	ctlra_exit(ctlra);
+	seq_bank_free(bank);
 
 	return 0;
 }
@@ -22,6 +22,7 @@
 #include "sequencer.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,11 +37,73 @@ struct Sequencer {
 
 	int note;
 
+	/* the next step to be played */
 	int cur_step;
 	int num_steps;
 	int steps[MAX_STEPS];
 };
 
+typedef void (*seq_emit_func)( int step, int frame, void* ud );
+
+/* The frame in the loop where *step* starts. Distributes the remainder of
+ * length / num_steps over the steps, so no frames are lost at the end */
+static inline int
+seq_step_start( int step, int length, int num_steps )
+{
+	return (int)(((int64_t)step * length) / num_steps);
+}
+
+/* After the length or number of steps change, find the next step to
+ * play from the current position in the loop */
+static inline void
+seq_resync( int* counter, int* cur_step, int length, int num_steps )
+{
+	if( *counter >= length )
+		*counter %= length;
+	*cur_step = (int)(((int64_t)*counter * num_steps + length - 1) / length);
+}
+
+/* Move the playhead of one sequence forward by nframes, and emit every
+ * step that starts inside the block with its frame offset. The emit
+ * callback is called for steps with a non-zero value only. */
+static inline void
+seq_walk( int* counter, int* cur_step, int length, int num_steps,
+          const int* steps, int nframes, seq_emit_func emit, void* ud )
+{
+	/* each step must be at least one frame long */
+	if( num_steps <= 0 || num_steps > MAX_STEPS || length < num_steps )
+		return;
+
+	if( *counter >= length || *cur_step > num_steps )
+		seq_resync( counter, cur_step, length, num_steps );
+
+	int frame = 0;
+	for(;;) {
+		int next = length;
+		if( *cur_step < num_steps )
+			next = seq_step_start( *cur_step, length, num_steps );
+
+		int until = next - *counter;
+		if( until >= nframes - frame ) {
+			*counter += nframes - frame;
+			return;
+		}
+
+		frame += until;
+		*counter = next;
+
+		/* end of loop, wrap around to step 0 */
+		if( *cur_step == num_steps ) {
+			*counter = 0;
+			*cur_step = 0;
+			continue;
+		}
+
+		if( steps[*cur_step] )
+			emit( *cur_step, frame, ud );
+		(*cur_step)++;
+	}
+}
 
 Sequencer* sequencer_new( int sr )
 {
@@ -52,47 +115,20 @@ Sequencer* sequencer_new( int sr )
 	return s;
 }
 
-void sequencer_process( Sequencer* s, int nframes )
+static void sequencer_emit( int step, int frame, void* ud )
 {
-	assert( s );
-	assert( s->num_steps );
+	Sequencer* s = ud;
+	s->cb( frame, s->note, s->steps[step], s->cb_user_data );
+}
 
-	// avoid stupidly short loops
-	if( s->length < s->sr / 8 )
+void sequencer_process( Sequencer* s, int nframes )
+{
+	/* no asserts here, this runs in the audio thread */
+	if( !s || !s->cb )
 		return;
 
-	int stepSize = s->length / s->num_steps;
-	int nextBeatFrames = stepSize + s->cur_step * stepSize;
-
-	s->counter += nframes;
-
-	if( s->counter >= nextBeatFrames ) {
-		/* check if step has value */
-		if( s->steps[s->cur_step] ) {
-			int frame = s->counter - nextBeatFrames;
-			s->cb( frame, s->note, s->steps[s->cur_step], s->cb_user_data );
-		}
-		s->cur_step++;
-	}
-
-	if( s->counter > s->length ) {
-		s->counter -= s->length;
-		s->cur_step = 0;
-	}
-
-	/*
-	int fpb = sequencer_bpm_to_frames( s->samplerate, s->bpm );
-	s->frame_counter += nframes;
-	if( s->frame_counter >= fpb )
-	{
-	  // play the step
-	  s->frame_counter -= fpb;
-	  // callback to handle event
-	  // next step with wrap
-	  if( ++s->cur_step >= s->num_steps )
-	    s->cur_step = 0;
-	}
-	*/
+	seq_walk( &s->counter, &s->cur_step, s->length, s->num_steps,
+	          s->steps, nframes, sequencer_emit, s );
 }
 
 void sequencer_reset_playhead( Sequencer* s )
@@ -128,8 +164,10 @@ void sequencer_set_callback( Sequencer* s, SeqEventCb cb, void* ud )
 void sequencer_set_num_steps( Sequencer* s, int steps )
 {
 	assert( s );
-	assert( steps );
+	assert( steps > 0 && steps <= MAX_STEPS );
 	s->num_steps = steps;
+	if( s->length >= steps )
+		seq_resync( &s->counter, &s->cur_step, s->length, steps );
 }
 
 int sequencer_get_num_steps( Sequencer* s )
@@ -142,6 +180,8 @@ void sequencer_set_length( Sequencer* s, int length )
 {
 	assert( s );
 	s->length = length;
+	if( length >= s->num_steps )
+		seq_resync( &s->counter, &s->cur_step, length, s->num_steps );
 }
 
 int sequencer_get_length( Sequencer* s )
@@ -190,9 +230,10 @@ int sequencer_get_step( Sequencer* s, int step )
 int sequencer_get_current_step( Sequencer* s )
 {
 	assert( s );
-	assert( s->cur_step >= 0 );
-	assert( s->cur_step < MAX_STEPS );
-	return s->cur_step;
+	/* cur_step is the next step to play, return the one playing now */
+	if( s->cur_step <= 0 || s->cur_step > s->num_steps )
+		return s->num_steps - 1;
+	return s->cur_step - 1;
 }
 
 
@@ -202,3 +243,260 @@ void sequencer_free( Sequencer* s )
 
 	free( s );
 }
+
+
+/* Edits queued from the controller thread to the audio thread */
+#define SEQ_BANK_OP_LENGTH     0
+#define SEQ_BANK_OP_NUM_STEPS  1
+#define SEQ_BANK_OP_NOTE       2
+#define SEQ_BANK_OP_STEP       3
+#define SEQ_BANK_OP_TOGGLE     4
+#define SEQ_BANK_OP_PLAYHEAD   5
+
+struct seq_bank_op_t {
+	uint16_t type;
+	uint16_t seq;
+	int32_t step;
+	int32_t value;
+};
+
+/* must be a power of two */
+#define SEQ_BANK_OPS_SIZE 1024
+
+struct SeqBank {
+	SeqBankEventCb cb;
+	void* cb_user_data;
+
+	int sr;
+	int num_seqs;
+
+	/* per sequence state, indexed by sequence */
+	int* length;
+	int* counter;
+	int* cur_step;
+	int* num_steps;
+	int* note;
+	/* the steps of sequence i are at steps[i * MAX_STEPS] */
+	int* steps;
+
+	/* single producer, single consumer queue of edits */
+	struct seq_bank_op_t ops[SEQ_BANK_OPS_SIZE];
+	uint32_t ops_head; /* written by the controller thread */
+	uint32_t ops_tail; /* written by the audio thread */
+};
+
+SeqBank* seq_bank_new( int sr, int num_seqs )
+{
+	if( num_seqs <= 0 || num_seqs > UINT16_MAX )
+		return 0x0;
+
+	SeqBank* b = (SeqBank *)calloc( 1, sizeof(SeqBank) );
+	if( !b ) return 0x0;
+
+	b->sr = sr;
+	b->num_seqs = num_seqs;
+	b->length    = calloc( num_seqs, sizeof(int) );
+	b->counter   = calloc( num_seqs, sizeof(int) );
+	b->cur_step  = calloc( num_seqs, sizeof(int) );
+	b->num_steps = calloc( num_seqs, sizeof(int) );
+	b->note      = calloc( num_seqs, sizeof(int) );
+	b->steps     = calloc( num_seqs * MAX_STEPS, sizeof(int) );
+	if( !b->length || !b->counter || !b->cur_step || !b->num_steps ||
+	    !b->note || !b->steps ) {
+		seq_bank_free( b );
+		return 0x0;
+	}
+
+	for( int i = 0; i < num_seqs; i++ )
+		b->num_steps[i] = 32;
+
+	return b;
+}
+
+int seq_bank_get_num_seqs( SeqBank* b )
+{
+	assert( b );
+	return b->num_seqs;
+}
+
+void seq_bank_set_callback( SeqBank* b, SeqBankEventCb cb, void* ud )
+{
+	assert( b );
+	assert( cb );
+
+	b->cb = cb;
+	b->cb_user_data = ud;
+}
+
+static int
+seq_bank_push( SeqBank* b, int type, int seq, int step, int value )
+{
+	if( !b || seq < 0 || seq >= b->num_seqs )
+		return -1;
+
+	uint32_t head = b->ops_head;
+	uint32_t tail = __atomic_load_n( &b->ops_tail, __ATOMIC_ACQUIRE );
+	if( head - tail >= SEQ_BANK_OPS_SIZE )
+		return -1;
+
+	struct seq_bank_op_t* op = &b->ops[head & (SEQ_BANK_OPS_SIZE - 1)];
+	op->type  = type;
+	op->seq   = seq;
+	op->step  = step;
+	op->value = value;
+	__atomic_store_n( &b->ops_head, head + 1, __ATOMIC_RELEASE );
+	return 0;
+}
+
+int seq_bank_set_length( SeqBank* b, int seq, int frames )
+{
+	if( frames < 0 )
+		return -1;
+	return seq_bank_push( b, SEQ_BANK_OP_LENGTH, seq, 0, frames );
+}
+
+int seq_bank_set_num_steps( SeqBank* b, int seq, int steps )
+{
+	if( steps <= 0 || steps > MAX_STEPS )
+		return -1;
+	return seq_bank_push( b, SEQ_BANK_OP_NUM_STEPS, seq, 0, steps );
+}
+
+int seq_bank_set_note( SeqBank* b, int seq, int note )
+{
+	return seq_bank_push( b, SEQ_BANK_OP_NOTE, seq, 0, note );
+}
+
+int seq_bank_set_step( SeqBank* b, int seq, int step, int value )
+{
+	if( step < 0 || step >= MAX_STEPS )
+		return -1;
+	return seq_bank_push( b, SEQ_BANK_OP_STEP, seq, step, value );
+}
+
+int seq_bank_toggle_step( SeqBank* b, int seq, int step )
+{
+	if( step < 0 || step >= MAX_STEPS )
+		return -1;
+	return seq_bank_push( b, SEQ_BANK_OP_TOGGLE, seq, step, 0 );
+}
+
+int seq_bank_reset_playhead( SeqBank* b, int seq )
+{
+	return seq_bank_push( b, SEQ_BANK_OP_PLAYHEAD, seq, 0, 0 );
+}
+
+/* Apply queued edits, called from the audio thread */
+static void seq_bank_apply_ops( SeqBank* b )
+{
+	uint32_t tail = b->ops_tail;
+	uint32_t head = __atomic_load_n( &b->ops_head, __ATOMIC_ACQUIRE );
+
+	for( ; tail != head; tail++ ) {
+		const struct seq_bank_op_t* op =
+			&b->ops[tail & (SEQ_BANK_OPS_SIZE - 1)];
+		int i = op->seq;
+		int* step = &b->steps[i * MAX_STEPS + op->step];
+
+		switch( op->type ) {
+		case SEQ_BANK_OP_LENGTH:
+			b->length[i] = op->value;
+			break;
+		case SEQ_BANK_OP_NUM_STEPS:
+			b->num_steps[i] = op->value;
+			break;
+		case SEQ_BANK_OP_NOTE:
+			b->note[i] = op->value;
+			break;
+		case SEQ_BANK_OP_STEP:
+			__atomic_store_n( step, op->value, __ATOMIC_RELAXED );
+			break;
+		case SEQ_BANK_OP_TOGGLE:
+			__atomic_store_n( step, !*step, __ATOMIC_RELAXED );
+			break;
+		case SEQ_BANK_OP_PLAYHEAD:
+			b->counter[i] = 0;
+			b->cur_step[i] = 0;
+			break;
+		}
+
+		/* position in the loop may have moved, find next step */
+		if( (op->type == SEQ_BANK_OP_LENGTH ||
+		     op->type == SEQ_BANK_OP_NUM_STEPS) &&
+		    b->length[i] >= b->num_steps[i] )
+			seq_resync( &b->counter[i], &b->cur_step[i],
+			            b->length[i], b->num_steps[i] );
+	}
+
+	__atomic_store_n( &b->ops_tail, tail, __ATOMIC_RELEASE );
+}
+
+struct seq_bank_emit_t {
+	SeqBank* b;
+	int seq;
+};
+
+static void seq_bank_emit( int step, int frame, void* ud )
+{
+	struct seq_bank_emit_t* e = ud;
+	SeqBank* b = e->b;
+	int i = e->seq;
+	b->cb( i, frame, b->note[i], b->steps[i * MAX_STEPS + step],
+	       b->cb_user_data );
+}
+
+void seq_bank_process( SeqBank* b, int nframes )
+{
+	/* no asserts here, this runs in the audio thread */
+	if( !b || !b->cb )
+		return;
+
+	seq_bank_apply_ops( b );
+
+	struct seq_bank_emit_t e = { .b = b };
+	for( int i = 0; i < b->num_seqs; i++ ) {
+		int counter = b->counter[i];
+		int cur_step = b->cur_step[i];
+		e.seq = i;
+		seq_walk( &counter, &cur_step, b->length[i], b->num_steps[i],
+		          &b->steps[i * MAX_STEPS], nframes,
+		          seq_bank_emit, &e );
+		b->counter[i] = counter;
+		__atomic_store_n( &b->cur_step[i], cur_step, __ATOMIC_RELAXED );
+	}
+}
+
+int seq_bank_get_step( SeqBank* b, int seq, int step )
+{
+	assert( b );
+	if( seq < 0 || seq >= b->num_seqs || step < 0 || step >= MAX_STEPS )
+		return 0;
+	return __atomic_load_n( &b->steps[seq * MAX_STEPS + step],
+	                        __ATOMIC_RELAXED );
+}
+
+int seq_bank_get_current_step( SeqBank* b, int seq )
+{
+	assert( b );
+	if( seq < 0 || seq >= b->num_seqs )
+		return 0;
+	int cur = __atomic_load_n( &b->cur_step[seq], __ATOMIC_RELAXED );
+	int num = __atomic_load_n( &b->num_steps[seq], __ATOMIC_RELAXED );
+	/* cur_step is the next step to play, return the one playing now */
+	if( cur <= 0 || cur > num )
+		return num - 1;
+	return cur - 1;
+}
+
+void seq_bank_free( SeqBank* b )
+{
+	assert( b );
+
+	free( b->length );
+	free( b->counter );
+	free( b->cur_step );
+	free( b->num_steps );
+	free( b->note );
+	free( b->steps );
+	free( b );
+}
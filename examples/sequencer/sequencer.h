@@ -46,7 +46,9 @@ void sequencer_reset_playhead( Sequencer* s );
 
 /** Sequencer Process
  * The sequencer will process nframes worth of time, calling SeqEventCb
- * for each event to process. */
+ * for every step that starts inside the block. The frame passed to the
+ * callback is the offset of the step from the start of the block. This
+ * function is realtime safe. */
 void sequencer_process( Sequencer*, int nframes );
 
 /** Set the user data passed with callback */
@@ -75,6 +77,49 @@ int sequencer_get_current_step( Sequencer* s );
 /** free a sequencer instance */
 void sequencer_free( Sequencer* );
 
+
+/** A bank of sequences processed together. The state of all sequences is
+ * kept in a struct-of-arrays layout, so processing a block touches each
+ * array linearly. The setters may be called from any single thread (eg:
+ * the controller thread) while the audio thread calls seq_bank_process:
+ * edits are passed through a lock-free queue, and applied by the audio
+ * thread at the start of the next block.
+ */
+typedef struct SeqBank SeqBank;
+
+/** Callback for when a step of sequence *seq* is played */
+typedef void (*SeqBankEventCb)( int seq,
+                                int frame,
+                                int note,
+                                int velocity,
+                                void* user_data );
+
+/** Creates a new bank of *num_seqs* sequences */
+SeqBank* seq_bank_new( int sr, int num_seqs );
+int  seq_bank_get_num_seqs( SeqBank* );
+
+/** Set the callback, must be called before processing starts */
+void seq_bank_set_callback( SeqBank*, SeqBankEventCb event_cb, void* ud );
+
+/** Process nframes for all sequences, see *sequencer_process* */
+void seq_bank_process( SeqBank*, int nframes );
+
+/** Queue edits for the audio thread. These return 0 when queued, or -1
+ * if the arguments are invalid or the queue is full. */
+int seq_bank_set_length   ( SeqBank*, int seq, int frames );
+int seq_bank_set_num_steps( SeqBank*, int seq, int steps );
+int seq_bank_set_note     ( SeqBank*, int seq, int note );
+int seq_bank_set_step     ( SeqBank*, int seq, int step, int value );
+int seq_bank_toggle_step  ( SeqBank*, int seq, int step );
+int seq_bank_reset_playhead( SeqBank*, int seq );
+
+/** Read state as last applied by the audio thread, for feedback */
+int seq_bank_get_step( SeqBank*, int seq, int step );
+int seq_bank_get_current_step( SeqBank*, int seq );
+
+/** free a bank instance */
+void seq_bank_free( SeqBank* );
+
 #ifdef __cplusplus
 }
 #endif
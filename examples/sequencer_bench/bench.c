@@ -0,0 +1,92 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../sequencer/sequencer.h"
+
+/* Benchmark of the sequencer engine: 64 sequences processed in 32 frame
+ * blocks, as a JACK client at a low latency setting would. Every step of
+ * every sequence is enabled, so each step boundary emits an event, which
+ * is counted and compared to the expected number to verify no step is
+ * dropped. Step edits are queued every block, as a controller would. */
+
+#define SR        48000
+#define NUM_SEQS  64
+#define NFRAMES   32
+#define SECONDS   600
+
+static uint64_t events;
+
+static void bench_event_cb(int seq, int frame, int note, int velocity,
+			   void *ud)
+{
+	if(frame < 0 || frame >= NFRAMES)
+		printf("error: seq %d frame %d outside of block\n", seq, frame);
+	events++;
+}
+
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main()
+{
+	SeqBank *b = seq_bank_new(SR, NUM_SEQS);
+	if(!b) {
+		printf("failed to create sequencer bank\n");
+		return -1;
+	}
+	seq_bank_set_callback(b, bench_event_cb, 0x0);
+
+	/* loops of different lengths, some with steps shorter than a
+	 * block, so multiple steps fire in a single process() call */
+	uint64_t expected = 0;
+	const uint64_t total_frames = (uint64_t)SR * SECONDS;
+	for(int i = 0; i < NUM_SEQS; i++) {
+		int steps = 16;
+		int length = 256 + i * 1500;
+		seq_bank_set_length(b, i, length);
+		seq_bank_set_num_steps(b, i, steps);
+		seq_bank_set_note(b, i, 36 + i);
+		for(int s = 0; s < steps; s++)
+			seq_bank_set_step(b, i, s, 100);
+		/* apply the queued edits, so the queue does not fill up */
+		seq_bank_process(b, 0);
+
+		/* steps start at frame 0, so a partial loop fires all steps
+		 * up to and including the one starting before the end */
+		uint64_t loops = total_frames / length;
+		uint64_t rem = total_frames % length;
+		expected += loops * steps;
+		for(int s = 0; s < steps; s++)
+			expected += ((uint64_t)s * length) / steps < rem;
+	}
+
+	const uint64_t blocks = total_frames / NFRAMES;
+	uint64_t start = time_ns();
+	for(uint64_t i = 0; i < blocks; i++) {
+		/* toggle a step twice, so the pattern is unchanged at the
+		 * end of each block, but the queue is exercised */
+		int seq = i % NUM_SEQS;
+		seq_bank_toggle_step(b, seq, 127);
+		seq_bank_toggle_step(b, seq, 127);
+		seq_bank_process(b, NFRAMES);
+	}
+	uint64_t elapsed = time_ns() - start;
+
+	printf("%d sequences, %d frame blocks, %d seconds of audio\n",
+	       NUM_SEQS, NFRAMES, SECONDS);
+	printf("  %.1f ns per block, %.3f %% of realtime\n",
+	       elapsed / (double)blocks,
+	       100. * elapsed / (SECONDS * 1e9));
+	printf("  events %lu, expected %lu: %s\n", events, expected,
+	       events == expected ? "ok" : "MISMATCH");
+
+	seq_bank_free(b);
+	return events == expected ? 0 : 1;
+}
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 /* Ctlra header */
@@ -39,16 +40,14 @@ static int file_modify_time(const char *path, time_t *new_time)
 	return 0;
 }
 
-struct script_t {
+/* One compiled version of the script. A new program is built by the
+ * compile thread, and published to the Ctlra callbacks with a single
+ * atomic pointer swap, so the callbacks always see a complete set of
+ * function pointers - either all from the old, or all from the new code.
+ */
+struct script_program_t {
 	/* A pointer to memory malloced for the generated code */
 	void *program;
-	/* The path of the script file */
-	char *filepath;
-	/* TCC should recompile the recompile and update when set */
-	uint8_t recompile;
-	uint8_t compile_failed;
-	/* Time the script file was last modified */
-	time_t time_modified;
 
 	/* Function pointer to get the USB device this script supports */
 	script_get_vid_pid get_vid_pid;
@@ -57,78 +56,230 @@ struct script_t {
 	/* Function pointer to the scripts feedback handling function */
 	script_feedback_func feedback_func;
 
+	/* Retired programs wait on this list until no callback can still
+	 * be running their code. See script_reclaim() */
+	struct script_program_t *retired_next;
+	uint64_t retired_epoch;
+};
+
+struct script_t {
+	/* The path of the script file */
+	char *filepath;
+	uint8_t compile_failed;
+	/* Time the script file was last modified */
+	time_t time_modified;
+
+	/* The last successfully compiled program. Loaded by the Ctlra
+	 * callbacks, swapped by the compile thread */
+	struct script_program_t *live;
+
+	/* Incremented by the Ctlra callbacks each time they return from
+	 * the script code. Ctlra invokes all callbacks from the thread
+	 * calling ctlra_idle_iter(), so once the epoch moves past the
+	 * value stored when a program was retired, that program is no
+	 * longer executing and its memory can be freed (RCU style). */
+	uint64_t epoch;
+
+	/* Background compilation, keeps TCC out of the event path */
+	pthread_t compile_thread;
+	uint8_t compile_thread_running;
+	volatile uint32_t compile_thread_quit;
+	struct script_program_t *retired;
+
 	/* The malloc() / free() memory from the script */
 	void *script_ud;
 };
 
-void script_free(struct script_t *s)
-{
-	if(s->program)
-		free(s->program);
-	if(s->filepath)
-		free(s->filepath);
-	free(s);
-}
+/* Older TCC versions keep global state, so only compile one at a time */
+static pthread_mutex_t tcc_lock = PTHREAD_MUTEX_INITIALIZER;
 
-void script_reset(struct script_t *s)
+static void script_program_free(struct script_program_t *p)
 {
-	s->event_func = 0x0;
-	s->get_vid_pid = 0x0;
-	if(s->program)
-		free(s->program);
+	if(p->program)
+		free(p->program);
+	free(p);
 }
 
-int script_compile_file(struct script_t *script)
+static struct script_program_t *script_program_compile(const char *filepath)
 {
-	script_reset(script);
-
-	printf("tcc_script example: compiling %s\n", script->filepath);
+	printf("tcc_script example: compiling %s\n", filepath);
 	TCCState *s;
-	script->compile_failed = 1;
+
+	struct script_program_t *p = calloc(1, sizeof(*p));
+	if(!p) {
+		error("failed to alloc script program\n");
+		return 0;
+	}
+
+	pthread_mutex_lock(&tcc_lock);
 
 	s = tcc_new();
 	if(!s) {
 		error("failed to create tcc context\n");
-		return -2;
+		goto fail;
 	}
 
 	tcc_set_error_func(s, 0x0, error_func);
 	tcc_set_options(s, "-g");
 	tcc_set_output_type(s, TCC_OUTPUT_MEMORY);
 
-	int ret = tcc_add_file(s, script->filepath);
+	int ret = tcc_add_file(s, filepath);
 	if(ret < 0) {
 		printf("gracefully handling error now... \n");
-		tcc_delete(s);
-		return -1;
+		goto fail;
 	}
 
-	script->program = calloc(1, tcc_relocate(s, NULL));
-	if(!script->program)
+	int size = tcc_relocate(s, NULL);
+	if(size < 0) {
+		error("failed to get size of program\n");
+		goto fail;
+	}
+	p->program = calloc(1, size);
+	if(!p->program) {
 		error("failed to alloc mem for program\n");
-	ret = tcc_relocate(s, script->program);
-	if(ret < 0)
+		goto fail;
+	}
+	ret = tcc_relocate(s, p->program);
+	if(ret < 0) {
 		error("failed to relocate code to program memory\n");
+		goto fail;
+	}
 
-	script->get_vid_pid = (script_get_vid_pid)
-	                      tcc_get_symbol(s, "script_get_vid_pid");
-	if(!script->get_vid_pid)
+	p->get_vid_pid = (script_get_vid_pid)
+	                 tcc_get_symbol(s, "script_get_vid_pid");
+	if(!p->get_vid_pid)
 		error("failed to find script_get_vid_pid function\n");
 
-	script->event_func = (script_event_func)
-	                      tcc_get_symbol(s, "script_event_func");
-	if(!script->event_func)
+	p->event_func = (script_event_func)
+	                tcc_get_symbol(s, "script_event_func");
+	if(!p->event_func)
 		error("failed to find script_event_func function\n");
 
+	p->feedback_func = (script_feedback_func)
+	                   tcc_get_symbol(s, "script_feedback_func");
+
 	tcc_delete(s);
+	pthread_mutex_unlock(&tcc_lock);
+	return p;
+
+fail:
+	if(s)
+		tcc_delete(s);
+	pthread_mutex_unlock(&tcc_lock);
+	script_program_free(p);
+	return 0;
+}
 
-	int err = file_modify_time(script->filepath,
-				   &script->time_modified);
+/* Free retired programs that no callback can be executing anymore */
+static void script_reclaim(struct script_t *script, int force)
+{
+	uint64_t epoch = __atomic_load_n(&script->epoch, __ATOMIC_ACQUIRE);
+	struct script_program_t **iter = &script->retired;
+	while(*iter) {
+		struct script_program_t *p = *iter;
+		if(force || epoch > p->retired_epoch) {
+			*iter = p->retired_next;
+			script_program_free(p);
+			continue;
+		}
+		iter = &p->retired_next;
+	}
+}
+
+static void *script_compile_thread(void *data)
+{
+	struct script_t *script = data;
+
+	while(!script->compile_thread_quit) {
+		usleep(100 * 1000);
+		script_reclaim(script, 0);
+
+		/* Check if we need to recompile script based on modified
+		 * time of the script file, comparing with the compiled
+		 * modified time */
+		time_t new_time;
+		int err = file_modify_time(script->filepath, &new_time);
+		if(err || new_time <= script->time_modified)
+			continue;
+
+		/* store the time before compiling, so a save during the
+		 * compile triggers another one on the next iteration. A
+		 * failed compile is not retried until the file changes */
+		script->time_modified = new_time;
+
+		printf("tcc: recompiling script %s\n", script->filepath);
+		struct script_program_t *p =
+			script_program_compile(script->filepath);
+		if(!p || !p->event_func) {
+			printf("tcc: compile failed, keeping last good script\n");
+			if(p)
+				script_program_free(p);
+			script->compile_failed = 1;
+			continue;
+		}
+		script->compile_failed = 0;
+
+		struct script_program_t *old =
+			__atomic_exchange_n(&script->live, p, __ATOMIC_ACQ_REL);
+		if(old) {
+			old->retired_epoch = __atomic_load_n(&script->epoch,
+							     __ATOMIC_ACQUIRE);
+			old->retired_next = script->retired;
+			script->retired = old;
+		}
+	}
+
+	return 0;
+}
+
+int script_compile_thread_start(struct script_t *script)
+{
+	int ret = pthread_create(&script->compile_thread, 0x0,
+				 script_compile_thread, script);
+	if(ret) {
+		printf("tcc: failed to start compile thread: %d\n", ret);
+		return -1;
+	}
+	script->compile_thread_running = 1;
+	return 0;
+}
+
+void script_free(struct script_t *s)
+{
+	if(s->compile_thread_running) {
+		s->compile_thread_quit = 1;
+		pthread_join(s->compile_thread, 0x0);
+	}
+	/* the caller guarantees no callback is running */
+	script_reclaim(s, 1);
+	if(s->live)
+		script_program_free(s->live);
+	if(s->filepath)
+		free(s->filepath);
+	free(s);
+}
+
+/* Compile the script synchronously, used for the initial compile only.
+ * Recompiles are handled by the compile thread. */
+int script_compile_file(struct script_t *script)
+{
+	script->compile_failed = 1;
+
+	time_t time_modified;
+	int err = file_modify_time(script->filepath, &time_modified);
 	if(err) {
 		printf("%s: error getting file modified time\n", __func__);
 		return -1;
 	}
 
+	struct script_program_t *p = script_program_compile(script->filepath);
+	if(!p)
+		return -1;
+
+	if(script->live)
+		script_program_free(script->live);
+	script->live = p;
+	script->time_modified = time_modified;
 	script->compile_failed = 0;
 	return 0;
 }
@@ -140,8 +291,11 @@ void tcc_feedback_func(struct ctlra_dev_t *dev, void *userdata)
 	 * from this function - one-way App->Ctlra updates only */
 
 	struct script_t *script = userdata;
-	if(script->feedback_func)
-		script->feedback_func(dev, userdata);
+	struct script_program_t *p = __atomic_load_n(&script->live,
+						     __ATOMIC_ACQUIRE);
+	if(p && p->feedback_func)
+		p->feedback_func(dev, userdata);
+	__atomic_fetch_add(&script->epoch, 1, __ATOMIC_RELEASE);
 }
 
 void tcc_event_proxy(struct ctlra_dev_t* dev,
@@ -152,31 +306,19 @@ void tcc_event_proxy(struct ctlra_dev_t* dev,
 	/* This is advanced usage of the event func - if you have not
 	 * already looked at the daemon example, please do so first!
 	 *
-	 * This function acts as a proxy for TCC to re-route the calls,
-	 * but also be able to check if a script has been updated. If it
-	 * has, it can swap the pointer for the event-func here, and then
-	 * neither Ctlra or the App need to know what happend */
+	 * This function acts as a proxy for TCC to re-route the calls.
+	 * The compile thread watches the script file, and when it has
+	 * been updated it swaps the live program pointer, so neither
+	 * Ctlra or the App need to know what happend. No compiling or
+	 * file access is done here, so input is never stalled */
 	struct script_t *script = userdata;
-
-	/* Check if we need to recompile script based on modified time of
-	 * the script file, comparing with the compiled modified time */
-	time_t new_time;
-	int err = file_modify_time(script->filepath,
-				   &new_time);
-	if(err) {
-		printf("%s: error getting file modified time\n", __func__);
-	}
-	if(new_time > script->time_modified) {
-		printf("tcc: recompiling script %s\n", script->filepath);
-		// trigger recompile, which will update modified timestamp
-		int ret = script_compile_file(script);
-		if(ret < 0)
-			return;
-	}
+	struct script_program_t *p = __atomic_load_n(&script->live,
+						     __ATOMIC_ACQUIRE);
 
 	/* Handle events */
-	if(script->event_func)
-		script->event_func(dev, num_events, events, userdata);
+	if(p && p->event_func)
+		p->event_func(dev, num_events, events, userdata);
+	__atomic_fetch_add(&script->epoch, 1, __ATOMIC_RELEASE);
 }
 
 void sighndlr(int signal)
@@ -219,14 +361,14 @@ int accept_dev_func(const struct ctlra_dev_info_t *info,
 		return 0;
 	}
 
-	if(!script->get_vid_pid) {
+	if(!script->live->get_vid_pid) {
 		script_free(script);
 		return 0;
 	}
 
 	int vid = -1;
 	int pid = -1;
-	script->get_vid_pid(&vid, &pid);
+	script->live->get_vid_pid(&vid, &pid);
 	if(vid != info->vendor_id || pid != info->device_id) {
 		script_free(script);
 		return 0;
@@ -239,6 +381,9 @@ int accept_dev_func(const struct ctlra_dev_info_t *info,
 	*remove_func = remove_dev_func;
 	*userdata_for_event_func = script;
 
+	/* watch the script for changes, and recompile in the background */
+	script_compile_thread_start(script);
+
 	accepted = 1;
 
 	return 1;